@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <gmp.h>
+#include "../src/cmatches.h"
+#include "../src/libmatches.h"
+
+/*
+ * Allocation check of the pair kernels
+ *
+ * The fast kernels keep their vectors and GMP accumulators in a workspace
+ * per thread, which only grows: once it has seen the biggest pair, no pair
+ * allocates anything. Random partitions are built in memory, every pair
+ * is calculated once for each index to warm the workspace up, and then
+ * again a number of times: the allocation count (workspaces and GMP, see
+ * count_allocations()) must not change.
+ */
+
+/** Indexes checked */
+static const int indexes[] = {
+	MATCHES_H, MATCHES_H2, MATCHES_ARI, MATCHES_NMI, MATCHES_JACCARD, MATCHES_FM
+};
+#define NINDEXES_CHECKED (sizeof(indexes) / sizeof(indexes[0]))
+
+/** PRNG state */
+static unsigned long long rng = 1;
+
+
+/**
+ * \brief Next pseudo-random number (xorshift64*)
+ * \return unsigned long long
+ */
+static unsigned long long next_random(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 2685821657736338717ULL;
+}
+
+
+/**
+ * \brief Build a random partition
+ * \param [in] universe Number of elements
+ * \param [in] nclusters Number of clusters
+ * \param [in] presence Elements kept (per thousand)
+ * \param [in] ids Scratch (universe items)
+ * \param [in] clusters Scratch (universe items)
+ * \return matches_partition_t* Partition, NULL on error
+ */
+static matches_partition_t *random_partition(unsigned long universe, unsigned long nclusters,
+		unsigned long presence, unsigned long *ids, unsigned long *clusters)
+{
+	unsigned long i, n;
+
+	n = 0;
+	for (i = 0; i < universe; i++) {
+		if ((next_random() % 1000) < presence) {
+			ids[n]      = i;
+			clusters[n] = next_random() % nclusters;
+			n++;
+		}
+	}
+	return matches_partition_create(ids, clusters, n);
+}
+
+
+/**
+ * \brief Calculate all pairs for all indexes
+ * \param [in] parts Partitions
+ * \param [in] n Number of partitions
+ * \return int 0 on success, -1 otherwise
+ */
+static int all_pairs(matches_partition_t **parts, unsigned long n)
+{
+	unsigned long i, j, x;
+	double h;
+
+	for (x = 0; x < NINDEXES_CHECKED; x++) {
+		for (i = 0; i < n; i++) {
+			for (j = i + 1; j < n; j++) {
+				if (matches_pair(parts[i], parts[j], indexes[x], &h) < 0) {
+					perror("matches_pair");
+					return -1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Show program help
+ * \param [in] prgname Program's name
+ */
+static void show_help(const char *prgname)
+{
+	printf("Use: %s [options]\n", prgname);
+	printf("Options:\n");
+	printf("    -n N        Number of partitions (default: 12)\n");
+	printf("    -u N        Number of elements (default: 20000)\n");
+	printf("    -r N        Rounds after the warm-up (default: 5)\n");
+	printf("    -s SEED     Random seed (default: 1)\n");
+}
+
+
+/**
+ * \brief Main
+ */
+int main(int argc, char *argv[])
+{
+	matches_partition_t **parts;
+	unsigned long nparts = 12, universe = 20000, rounds = 5, i, r, before, after;
+	unsigned long *ids, *clusters;
+	int c, ret;
+
+	while ((c = getopt(argc, argv, "hn:u:r:s:")) != -1) {
+		switch (c) {
+			case 'n':
+				nparts = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'u':
+				universe = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'r':
+				rounds = strtoul(optarg, NULL, 10);
+				break;
+
+			case 's':
+				rng = strtoull(optarg, NULL, 10) | 1;
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				exit(EXIT_SUCCESS);
+
+			default:
+				show_help(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (universe < 1) {
+		universe = 1;
+	}
+
+	/* Before any GMP variable is created */
+	count_allocations();
+
+	parts    = calloc(nparts, sizeof(matches_partition_t*));
+	ids      = malloc(sizeof(unsigned long) * universe);
+	clusters = malloc(sizeof(unsigned long) * universe);
+	if (parts == NULL || ids == NULL || clusters == NULL) {
+		perror("alloccheck");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Partitions of different sizes, cluster counts and overlaps */
+	for (i = 0; i < nparts; i++) {
+		parts[i] = random_partition(universe, 2 + (next_random() % (universe / 4 + 1)),
+				200 + (next_random() % 801), ids, clusters);
+		if (parts[i] == NULL) {
+			perror("matches_partition_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	ret = EXIT_SUCCESS;
+	if (all_pairs(parts, nparts) < 0) {
+		ret = EXIT_FAILURE;
+	} else {
+		before = allocation_count();
+		for (r = 0; r < rounds && ret == EXIT_SUCCESS; r++) {
+			if (all_pairs(parts, nparts) < 0) {
+				ret = EXIT_FAILURE;
+			}
+		}
+		after = allocation_count();
+
+		printf("%lu pairs x %lu indexes x %lu rounds after the warm-up: %lu allocations\n",
+				(nparts * (nparts - 1)) / 2, (unsigned long)NINDEXES_CHECKED, rounds, after - before);
+		if (after != before) {
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < nparts; i++) {
+		matches_partition_destroy(parts[i]);
+	}
+	free(parts);
+	free(ids);
+	free(clusters);
+	matches_thread_cleanup();
+	return ret;
+}
@@ -0,0 +1,471 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "bench.h"
+#include "../src/libmatches.h"
+
+/*
+ * Check of the library API against the program
+ *
+ * A corpus is generated with gencsets and calculated by matches for every
+ * index (roundtrip format). The same cluster set files are then read here,
+ * element names are mapped to dense ids and each file becomes a partition
+ * of libmatches.so: every row from matches_row() and every pair from
+ * matches_pair() must be the value written by the program, to the last
+ * bit. Only the public API (libmatches.h) is used.
+ */
+
+/** Indexes checked (order of the matrices written by matches) */
+static const int indexes[] = {
+	MATCHES_H, MATCHES_H2, MATCHES_ARI, MATCHES_NMI, MATCHES_JACCARD, MATCHES_FM
+};
+#define NINDEXES_CHECKED (sizeof(indexes) / sizeof(indexes[0]))
+
+/** Cluster set file */
+typedef struct _csfile {
+	/** file contents (names are NUL terminated in place) */
+	char *buf;
+	/** element names */
+	char **names;
+	/** cluster of each element */
+	unsigned long *clusters;
+	/** number of elements */
+	unsigned long n;
+} csfile_t;
+
+/** Number of values that differ (all corpora) */
+static unsigned long ndiffs = 0;
+
+
+/**
+ * \brief Read a whole file
+ * \param [in] filename File name
+ * \return char* Contents (NUL terminated), NULL on error
+ */
+static char *read_file(const char *filename)
+{
+	FILE *fp;
+	long size;
+	char *buf;
+
+	if ((fp = fopen(filename, "r")) == NULL) {
+		perror(filename);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	buf = malloc(size + 1);
+	if (buf == NULL || fread(buf, 1, size, fp) != (size_t)size) {
+		perror(filename);
+		free(buf);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	buf[size] = '\0';
+	return buf;
+}
+
+
+/**
+ * \brief Read a cluster set file ("name cluster," per line, in order)
+ * \param [in] filename File name
+ * \param [out] cs Cluster set
+ * \return int 0 on success, -1 otherwise
+ */
+static int read_csfile(const char *filename, csfile_t *cs)
+{
+	char *p, *name, *end;
+	unsigned long cap;
+
+	memset(cs, 0, sizeof(csfile_t));
+	if ((cs->buf = read_file(filename)) == NULL) {
+		return -1;
+	}
+
+	cap = 0;
+	for (p = cs->buf; (p = strchr(p, ',')) != NULL; p++) {
+		cap++;
+	}
+	cs->names    = malloc(sizeof(char*) * (cap + 1));
+	cs->clusters = malloc(sizeof(unsigned long) * (cap + 1));
+	if (cs->names == NULL || cs->clusters == NULL) {
+		perror(filename);
+		return -1;
+	}
+
+	p = cs->buf;
+	while (cs->n < cap) {
+		p += strspn(p, " \n");
+		name = p;
+		p += strcspn(p, " ");
+		if (*p == '\0') {
+			break;
+		}
+		*p++ = '\0';
+		cs->clusters[cs->n] = strtoul(p, &end, 10);
+		cs->names[cs->n++]  = name;
+		p = end + strcspn(end, ",");
+		if (*p == ',') {
+			p++;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Compare names (for qsort() and bsearch())
+ */
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+/**
+ * \brief Build the partitions of some cluster set files, with element ids
+ *        shared by all of them
+ * \param [in] cs Cluster sets
+ * \param [in] n Number of cluster sets
+ * \param [out] parts Partitions
+ * \return int 0 on success, -1 otherwise
+ */
+static int build_partitions(csfile_t *cs, unsigned long n, matches_partition_t **parts)
+{
+	char **dict, **found;
+	unsigned long *ids, total, ndict, i, k;
+
+	/* Dictionary: all names, sorted and unique; ids are their positions */
+	total = 0;
+	for (i = 0; i < n; i++) {
+		total += cs[i].n;
+	}
+	dict = malloc(sizeof(char*) * (total + 1));
+	ids  = malloc(sizeof(unsigned long) * (total + 1));
+	if (dict == NULL || ids == NULL) {
+		perror("build_partitions");
+		free(dict);
+		free(ids);
+		return -1;
+	}
+	ndict = 0;
+	for (i = 0; i < n; i++) {
+		memcpy(&dict[ndict], cs[i].names, sizeof(char*) * cs[i].n);
+		ndict += cs[i].n;
+	}
+	qsort(dict, ndict, sizeof(char*), name_cmp);
+	for (i = 0, k = 0; i < ndict; i++) {
+		if (k == 0 || strcmp(dict[k - 1], dict[i]) != 0) {
+			dict[k++] = dict[i];
+		}
+	}
+	ndict = k;
+
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < cs[i].n; k++) {
+			found  = bsearch(&cs[i].names[k], dict, ndict, sizeof(char*), name_cmp);
+			ids[k] = found - dict;
+		}
+		parts[i] = matches_partition_create(ids, cs[i].clusters, cs[i].n);
+		if (parts[i] == NULL) {
+			perror("matches_partition_create");
+			break;
+		}
+	}
+	free(dict);
+	free(ids);
+	return (i < n) ? -1 : 0;
+}
+
+
+/**
+ * \brief Compare one value of the library with the program output
+ * \param [in] title Matrix title
+ * \param [in] rows Row names
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] what Function that gave the value
+ * \param [in] lib Value of the library
+ * \param [in] prog Value written by the program
+ * \return unsigned long 1 if they differ, 0 otherwise
+ */
+static unsigned long compare_value(const char *title, char **rows, unsigned long i, unsigned long j,
+		const char *what, double lib, const char *prog)
+{
+	if (prog != NULL && lib == strtod(prog, NULL)) {
+		return 0;
+	}
+	printf("    %s: %s x %s: %s %.17g, matches %s\n", title, rows[i], rows[j], what, lib,
+			(prog != NULL) ? prog : "-");
+	return 1;
+}
+
+
+/**
+ * \brief Check one corpus
+ * \param [in] matches matches binary
+ * \param [in] corpus Corpus directory
+ * \param [in] workdir Directory for the outputs
+ * \return int 0 if results are identical, -1 otherwise
+ */
+static int check_corpus(const char *matches, const char *corpus, const char *workdir)
+{
+	char *argv[12], output[4096], path[4096], **lines, **rows, **cells, *p, *buf, *save;
+	unsigned long nlines, nrows, ncells, i, j, l, x, n;
+	matches_partition_t **parts;
+	csfile_t *cs;
+	double *values, h;
+	runres_t res;
+	int ret = -1;
+
+	snprintf(output, sizeof(output), "%s/api.out", workdir);
+	argv[0]  = (char *)matches;
+	argv[1]  = "-i"; argv[2] = (char *)corpus;
+	argv[3]  = "-x"; argv[4] = "h,h2,ari,nmi,jaccard,fm";
+	argv[5]  = "-f"; argv[6] = "roundtrip";
+	argv[7]  = NULL;
+	if (run(argv, output, &res) < 0) {
+		printf("%s: matches failed\n", corpus);
+		return -1;
+	}
+	if ((buf = read_file(output)) == NULL) {
+		return -1;
+	}
+
+	/* Lines of the output */
+	nlines = 1;
+	for (p = buf; *p != '\0'; p++) {
+		nlines += (*p == '\n');
+	}
+	lines = malloc(sizeof(char*) * nlines);
+	cells = NULL;
+	rows  = NULL;
+	cs    = NULL;
+	parts = NULL;
+	values = NULL;
+	if (lines == NULL) {
+		perror("check_corpus");
+		goto out;
+	}
+	nlines = 0;
+	for (p = strtok_r(buf, "\n", &save); p != NULL; p = strtok_r(NULL, "\n", &save)) {
+		lines[nlines++] = p;
+	}
+
+	/* Rows of the first matrix give the cluster set files, in order */
+	nrows = 0;
+	for (l = 1; l < nlines && lines[l][0] != '-'; l++) {
+		nrows++;
+	}
+	rows   = malloc(sizeof(char*) * (nrows + 1));
+	cells  = malloc(sizeof(char*) * (nrows + 2));
+	cs     = calloc(nrows + 1, sizeof(csfile_t));
+	parts  = calloc(nrows + 1, sizeof(matches_partition_t*));
+	values = malloc(sizeof(double) * (nrows + 1));
+	if (rows == NULL || cells == NULL || cs == NULL || parts == NULL || values == NULL) {
+		perror("check_corpus");
+		goto out;
+	}
+	for (i = 0; i < nrows; i++) {
+		rows[i] = strndup(lines[1 + i], strcspn(lines[1 + i], " "));
+		snprintf(path, sizeof(path), "%s/%s", corpus, rows[i]);
+		if (rows[i] == NULL || read_csfile(path, &cs[i]) < 0) {
+			nrows = i + (rows[i] != NULL);
+			goto out;
+		}
+	}
+	if (build_partitions(cs, nrows, parts) < 0) {
+		goto out;
+	}
+
+	/* Each matrix: title, nrows rows, statistics */
+	n = 0;
+	l = 0;
+	for (x = 0; x < NINDEXES_CHECKED; x++) {
+		while (l < nlines && lines[l][0] != '=') {
+			l++;
+		}
+		if ((l + nrows) >= nlines) {
+			printf("%s: matrix %lu missing from the output of matches\n", corpus, x + 1);
+			n++;
+			break;
+		}
+		for (i = 0; i < nrows; i++) {
+			ncells = 0;
+			for (p = strtok_r(lines[l + 1 + i], " ", &save); p != NULL && ncells <= nrows;
+					p = strtok_r(NULL, " ", &save)) {
+				cells[ncells++] = p;
+			}
+			for (j = ncells; j <= nrows; j++) {
+				cells[j] = NULL;
+			}
+
+			if (matches_row(parts, nrows, i, indexes[x], values) < 0) {
+				perror("matches_row");
+				goto out;
+			}
+			for (j = 0; j < nrows; j++) {
+				n += compare_value(lines[l], rows, i, j, "matches_row", values[j], cells[1 + j]);
+				if (j <= i) {
+					continue;
+				}
+				if (matches_pair(parts[i], parts[j], indexes[x], &h) < 0) {
+					perror("matches_pair");
+					goto out;
+				}
+				n += compare_value(lines[l], rows, i, j, "matches_pair", h, cells[1 + j]);
+			}
+		}
+		l += 1 + nrows;
+	}
+
+	printf("%s: %lu cluster sets, %s\n", corpus, nrows, (n == 0) ? "identical" : "DIFFERENT");
+	ndiffs += n;
+	ret = (n == 0) ? 0 : -1;
+
+out:
+	for (i = 0; parts != NULL && i < nrows; i++) {
+		matches_partition_destroy(parts[i]);
+	}
+	for (i = 0; cs != NULL && i < nrows; i++) {
+		free(cs[i].buf);
+		free(cs[i].names);
+		free(cs[i].clusters);
+		free(rows[i]);
+	}
+	free(parts);
+	free(cs);
+	free(rows);
+	free(cells);
+	free(values);
+	free(lines);
+	free(buf);
+	return ret;
+}
+
+
+/**
+ * \brief Show program help
+ * \param [in] prgname Program's name
+ */
+static void show_help(const char *prgname)
+{
+	printf("Use: %s [options] [corpus...]\n", prgname);
+	printf("Options:\n");
+	printf("    -m PATH     matches binary (default: ../src/matches)\n");
+	printf("    -g PATH     gencsets binary (default: ./gencsets)\n");
+	printf("    -w DIR      Directory of generated corpora and outputs (default: check)\n");
+	printf("    -n N        Number of generated corpora (default: 4, 0 for none)\n");
+	printf("    -s SEED     Seed of the first generated corpus (default: 1)\n");
+	printf("Corpus directories given as arguments are checked too.\n");
+}
+
+
+/**
+ * \brief Main
+ */
+int main(int argc, char *argv[])
+{
+	const char *matches = "../src/matches";
+	const char *gencsets = "./gencsets";
+	const char *workdir = "check";
+	unsigned long ncorpora = 4, seed = 1, i;
+	char corpus[4096], sseed[32];
+	char *gargv[16];
+	runres_t res;
+	struct stat st;
+	int c, failed;
+
+	while ((c = getopt(argc, argv, "hm:g:w:n:s:")) != -1) {
+		switch (c) {
+			case 'm':
+				matches = optarg;
+				break;
+
+			case 'g':
+				gencsets = optarg;
+				break;
+
+			case 'w':
+				workdir = optarg;
+				break;
+
+			case 'n':
+				ncorpora = strtoul(optarg, NULL, 10);
+				break;
+
+			case 's':
+				seed = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				exit(EXIT_SUCCESS);
+
+			default:
+				show_help(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (mkdir(workdir, 0755) != 0 && stat(workdir, &st) != 0) {
+		perror(workdir);
+		exit(EXIT_FAILURE);
+	}
+
+	failed = 0;
+	for (i = 0; i < ncorpora; i++) {
+		/* Partial presence, so partitions have different elements */
+		snprintf(corpus, sizeof(corpus), "%s/api-seed%lu", workdir, seed + i);
+		snprintf(sseed, sizeof(sseed), "%lu", seed + i);
+		gargv[0]  = (char *)gencsets;
+		gargv[1]  = "-n"; gargv[2]  = "12";
+		gargv[3]  = "-u"; gargv[4]  = "3000";
+		gargv[5]  = "-k"; gargv[6]  = "40";
+		gargv[7]  = "-p"; gargv[8]  = "0.8";
+		gargv[9]  = "-s"; gargv[10] = sseed;
+		gargv[11] = corpus;
+		gargv[12] = NULL;
+		if (run(gargv, NULL, &res) < 0 || check_corpus(matches, corpus, workdir) < 0) {
+			failed = 1;
+		}
+	}
+
+	for (i = optind; i < (unsigned long)argc; i++) {
+		if (check_corpus(matches, argv[i], workdir) < 0) {
+			failed = 1;
+		}
+	}
+
+	/* The main thread does not run key destructors */
+	matches_thread_cleanup();
+
+	printf("%lu values differ\n", ndiffs);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
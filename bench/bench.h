@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef BENCH_H
+
+	#define BENCH_H
+
+	/** Result of one run */
+	typedef struct _runres {
+		/** wall time (s) */
+		double seconds;
+		/** peak resident memory (KiB) */
+		long max_rss;
+	} runres_t;
+
+	/* Prototypes */
+	double now(void);
+	int run(char **argv, const char *output, runres_t *res);
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "bench.h"
+
+/*
+ * Benchmark driver
+ *
+ * For each point of the grid (files x universe x clusters x distribution x
+ * overlap) a corpus is generated with gencsets, then matches is run with
+ * -p, -c and -p -c for each number of threads. Each run is repeated and
+ * the best wall time is kept; peak RSS comes from the child's rusage.
+ *
+ * One CSV row is appended per run, so results of several builds (see -l)
+ * can be kept in the same file and compared.
+ */
+
+/** Maximum items of a grid list */
+#define MAX_LIST 32
+
+/** CSV header */
+#define CSV_HEADER "label,date,files,universe,clusters,distribution,overlap,threads,mode," \
+	"pairs,seconds,pairs_per_second,max_rss_kb\n"
+
+/** Grid list (strings, as given on the command line) */
+typedef struct _list {
+	/** items */
+	char *item[MAX_LIST];
+	/** number of items */
+	int n;
+} list_t;
+
+
+
+/**
+ * \brief Split a comma separated list
+ * \param [in] str List
+ * \param [out] l Items (point into a copy of str)
+ * \return int 0 on success, -1 otherwise
+ */
+static int parse_list(const char *str, list_t *l)
+{
+	char *s, *tok, *save;
+
+	if ((s = strdup(str)) == NULL) {
+		return -1;
+	}
+	l->n = 0;
+	for (tok = strtok_r(s, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+		if (l->n == MAX_LIST) {
+			fprintf(stderr, "Too many items: %s\n", str);
+			return -1;
+		}
+		l->item[l->n++] = tok;
+	}
+	return (l->n > 0) ? 0 : -1;
+}
+
+
+/**
+ * \brief Show program help
+ * \param [in] prgname Program's name
+ */
+static void show_help(const char *prgname)
+{
+	printf("Use: %s [options]\n", prgname);
+	printf("Options:\n");
+	printf("    -m PATH     matches binary (default: ../src/matches)\n");
+	printf("    -g PATH     gencsets binary (default: ./gencsets)\n");
+	printf("    -w DIR      Directory of generated corpora (default: corpus)\n");
+	printf("    -o FILE     Append results to CSV file (default: standard output)\n");
+	printf("    -l LABEL    Label of the results, e.g. the commit (default: none)\n");
+	printf("    -r N        Repetitions of each run, best time is kept (default: 3)\n");
+	printf("Grid (comma separated lists):\n");
+	printf("    -n FILES    Number of cluster sets (default: 20,40,80)\n");
+	printf("    -u ELEMENTS Universe sizes (default: 1000,10000)\n");
+	printf("    -k CLUSTERS Number of clusters (default: 20)\n");
+	printf("    -d DIST     Cluster size distributions (default: zipf)\n");
+	printf("    -v OVERLAP  Overlap between partitions (default: 0.8)\n");
+	printf("    -t THREADS  Worker threads (default: 1)\n");
+	printf("    -M MODES    Indexes: p, c, pc (default: p,c,pc)\n");
+}
+
+
+/**
+ * \brief Main
+ */
+int main(int argc, char *argv[])
+{
+	const char *matches = "../src/matches";
+	const char *gencsets = "./gencsets";
+	const char *workdir = "corpus";
+	const char *csvfile = NULL;
+	const char *label = "";
+	unsigned long reps = 3, nfiles, npairs, r;
+	list_t files, universe, clusters, dist, overlap, threads, modes;
+	char corpus[4096], date[32];
+	char *gargv[16], *margv[16];
+	runres_t res, best;
+	struct stat st;
+	time_t t;
+	FILE *csv;
+	int c, a, b, k, d, v, th, m, ok, failed;
+
+	parse_list("20,40,80", &files);
+	parse_list("1000,10000", &universe);
+	parse_list("20", &clusters);
+	parse_list("zipf", &dist);
+	parse_list("0.8", &overlap);
+	parse_list("1", &threads);
+	parse_list("p,c,pc", &modes);
+
+	while ((c = getopt(argc, argv, "hm:g:w:o:l:r:n:u:k:d:v:t:M:")) != -1) {
+		ok = 0;
+		switch (c) {
+			case 'm':
+				matches = optarg;
+				break;
+
+			case 'g':
+				gencsets = optarg;
+				break;
+
+			case 'w':
+				workdir = optarg;
+				break;
+
+			case 'o':
+				csvfile = optarg;
+				break;
+
+			case 'l':
+				label = optarg;
+				break;
+
+			case 'r':
+				reps = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'n':
+				ok = parse_list(optarg, &files);
+				break;
+
+			case 'u':
+				ok = parse_list(optarg, &universe);
+				break;
+
+			case 'k':
+				ok = parse_list(optarg, &clusters);
+				break;
+
+			case 'd':
+				ok = parse_list(optarg, &dist);
+				break;
+
+			case 'v':
+				ok = parse_list(optarg, &overlap);
+				break;
+
+			case 't':
+				ok = parse_list(optarg, &threads);
+				break;
+
+			case 'M':
+				ok = parse_list(optarg, &modes);
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				exit(EXIT_SUCCESS);
+			default:
+				show_help(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+		if (ok < 0) {
+			fprintf(stderr, "Invalid list: %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (reps < 1) {
+		reps = 1;
+	}
+
+	if (csvfile == NULL) {
+		csv = stdout;
+		fputs(CSV_HEADER, csv);
+	} else {
+		/* Header only for a new file */
+		b = (stat(csvfile, &st) != 0 || st.st_size == 0);
+		if ((csv = fopen(csvfile, "a")) == NULL) {
+			perror(csvfile);
+			exit(EXIT_FAILURE);
+		}
+		if (b) {
+			fputs(CSV_HEADER, csv);
+		}
+	}
+	if (mkdir(workdir, 0755) != 0 && stat(workdir, &st) != 0) {
+		perror(workdir);
+		exit(EXIT_FAILURE);
+	}
+
+	t = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+
+	failed = 0;
+	for (a = 0; a < files.n; a++)
+	for (b = 0; b < universe.n; b++)
+	for (k = 0; k < clusters.n; k++)
+	for (d = 0; d < dist.n; d++)
+	for (v = 0; v < overlap.n; v++) {
+		snprintf(corpus, sizeof(corpus), "%s/n%s-u%s-k%s-%s-v%s", workdir,
+				files.item[a], universe.item[b], clusters.item[k], dist.item[d], overlap.item[v]);
+
+		/* Generate the corpus (same seed for every point) */
+		gargv[0] = (char *)gencsets;
+		gargv[1] = "-n"; gargv[2]  = files.item[a];
+		gargv[3] = "-u"; gargv[4]  = universe.item[b];
+		gargv[5] = "-k"; gargv[6]  = clusters.item[k];
+		gargv[7] = "-d"; gargv[8]  = dist.item[d];
+		gargv[9] = "-v"; gargv[10] = overlap.item[v];
+		gargv[11] = corpus;
+		gargv[12] = NULL;
+		if (run(gargv, NULL, &res) < 0) {
+			failed = 1;
+			continue;
+		}
+		nfiles = strtoul(files.item[a], NULL, 10);
+
+		for (th = 0; th < threads.n; th++)
+		for (m = 0; m < modes.n; m++) {
+			margv[0] = (char *)matches;
+			margv[1] = "-i"; margv[2] = corpus;
+			margv[3] = "-t"; margv[4] = threads.item[th];
+			npairs = (nfiles * (nfiles - 1)) / 2;
+			if (strcmp(modes.item[m], "p") == 0) {
+				margv[5] = "-p"; margv[6] = NULL;
+			} else if (strcmp(modes.item[m], "c") == 0) {
+				margv[5] = "-c"; margv[6] = NULL;
+			} else if (strcmp(modes.item[m], "pc") == 0) {
+				margv[5] = "-p"; margv[6] = "-c"; margv[7] = NULL;
+				npairs *= 2;
+			} else {
+				fprintf(stderr, "Invalid mode: %s\n", modes.item[m]);
+				failed = 1;
+				continue;
+			}
+
+			best.seconds = -1;
+			best.max_rss = 0;
+			for (r = 0; r < reps; r++) {
+				if (run(margv, NULL, &res) < 0) {
+					failed = 1;
+					break;
+				}
+				if (best.seconds < 0 || res.seconds < best.seconds) {
+					best.seconds = res.seconds;
+				}
+				if (res.max_rss > best.max_rss) {
+					best.max_rss = res.max_rss;
+				}
+			}
+			if (r < reps) {
+				continue;
+			}
+
+			fprintf(csv, "%s,%s,%s,%s,%s,%s,%s,%s,%s,%lu,%.6f,%.1f,%ld\n", label, date,
+					files.item[a], universe.item[b], clusters.item[k], dist.item[d], overlap.item[v],
+					threads.item[th], modes.item[m], npairs, best.seconds,
+					(best.seconds > 0) ? (npairs / best.seconds) : 0, best.max_rss);
+			fflush(csv);
+		}
+	}
+
+	if (csv != stdout) {
+		fclose(csv);
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "bench.h"
+
+/*
+ * Differential check of the fast kernels against the reference ones
+ *
+ * Each corpus (generated with gencsets and/or given on the command line)
+ * is calculated twice by matches, with and without --reference, for h and
+ * h2 and for Np and Ne (-P, -E). Results are written with the roundtrip
+ * format, so any difference in the last bit shows up. Every cell that
+ * differs is reported, together with the time of both runs.
+ *
+ * Each generated corpus is checked twice: with every element in every
+ * cluster set, and with each element present in a cluster set with
+ * probability 0.8, so elements out of the other set of a pair are dropped
+ * and single common elements (the num_el == 1 rule of h2) are compared too.
+ *
+ * Pairs of more than SPLIT_ELEMS elements (kernel.c) are calculated by a
+ * team of threads when there are fewer pairs than threads. A few corpora
+ * of two and three big cluster sets are calculated with one thread and
+ * with SPLIT_THREADS, and both outputs must be identical.
+ */
+
+/** Presence of the elements in each cluster set of the generated corpora */
+static const char *presences[] = { "1", "0.8" };
+#define NPRESENCES (sizeof(presences) / sizeof(presences[0]))
+
+/** Threads of the split check (more than the pairs of its corpora) */
+#define SPLIT_THREADS "8"
+/** Cluster sets of the corpora of the split check */
+static const char *split_files[] = { "2", "3" };
+#define NSPLIT (sizeof(split_files) / sizeof(split_files[0]))
+
+/** Options of each check */
+static const char *modes[][2] = {
+	{ "h, h2", NULL },
+	{ "Np",    "-P" },
+	{ "Ne",    "-E" }
+};
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+/** Loaded output file */
+typedef struct _lines {
+	/** file contents */
+	char *buf;
+	/** lines */
+	char **line;
+	/** number of lines */
+	unsigned long n;
+} lines_t;
+
+/** Number of cells that differ (all checks) */
+static unsigned long ndiffs = 0;
+/** Total time of fast and reference runs */
+static double tfast = 0, tref = 0;
+
+
+/**
+ * \brief Load a text file split in lines
+ * \param [in] filename File name
+ * \param [out] l Lines
+ * \return int 0 on success, -1 otherwise
+ */
+static int load_lines(const char *filename, lines_t *l)
+{
+	FILE *fp;
+	long size;
+	unsigned long i, n;
+
+	memset(l, 0, sizeof(lines_t));
+	if ((fp = fopen(filename, "r")) == NULL) {
+		perror(filename);
+		return -1;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	l->buf = malloc(size + 1);
+	if (l->buf == NULL || fread(l->buf, 1, size, fp) != (size_t)size) {
+		perror(filename);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	l->buf[size] = '\0';
+
+	n = 0;
+	for (i = 0; i < (unsigned long)size; i++) {
+		if (l->buf[i] == '\n') n++;
+	}
+	l->line = malloc(sizeof(char*) * (n + 1));
+	if (l->line == NULL) {
+		perror(filename);
+		return -1;
+	}
+	l->line[0] = l->buf;
+	for (i = 0; i < (unsigned long)size; i++) {
+		if (l->buf[i] == '\n') {
+			l->buf[i] = '\0';
+			l->line[++l->n] = &l->buf[i + 1];
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Free loaded lines
+ * \param [in] l Lines
+ */
+static void free_lines(lines_t *l)
+{
+	free(l->buf);
+	free(l->line);
+}
+
+
+/**
+ * \brief Copy the first word of a line
+ * \param [in] line Line
+ * \param [out] buf Buffer
+ * \param [in] size Buffer size
+ */
+static void first_word(const char *line, char *buf, size_t size)
+{
+	size_t n;
+
+	n = strcspn(line, " ");
+	if (n >= size) {
+		n = size - 1;
+	}
+	memcpy(buf, line, n);
+	buf[n] = '\0';
+}
+
+
+/**
+ * \brief Compare one line of both outputs, reporting the cells that differ
+ * \param [in] l Lines of the fast kernels
+ * \param [in] tline Title line of the current matrix (rows follow it)
+ * \param [in] fast Line of the fast kernels
+ * \param [in] ref Line of the reference kernels
+ * \return unsigned long Number of cells that differ
+ */
+static unsigned long compare_line(lines_t *l, unsigned long tline, char *fast, char *ref)
+{
+	char *sf, *sr, *tf, *tr, *row, title[256], colname[256];
+	unsigned long col, n;
+
+	if (strcmp(fast, ref) == 0) {
+		return 0;
+	}
+
+	/* Title without the decoration */
+	snprintf(title, sizeof(title), "%s", l->line[tline] + strspn(l->line[tline], "= "));
+	title[strcspn(title, "=")] = '\0';
+	while (title[0] != '\0' && title[strlen(title) - 1] == ' ') {
+		title[strlen(title) - 1] = '\0';
+	}
+
+	n   = 0;
+	col = 0;
+	row = NULL;
+	tf  = strtok_r(fast, " ", &sf);
+	tr  = strtok_r(ref, " ", &sr);
+	while (tf != NULL || tr != NULL) {
+		if (tf == NULL || tr == NULL || strcmp(tf, tr) != 0) {
+			if (row == NULL) {
+				printf("    %s: fast \"%s\", reference \"%s\"\n", title,
+						(tf != NULL) ? tf : "", (tr != NULL) ? tr : "");
+			} else {
+				colname[0] = '\0';
+				if ((tline + 1 + col) < l->n) {
+					first_word(l->line[tline + 1 + col], colname, sizeof(colname));
+				}
+				printf("    %s: %s x %s: fast %s, reference %s\n", title, row, colname,
+						(tf != NULL) ? tf : "-", (tr != NULL) ? tr : "-");
+			}
+			n++;
+		}
+		if (row == NULL) {
+			row = tf;
+		} else {
+			col++;
+		}
+		tf = (tf != NULL) ? strtok_r(NULL, " ", &sf) : NULL;
+		tr = (tr != NULL) ? strtok_r(NULL, " ", &sr) : NULL;
+	}
+	return n;
+}
+
+
+/**
+ * \brief Check one corpus
+ * \param [in] matches matches binary
+ * \param [in] corpus Corpus directory or file
+ * \param [in] threads Worker threads
+ * \param [in] split Threads of the run compared with the first one (NULL
+ *        for a run of the reference kernels)
+ * \param [in] workdir Directory for the outputs
+ * \return int 0 if results are identical, -1 otherwise
+ */
+static int check_corpus(const char *matches, const char *corpus, const char *threads, const char *split,
+		const char *workdir)
+{
+	char *argv[16], fastout[4096], refout[4096];
+	runres_t fast, ref;
+	lines_t lf, lr;
+	unsigned long i, m, n, tline;
+	int a, ret = 0;
+
+	snprintf(fastout, sizeof(fastout), "%s/fast.out", workdir);
+	snprintf(refout, sizeof(refout), "%s/reference.out", workdir);
+
+	for (m = 0; m < NMODES; m++) {
+		a = 0;
+		argv[a++] = (char *)matches;
+		argv[a++] = "-i";
+		argv[a++] = (char *)corpus;
+		argv[a++] = "-p";
+		argv[a++] = "-c";
+		argv[a++] = "-t";
+		argv[a++] = (char *)threads;
+		argv[a++] = "-f";
+		argv[a++] = "roundtrip";
+		if (modes[m][1] != NULL) {
+			argv[a++] = (char *)modes[m][1];
+		}
+		argv[a] = NULL;
+		if (run(argv, fastout, &fast) < 0) {
+			printf("%s (%s): fast run failed\n", corpus, modes[m][0]);
+			ret = -1;
+			continue;
+		}
+		if (split != NULL) {
+			/* Same run with more threads */
+			argv[6] = (char *)split;
+		} else {
+			argv[a++] = "--reference";
+			argv[a]   = NULL;
+		}
+		if (run(argv, refout, &ref) < 0) {
+			printf("%s (%s): reference run failed\n", corpus, modes[m][0]);
+			ret = -1;
+			continue;
+		}
+
+		if (load_lines(fastout, &lf) < 0 || load_lines(refout, &lr) < 0) {
+			ret = -1;
+			continue;
+		}
+		if (lf.n != lr.n) {
+			printf("%s (%s): outputs have %lu and %lu lines\n", corpus, modes[m][0], lf.n, lr.n);
+			n = 1;
+		} else {
+			n = 0;
+			tline = 0;
+			for (i = 0; i < lf.n; i++) {
+				if (lf.line[i][0] == '=') {
+					tline = i;
+				}
+				n += compare_line(&lf, tline, lf.line[i], lr.line[i]);
+			}
+		}
+		free_lines(&lf);
+		free_lines(&lr);
+		if (split == NULL) {
+			tfast += fast.seconds;
+			tref  += ref.seconds;
+		}
+
+		if (split != NULL) {
+			printf("%s (%s): %s, %s thread(s) %.6f s, %s threads %.6f s\n", corpus, modes[m][0],
+					(n == 0) ? "identical" : "DIFFERENT", threads, fast.seconds, split, ref.seconds);
+		} else {
+			printf("%s (%s): %s, fast %.6f s, reference %.6f s, speedup %.2fx\n", corpus, modes[m][0],
+					(n == 0) ? "identical" : "DIFFERENT", fast.seconds, ref.seconds,
+					(fast.seconds > 0) ? (ref.seconds / fast.seconds) : 0);
+		}
+		if (n > 0) {
+			ndiffs += n;
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+
+/**
+ * \brief Show program help
+ * \param [in] prgname Program's name
+ */
+static void show_help(const char *prgname)
+{
+	printf("Use: %s [options] [corpus...]\n", prgname);
+	printf("Options:\n");
+	printf("    -m PATH     matches binary (default: ../src/matches)\n");
+	printf("    -g PATH     gencsets binary (default: ./gencsets)\n");
+	printf("    -w DIR      Directory of generated corpora and outputs (default: check)\n");
+	printf("    -n N        Number of generated corpora, each one with full and partial\n");
+	printf("                presence of the elements (default: 20, 0 for none)\n");
+	printf("    -s SEED     Seed of the first generated corpus (default: 1)\n");
+	printf("    -t THREADS  Worker threads (default: 1)\n");
+	printf("    -S          Skip the check of big pairs split among threads\n");
+	printf("Corpora given as arguments (directories or corpus files) are checked too.\n");
+}
+
+
+/**
+ * \brief Main
+ */
+int main(int argc, char *argv[])
+{
+	const char *matches = "../src/matches";
+	const char *gencsets = "./gencsets";
+	const char *workdir = "check";
+	const char *threads = "1";
+	static const char *dists[] = { "uniform", "zipf", "geometric" };
+	static const char *overlaps[] = { "0", "0.25", "0.5", "0.75", "0.9", "1" };
+	unsigned long ncorpora = 20, seed = 1, i, p, x;
+	char corpus[4096], sfiles[32], suniverse[32], sclusters[32], sseed[32];
+	char *gargv[18];
+	runres_t res;
+	struct stat st;
+	int c, failed, nsplit = 1;
+
+	while ((c = getopt(argc, argv, "hm:g:w:n:s:t:S")) != -1) {
+		switch (c) {
+			case 'm':
+				matches = optarg;
+				break;
+
+			case 'g':
+				gencsets = optarg;
+				break;
+
+			case 'w':
+				workdir = optarg;
+				break;
+
+			case 'n':
+				ncorpora = strtoul(optarg, NULL, 10);
+				break;
+
+			case 's':
+				seed = strtoul(optarg, NULL, 10);
+				break;
+
+			case 't':
+				threads = optarg;
+				break;
+
+			case 'S':
+				nsplit = 0;
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				exit(EXIT_SUCCESS);
+
+			default:
+				show_help(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (mkdir(workdir, 0755) != 0 && stat(workdir, &st) != 0) {
+		perror(workdir);
+		exit(EXIT_FAILURE);
+	}
+
+	failed = 0;
+	for (i = 0; i < ncorpora; i++) {
+		/* Corpus parameters from the seed */
+		x = (seed + i) * 2654435761UL;
+		snprintf(sfiles, sizeof(sfiles), "%lu", 2 + (x >> 3) % 11);
+		snprintf(suniverse, sizeof(suniverse), "%lu", 2 + (x >> 7) % 150);
+		snprintf(sclusters, sizeof(sclusters), "%lu", 2 + (x >> 13) % 30);
+		snprintf(sseed, sizeof(sseed), "%lu", seed + i);
+
+		for (p = 0; p < NPRESENCES; p++) {
+			snprintf(corpus, sizeof(corpus), "%s/seed%lu-p%s", workdir, seed + i, presences[p]);
+
+			gargv[0]  = (char *)gencsets;
+			gargv[1]  = "-n"; gargv[2]  = sfiles;
+			gargv[3]  = "-u"; gargv[4]  = suniverse;
+			gargv[5]  = "-k"; gargv[6]  = sclusters;
+			gargv[7]  = "-d"; gargv[8]  = (char *)dists[(x >> 19) % 3];
+			gargv[9]  = "-v"; gargv[10] = (char *)overlaps[(x >> 23) % 6];
+			gargv[11] = "-p"; gargv[12] = (char *)presences[p];
+			gargv[13] = "-s"; gargv[14] = sseed;
+			gargv[15] = corpus;
+			gargv[16] = NULL;
+			if (run(gargv, NULL, &res) < 0) {
+				failed = 1;
+				continue;
+			}
+			if (check_corpus(matches, corpus, threads, NULL, workdir) < 0) {
+				failed = 1;
+			}
+		}
+	}
+
+	/* Big pairs split among threads against one thread */
+	for (i = 0; nsplit && i < NSPLIT; i++) {
+		snprintf(corpus, sizeof(corpus), "%s/split%s", workdir, split_files[i]);
+		snprintf(sseed, sizeof(sseed), "%lu", seed + i);
+		gargv[0]  = (char *)gencsets;
+		gargv[1]  = "-n"; gargv[2]  = (char *)split_files[i];
+		gargv[3]  = "-u"; gargv[4]  = "50000";
+		gargv[5]  = "-k"; gargv[6]  = "200";
+		gargv[7]  = "-p"; gargv[8]  = "0.9";
+		gargv[9]  = "-s"; gargv[10] = sseed;
+		gargv[11] = corpus;
+		gargv[12] = NULL;
+		if (run(gargv, NULL, &res) < 0 || check_corpus(matches, corpus, "1", SPLIT_THREADS, workdir) < 0) {
+			failed = 1;
+		}
+	}
+
+	for (i = optind; i < (unsigned long)argc; i++) {
+		if (check_corpus(matches, argv[i], threads, NULL, workdir) < 0) {
+			failed = 1;
+		}
+	}
+
+	printf("%lu cells differ; fast %.6f s, reference %.6f s, speedup %.2fx\n", ndiffs, tfast, tref,
+			(tfast > 0) ? (tref / tfast) : 0);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
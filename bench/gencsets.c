@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * Synthetic DAMICORE-style cluster sets
+ *
+ * A base partition of the universe is drawn once; each cluster set keeps
+ * the base cluster of an element with probability "overlap" and draws a
+ * new one otherwise, so overlap 1 gives identical partitions and overlap 0
+ * independent ones. Cluster sizes follow the chosen distribution (weights
+ * of the clusters), and each file has a "presence" fraction of the
+ * universe, in random order.
+ *
+ * The generator has its own PRNG, so the same seed gives the same corpus
+ * on any system.
+ */
+
+/** Cluster size distributions */
+#define DIST_UNIFORM   0
+#define DIST_ZIPF      1
+#define DIST_GEOMETRIC 2
+
+/** Generator parameters */
+typedef struct _genparam {
+	/** number of cluster sets */
+	unsigned long nfiles;
+	/** number of elements */
+	unsigned long universe;
+	/** number of clusters */
+	unsigned long nclusters;
+	/** cluster size distribution */
+	int dist;
+	/** probability of keeping the base cluster */
+	double overlap;
+	/** fraction of the universe in each cluster set */
+	double presence;
+	/** random seed */
+	unsigned long long seed;
+} genparam_t;
+
+/** PRNG state */
+static unsigned long long rng;
+
+
+/**
+ * \brief Next pseudo-random number (xorshift64*)
+ * \return unsigned long long
+ */
+static unsigned long long next_random(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 2685821657736338717ULL;
+}
+
+
+/**
+ * \brief Pseudo-random number in [0, 1)
+ * \return double
+ */
+static double next_unit(void)
+{
+	return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/**
+ * \brief Draw a cluster
+ * \param [in] cdf Cumulative weights of the clusters
+ * \param [in] n Number of clusters
+ * \return unsigned long Cluster
+ */
+static unsigned long draw_cluster(double *cdf, unsigned long n)
+{
+	unsigned long lo, hi, mid;
+	double x;
+
+	x  = next_unit() * cdf[n - 1];
+	lo = 0;
+	hi = n - 1;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cdf[mid] > x) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+
+/**
+ * \brief Parse a cluster size distribution name
+ * \param [in] name Name
+ * \return int Distribution (DIST_*), -1 if unknown
+ */
+static int parse_dist(const char *name)
+{
+	if (strcmp(name, "uniform") == 0) {
+		return DIST_UNIFORM;
+	} else if (strcmp(name, "zipf") == 0) {
+		return DIST_ZIPF;
+	} else if (strcmp(name, "geometric") == 0) {
+		return DIST_GEOMETRIC;
+	}
+	return -1;
+}
+
+
+/**
+ * \brief Write the cluster sets
+ * \param [in] dirname Output directory
+ * \param [in] gp Parameters
+ * \return int 0 on success, -1 otherwise
+ */
+static int generate(const char *dirname, genparam_t *gp)
+{
+	unsigned long *base, *order, i, j, k, n, tmp;
+	double *cdf, w;
+	char *fname;
+	FILE *fp;
+	int ret = 0;
+
+	if (mkdir(dirname, 0755) != 0 && errno != EEXIST) {
+		perror(dirname);
+		return -1;
+	}
+
+	base  = malloc(sizeof(unsigned long) * gp->universe);
+	order = malloc(sizeof(unsigned long) * gp->universe);
+	cdf   = malloc(sizeof(double) * gp->nclusters);
+	fname = malloc(strlen(dirname) + 32);
+	if (base == NULL || order == NULL || cdf == NULL || fname == NULL) {
+		perror("generate");
+		ret = -1;
+		goto out;
+	}
+
+	/* Cluster weights */
+	w = 0;
+	for (k = 0; k < gp->nclusters; k++) {
+		switch (gp->dist) {
+			case DIST_ZIPF:
+				w += 1.0 / (k + 1);
+				break;
+			case DIST_GEOMETRIC:
+				w += pow(0.75, k);
+				break;
+			default:
+				w += 1.0;
+		}
+		cdf[k] = w;
+	}
+
+	rng = (gp->seed * 0x9E3779B97F4A7C15ULL) | 1;
+	for (i = 0; i < gp->universe; i++) {
+		base[i]  = draw_cluster(cdf, gp->nclusters);
+		order[i] = i;
+	}
+
+	for (j = 0; j < gp->nfiles; j++) {
+		sprintf(fname, "%s/cs%06lu.txt", dirname, j);
+		if ((fp = fopen(fname, "w")) == NULL) {
+			perror(fname);
+			ret = -1;
+			goto out;
+		}
+
+		/* Random order */
+		for (i = gp->universe - 1; i > 0; i--) {
+			n = next_random() % (i + 1);
+			tmp      = order[i];
+			order[i] = order[n];
+			order[n] = tmp;
+		}
+
+		for (i = 0; i < gp->universe; i++) {
+			if (gp->presence < 1.0 && next_unit() >= gp->presence) {
+				continue;
+			}
+			k = base[order[i]];
+			if (next_unit() >= gp->overlap) {
+				k = draw_cluster(cdf, gp->nclusters);
+			}
+			fprintf(fp, "sample%06lu %lu,\n", order[i], k);
+		}
+
+		if (fclose(fp) != 0) {
+			perror(fname);
+			ret = -1;
+			goto out;
+		}
+	}
+
+out:
+	free(base);
+	free(order);
+	free(cdf);
+	free(fname);
+	return ret;
+}
+
+
+/**
+ * \brief Show program help
+ * \param [in] prgname Program's name
+ */
+static void show_help(const char *prgname)
+{
+	printf("Use: %s [options] output_directory\n", prgname);
+	printf("Options:\n");
+	printf("    -n FILES      Number of cluster sets (default: 50)\n");
+	printf("    -u ELEMENTS   Universe size (default: 1000)\n");
+	printf("    -k CLUSTERS   Number of clusters (default: 20)\n");
+	printf("    -d DIST       Cluster sizes: uniform, zipf (default), geometric\n");
+	printf("    -v OVERLAP    Probability of an element keeping its base cluster, 0 to 1\n");
+	printf("                  (default: 0.8)\n");
+	printf("    -p PRESENCE   Fraction of the universe in each cluster set (default: 1)\n");
+	printf("    -s SEED       Random seed (default: 1)\n");
+}
+
+
+/**
+ * \brief Main
+ */
+int main(int argc, char *argv[])
+{
+	genparam_t gp;
+	int c;
+
+	gp.nfiles    = 50;
+	gp.universe  = 1000;
+	gp.nclusters = 20;
+	gp.dist      = DIST_ZIPF;
+	gp.overlap   = 0.8;
+	gp.presence  = 1.0;
+	gp.seed      = 1;
+
+	while ((c = getopt(argc, argv, "hn:u:k:d:v:p:s:")) != -1) {
+		switch (c) {
+			case 'n':
+				gp.nfiles = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'u':
+				gp.universe = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'k':
+				gp.nclusters = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'd':
+				if ((gp.dist = parse_dist(optarg)) < 0) {
+					fprintf(stderr, "Invalid distribution: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'v':
+				gp.overlap = atof(optarg);
+				break;
+
+			case 'p':
+				gp.presence = atof(optarg);
+				break;
+
+			case 's':
+				gp.seed = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				exit(EXIT_SUCCESS);
+
+			default:
+				show_help(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind >= argc || gp.nfiles < 1 || gp.universe < 1 || gp.nclusters < 1) {
+		show_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (generate(argv[optind], &gp) < 0) {
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <gmp.h>
+#include "../src/cmatches.h"
+
+/*
+ * Microbenchmark of the combinatorics layer (src/math.c)
+ *
+ * factorial() and single_combination() are timed against replacements:
+ * GMP's own functions, a table of factorials built once, and native
+ * 64-bit integers (only where the result fits). Each variant is called
+ * repeatedly for each n, and its result is compared with the one of
+ * math.c.
+ *
+ * Allocations are counted through the GMP memory functions and by
+ * wrapping malloc() at link time (-Wl,--wrap=malloc), which catches the
+ * mpz_t that math.c returns.
+ */
+
+/** Values of n */
+static const unsigned long sizes[] = {
+	0, 1, 2, 5, 10, 20, 30, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/** Largest n */
+#define MAX_N 10000
+
+/** Minimum time measured for each variant and n (s) */
+#define MIN_TIME 0.02
+
+/** Allocations so far */
+static unsigned long allocations = 0;
+
+/** Factorials 0! ... MAX_N! */
+static mpz_t ftable[MAX_N + 1];
+
+/** Result of the replacements */
+static mpz_t result;
+
+/** Native result does not fit */
+#define NO_FIT ((unsigned long long)-1)
+
+/** Variant being measured */
+typedef struct _variant {
+	/** name */
+	const char *name;
+	/** function of math.c (1) or replacement (0) */
+	char original;
+	/** calculate f(n, r): math.c functions return the value, others set result */
+	mpz_t *(*fn)(unsigned long n, unsigned long r);
+} variant_t;
+
+
+void *__real_malloc(size_t size);
+
+/**
+ * \brief malloc() of math.c (see -Wl,--wrap=malloc)
+ */
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+	return __real_malloc(size);
+}
+
+
+/**
+ * \brief GMP allocation functions
+ */
+static void *count_alloc(size_t size)
+{
+	allocations++;
+	return __real_malloc(size);
+}
+
+static void *count_realloc(void *ptr, size_t old, size_t size)
+{
+	allocations++;
+	return realloc(ptr, size);
+}
+
+static void count_free(void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+
+/**
+ * \brief Monotonic clock
+ * \return double Seconds
+ */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+/**
+ * \brief n! as a native integer
+ * \param [in] n Number
+ * \return unsigned long long n!, NO_FIT if it does not fit
+ */
+static unsigned long long native_factorial(unsigned long n)
+{
+	unsigned long long f = 1;
+	unsigned long i;
+
+	if (n > 20) {
+		return NO_FIT;
+	}
+	for (i = 2; i <= n; i++) {
+		f *= i;
+	}
+	return f;
+}
+
+
+/**
+ * \brief C(n, r) as a native integer (multiplicative formula)
+ * \param [in] n
+ * \param [in] r
+ * \return unsigned long long C(n, r), NO_FIT if it does not fit
+ */
+static unsigned long long native_combination(unsigned long n, unsigned long r)
+{
+	unsigned __int128 c = 1;
+	unsigned long i;
+
+	if (r > n) {
+		return 0;
+	}
+	if (r > (n - r)) {
+		r = n - r;
+	}
+	for (i = 1; i <= r; i++) {
+		/* C(n-r+i, i) = C(n-r+i-1, i-1) * (n-r+i) / i, always exact */
+		c = (c * (n - r + i)) / i;
+		if (c >= NO_FIT) {
+			return NO_FIT;
+		}
+	}
+	return c;
+}
+
+
+/* Variants (r is ignored by factorials) */
+
+static mpz_t *math_factorial(unsigned long n, unsigned long r)
+{
+	return factorial(n);
+}
+
+static mpz_t *gmp_factorial(unsigned long n, unsigned long r)
+{
+	mpz_fac_ui(result, n);
+	return &result;
+}
+
+static mpz_t *table_factorial(unsigned long n, unsigned long r)
+{
+	return &ftable[n];
+}
+
+static mpz_t *native_fact(unsigned long n, unsigned long r)
+{
+	unsigned long long f = native_factorial(n);
+
+	if (f == NO_FIT) {
+		return NULL;
+	}
+	mpz_set_ui(result, f);
+	return &result;
+}
+
+static mpz_t *math_combination(unsigned long n, unsigned long r)
+{
+	return single_combination(n, r);
+}
+
+static mpz_t *gmp_combination(unsigned long n, unsigned long r)
+{
+	mpz_bin_uiui(result, n, r);
+	return &result;
+}
+
+static mpz_t *table_combination(unsigned long n, unsigned long r)
+{
+	mpz_mul(result, ftable[r], ftable[n - r]);
+	mpz_divexact(result, ftable[n], result);
+	return &result;
+}
+
+static mpz_t *native_comb(unsigned long n, unsigned long r)
+{
+	unsigned long long c = native_combination(n, r);
+
+	if (c == NO_FIT) {
+		return NULL;
+	}
+	mpz_set_ui(result, c);
+	return &result;
+}
+
+/** Factorial variants (the first one is the reference) */
+static const variant_t factorials[] = {
+	{ "factorial",      1, math_factorial },
+	{ "mpz_fac_ui",     0, gmp_factorial },
+	{ "table",          0, table_factorial },
+	{ "native",         0, native_fact }
+};
+
+/** Combination variants (the first one is the reference) */
+static const variant_t combinations[] = {
+	{ "single_combination", 1, math_combination },
+	{ "mpz_bin_uiui",       0, gmp_combination },
+	{ "table",              0, table_combination },
+	{ "native",             0, native_comb }
+};
+
+
+/**
+ * \brief Release a result of math.c
+ * \param [in] v Result
+ */
+static void release(mpz_t *v)
+{
+	mpz_clear(*v);
+	free(v);
+}
+
+
+/**
+ * \brief Measure one variant
+ * \param [in] v Variant
+ * \param [in] n
+ * \param [in] r
+ * \param [in] expected Result of math.c
+ * \param [in] csv Write CSV
+ * \param [in] what Function being replaced
+ * \return int 0 if the result is identical (or does not fit), -1 otherwise
+ */
+static int measure(const variant_t *v, unsigned long n, unsigned long r, mpz_t expected, char csv, const char *what)
+{
+	unsigned long calls, i, allocs;
+	double start, elapsed;
+	mpz_t *res;
+	const char *same;
+	int ret = 0;
+
+	/* Check */
+	res = v->fn(n, r);
+	if (res == NULL) {
+		same = "n/a";
+	} else {
+		if (mpz_cmp(*res, expected) == 0) {
+			same = "yes";
+		} else {
+			same = "NO";
+			ret  = -1;
+		}
+		if (v->original) {
+			release(res);
+		}
+	}
+	if (res == NULL) {
+		if (csv) {
+			printf("%s,%s,%lu,%lu,,,%s\n", what, v->name, n, r, same);
+		} else {
+			printf("%-20s %-18s %6lu %6lu %14s %12s %9s\n", what, v->name, n, r, "-", "-", same);
+		}
+		return 0;
+	}
+
+	/* Time */
+	calls   = 0;
+	allocs  = allocations;
+	start   = now();
+	elapsed = 0;
+	do {
+		for (i = 0; i < 16; i++) {
+			res = v->fn(n, r);
+			if (v->original) {
+				release(res);
+			}
+		}
+		calls  += 16;
+		elapsed = now() - start;
+	} while (elapsed < MIN_TIME);
+	allocs = allocations - allocs;
+
+	if (csv) {
+		printf("%s,%s,%lu,%lu,%.1f,%.2f,%s\n", what, v->name, n, r,
+				(elapsed * 1e9) / calls, (double)allocs / calls, same);
+	} else {
+		printf("%-20s %-18s %6lu %6lu %14.1f %12.2f %9s\n", what, v->name, n, r,
+				(elapsed * 1e9) / calls, (double)allocs / calls, same);
+	}
+	return ret;
+}
+
+
+/**
+ * \brief Show program help
+ * \param [in] prgname Program's name
+ */
+static void show_help(const char *prgname)
+{
+	printf("Use: %s [-c]\n", prgname);
+	printf("    -c   Write CSV\n");
+}
+
+
+/**
+ * \brief Main
+ */
+int main(int argc, char *argv[])
+{
+	unsigned long i, k, n, r, rs[2];
+	mpz_t *expected;
+	char csv = 0;
+	int c, failed = 0;
+
+	while ((c = getopt(argc, argv, "hc")) != -1) {
+		switch (c) {
+			case 'c':
+				csv = 1;
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				exit(EXIT_SUCCESS);
+
+			default:
+				show_help(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	mp_set_memory_functions(count_alloc, count_realloc, count_free);
+
+	mpz_init(result);
+	mpz_init_set_ui(ftable[0], 1);
+	for (i = 1; i <= MAX_N; i++) {
+		mpz_init(ftable[i]);
+		mpz_mul_ui(ftable[i], ftable[i - 1], i);
+	}
+
+	if (csv) {
+		printf("function,variant,n,r,ns_per_call,allocs_per_call,identical\n");
+	} else {
+		printf("%-20s %-18s %6s %6s %14s %12s %9s\n", "function", "variant", "n", "r",
+				"ns/call", "allocs/call", "identical");
+	}
+
+	for (i = 0; i < NSIZES; i++) {
+		n = sizes[i];
+		expected = factorial(n);
+		for (k = 0; k < (sizeof(factorials) / sizeof(factorials[0])); k++) {
+			if (measure(&factorials[k], n, 0, *expected, csv, "factorial") < 0) {
+				failed = 1;
+			}
+		}
+		release(expected);
+	}
+
+	for (i = 0; i < NSIZES; i++) {
+		n = sizes[i];
+		/* Pairs of Np (r = 2) and the middle of the Ne sums (r = n/2) */
+		rs[0] = (n < 2) ? n : 2;
+		rs[1] = n / 2;
+		for (k = 0; k < 2; k++) {
+			r = rs[k];
+			if (k == 1 && r == rs[0]) {
+				continue;
+			}
+			expected = single_combination(n, r);
+			for (c = 0; c < (int)(sizeof(combinations) / sizeof(combinations[0])); c++) {
+				if (measure(&combinations[c], n, r, *expected, csv, "single_combination") < 0) {
+					failed = 1;
+				}
+			}
+			release(expected);
+		}
+	}
+
+	for (i = 0; i <= MAX_N; i++) {
+		mpz_clear(ftable[i]);
+	}
+	mpz_clear(result);
+
+	if (failed) {
+		fprintf(stderr, "Some results differ from math.c.\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
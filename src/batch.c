@@ -0,0 +1,593 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "cmatches.h"
+
+/** Experiments held in memory: one being calculated, one queued and one loading */
+#define BATCH_RESIDENT	3
+/** Parser threads of each load (loads overlap the calculation of others) */
+#define BATCH_PARSERS	2
+
+/*
+ * Batch mode (--batch manifest)
+ *
+ * Each line of the manifest is one experiment:
+ *
+ *   input output [indexes]
+ *
+ * input is a directory or a corpus file, output is the results file (the
+ * base name with binary formats) and indexes is a list of index names,
+ * as for --index (default: the ones selected on the command line). Blank lines and lines starting
+ * with '#' are ignored.
+ *
+ * Experiments run on one pool of nthreads workers, largest inputs first.
+ * A worker takes the next row of the oldest experiment being calculated
+ * and, when there is none, loads the next experiment, so loading and
+ * output of one experiment overlap the calculation of others. Rows go
+ * straight into the matrix of the experiment; the worker that completes
+ * an index writes it. Only one experiment is loaded at a time, and only
+ * while fewer than BATCH_RESIDENT are held, so memory does not grow with
+ * the number of workers. All experiments share the element dictionary (names
+ * are interned once), and the workers keep their workspaces from one
+ * experiment to the next.
+ */
+
+/**
+ * One experiment of the manifest
+ */
+typedef struct _experiment {
+	/** input directory or corpus file */
+	char *input;
+	/** output file (base name with binary formats) */
+	char *output;
+	/** indexes to be calculated */
+	char cindex;
+	/** estimated cost (input size in bytes) */
+	unsigned long long cost;
+	/** position in the manifest */
+	unsigned long order;
+} experiment_t;
+
+/**
+ * Experiment being calculated
+ */
+typedef struct _brun {
+	/** experiment */
+	experiment_t *exp;
+	/** total congruency matrix */
+	cmat_t *mat;
+	/** loaded cluster sets */
+	cstore_t *store;
+	/** output stream */
+	FILE *stream;
+	/** index being calculated */
+	char ind;
+	/** congruency function of the index */
+	index_fn_t index;
+	/** next row to be calculated */
+	unsigned long next;
+	/** rows calculated */
+	unsigned long done;
+	/** 0 on success, -1 otherwise */
+	int ret;
+	/** next experiment being calculated (started later) */
+	struct _brun *link;
+} brun_t;
+
+/**
+ * Batch state
+ */
+typedef struct _batch {
+	/** experiments (largest first) */
+	experiment_t *exps;
+	/** number of experiments */
+	unsigned long nexps;
+	/** next experiment to be started */
+	unsigned long next;
+	/** number of experiments that failed */
+	unsigned long failed;
+	/** number of worker threads */
+	unsigned long nworkers;
+	/** shared element dictionary */
+	nameset_t *dict;
+	/** new elements are added to the dictionary */
+	char grow;
+	/** experiments being calculated (oldest first) */
+	brun_t *runs;
+	/** number of experiments in runs */
+	unsigned long nruns;
+	/** an experiment is being loaded */
+	char loading;
+	/** workers loading an experiment or writing an index */
+	unsigned long busy;
+	/** protects the fields above and the rows of the runs */
+	pthread_mutex_t lock;
+	/** signaled when rows become available or an experiment ends */
+	pthread_cond_t cond;
+} batch_t;
+
+
+/**
+ * \brief Estimate the cost of an experiment from the size of its input
+ * \param [in] input Directory or corpus file
+ * \return unsigned long long Input size in bytes
+ */
+static unsigned long long input_cost(const char *input)
+{
+	struct dirent *ep;
+	struct stat st;
+	unsigned long long cost;
+	DIR *dp;
+
+	if (stat(input, &st) < 0) {
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		return st.st_size;
+	}
+
+	cost = 0;
+	if ((dp = opendir(input)) == NULL) {
+		return 0;
+	}
+	while ((ep = readdir(dp))) {
+		if ((ep->d_type == DT_REG || ep->d_type == DT_LNK) &&
+				fstatat(dirfd(dp), ep->d_name, &st, 0) == 0) {
+			cost += st.st_size;
+		}
+	}
+	closedir(dp);
+	return cost;
+}
+
+
+/**
+ * \brief Sort experiments, largest first
+ */
+static int experiment_cmp(const void *a, const void *b)
+{
+	const experiment_t *e1 = a, *e2 = b;
+
+	if (e1->cost != e2->cost) {
+		return (e1->cost > e2->cost) ? -1 : 1;
+	}
+	/* Keep manifest order (qsort is not stable) */
+	return (e1->order < e2->order) ? -1 : (e1->order > e2->order);
+}
+
+
+/**
+ * \brief Free the experiments of a manifest
+ * \param [in] exps Experiments
+ * \param [in] nexps Number of experiments
+ */
+static void free_manifest(experiment_t *exps, unsigned long nexps)
+{
+	unsigned long i;
+
+	for (i = 0; i < nexps; i++) {
+		free(exps[i].input);
+		free(exps[i].output);
+	}
+	free(exps);
+}
+
+
+/**
+ * \brief Read a batch manifest
+ * \param [in] filename Manifest file name
+ * \param [in] cindex Indexes of experiments that do not select them
+ * \param [out] nexps Number of experiments
+ * \return experiment_t* Experiments (in manifest order), NULL on error
+ */
+static experiment_t *read_manifest(const char *filename, char cindex, unsigned long *nexps)
+{
+	experiment_t *exps, *e;
+	char *line, *input, *output, *ind, *saveptr;
+	unsigned long n, cap, lineno;
+	size_t len;
+	FILE *fp;
+
+	if ((fp = fopen(filename, "r")) == NULL) {
+		perror(filename);
+		return NULL;
+	}
+
+	exps   = NULL;
+	line   = NULL;
+	len    = 0;
+	n      = 0;
+	cap    = 0;
+	lineno = 0;
+	while (getline(&line, &len, fp) >= 0) {
+		lineno++;
+		input = strtok_r(line, " \t\r\n", &saveptr);
+		if (input == NULL || input[0] == '#') {
+			continue;
+		}
+		output = strtok_r(NULL, " \t\r\n", &saveptr);
+		ind    = strtok_r(NULL, " \t\r\n", &saveptr);
+		if (output == NULL || strtok_r(NULL, " \t\r\n", &saveptr) != NULL) {
+			fprintf(stderr, "%s:%lu: expected input, output and optional indexes.\n", filename, lineno);
+			goto error;
+		}
+		if (strcmp(input, "-") == 0) {
+			fprintf(stderr, "%s:%lu: standard input cannot be used in a batch.\n", filename, lineno);
+			goto error;
+		}
+
+		if (n == cap) {
+			cap = (cap > 0) ? (cap * 2) : 16;
+			e = realloc(exps, sizeof(experiment_t) * cap);
+			if (e == NULL) {
+				perror("read_manifest");
+				goto error;
+			}
+			exps = e;
+		}
+		e = &exps[n];
+		e->cindex = (ind != NULL) ? parse_indexes(ind) : cindex;
+		if (e->cindex == 0) {
+			fprintf(stderr, "%s:%lu: invalid indexes (expected a list of h, h2, ari, nmi, jaccard, fm).\n",
+					filename, lineno);
+			goto error;
+		}
+		if (show_n != 0 && (e->cindex & INDEX_PARTITION)) {
+			fprintf(stderr, "%s:%lu: -P and -E only apply to h and h2.\n", filename, lineno);
+			goto error;
+		}
+		e->input  = strdup(input);
+		e->output = strdup(output);
+		e->cost   = input_cost(input);
+		e->order  = n;
+		n++;
+		if (e->input == NULL || e->output == NULL) {
+			perror("read_manifest");
+			goto error;
+		}
+	}
+	free(line);
+	fclose(fp);
+
+	*nexps = n;
+	return exps;
+
+error:
+	free(line);
+	fclose(fp);
+	free_manifest(exps, n);
+	return NULL;
+}
+
+
+/**
+ * \brief Calculate one row of an experiment into its matrix
+ * \param [in] run Experiment
+ * \param [in] i Row
+ */
+static void batch_row(brun_t *run, unsigned long i)
+{
+	unsigned long j;
+	double h;
+
+	run->mat->matrix[i][i] = 1.0;
+	for (j = (i+1); j < run->mat->size; j++) {
+		h = run->index(store_get(run->store, i), store_get(run->store, j), show_n, 0);
+		run->mat->matrix[i][j] = h;
+		run->mat->matrix[j][i] = h;
+	}
+}
+
+
+/**
+ * \brief Load the input of an experiment
+ * \param [in] batch Batch state
+ * \param [in] exp Experiment
+ * \param [in] nparsers Number of parser threads (directories)
+ * \param [out] mat Total congruency matrix
+ * \param [out] store Loaded cluster sets
+ * \return int 0 on success, -1 otherwise
+ */
+static int load_experiment(batch_t *batch, experiment_t *exp, unsigned long nparsers,
+		cmat_t **mat, cstore_t **store)
+{
+	unsigned long i, size;
+
+	if (!is_corpus_stream(exp->input)) {
+		*mat = initialize_cmatrix(exp->input, 1);
+		if (*mat == NULL) {
+			return -1;
+		}
+		*store = open_store(exp->input, (*mat)->col_names, (*mat)->size, batch->dict, batch->grow,
+				iothreads, nparsers);
+		if (*store == NULL) {
+			destroy_matrix(*mat);
+			return -1;
+		}
+		return 0;
+	}
+
+	*store = open_stream_store(exp->input, batch->dict, batch->grow);
+	if (*store == NULL) {
+		return -1;
+	}
+	size = store_wait(*store);
+	if ((*store)->error || (*mat = create_matrix(size)) == NULL) {
+		close_store(*store);
+		return -1;
+	}
+	for (i = 0; i < size; i++) {
+		(*mat)->col_names[i] = strdup((*store)->csets[i].path);
+	}
+	zero_matrix(*mat);
+	return 0;
+}
+
+
+/**
+ * \brief Select the next index of an experiment
+ * \param [in] run Experiment
+ * \param [in] ind Index after which to look for (0 for the first one)
+ * \return int 1 if there is one, 0 otherwise
+ * \note Rows of the experiment must not be given to workers meanwhile.
+ */
+static int select_index(brun_t *run, char ind)
+{
+	for (ind = (ind != 0) ? (ind << 1) : INDEX_P2P; ind <= INDEX_FM; ind <<= 1) {
+		if (run->exp->cindex & ind) {
+			run->ind   = ind;
+			run->index = index_function(ind);
+			zero_matrix(run->mat);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Load an experiment and open its output
+ * \param [in] batch Batch state
+ * \param [in] exp Experiment
+ * \return brun_t* Experiment ready to be calculated, NULL on error
+ */
+static brun_t *start_experiment(batch_t *batch, experiment_t *exp)
+{
+	brun_t *run;
+
+	if ((run = calloc(1, sizeof(brun_t))) == NULL) {
+		perror("start_experiment");
+		return NULL;
+	}
+	run->exp = exp;
+	if (load_experiment(batch, exp, BATCH_PARSERS, &run->mat, &run->store) < 0) {
+		fprintf(stderr, "%s: could not read cluster sets.\n", exp->input);
+		free(run);
+		return NULL;
+	}
+
+	/* Binary formats write files named after output and show a summary */
+	if (outfmt > OUTPUT_ROUNDTRIP) {
+		run->stream = stdout;
+	} else if ((run->stream = fopen(exp->output, "w")) == NULL) {
+		perror(exp->output);
+		close_store(run->store);
+		destroy_matrix(run->mat);
+		free(run);
+		return NULL;
+	}
+	select_index(run, 0);
+	return run;
+}
+
+
+/**
+ * \brief Close an experiment
+ * \param [in] run Experiment
+ * \return int 0 on success, -1 otherwise
+ */
+static int end_experiment(brun_t *run)
+{
+	int ret;
+
+	ret = run->ret;
+	if (run->stream != stdout && fclose(run->stream) != 0) {
+		perror(run->exp->output);
+		ret = -1;
+	}
+	close_store(run->store);
+	destroy_matrix(run->mat);
+	free(run);
+	return ret;
+}
+
+
+/**
+ * \brief Write a calculated index and go to the next one, or close the
+ *        experiment when it was the last one
+ * \param [in] batch Batch state (locked)
+ * \param [in] run Experiment (all rows calculated)
+ */
+static void finish_index(batch_t *batch, brun_t *run)
+{
+	brun_t **prev;
+	int more, ret;
+
+	batch->busy++;
+	do {
+		pthread_mutex_unlock(&batch->lock);
+		/* Summaries of concurrent experiments must not mix */
+		flockfile(run->stream);
+		print_index_title(run->ind, run->stream);
+		if (output_results(run->mat, run->ind, outfmt, run->exp->output, run->stream) < 0) {
+			run->ret = -1;
+		}
+		funlockfile(run->stream);
+		more = (run->ret == 0) && select_index(run, run->ind);
+		pthread_mutex_lock(&batch->lock);
+		run->next = 0;
+		run->done = 0;
+	} while (more && run->mat->size == 0);
+
+	if (!more) {
+		for (prev = &batch->runs; *prev != run; prev = &(*prev)->link);
+		*prev = run->link;
+		batch->nruns--;
+		pthread_mutex_unlock(&batch->lock);
+		ret = end_experiment(run);
+		pthread_mutex_lock(&batch->lock);
+		if (ret < 0) {
+			batch->failed++;
+		}
+	}
+	batch->busy--;
+	pthread_cond_broadcast(&batch->cond);
+}
+
+
+/**
+ * \brief Batch worker: calculate rows and start experiments until all
+ *        experiments are done
+ * \param [in] arg Batch state
+ */
+static void *batch_worker(void *arg)
+{
+	batch_t *batch = arg;
+	experiment_t *exp;
+	brun_t *run, **last;
+	unsigned long i;
+
+	pthread_mutex_lock(&batch->lock);
+	for (;;) {
+		/* Rows of the oldest experiment being calculated */
+		for (run = batch->runs; run != NULL && run->next >= run->mat->size; run = run->link);
+		if (run != NULL) {
+			i = run->next++;
+			pthread_mutex_unlock(&batch->lock);
+			batch_row(run, i);
+			pthread_mutex_lock(&batch->lock);
+			if (++run->done == run->mat->size) {
+				finish_index(batch, run);
+			}
+			continue;
+		}
+
+		/* No rows left: start the next experiment, unless one is already
+		 * loading or enough of them are held */
+		if (batch->next < batch->nexps && !batch->loading &&
+				(batch->nruns + 1) <= BATCH_RESIDENT) {
+			exp = &batch->exps[batch->next++];
+			batch->busy++;
+			batch->loading = 1;
+			pthread_mutex_unlock(&batch->lock);
+			run = start_experiment(batch, exp);
+			pthread_mutex_lock(&batch->lock);
+			batch->busy--;
+			batch->loading = 0;
+			if (run == NULL) {
+				batch->failed++;
+			} else {
+				for (last = &batch->runs; *last != NULL; last = &(*last)->link);
+				*last = run;
+				batch->nruns++;
+				if (run->mat->size == 0) {
+					finish_index(batch, run);
+				}
+			}
+			pthread_cond_broadcast(&batch->cond);
+			continue;
+		}
+
+		/* Wait for the rows of the others, or for room to load */
+		if (batch->next >= batch->nexps && batch->runs == NULL && batch->busy == 0) {
+			break;
+		}
+		pthread_cond_wait(&batch->cond, &batch->lock);
+	}
+	pthread_mutex_unlock(&batch->lock);
+	return NULL;
+}
+
+
+/**
+ * \brief Run all experiments of a batch manifest
+ * \param [in] manifest Manifest file name
+ * \param [in] cindex Indexes of experiments that do not select them
+ * \param [in] dict Shared element dictionary
+ * \param [in] grow New elements are added to the dictionary (otherwise,
+ *        elements not in it are dropped)
+ * \param [in] nworkers Number of worker threads
+ * \return int 0 on success, -1 if the manifest could not be read or any
+ *         experiment failed
+ */
+int run_batch(const char *manifest, char cindex, nameset_t *dict, char grow, unsigned long nworkers)
+{
+	batch_t batch;
+	pthread_t *threads;
+	unsigned long i, started;
+
+	memset(&batch, 0, sizeof(batch_t));
+	batch.exps = read_manifest(manifest, cindex, &batch.nexps);
+	if (batch.exps == NULL) {
+		return -1;
+	}
+	qsort(batch.exps, batch.nexps, sizeof(experiment_t), experiment_cmp);
+	batch.nworkers = (nworkers > 0) ? nworkers : 1;
+	batch.dict     = dict;
+	batch.grow     = grow;
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+
+	threads = malloc(sizeof(pthread_t) * batch.nworkers);
+	started = 0;
+	for (i = 0; threads != NULL && i < batch.nworkers; i++) {
+		if (pthread_create(&threads[i], NULL, batch_worker, &batch) != 0) {
+			perror("run_batch");
+			break;
+		}
+		started++;
+	}
+	if (started == 0) {
+		/* Run them here */
+		batch_worker(&batch);
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	pthread_mutex_destroy(&batch.lock);
+	pthread_cond_destroy(&batch.cond);
+	if (batch.failed > 0) {
+		fprintf(stderr, "%lu of %lu experiments failed.\n", batch.failed, batch.nexps);
+	}
+	i = batch.failed;
+	free_manifest(batch.exps, batch.nexps);
+	return (i > 0) ? -1 : 0;
+}
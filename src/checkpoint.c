@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "cmatches.h"
+
+/** Seconds between two checkpoint synchronizations */
+#define CHECKPOINT_INTERVAL 30
+
+
+/**
+ * \brief Hash a memory block (FNV-1a)
+ * \param [in] hash Current hash value
+ * \param [in] data Data
+ * \param [in] len Data length
+ * \return unsigned long New hash value
+ */
+unsigned long fnv1a(unsigned long hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+
+/**
+ * \brief Add name, size and modification time of a file to a fingerprint
+ * \param [in] hash Fingerprint
+ * \param [in] path File path
+ * \param [in] name File name (hashed, so the fingerprint does not depend on
+ *        the directory)
+ * \param [out] result New fingerprint
+ * \return int 0 on success, -1 if the file can not be stat'ed
+ */
+static int add_file(unsigned long hash, const char *path, const char *name, unsigned long *result)
+{
+	struct stat st;
+	unsigned long val;
+
+	if (stat(path, &st) < 0) {
+		perror(path);
+		return -1;
+	}
+	hash = fnv1a(hash, name, strlen(name) + 1);
+	val  = st.st_size;
+	hash = fnv1a(hash, &val, sizeof(val));
+	val  = st.st_mtim.tv_sec;
+	hash = fnv1a(hash, &val, sizeof(val));
+	val  = st.st_mtim.tv_nsec;
+	hash = fnv1a(hash, &val, sizeof(val));
+	*result = hash;
+	return 0;
+}
+
+
+/**
+ * \brief Calculate the fingerprint of the input manifest
+ * \param [in] dirname Directory with clustersets
+ * \param [in] names Clusterset file names
+ * \param [in] size Number of files
+ * \param [out] fingerprint Fingerprint
+ * \return int 0 on success, -1 if a file can not be stat'ed
+ * \note Name, size and modification time of each file are used, so any
+ *       change in the input files changes the fingerprint.
+ */
+int manifest_fingerprint(const char *dirname, char **names, unsigned long size, unsigned long *fingerprint)
+{
+	unsigned long i, hash;
+	char *cfile;
+	int ret;
+
+	hash = FNV_OFFSET;
+	for (i = 0; i < size; i++) {
+		if (asprintf(&cfile, "%s/%s", dirname, names[i]) < 0) {
+			perror("manifest_fingerprint");
+			return -1;
+		}
+		ret = add_file(hash, cfile, names[i], &hash);
+		free(cfile);
+		if (ret < 0) {
+			return -1;
+		}
+	}
+	*fingerprint = hash;
+	return 0;
+}
+
+
+/**
+ * \brief Add one more input file (e.g. the element list) to a fingerprint
+ * \param [in] filename File name (as given, absolute or relative)
+ * \param [in,out] fingerprint Fingerprint
+ * \return int 0 on success, -1 if the file can not be stat'ed
+ */
+int file_fingerprint(const char *filename, unsigned long *fingerprint)
+{
+	return add_file(*fingerprint, filename, filename, fingerprint);
+}
+
+
+/**
+ * \brief Read checkpoint file and check it belongs to this run
+ * \param [in] ck Checkpoint
+ * \param [in] mat Matrix (only file names and size are used)
+ * \param [in] fp Checkpoint file
+ * \param [in] expected Expected header
+ * \return long Offset of the end of the last complete record, -1 on error
+ */
+static long scan_checkpoint(ckpt_t *ck, cmat_t *mat, FILE *fp, partial_t *expected)
+{
+	partial_t hdr;
+	unsigned long i, j, bit;
+	double value;
+	char ind;
+	long offset;
+	int r, q;
+
+	memset(&hdr, 0, sizeof(partial_t));
+	if (read_partial_header(fp, ck->filename, &hdr) < 0) {
+		free_partial_header(&hdr);
+		return -1;
+	}
+	if (hdr.fingerprint != expected->fingerprint || hdr.size != mat->size) {
+		fprintf(stderr, "%s: input files have changed, refusing to resume.\n", ck->filename);
+		free_partial_header(&hdr);
+		return -1;
+	}
+	for (i = 0; i < hdr.size; i++) {
+		if (strcmp(hdr.names[i], mat->col_names[i]) != 0) {
+			fprintf(stderr, "%s: input files have changed, refusing to resume.\n", ck->filename);
+			free_partial_header(&hdr);
+			return -1;
+		}
+	}
+	free_partial_header(&hdr);
+	if (hdr.shard != expected->shard || hdr.nshards != expected->nshards ||
+			hdr.cindex != expected->cindex || hdr.flags != expected->flags) {
+		fprintf(stderr, "%s: checkpoint was created with different options, refusing to resume.\n", ck->filename);
+		return -1;
+	}
+
+	/* Mark completed pairs */
+	offset = ftell(fp);
+	while ((r = read_partial_pair(fp, &ind, &i, &j, &value)) > 0) {
+		q = index_slot(ind);
+		if (q < 0 || ck->done[q] == NULL || i >= j || j >= mat->size) {
+			r = -1;
+			break;
+		}
+		bit = i * mat->size + j;
+		ck->done[q][bit / 8] |= (1 << (bit % 8));
+		ck->ndone++;
+		offset = ftell(fp);
+	}
+	if (r < 0) {
+		fprintf(stderr, "%s: corrupted pair record.\n", ck->filename);
+		return -1;
+	}
+	return offset;
+}
+
+
+/**
+ * \brief Open checkpoint file
+ * \param [in] filename Checkpoint file name
+ * \param [in] mat Matrix (only file names and size are used)
+ * \param [in] shard Shard number
+ * \param [in] nshards Total number of shards
+ * \param [in] cindex Congruency index(es) calculated
+ * \param [in] flags Flags to show Np or Ne
+ * \param [in] fingerprint Input manifest fingerprint
+ * \param [in] resume Resume from an existing checkpoint file
+ * \return ckpt_t* Checkpoint, NULL on error
+ * \note The checkpoint file is a partial result file (see shard.c), so a
+ *       finished checkpoint can also be used with the merge subcommand.
+ */
+ckpt_t *open_checkpoint(const char *filename, cmat_t *mat, unsigned long shard, unsigned long nshards,
+		char cindex, char flags, unsigned long fingerprint, char resume)
+{
+	ckpt_t *ck;
+	partial_t expected;
+	FILE *fp;
+	size_t bsize;
+	int q;
+	long offset;
+
+	ck = calloc(1, sizeof(ckpt_t));
+	if (ck == NULL) {
+		perror("open_checkpoint");
+		return NULL;
+	}
+	ck->filename = filename;
+	ck->size     = mat->size;
+	bsize        = ((mat->size * mat->size) + 7) / 8;
+	for (q = 0; q < NINDEXES; q++) {
+		if (!(cindex & (1 << q))) {
+			continue;
+		}
+		ck->done[q] = calloc(bsize, sizeof(unsigned char));
+		if (ck->done[q] == NULL) {
+			perror("open_checkpoint");
+			close_checkpoint(ck);
+			return NULL;
+		}
+	}
+
+	offset = -1;
+	if (resume && (fp = fopen(filename, "r")) != NULL) {
+		expected.shard       = shard;
+		expected.nshards     = nshards;
+		expected.cindex      = cindex;
+		expected.flags       = flags;
+		expected.fingerprint = fingerprint;
+		offset = scan_checkpoint(ck, mat, fp, &expected);
+		fclose(fp);
+		if (offset < 0) {
+			close_checkpoint(ck);
+			return NULL;
+		}
+		/* Drop an incomplete last record */
+		if (truncate(filename, offset) < 0) {
+			perror(filename);
+			close_checkpoint(ck);
+			return NULL;
+		}
+	}
+
+	if (offset < 0) {
+		/* New checkpoint */
+		if ((ck->fp = fopen(filename, "w")) == NULL) {
+			perror(filename);
+			close_checkpoint(ck);
+			return NULL;
+		}
+		write_partial_header(ck->fp, mat, shard, nshards, cindex, flags, fingerprint);
+	} else {
+		if ((ck->fp = fopen(filename, "a")) == NULL) {
+			perror(filename);
+			close_checkpoint(ck);
+			return NULL;
+		}
+	}
+	sync_checkpoint(ck);
+
+	return ck;
+}
+
+
+/**
+ * \brief Check if a pair was already calculated
+ * \param [in] ck Checkpoint
+ * \param [in] ind Congruency index
+ * \param [in] i Row
+ * \param [in] j Column
+ * \return char 1 if pair is on the checkpoint, 0 otherwise
+ */
+char checkpoint_done(ckpt_t *ck, char ind, unsigned long i, unsigned long j)
+{
+	unsigned long bit = i * ck->size + j;
+
+	return (ck->done[index_slot(ind)][bit / 8] >> (bit % 8)) & 1;
+}
+
+
+/**
+ * \brief Load values of the pairs already calculated into the matrix
+ * \param [in] ck Checkpoint
+ * \param [in] ind Congruency index
+ * \param [out] mat Matrix
+ * \return int 0 on success, -1 otherwise
+ */
+int checkpoint_load(ckpt_t *ck, char ind, cmat_t *mat)
+{
+	FILE *fp;
+	partial_t hdr;
+	unsigned long i, j;
+	double value;
+	char rind;
+
+	if (ck->ndone == 0) {
+		return 0;
+	}
+
+	fflush(ck->fp);
+	if ((fp = fopen(ck->filename, "r")) == NULL) {
+		perror(ck->filename);
+		return -1;
+	}
+	memset(&hdr, 0, sizeof(partial_t));
+	if (read_partial_header(fp, ck->filename, &hdr) < 0) {
+		free_partial_header(&hdr);
+		fclose(fp);
+		return -1;
+	}
+	free_partial_header(&hdr);
+
+	while (read_partial_pair(fp, &rind, &i, &j, &value) > 0) {
+		if (rind == ind && i < j && j < mat->size) {
+			mat->matrix[i][j] = value;
+			mat->matrix[j][i] = value;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+
+/**
+ * \brief Record a calculated pair
+ * \param [in] ck Checkpoint
+ * \param [in] ind Congruency index
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] value Congruency
+ */
+void checkpoint_pair(ckpt_t *ck, char ind, unsigned long i, unsigned long j, double value)
+{
+	write_partial_pair(ck->fp, ind, i, j, value);
+
+	/* Records are buffered and synchronized periodically */
+	if ((time(NULL) - ck->last_sync) >= CHECKPOINT_INTERVAL) {
+		sync_checkpoint(ck);
+	}
+}
+
+
+/**
+ * \brief Write buffered records to disk
+ * \param [in] ck Checkpoint
+ */
+void sync_checkpoint(ckpt_t *ck)
+{
+	fflush(ck->fp);
+	fsync(fileno(ck->fp));
+	ck->last_sync = time(NULL);
+}
+
+
+/**
+ * \brief Close checkpoint file
+ * \param [in] ck Checkpoint
+ */
+void close_checkpoint(ckpt_t *ck)
+{
+	int q;
+
+	if (ck == NULL) return;
+
+	if (ck->fp != NULL) {
+		sync_checkpoint(ck);
+		fclose(ck->fp);
+	}
+	for (q = 0; q < NINDEXES; q++) {
+		free(ck->done[q]);
+	}
+	free(ck);
+}
@@ -25,6 +25,9 @@
 #include <dirent.h>
 #include "cmatches.h"
 
+/** Initial buffer size to read compressed files */
+#define READ_BUFFER (1 << 16)
+
 
 /**
  * \brief Compare two cluster elements
@@ -55,43 +58,95 @@ int cmpstringp(const void *p1, const void *p2)
 
 
 /**
- * \brief Read cluster set file
- * \param [in] filename Cluster set file name
- * \param [out] vsize The number of elements
- * \return elem_t* Vector of elements (name and cluster number) and vector size
+ * \brief Read the contents of a file (decompressed, if it is compressed)
+ * \param [in] filename File name
+ * \param [out] fsize File size
+ * \return char* File contents (NUL terminated), NULL on error
  */
-elem_t *read_clusterset(char *filename, unsigned long *vsize)
+char *read_file(const char *filename, size_t *fsize)
 {
 	FILE *fp;
-	size_t i, k, cnt, fsize;
-	elem_t *elements;
-	char *buffer, *str;
+	char *buffer, *nbuf;
+	long size;
+	size_t len, cap, n;
+	char compressed;
 
-	if ((fp = fopen(filename, "r")) == NULL) {
-		perror("read_clusterset()");
+	if ((fp = open_input(filename, &compressed)) == NULL) {
 		return NULL;
-	} else {
-		/* Read file contents */
-		fseek(fp, 0, SEEK_END);
-		fsize = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
-		buffer = malloc(sizeof(char) * fsize);
-		if (buffer == NULL) {
-			fclose(fp);
-			perror("read_clusterset()");
-			return NULL;
-		} else {
-			if(fread(buffer, sizeof(char), fsize, fp) < fsize) {
-				fclose(fp);
+	}
+
+	if (compressed) {
+		/* Size is unknown: decompress into a growing buffer */
+		len = 0;
+		cap = READ_BUFFER;
+		buffer = malloc(cap + 1);
+		while (buffer != NULL) {
+			n = fread(&buffer[len], sizeof(char), cap - len, fp);
+			len += n;
+			if (len < cap) {
+				if (ferror(fp)) {
+					free(buffer);
+					buffer = NULL;
+				}
+				break;
+			}
+			cap *= 2;
+			nbuf = realloc(buffer, cap + 1);
+			if (nbuf == NULL) {
 				free(buffer);
-				perror("read_clusterset()");
-				return NULL;
-			} else {
-				fclose(fp);
 			}
+			buffer = nbuf;
+		}
+		fclose(fp);
+		if (buffer == NULL) {
+			return NULL;
 		}
+		buffer[len] = '\0';
+		*fsize = len;
+		stats_count(COUNT_BYTES, len);
+		return buffer;
 	}
 
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (size < 0) {
+		fclose(fp);
+		return NULL;
+	}
+
+	buffer = malloc(sizeof(char) * (size + 1));
+	if (buffer == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+	if (fread(buffer, sizeof(char), size, fp) < (size_t)size) {
+		fclose(fp);
+		free(buffer);
+		return NULL;
+	}
+	fclose(fp);
+
+	buffer[size] = '\0';
+	*fsize = size;
+	stats_count(COUNT_BYTES, size);
+	return buffer;
+}
+
+
+/**
+ * \brief Parse cluster set file contents
+ * \param [in] buffer File contents (it is modified)
+ * \param [in] fsize Contents size
+ * \param [out] vsize The number of elements
+ * \return elem_t* Vector of elements (name and cluster number) sorted by cluster
+ */
+elem_t *parse_clusterset(char *buffer, size_t fsize, unsigned long *vsize)
+{
+	size_t i, k, cnt;
+	elem_t *elements;
+	char *str;
+
 	/* Count the number of elements into the file */
 	cnt = 0;
 	for (i = 0; i < fsize; i++) {
@@ -107,8 +162,7 @@ elem_t *read_clusterset(char *filename, unsigned long *vsize)
 	/* Read clusters */
 	elements = malloc(sizeof(elem_t) * cnt);
 	if (elements == NULL) {
-		perror("read_clusterset()");
-		free(buffer);
+		perror("parse_clusterset()");
 		return NULL;
 	}
 
@@ -132,6 +186,7 @@ elem_t *read_clusterset(char *filename, unsigned long *vsize)
 
 		buffer[i] = '\0';
 		elements[k].cluster = atoi(str);
+		elements[k].id = 0;
 
 		k++;
 		i++;
@@ -140,13 +195,35 @@ elem_t *read_clusterset(char *filename, unsigned long *vsize)
 	/* Sort clusters */
 	qsort(elements, k, sizeof(elem_t), elem_cmp);
 
-	/* Return */
-	free(buffer);
 	*vsize = k;
 	return elements;
 }
 
 
+/**
+ * \brief Read cluster set file
+ * \param [in] filename Cluster set file name
+ * \param [out] vsize The number of elements
+ * \return elem_t* Vector of elements (name and cluster number) and vector size
+ */
+elem_t *read_clusterset(char *filename, unsigned long *vsize)
+{
+	elem_t *elements;
+	char *buffer;
+	size_t fsize;
+
+	if ((buffer = read_file(filename, &fsize)) == NULL) {
+		perror("read_clusterset()");
+		return NULL;
+	}
+
+	elements = parse_clusterset(buffer, fsize, vsize);
+
+	free(buffer);
+	return elements;
+}
+
+
 /**
  * \brief Duplicate a clusterset
  * \param [in] cset Clusterset to be duplicated
@@ -168,12 +245,45 @@ elem_t *dup_clusterset(elem_t *cset, unsigned long size)
 	for (i = 0; i < size; i++) {
 		newcs[i].name = strdup(cset[i].name);
 		newcs[i].cluster = cset[i].cluster;
+		newcs[i].id = cset[i].id;
 	}
 
 	return newcs;
 }
 
 
+/**
+ * \brief Set the element ids of a clusterset, dropping the elements that
+ *        are not in the dictionary
+ * \param [in] [out] cset Clusterset
+ * \param [in] size Clusterset size
+ * \param [in] dict Element dictionary
+ * \param [in] grow Add new elements to the dictionary instead of dropping them
+ * \return unsigned long New clusterset size
+ * \note Element order (sorted by cluster) is kept.
+ */
+unsigned long map_clusterset(elem_t *cset, unsigned long size, nameset_t *dict, char grow)
+{
+	unsigned long i, k;
+	int found;
+
+	k = 0;
+	for (i = 0; i < size; i++) {
+		if (grow) {
+			found = (nameset_add(dict, cset[i].name, 0, &cset[i].id) >= 0);
+		} else {
+			found = nameset_find(dict, cset[i].name, &cset[i].id);
+		}
+		if (found) {
+			cset[k++] = cset[i];
+		} else {
+			free(cset[i].name);
+		}
+	}
+	return k;
+}
+
+
 /**
  * \brief Destroy clusterset (release allocated memory)
  * \param [in] [out] cset Clusterset
@@ -304,155 +414,3 @@ void show_clustersets(const char *dirname, FILE *stream)
 	free(filenames);
 	return;
 }
-
-
-/**
- * \brief Read clustersets and create the list of elements
- * \param [in] dirname Directory with clustersets
- * \param [out] filename List file name (if NULL, list file will not be generated)
- * \param [out] size Vector size (returned by the function)
- * \return char** vector with the names and the vector size
- */
-char **gen_elements_list(const char *dirname, const char *filename, unsigned long *size)
-{
-	DIR *dp;
-	struct dirent *ep;
-	unsigned long nfiles, i, j, k;
-	char **filenames, **elements, **enames;
-	char *cfile;
-	elem_t **clustersets;
-	unsigned long *csizes, vsize, esize;
-	FILE *fp = NULL;
-
-	/* Create/Open output list file */
-	if (filename != NULL) {
-		if ((fp = fopen(filename, "w+")) == NULL) {
-			perror("gen_elements_list");
-			return NULL;
-		}
-	}
-
-	/* Count the number of interested files into directory */
-	nfiles = 0;
-	dp = opendir(dirname);
-	if (dp == NULL) {
-		perror("gen_elements_list");
-		if (fp != NULL)
-			fclose(fp);
-		return NULL;
-	}
-	while ((ep = readdir(dp))) {
-		if (ep->d_type == DT_REG || ep->d_type == DT_LNK) {
-			nfiles++;
-		}
-	}
-	closedir(dp);
-
-	/* Fill columns with file names */
-	filenames = malloc(sizeof(char*) * nfiles);
-	if (filenames == NULL) {
-		perror("gen_elements_list");
-		if (fp != NULL)
-			fclose(fp);
-		return NULL;
-	}
-
-	i = 0;
-	dp = opendir(dirname);
-	while ((ep = readdir(dp)) && i < nfiles) {
-		if (ep->d_type == DT_REG || ep->d_type == DT_LNK) {
-			filenames[i] = strdup(ep->d_name);
-			i++;
-		}
-	}
-	closedir(dp);
-
-	clustersets = malloc(sizeof(elem_t*) * nfiles);
-	csizes      = malloc(sizeof(unsigned long) * nfiles);
-	if (clustersets == NULL || csizes == NULL) {
-		perror("gen_elements_list");
-		for (i = 0; i < nfiles; i++) free(filenames[i]);
-		free(filenames);
-		if (fp != NULL)
-			fclose(fp);
-		return NULL;
-	}
-
-	/* Now, read each clusterset */
-	vsize = 0;
-	for (i = 0; i < nfiles; i++) {
-		asprintf(&cfile, "%s/%s", dirname, filenames[i]);
-		
-		clustersets[i] = read_clusterset(cfile, &csizes[i]);
-		vsize += csizes[i];
-		
-		free(cfile);
-		free(filenames[i]);
-	}
-	free(filenames);
-
-	/* Read elements from each clusterset */
-	elements = malloc(sizeof(char*) * vsize);
-	if (elements == NULL) {
-		perror("gen_elements_list");
-		if (fp != NULL)
-			fclose(fp);
-		return NULL;
-	}
-
-	k = 0;
-	for (i = 0; i < nfiles; i++) {
-		for (j = 0; j < csizes[i]; j++) {
-			elements[k] = strdup(clustersets[i][j].name);
-			k++;
-		}
-		free_clusterset(clustersets[i], csizes[i]);
-	}
-
-	/* Sort elements */
-	qsort(elements, vsize, sizeof(char*), cmpstringp);
-
-	/* Remove duplicated entries and write to file (if necessary) */
-	i = 0;
-	esize = vsize;
-	while (i < vsize) {
-		if (fp != NULL)
-			fprintf(fp, "%s\n", elements[i]);
-		for (j = i+1; j < vsize; j++) {
-			if (strcmp(elements[i], elements[j]) != 0) {
-				break;
-			} else {
-				free(elements[j]);
-				elements[j] = NULL;
-				esize--;
-			}
-		}
-		i = j;
-	}
-
-	/* Generate return vector */
-	enames = malloc(sizeof(char*) * esize);
-	if (enames == NULL) {
-		perror("gen_elements_list");
-		if (fp != NULL)
-			fclose(fp);
-		free(csizes);
-	}
-
-	j = 0;
-	for (i = 0; i < vsize; i++) {
-		if (elements[i] != NULL) {
-			enames[j] = strdup(elements[i]);
-			free(elements[i]);
-			j++;
-		}
-	}
-	free(elements);
-
-	if (fp != NULL)
-		fclose(fp);
-	*size = esize;
-	free(csizes);
-	return enames;
-}
-
@@ -22,17 +22,15 @@
 #include <string.h>
 #include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <math.h>
 #include "cmatches.h"
 
-#define FAKE_CLUSTER 9999999
-
 #define DEFAULT_INDEX INDEX_COMP
 #define SHOW_CLUSTERS 1
 #define GENERATE_LIST 1
-#define SHOW_NE       0x01
-#define SHOW_NP       0x02
+#define PROGRESS_INTERVAL 5
 
 /* Program arguments */
 
@@ -52,20 +50,128 @@ char agroup = 0;
 char show_n = 0;
 /** be verbose */
 char verbose = 0;
+/** Use the reference (legacy) kernels */
+char reference = 0;
+/** Output format */
+int outfmt = OUTPUT_TEXT;
+/** Shard to be calculated (0 for all pairs) */
+unsigned long shard = 0;
+/** Total number of shards */
+unsigned long nshards = 0;
+/** Checkpoint file name */
+const char *ckptfile = NULL;
+/** Resume from checkpoint */
+char resume = 0;
+/** Sparse output: minimum congruency (disabled if negative) */
+double minh = -1;
+/** Sparse output: most congruent partners of each file (disabled if 0) */
+unsigned long topk = 0;
+/** Write rows as soon as they are calculated */
+char stream_rows = 0;
+/** Number of worker threads */
+unsigned long nthreads = 1;
+/** Number of threads reading cluster set files */
+unsigned long iothreads = 2;
+/** Run statistics file (JSON), NULL to report on stderr */
+const char *statsfile = NULL;
+/** Report progress */
+char show_progress = 0;
+/** Progress status file, NULL to report on stderr */
+const char *progressfile = NULL;
+/** Seconds between progress updates */
+unsigned long progress_interval = PROGRESS_INTERVAL;
+/** Batch manifest file name */
+const char *batchfile = NULL;
+/** Input files are Newick trees */
+char newick = 0;
+/** Cut levels of the trees (NULL for all) */
+const char *levellist = NULL;
+/** Permutations of each pair (permutation test, disabled if 0) */
+unsigned long npermutations = 0;
+/** Seed of the permutations */
+unsigned long perm_seed = 0;
 
 
 /* Prototypes */
 void show_help(const char *prgname);
+int merge_main(int argc, char *argv[]);
+int serve_main(int argc, char *argv[]);
+int batch_main(void);
+int tree_main(void);
 char **get_enames(const char *filename, unsigned long *size);
-cmat_t *initialize_cmatrix(const char *dirname);
-int calculate_total_congruency(cmat_t *mat, char **names, unsigned long nsize, const char *dirname, char ind, char flags);
-char search_el(char *name, elem_t *clusterset, unsigned long csize);
-double calculate_congruency1(char *file1, char *file2, char **names, unsigned long nsize, char flags);
-double calculate_congruency2(char *file1, char *file2, char **names, unsigned long nsize, char flags);
+nameset_t *create_dictionary(char **enames, unsigned long ecnt, char owned);
+int load_directory(const char *dirname, cmat_t **mat, nameset_t **dict, cstore_t **store, unsigned long *fingerprint);
+int load_corpus_stream(const char *filename, cmat_t **mat, nameset_t **dict, cstore_t **store, unsigned long *fingerprint);
+int calculate_total_congruency(cmat_t *mat, cstore_t *store, char ind, char flags, tile_t *tiles, unsigned long ntiles, FILE *partial);
+int calculate_sparse_congruency(cmat_t *mat, cstore_t *store, char ind, FILE *stream);
+int calculate_stream_congruency(cmat_t *mat, cstore_t *store, char ind, char flags, FILE *stream);
+int calculate_partition_congruency(cmat_t *mat, cstore_t *store, char pindex, cmat_t **pmats);
+int permutation_test(cmat_t *mat, cstore_t *store, char ind);
 
 /* Program standard output */
 FILE *fpout;
 
+/* Checkpoint of the current run */
+ckpt_t *ckpt = NULL;
+
+/**
+ * Calculation of one congruency index
+ */
+typedef struct _job {
+	/** total congruency matrix */
+	cmat_t *mat;
+	/** loaded cluster sets */
+	cstore_t *store;
+	/** congruency index */
+	char ind;
+	/** flags to show Np or Ne */
+	char flags;
+	/** congruency function */
+	index_fn_t index;
+	/** output writer (streaming mode) */
+	writer_t *writer;
+	/** online statistics (streaming mode) */
+	stat_t stat;
+	/** tiles being calculated (shard mode) */
+	tile_t *tiles;
+	/** number of tiles */
+	unsigned long ntiles;
+	/** first tile of the band of the last delivered row */
+	unsigned long tile;
+	/** partial result file (shard mode, NULL if not used) */
+	FILE *partial;
+} job_t;
+
+/**
+ * Calculation of all partition indexes in one pass
+ */
+typedef struct _pjob {
+	/** loaded cluster sets */
+	cstore_t *store;
+	/** matrix of each partition index (NULL if not selected) */
+	cmat_t **mats;
+} pjob_t;
+
+/**
+ * Calculation of the pairs shown by --min-h and --top-k
+ */
+typedef struct _sjob {
+	/** total congruency matrix (only file names and size are used) */
+	cmat_t *mat;
+	/** loaded cluster sets */
+	cstore_t *store;
+	/** congruency index */
+	char ind;
+	/** congruency function */
+	index_fn_t index;
+	/** top-k lists (NULL without --top-k) */
+	topk_t *tk;
+	/** protect the top-k list of each row */
+	pthread_mutex_t *locks;
+	/** output file descriptor */
+	FILE *stream;
+} sjob_t;
+
 /**
  * \brief Main
  */
@@ -74,7 +180,7 @@ int main(int argc, char *argv[])
 	int c, q;
 	int longindex;
 	char ind;
-	const char optstring[] = "hvi:l:o:L:cpgPE";
+	const char optstring[] = "hvi:l:o:L:cpgPEs:C:Rm:k:St:f:I:T::HG::U:rB:x:NK:n:e:";
 	static const struct option longOpts[] = {
 		{ "help",   no_argument, NULL, 'h' },
 		{ "input",  required_argument, NULL, 'i' },
@@ -87,12 +193,44 @@ int main(int argc, char *argv[])
 		{ "ne",       no_argument, NULL, 'E' },
 		{ "createlist", required_argument, NULL, 'L' },
 		{ "verbose" , no_argument, NULL, 'v' },
+		{ "reference", no_argument, NULL, 'r' },
+		{ "shard",    required_argument, NULL, 's' },
+		{ "checkpoint", required_argument, NULL, 'C' },
+		{ "resume",   no_argument, NULL, 'R' },
+		{ "min-h",    required_argument, NULL, 'm' },
+		{ "top-k",    required_argument, NULL, 'k' },
+		{ "stream",   no_argument, NULL, 'S' },
+		{ "threads",  required_argument, NULL, 't' },
+		{ "format",   required_argument, NULL, 'f' },
+		{ "io-threads", required_argument, NULL, 'I' },
+		{ "stats",    optional_argument, NULL, 'T' },
+		{ "perf",     no_argument, NULL, 'H' },
+		{ "progress", optional_argument, NULL, 'G' },
+		{ "progress-interval", required_argument, NULL, 'U' },
+		{ "batch",    required_argument, NULL, 'B' },
+		{ "index",    required_argument, NULL, 'x' },
+		{ "newick",   no_argument, NULL, 'N' },
+		{ "levels",   required_argument, NULL, 'K' },
+		{ "permutations", required_argument, NULL, 'n' },
+		{ "seed",     required_argument, NULL, 'e' },
 		{ NULL,       no_argument, NULL, 0 }
 	};
 	cmat_t *mat;
-	char **enames;
-	unsigned long ecnt, i, j, n;
-	double c_mean, sd, sumsqr, dev, va;
+	cstore_t *store;
+	nameset_t *dict;
+	unsigned long ntiles, fingerprint, npairs;
+	char stream_input, pdone;
+	int ret, status = EXIT_SUCCESS;
+	tile_t *tiles;
+	cmat_t *pmats[NPARTITION] = { NULL, NULL, NULL, NULL };
+
+	/* Subcommands */
+	if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+		return merge_main(argc - 1, &argv[1]);
+	}
+	if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+		return serve_main(argc - 1, &argv[1]);
+	}
 
 	/* Parse arguments */
 	while((c = getopt_long(argc, argv, optstring, longOpts, &longindex)) != -1) {
@@ -142,17 +280,132 @@ int main(int argc, char *argv[])
 				verbose = 1;
 				break;
 
+			case 'r':
+				reference = 1;
+				break;
+
+			case 's':
+				if (parse_shard(optarg, &shard, &nshards) < 0) {
+					fprintf(stderr, "Invalid shard: %s (expected k/K, 1 <= k <= K).\n", optarg);
+					show_help(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 'C':
+				ckptfile = optarg;
+				break;
+
+			case 'R':
+				resume = 1;
+				break;
+
+			case 'm':
+				minh = atof(optarg);
+				break;
+
+			case 'k':
+				topk = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'S':
+				stream_rows = 1;
+				break;
+
+			case 'f':
+				if ((outfmt = parse_output_format(optarg)) < 0) {
+					fprintf(stderr, "Invalid output format: %s\n", optarg);
+					show_help(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+
+			case 't':
+				nthreads = strtoul(optarg, NULL, 10);
+				if (nthreads < 1) {
+					nthreads = 1;
+				}
+				break;
+
+			case 'I':
+				iothreads = strtoul(optarg, NULL, 10);
+				if (iothreads < 1) {
+					iothreads = 1;
+				}
+				break;
+
+			case 'T':
+				collect_stats = 1;
+				statsfile = optarg;
+				break;
+
+			case 'H':
+				collect_stats = 1;
+				hw_counters = 1;
+				break;
+
+			case 'G':
+				show_progress = 1;
+				progressfile = optarg;
+				break;
+
+			case 'U':
+				progress_interval = strtoul(optarg, NULL, 10);
+				if (progress_interval < 1) {
+					progress_interval = 1;
+				}
+				break;
+
+			case 'B':
+				batchfile = optarg;
+				break;
+
+			case 'x':
+				if ((ind = parse_indexes(optarg)) == 0) {
+					fprintf(stderr, "Invalid index list: %s (expected names of h, h2, ari, nmi, jaccard, fm).\n", optarg);
+					show_help(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				cindex |= ind;
+				break;
+
+			case 'N':
+				newick = 1;
+				break;
+
+			case 'K':
+				levellist = optarg;
+				break;
+
+			case 'n':
+				npermutations = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'e':
+				perm_seed = strtoul(optarg, NULL, 0);
+				break;
+
 			default:
 				break;
 		}
 	}
 
+	if (batchfile != NULL) {
+		return batch_main();
+	}
+
 	/* Validate arguments */
 	if (inpdir == NULL) {
 		fprintf(stderr, "Input directory should be provided.\n");
 		show_help(argv[0]);
 		exit(EXIT_FAILURE);
 	}
+	stream_input = is_corpus_stream(inpdir);
+	if (stream_input && agroup == SHOW_CLUSTERS) {
+		fprintf(stderr, "-g needs an input directory.\n");
+		show_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
 	if (listfile != NULL && newlist != NULL) {
 		fprintf(stderr, "Both -l and -L cannot be used at the same time.\n");
 		show_help(argv[0]);
@@ -162,7 +415,7 @@ int main(int argc, char *argv[])
 		cindex = DEFAULT_INDEX;
 	} else {
 		if (agroup == SHOW_CLUSTERS) {
-			fprintf(stderr, "-g cannot be used with -c and/or -p at the same time.\n");
+			fprintf(stderr, "-g cannot be used with -c, -p or --index at the same time.\n");
 			show_help(argv[0]);
 			exit(EXIT_FAILURE);
 		}
@@ -172,10 +425,83 @@ int main(int argc, char *argv[])
 		show_help(argv[0]);
 		exit(EXIT_FAILURE);
 	}
+	if (show_n != 0 && (cindex & INDEX_PARTITION)) {
+		fprintf(stderr, "-P and -E only apply to h and h2.\n");
+		show_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (resume && ckptfile == NULL) {
+		fprintf(stderr, "--resume needs a checkpoint file (--checkpoint).\n");
+		show_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if ((minh >= 0 || topk > 0) && (show_n != 0 || nshards > 0 || ckptfile != NULL)) {
+		fprintf(stderr, "--min-h and --top-k cannot be used with -P, -E, --shard or --checkpoint.\n");
+		show_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (stream_rows && (minh >= 0 || topk > 0 || nshards > 0 || ckptfile != NULL)) {
+		fprintf(stderr, "--stream cannot be used with --min-h, --top-k, --shard or --checkpoint.\n");
+		show_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (outfmt > OUTPUT_ROUNDTRIP) {
+		if (outfile == NULL) {
+			fprintf(stderr, "Binary formats need an output file base name (-o).\n");
+			show_help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (stream_rows || minh >= 0 || topk > 0 || nshards > 0) {
+			fprintf(stderr, "Binary formats cannot be used with --stream, --min-h, --top-k or --shard.\n");
+			show_help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (levellist != NULL && !newick) {
+		fprintf(stderr, "--levels only applies to trees (--newick).\n");
+		show_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (newick) {
+		if (stream_input || agroup == SHOW_CLUSTERS || newlist != NULL) {
+			fprintf(stderr, "--newick needs an input directory of trees (no corpus file, -g or -L).\n");
+			show_help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if ((cindex & INDEX_PARTITION) || nshards > 0 || ckptfile != NULL || minh >= 0 || topk > 0 || stream_rows) {
+			fprintf(stderr, "--newick only calculates h and h2, and cannot be used with --shard,\n"
+					"--checkpoint, --min-h, --top-k or --stream.\n");
+			show_help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (npermutations > 0) {
+		if ((cindex & INDEX_PARTITION) || show_n != 0 || reference) {
+			fprintf(stderr, "--permutations only applies to h and h2 (no -P, -E or --reference).\n");
+			show_help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (newick || nshards > 0 || ckptfile != NULL || minh >= 0 || topk > 0 || stream_rows) {
+			fprintf(stderr, "--permutations cannot be used with --newick, --shard, --checkpoint,\n"
+					"--min-h, --top-k or --stream.\n");
+			show_help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (verbose) {
+		/* Keep verbose information in order */
+		nthreads = 1;
+	}
+	if (nshards > 0 && (verbose || agroup == SHOW_CLUSTERS)) {
+		fprintf(stderr, "--shard cannot be used with -v or -g.\n");
+		show_help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
 
 	
 	/* Check output */
-	if (outfile == NULL) {
+	if (outfile == NULL || outfmt > OUTPUT_ROUNDTRIP) {
+		/* Binary formats use outfile as base name, results are shown on stdout */
 		fpout = stdout;
 	} else {
 		if ((fpout = fopen(outfile, "w")) == NULL) {
@@ -187,132 +513,818 @@ int main(int argc, char *argv[])
 	if (agroup == SHOW_CLUSTERS) {
 		/* Show clusters of each clusterset */
 		show_clustersets(inpdir, fpout);
+	} else if (newick) {
+		/* Trees at each cut level */
+		if (tree_main() != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	} else {
+		if (stream_input) {
+			ret = load_corpus_stream(inpdir, &mat, &dict, &store, &fingerprint);
+		} else {
+			ret = load_directory(inpdir, &mat, &dict, &store, &fingerprint);
+		}
+		if (ret < 0) {
+			return EXIT_FAILURE;
+		}
+		/* Results also depend on the element list */
+		if (listfile != NULL && file_fingerprint(listfile, &fingerprint) < 0) {
+			close_store(store);
+			destroy_nameset(dict);
+			destroy_matrix(mat);
+			return EXIT_FAILURE;
+		}
+
+		/* Partial results: just write the pairs of our tiles */
+		tiles  = NULL;
+		ntiles = 0;
+		if (nshards > 0) {
+			ntiles = gen_tiles(mat->size, shard, nshards, &tiles);
+			write_partial_header(fpout, mat, shard, nshards, cindex, show_n, fingerprint);
+		}
+
+		if (ckptfile != NULL) {
+			ckpt = open_checkpoint(ckptfile, mat, (nshards > 0) ? shard : 1, (nshards > 0) ? nshards : 1,
+					cindex, show_n, fingerprint, resume);
+			if (ckpt == NULL) {
+				fprintf(stderr, "Could not open checkpoint file.\n");
+				close_store(store);
+				destroy_nameset(dict);
+				destroy_matrix(mat);
+				return EXIT_FAILURE;
+			}
+			if (resume) {
+				print_info("Resuming from %s: %lu pairs already calculated\n", ckptfile, ckpt->ndone);
+			}
+		}
+
+		if (show_progress) {
+			npairs = (nshards > 0) ? count_tile_pairs(tiles, ntiles) : ((mat->size * (mat->size - 1)) / 2);
+			npairs *= __builtin_popcount(cindex);
+			progress_start(npairs, progressfile, progress_interval);
+		}
+
+		pdone = 0;
+		for (q = 0; q < NINDEXES; q++) {
+			ind = (1 << q);
+			if (!(cindex & ind)) {
+				continue;
+			}
+			zero_matrix(mat);
+
+			if (ckpt != NULL) {
+				checkpoint_load(ckpt, ind, mat);
+			}
+			stats_phase(PHASE_PAIRS);
+
+			if (stream_rows) {
+				print_index_title(ind, fpout);
+
+				/* Streaming output */
+				calculate_stream_congruency(mat, store, ind, show_n, fpout);
+			} else if (minh >= 0 || topk > 0) {
+				print_index_title(ind, fpout);
+
+				/* Sparse output */
+				if (calculate_sparse_congruency(mat, store, ind, fpout) < 0) {
+					status = EXIT_FAILURE;
+					break;
+				}
+				fprintf(fpout, "\n");
+			} else if (nshards > 0) {
+				if (calculate_total_congruency(mat, store, ind, show_n, tiles, ntiles, fpout) < 0) {
+					status = EXIT_FAILURE;
+					break;
+				}
+			} else if (npermutations > 0) {
+				/* Index, p-values and z-scores */
+				if (permutation_test(mat, store, ind) < 0) {
+					status = EXIT_FAILURE;
+					break;
+				}
+			} else if ((ind & INDEX_PARTITION) && ckpt == NULL) {
+				/* All partition indexes in one pass, the first one on mat */
+				if (!pdone) {
+					if (calculate_partition_congruency(mat, store, cindex & INDEX_PARTITION, pmats) < 0) {
+						status = EXIT_FAILURE;
+						break;
+					}
+					pdone = 1;
+				}
+				print_index_title(ind, fpout);
+				stats_phase(PHASE_OUTPUT);
+				if (output_results(pmats[q - index_slot(INDEX_ARI)], ind, outfmt, outfile, fpout) < 0) {
+					status = EXIT_FAILURE;
+				}
+			} else {
+				print_index_title(ind, fpout);
+
+				/* Calculate congruences */
+				calculate_total_congruency(mat, store, ind, show_n, NULL, 0, NULL);
+
+				/* Print results */
+				stats_phase(PHASE_OUTPUT);
+				if (output_results(mat, ind, outfmt, outfile, fpout) < 0) {
+					status = EXIT_FAILURE;
+				}
+			}
+		}
+		for (q = 0; q < NPARTITION; q++) {
+			if (pmats[q] != mat) {
+				destroy_matrix(pmats[q]);
+			}
+		}
+
+		if (show_progress) {
+			progress_stop();
+		}
+		free(tiles);
+		close_checkpoint(ckpt);
+		close_store(store);
+		destroy_nameset(dict);
+		destroy_matrix(mat);
+		release_workspace();
+
+		if (collect_stats) {
+			stats_report(statsfile);
+		}
+	}
+
+	if (fpout != stdout) {
+		fclose(fpout);
+	}
+
+	return status;
+}
+
+/**
+ * \brief Show program help
+ * \param [in] prgname Program's name
+ */
+void show_help(const char *prgname)
+{
+	printf("Use: %s [options]\n", prgname);
+	printf("Options:\n");
+	printf("    -h | --help        Show this help and exit\n");
+	printf("    -i | --input       Input directory, or corpus file with many cluster sets\n");
+	printf("                       (\"-\" reads the corpus from standard input)\n");
+	printf("    -l | --list        Input list file (only listed elements are used)\n");
+	printf("    -c | --complete    Calculate complete congruency\n");
+	printf("    -p | --pair        Calculate pair-to-pair congruency\n");
+	printf("    -x | --index LIST  Calculate the indexes of LIST: h, h2, ari (adjusted Rand),\n");
+	printf("                       nmi (normalized mutual information), jaccard, fm\n");
+	printf("                       (Fowlkes-Mallows), e.g. h,h2,ari; one matrix per index\n");
+	printf("    -g | --group       Just show clusterset clusters (groups)\n");
+	printf("    -P | --np          Show congruency matrix with Np\n");
+	printf("    -E | --ne          Show congruency matrix with Ne\n");
+	printf("    -L | --createlist  Create elements list from clustersets\n");
+	printf("    -o | --output      Write results to output file\n");
+	printf("    -f | --format FMT  Output format: text (default), roundtrip (shortest exact\n");
+	printf("                       text), raw64, raw32 (little endian with header), npy, npy32\n");
+	printf("                       Binary formats write <output>-<index> (e.g. <output>-h2) and\n");
+	printf("                       <output>.names\n");
+	printf("    -s | --shard k/K   Calculate only shard k of K and write a partial result file\n");
+	printf("    -C | --checkpoint  Save calculated pairs periodically to checkpoint file\n");
+	printf("    -R | --resume      Resume from checkpoint file, skipping pairs already calculated\n");
+	printf("    -m | --min-h X     Show only pairs with congruency >= X (edge list)\n");
+	printf("    -k | --top-k K     Show only the K most congruent partners of each file (edge list)\n");
+	printf("    -S | --stream      Write each row (upper triangle) as soon as it is calculated\n");
+	printf("    -t | --threads N   Use N worker threads\n");
+	printf("                       (with less pairs than threads, big pairs are split among them)\n");
+	printf("    -I | --io-threads N  Use N threads to read cluster set files (default: 2)\n");
+	printf("    -T | --stats[=FILE]  Report time of each phase and counters on stderr, or\n");
+	printf("                       as JSON to FILE\n");
+	printf("    -H | --perf        Add hardware events (cycles, instructions, cache and branch\n");
+	printf("                       misses) to the statistics, when available\n");
+	printf("    -G | --progress[=FILE]  Report pairs done, pairs/s, ETA and memory periodically\n");
+	printf("                       on stderr, or as JSON to status FILE\n");
+	printf("    -U | --progress-interval S  Seconds between progress updates (default: 5)\n");
+	printf("    -B | --batch FILE  Run the experiments listed in FILE in one process, one per\n");
+	printf("                       line: input output [index list] (default: -c/-p/-x)\n");
+	printf("    -N | --newick      Input files are trees in Newick format: calculate h and/or h2\n");
+	printf("                       between the trees cut at each number of clusters, one\n");
+	printf("                       matrix per index and level (binary formats write\n");
+	printf("                       <output>-k<clusters>-<index>)\n");
+	printf("    -K | --levels LIST Cut the trees only at these numbers of clusters, e.g.\n");
+	printf("                       2,4,10-20 (default: all)\n");
+	printf("    -n | --permutations K  Permutation test of h/h2: relabel the common elements\n");
+	printf("                       of each pair K times and show p-value and z-score\n");
+	printf("                       matrices after each index (binary formats write\n");
+	printf("                       <output>-pvalue-<index> and <output>-zscore-<index>)\n");
+	printf("    -e | --seed S      Seed of the permutations (default: 0)\n");
+	printf("    -r | --reference   Use the reference (original) kernels, to check or time\n");
+	printf("                       the fast ones\n");
+	printf("    -v | --verbose     Be verbose\n");
+	printf("\n");
+	printf("Use: %s merge [-o output] [-f format] partial_file...\n", prgname);
+	printf("    Merge partial result files (see --shard) and show final results\n");
+	printf("\n");
+	printf("Use: %s serve -i input [-l list] [-t threads] [-I io-threads] socket\n", prgname);
+	printf("    Keep the input loaded and answer pair, row and query requests on the\n");
+	printf("    Unix domain socket (see serve.c for the protocol) until SIGINT/SIGTERM\n");
+}
+
+
+/**
+ * \brief Merge subcommand
+ * \param [in] argc Number of arguments
+ * \param [in] argv Arguments (argv[0] is "merge")
+ * \return int Exit status
+ */
+int merge_main(int argc, char *argv[])
+{
+	int c, ret;
+	const char optstring[] = "ho:f:";
+	static const struct option longOpts[] = {
+		{ "help",   no_argument, NULL, 'h' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "format", required_argument, NULL, 'f' },
+		{ NULL,     no_argument, NULL, 0 }
+	};
+	FILE *stream;
+
+	while((c = getopt_long(argc, argv, optstring, longOpts, NULL)) != -1) {
+		switch(c) {
+			case 'h':
+				show_help("matches");
+				exit(EXIT_SUCCESS);
+				break;
+
+			case 'o':
+				outfile = optarg;
+				break;
+
+			case 'f':
+				if ((outfmt = parse_output_format(optarg)) < 0) {
+					fprintf(stderr, "Invalid output format: %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	if (outfmt > OUTPUT_ROUNDTRIP && outfile == NULL) {
+		fprintf(stderr, "Binary formats need an output file base name (-o).\n");
+		return EXIT_FAILURE;
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Partial result files should be provided.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (outfile == NULL || outfmt > OUTPUT_ROUNDTRIP) {
+		stream = stdout;
+	} else {
+		if ((stream = fopen(outfile, "w")) == NULL) {
+			fprintf(stderr, "Could not open/create output file. Using standard output.\n");
+			stream = stdout;
+		}
+	}
+
+	ret = merge_partials(argc - optind, &argv[optind], outfile, stream);
+
+	if (stream != stdout) {
+		fclose(stream);
+	}
+
+	return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/**
+ * \brief Serve subcommand
+ * \param [in] argc Number of arguments
+ * \param [in] argv Arguments (argv[0] is "serve")
+ * \return int Exit status
+ */
+int serve_main(int argc, char *argv[])
+{
+	int c, ret;
+	const char optstring[] = "hi:l:t:I:";
+	static const struct option longOpts[] = {
+		{ "help",   no_argument, NULL, 'h' },
+		{ "input",  required_argument, NULL, 'i' },
+		{ "list",   required_argument, NULL, 'l' },
+		{ "threads",  required_argument, NULL, 't' },
+		{ "io-threads", required_argument, NULL, 'I' },
+		{ NULL,     no_argument, NULL, 0 }
+	};
+	cmat_t *mat;
+	cstore_t *store;
+	nameset_t *dict;
+	unsigned long fingerprint, i;
+
+	while((c = getopt_long(argc, argv, optstring, longOpts, NULL)) != -1) {
+		switch(c) {
+			case 'h':
+				show_help("matches");
+				exit(EXIT_SUCCESS);
+				break;
+
+			case 'i':
+				inpdir = optarg;
+				break;
+
+			case 'l':
+				listfile = optarg;
+				break;
+
+			case 't':
+				nthreads = strtoul(optarg, NULL, 10);
+				if (nthreads < 1) {
+					nthreads = 1;
+				}
+				break;
+
+			case 'I':
+				iothreads = strtoul(optarg, NULL, 10);
+				if (iothreads < 1) {
+					iothreads = 1;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	if (inpdir == NULL || strcmp(inpdir, "-") == 0) {
+		fprintf(stderr, "Input directory or corpus file should be provided.\n");
+		return EXIT_FAILURE;
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Socket path should be provided.\n");
+		return EXIT_FAILURE;
+	}
+	fpout = stdout;
+
+	/* Only file names are needed: results are sent to the clients */
+	stream_rows = 1;
+	if (is_corpus_stream(inpdir)) {
+		ret = load_corpus_stream(inpdir, &mat, &dict, &store, &fingerprint);
+	} else {
+		ret = load_directory(inpdir, &mat, &dict, &store, &fingerprint);
+	}
+	if (ret < 0) {
+		return EXIT_FAILURE;
+	}
+
+	/* Everything is loaded before the first request, and every request
+	 * may need any cluster set: do not serve a partial corpus */
+	ret = 0;
+	for (i = 0; i < mat->size; i++) {
+		if (store_get(store, i) == NULL) {
+			fprintf(stderr, "Could not read cluster set: %s\n", mat->col_names[i]);
+			ret = -1;
+		}
+	}
+
+	if (ret == 0) {
+		ret = serve(store, mat->col_names, mat->size, dict, argv[optind], nthreads);
+	}
+
+	close_store(store);
+	destroy_nameset(dict);
+	destroy_matrix(mat);
+	release_workspace();
+
+	return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/**
+ * \brief Batch mode (--batch)
+ * \return int Exit status
+ */
+int batch_main(void)
+{
+	char **enames;
+	unsigned long ecnt;
+	nameset_t *dict;
+	int ret;
+
+	if (inpdir != NULL || outfile != NULL || newlist != NULL || agroup == SHOW_CLUSTERS) {
+		fprintf(stderr, "--batch takes inputs and outputs from the manifest (no -i, -o, -L or -g).\n");
+		return EXIT_FAILURE;
+	}
+	if (verbose || nshards > 0 || ckptfile != NULL || minh >= 0 || topk > 0 || stream_rows ||
+			collect_stats || show_progress || npermutations > 0 || newick) {
+		fprintf(stderr, "--batch cannot be used with -v, --shard, --checkpoint, --min-h, --top-k,\n"
+				"--stream, --stats, --perf, --progress, --permutations or --newick.\n");
+		return EXIT_FAILURE;
+	}
+	if ((show_n & SHOW_NP) && (show_n & SHOW_NE)) {
+		fprintf(stderr, "Both -P and -E cannot be used at the same time.\n");
+		return EXIT_FAILURE;
+	}
+	if (show_n != 0 && (cindex & INDEX_PARTITION)) {
+		fprintf(stderr, "-P and -E only apply to h and h2.\n");
+		return EXIT_FAILURE;
+	}
+	fpout = stdout;
+
+	/* One dictionary for all experiments */
+	if (listfile != NULL) {
+		enames = get_enames(listfile, &ecnt);
+		if (enames == NULL) {
+			fprintf(stderr, "Could not get elements names.\n");
+			return EXIT_FAILURE;
+		}
+		dict = create_dictionary(enames, ecnt, 0);
+		if (ecnt > 0) {
+			free(enames[0]);
+		}
+		free(enames);
 	} else {
-		/* Initialize total congruency matrix */
-		mat = initialize_cmatrix(inpdir);
-		if (mat == NULL) {
-			fprintf(stderr, "Could not read cluster set files.\n");
+		dict = create_nameset();
+	}
+	if (dict == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	ret = run_batch(batchfile, (cindex != 0) ? cindex : DEFAULT_INDEX, dict, (listfile == NULL), nthreads);
+
+	destroy_nameset(dict);
+	release_workspace();
+	return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/**
+ * \brief Trees mode (--newick): congruency between trees at each cut level
+ * \return int Exit status
+ */
+int tree_main(void)
+{
+	cmat_t *names, **mats;
+	nameset_t *dict;
+	tree_t *trees;
+	char **enames, *path, *base;
+	unsigned long ecnt, ntrees, i, l, x, *levels, nlevels, maxleaves, npairs;
+	int ret;
+
+	/* Trees and element dictionary */
+	stats_phase(PHASE_SCAN);
+	if ((names = initialize_cmatrix(inpdir, 0)) == NULL) {
+		fprintf(stderr, "Could not read tree files.\n");
+		return EXIT_FAILURE;
+	}
+	ntrees = names->size;
+
+	stats_phase(PHASE_ELEMENTS);
+	if (listfile != NULL) {
+		enames = get_enames(listfile, &ecnt);
+		if (enames == NULL) {
+			fprintf(stderr, "Could not get elements names.\n");
+			destroy_matrix(names);
 			return EXIT_FAILURE;
 		}
+		dict = create_dictionary(enames, ecnt, 0);
+		if (ecnt > 0) {
+			free(enames[0]);
+		}
+		free(enames);
+	} else {
+		dict = create_nameset();
+	}
+	if (dict == NULL) {
+		destroy_matrix(names);
+		return EXIT_FAILURE;
+	}
+
+	stats_phase(PHASE_LOAD);
+	ret    = 0;
+	trees  = calloc(ntrees + 1, sizeof(tree_t));
+	levels = NULL;
+	mats   = NULL;
+	maxleaves = 0;
+	for (i = 0; trees != NULL && i < ntrees && ret == 0; i++) {
+		print_info("Reading tree: %s\n", names->col_names[i]);
+		if (asprintf(&path, "%s/%s", inpdir, names->col_names[i]) < 0) {
+			perror("tree_main");
+			ret = -1;
+			break;
+		}
+		ret = read_tree(path, dict, (listfile == NULL), &trees[i]);
+		free(path);
+		if (trees[i].nleaves > maxleaves) {
+			maxleaves = trees[i].nleaves;
+		}
+	}
+	if (trees == NULL || ret < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	/* Cut levels (all of them by default) */
+	if (levellist != NULL) {
+		levels = parse_levels(levellist, &nlevels);
+		if (levels == NULL) {
+			fprintf(stderr, "Invalid levels: %s (expected numbers of clusters, e.g. 2,4,10-20).\n", levellist);
+			ret = -1;
+			goto out;
+		}
+	} else {
+		nlevels = (maxleaves > 0) ? maxleaves : 1;
+		if ((levels = malloc(sizeof(unsigned long) * nlevels)) == NULL) {
+			perror("tree_main");
+			ret = -1;
+			goto out;
+		}
+		for (l = 0; l < nlevels; l++) {
+			levels[l] = l + 1;
+		}
+	}
+
+	/* Matrices of h, then h2, of each level */
+	if ((mats = calloc(2 * nlevels, sizeof(cmat_t *))) == NULL) {
+		perror("tree_main");
+		ret = -1;
+		goto out;
+	}
+	for (x = 0; x < 2; x++) {
+		if (!(cindex & (INDEX_P2P << x))) {
+			continue;
+		}
+		for (l = 0; l < nlevels; l++) {
+			if ((mats[x * nlevels + l] = create_matrix(ntrees)) == NULL) {
+				perror("tree_main");
+				ret = -1;
+				goto out;
+			}
+			/* Names are shared (destroy_matrix() does not free them) */
+			memcpy(mats[x * nlevels + l]->col_names, names->col_names, sizeof(char *) * ntrees);
+			zero_matrix(mats[x * nlevels + l]);
+		}
+	}
+
+	if (show_progress) {
+		npairs = ((ntrees * (ntrees - 1)) / 2) * nlevels * __builtin_popcount(cindex);
+		progress_start(npairs, progressfile, progress_interval);
+	}
+	stats_phase(PHASE_PAIRS);
+	ret = calculate_tree_congruency(trees, ntrees, cindex, show_n, levels, nlevels, mats, nthreads);
+	if (show_progress) {
+		progress_stop();
+	}
+
+	/* Print results: each index, each level */
+	stats_phase(PHASE_OUTPUT);
+	for (x = 0; x < 2 && ret == 0; x++) {
+		if (!(cindex & (INDEX_P2P << x))) {
+			continue;
+		}
+		for (l = 0; l < nlevels && ret == 0; l++) {
+			print_index_title(INDEX_P2P << x, fpout);
+			fprintf(fpout, "Cut at %lu clusters\n", levels[l]);
+			base = NULL;
+			if (outfmt > OUTPUT_ROUNDTRIP &&
+					asprintf(&base, "%s-k%lu", outfile, levels[l]) < 0) {
+				perror("tree_main");
+				ret = -1;
+				break;
+			}
+			ret = output_results(mats[x * nlevels + l], INDEX_P2P << x, outfmt, base, fpout);
+			free(base);
+		}
+	}
+
+out:
+	if (mats != NULL) {
+		for (l = 0; l < (2 * nlevels); l++) {
+			destroy_matrix(mats[l]);
+		}
+		free(mats);
+	}
+	for (i = 0; trees != NULL && i < ntrees; i++) {
+		free_tree(&trees[i]);
+	}
+	free(trees);
+	free(levels);
+	destroy_nameset(dict);
+	for (i = 0; i < ntrees; i++) {
+		free(names->col_names[i]);
+	}
+	destroy_matrix(names);
+	release_workspace();
+
+	if (collect_stats) {
+		stats_report(statsfile);
+	}
+	return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/**
+ * \brief Check if the input is a corpus stream (a file with many cluster
+ *        sets, or standard input) instead of a directory
+ * \param [in] input Input name (-i)
+ * \return char 1 if input is a corpus stream
+ */
+char is_corpus_stream(const char *input)
+{
+	struct stat st;
+
+	if (strcmp(input, "-") == 0) {
+		return 1;
+	}
+	return (stat(input, &st) == 0 && !S_ISDIR(st.st_mode));
+}
+
+
+/**
+ * \brief Create the element dictionary from a list of names
+ * \param [in] enames Elements names
+ * \param [in] ecnt Number of elements
+ * \param [in] owned Names were allocated one by one (the dictionary keeps them)
+ * \return nameset_t* Dictionary, NULL on error
+ */
+nameset_t *create_dictionary(char **enames, unsigned long ecnt, char owned)
+{
+	nameset_t *dict;
+	unsigned long i;
+
+	dict = create_nameset();
+	for (i = 0; dict != NULL && i < ecnt; i++) {
+		if (nameset_add(dict, enames[i], owned, NULL) < 0) {
+			destroy_nameset(dict);
+			dict = NULL;
+		}
+	}
+	if (dict == NULL) {
+		fprintf(stderr, "Could not create elements dictionary.\n");
+	}
+	return dict;
+}
+
+
+/**
+ * \brief Prepare the calculation for a directory of cluster set files
+ * \param [in] dirname Path to cluster set files
+ * \param [out] mat Total congruency matrix
+ * \param [out] dict Element dictionary
+ * \param [out] store Loaded cluster sets
+ * \param [out] fingerprint Input manifest fingerprint
+ * \return int 0 on success, -1 otherwise
+ */
+int load_directory(const char *dirname, cmat_t **mat, nameset_t **dict, cstore_t **store, unsigned long *fingerprint)
+{
+	char **enames;
+	unsigned long ecnt, i;
+
+	/* Initialize total congruency matrix */
+	stats_phase(PHASE_SCAN);
+	*mat = initialize_cmatrix(dirname, !stream_rows);
+	if (*mat == NULL) {
+		fprintf(stderr, "Could not read cluster set files.\n");
+		return -1;
+	}
 
-		/* Get elements names */
-		if (listfile != NULL) {
-			enames = get_enames(listfile, &ecnt);
-		} else if (newlist != NULL) {
-			print_info("Generating list file: %s\n", newlist);
-			enames = gen_elements_list(inpdir, newlist, &ecnt);
-		} else {
-			print_info("Generating clusters elements list\n");
-			enames = gen_elements_list(inpdir, NULL, &ecnt);
-		}
+	/* Element dictionary: from the list (elements out of it are dropped
+	 * when loaded), or built while cluster sets are loaded */
+	stats_phase(PHASE_ELEMENTS);
+	if (listfile != NULL) {
+		enames = get_enames(listfile, &ecnt);
 		if (enames == NULL) {
 			fprintf(stderr, "Could not get elements names.\n");
-			destroy_matrix(mat);
-			return EXIT_FAILURE;
+			destroy_matrix(*mat);
+			return -1;
 		}
+		*dict = create_dictionary(enames, ecnt, 0);
+		if (ecnt > 0) {
+			/* get_enames() names share one buffer */
+			free(enames[0]);
+		}
+		free(enames);
+	} else {
+		*dict = create_nameset();
+	}
+	if (*dict == NULL) {
+		destroy_matrix(*mat);
+		return -1;
+	}
 
-		q = 0;
-		while(q < 2) {
-			zero_matrix(mat);
-
-			if (q == 0) {
-				if ((cindex & INDEX_P2P)) {
-					ind = INDEX_P2P;
-					fprintf(fpout, "============= pair-to-pair congruency (h) =============\n");
-				} else {
-					q++;
-					continue;
-				}
-			}
-			
-			if (q == 1) {
-				if ((cindex & INDEX_COMP)) {
-					ind = INDEX_COMP;
-					fprintf(fpout, "============== complete congruency index ==============\n");
-				} else {
-					break;
-				}
-			}
+	if (manifest_fingerprint(dirname, (*mat)->col_names, (*mat)->size, fingerprint) < 0) {
+		destroy_nameset(*dict);
+		destroy_matrix(*mat);
+		return -1;
+	}
 
-			/* Calculate congruences */
-			calculate_total_congruency(mat, enames, ecnt, inpdir, ind, show_n);
+	/* Start loading cluster sets, calculation waits only for the ones it needs */
+	stats_phase(PHASE_NONE);
+	*store = open_store(dirname, (*mat)->col_names, (*mat)->size, *dict, (listfile == NULL), iothreads, nthreads);
+	if (*store == NULL) {
+		fprintf(stderr, "Could not read cluster set files.\n");
+		destroy_nameset(*dict);
+		destroy_matrix(*mat);
+		return -1;
+	}
 
-			/* Calculate total mean and standard deviation */
-			c_mean = n = 0;
-			for (i = 0; i < mat->size; i++) {
-				for (j = i+1; j < mat->size; j++) {
-					c_mean += mat->matrix[i][j];
-					n++;
-				}
-			}
-			c_mean = c_mean / (double)n;
+	if (newlist != NULL) {
+		/* The list needs every cluster set */
+		print_info("Generating list file: %s\n", newlist);
+		for (i = 0; i < (*mat)->size; i++) {
+			store_get(*store, i);
+		}
+		if (write_nameset(*dict, newlist) < 0) {
+			perror(newlist);
+		}
+	}
+	return 0;
+}
 
-			sumsqr = 0;
-			for (i = 0; i < mat->size; i++) {
-				for (j = i+1; j < mat->size; j++) {
-					dev     = mat->matrix[i][j] - c_mean;
-					sumsqr += (dev * dev);
-				}
-			}
-			if (n == 1) {
-				sd = 0;
-			} else {
-				va = sumsqr / (double)(n-1);
-				sd = sqrt(va);
-			}
 
-			/* Print results */
-			print_matrix(mat, fpout);
-			fprintf(fpout, "---------------------------------------\n");
-			fprintf(fpout, "Total mean         = %f\n", c_mean);
-			fprintf(fpout, "Standard deviation = %f\n", sd);
-			fprintf(fpout, "---------------------------------------\n\n");
+/**
+ * \brief Prepare the calculation for a corpus stream
+ * \param [in] filename Corpus file name ("-" for standard input)
+ * \param [out] mat Total congruency matrix
+ * \param [out] dict Element dictionary
+ * \param [out] store Loaded cluster sets
+ * \param [out] fingerprint Corpus fingerprint
+ * \return int 0 on success, -1 otherwise
+ * \note The element dictionary is built while the corpus is parsed, unless
+ *       a list file is given.
+ */
+int load_corpus_stream(const char *filename, cmat_t **mat, nameset_t **dict, cstore_t **store, unsigned long *fingerprint)
+{
+	char **enames;
+	unsigned long ecnt, i, size;
 
-			q++;
+	stats_phase(PHASE_ELEMENTS);
+	if (listfile != NULL) {
+		enames = get_enames(listfile, &ecnt);
+		if (enames == NULL) {
+			fprintf(stderr, "Could not get elements names.\n");
+			return -1;
+		}
+		*dict = create_dictionary(enames, ecnt, 0);
+		if (ecnt > 0) {
+			free(enames[0]);
 		}
+		free(enames);
+	} else {
+		*dict = create_nameset();
+	}
+	if (*dict == NULL) {
+		return -1;
+	}
 
-		destroy_matrix(mat);
+	print_info("Reading corpus: %s\n", filename);
+	stats_phase(PHASE_LOAD);
+	*store = open_stream_store(filename, *dict, (listfile == NULL));
+	if (*store == NULL) {
+		destroy_nameset(*dict);
+		return -1;
+	}
+	size = store_wait(*store);
+	if ((*store)->error) {
+		fprintf(stderr, "Could not read corpus: %s\n", filename);
+		close_store(*store);
+		destroy_nameset(*dict);
+		return -1;
 	}
 
-	if (fpout != stdout) {
-		fclose(fpout);
+	/* Initialize total congruency matrix */
+	*mat = stream_rows ? create_matrix_header(size) : create_matrix(size);
+	if (*mat == NULL) {
+		perror("load_corpus_stream");
+		close_store(*store);
+		destroy_nameset(*dict);
+		return -1;
+	}
+	for (i = 0; i < size; i++) {
+		(*mat)->col_names[i] = strdup((*store)->csets[i].path);
 	}
+	zero_matrix(*mat);
 
-	return EXIT_SUCCESS;
-}
+	if (newlist != NULL) {
+		print_info("Generating list file: %s\n", newlist);
+		if (write_nameset(*dict, newlist) < 0) {
+			perror(newlist);
+		}
+	}
 
-/**
- * \brief Show program help
- * \param [in] prgname Program's name
- */
-void show_help(const char *prgname)
-{
-	printf("Use: %s [options]\n", prgname);
-	printf("Options:\n");
-	printf("    -h | --help        Show this help and exit\n");
-	printf("    -i | --input       Input directory\n");
-	printf("    -l | --list        Input list file\n");
-	printf("    -c | --complete    Calculate complete congruency\n");
-	printf("    -p | --pair        Calculate pair-to-pair congruency\n");
-	printf("    -g | --group       Just show clusterset clusters (groups)\n");
-	printf("    -P | --np          Show congruency matrix with Np\n");
-	printf("    -E | --ne          Show congruency matrix with Ne\n");
-	printf("    -L | --createlist  Create elements list from clustersets\n");
-	printf("    -o | --output      Write results to output file\n");
-	printf("    -v | --verbose     Be verbose\n");
+	*fingerprint = (*store)->fingerprint;
+	stats_phase(PHASE_NONE);
+	return 0;
 }
 
 
 /**
  * \brief Initialize total congruency matrix
  * \param [in] dirname Path to cluster set files
+ * \param [in] dense Allocate the matrix values (otherwise, just file names)
  * \return cmat_t*
  */
-cmat_t *initialize_cmatrix(const char *dirname)
+cmat_t *initialize_cmatrix(const char *dirname, char dense)
 {
 	DIR *dp;
 	struct dirent *ep;
-	unsigned long nfiles, i, j;
+	unsigned long nfiles, i;
 	char **filenames;
 	cmat_t *mat = NULL;
 
@@ -332,7 +1344,15 @@ cmat_t *initialize_cmatrix(const char *dirname)
 	closedir(dp);
 
 	/* Initialize the matrix */
-	mat = create_matrix(nfiles);
+	if (dense) {
+		mat = create_matrix(nfiles);
+	} else {
+		mat = create_matrix_header(nfiles);
+	}
+	if (mat == NULL) {
+		perror("initialize_cmatrix");
+		return NULL;
+	}
 
 	/* Fill columns with file names */
 	filenames = malloc(sizeof(char*) * nfiles);
@@ -352,13 +1372,10 @@ cmat_t *initialize_cmatrix(const char *dirname)
 	}
 	closedir(dp);
 	qsort(filenames, i, sizeof(char*), cmpstringp);
+	free(mat->col_names);
 	mat->col_names = filenames;
 
-	for (i = 0; i < mat->size; i++) {
-		for (j = 0; j < mat->size; j++) {
-			mat->matrix[i][j] = 0;
-		}
-	}
+	zero_matrix(mat);
 
 	return mat;
 }
@@ -435,556 +1452,486 @@ char **get_enames(const char *filename, unsigned long *size)
 
 
 /**
- * \brief Calculate total congruency
- * \param [out] mat Total congruency matrix
- * \param [out] names Elements names
- * \param [in] dirname Path to cluster set files
- * \param [in] indx Which index should be calculated
- * \param [in] flags Flags to show Np or Ne
- * \return int
+ * \brief Calculate the congruency of one pair of the matrix
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] arg Index being calculated (job_t)
+ * \return double Congruency
+ * \note Pairs already on the checkpoint are not calculated again
  */
-
-int calculate_total_congruency(cmat_t *mat, char **names, unsigned long nsize, const char *dirname, char ind, char flags)
+static double pair_congruency(unsigned long i, unsigned long j, void *arg)
 {
-	unsigned long i, j;
-	char *file1, *file2;
-    double (*index)(char*, char *, char **, unsigned long, char);
+	job_t *job = arg;
+	cset_t *c1, *c2;
 
-	if (mat == NULL || names == NULL) {
-		return -1;
+	PROGRESS_ADD(1);
+	if (ckpt != NULL && checkpoint_done(ckpt, job->ind, i, j)) {
+		return job->mat->matrix[i][j];
 	}
-	
-	switch(ind) {
-		case INDEX_P2P:
-			index = calculate_congruency1;
-			break;
-
-		case INDEX_COMP:
-			index = calculate_congruency2;
-			break;
 
-		default:
-			index = calculate_congruency1;
-	}
-	
-	
-	for (i = 0; i < mat->size; i++) {
-		mat->matrix[i][i] = 1.0;
-		for (j = (i+1); j < mat->size; j++) {
-		//for (j = 0; j < mat->size; j++) {
-			asprintf(&file1, "%s/%s", dirname, mat->col_names[i]);
-			asprintf(&file2, "%s/%s", dirname, mat->col_names[j]);
-			
-			mat->matrix[i][j] = index(file1, file2, names, nsize, flags);
-			mat->matrix[j][i] = mat->matrix[i][j];
-			
-			free(file1);
-			free(file2);
-		}
-	}
+	c1 = store_get(job->store, i);
+	c2 = store_get(job->store, j);
 
-	return 0;
+	return job->index(c1, c2, job->flags, 0);
 }
 
 
 /**
- * \brief Search for an element on the cluster set
- * \param [in] name 
- * \param [in] clusterset
- * \param [in] csize Clusterset size
- * return char 1 if element was found, 0 otherwise
+ * \brief Store one pair into the matrix (and on the checkpoint)
+ * \param [in] job Index being calculated
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] h Congruency
  */
-char search_el(char *name, elem_t *clusterset, unsigned long csize)
+static void store_pair(job_t *job, unsigned long i, unsigned long j, double h)
 {
-	unsigned long i;
-	for (i = 0; i < csize; i++) {
-		if (strcmp(name, clusterset[i].name) == 0) {
-			return 1;
-		}
+	if (ckpt != NULL && !checkpoint_done(ckpt, job->ind, i, j)) {
+		checkpoint_pair(ckpt, job->ind, i, j, h);
 	}
-	return 0;
+	job->mat->matrix[i][j] = h;
+	job->mat->matrix[j][i] = h;
 }
 
 
 /**
- *  Calculate pair-to-pair congruency (h) between two cluster sets
- *  \param [in] file1 Cluster set file 1
- *  \param [in] file2 Cluster set file 2
- *  \param [in] flags Flags to show Np or Ne
- *  \return double Congruency
+ * \brief Store one calculated row into the matrix
+ * \param [in] i Row
+ * \param [in] values Row values
+ * \param [in] arg Index being calculated (job_t)
  */
-double calculate_congruency1(char *file1, char *file2, char **names, unsigned long nsize, char flags)
+static void store_row(unsigned long i, double *values, void *arg)
 {
-	unsigned long i, j, k, l;
-	unsigned long csize1, csize2, csizeA, csizeB;
-	unsigned long common_el;
-	mpz_t *T;
-	mpz_t maxNp, Ne, Np[2];
-	mpf_t NeNp, div;
-	elem_t *cset1, *cset2;
-	elem_t *csetA, *csetB;
-	char *fileA, *fileB, *e1, *e2;
-	int x;
-	double h;
+	job_t *job = arg;
+	unsigned long j;
 
-	cset1 = read_clusterset(file1, &csize1);
-	cset2 = read_clusterset(file2, &csize2);
-	if (cset1 == NULL || cset2 == NULL) {
-		perror("calculate_congruency1()");
-		return -1;
+	job->mat->matrix[i][i] = 1.0;
+	for (j = (i+1); j < job->mat->size; j++) {
+		store_pair(job, i, j, values[j]);
 	}
+}
 
-	mpz_init(Ne);
-	mpz_init(maxNp);
-	mpz_init(Np[0]);
-	mpz_init(Np[1]);
-
-	/* Here we first analyzes clusterset1 X clusterset2, and then,
-	   on the second iteration we make clusterset2 X clusterset1 analyzes */
-	csetA  = cset1;
-	csizeA = csize1;
-	fileA  = file1;
-	csetB  = cset2;
-	csizeB = csize2;
-	fileB  = file2;
-	for (x = 0; x < 2; x++) {
-		print_info("\n=========================================\n");
-		print_info("Clustersets: %s X %s\n", fileA, fileB);
-
-		/* analyzes first cluster set */
-		i = k = 0;
-		mpz_set_ui(Np[x], 0);
-		while(i <= csizeA) {
-			while((csetA[k].cluster == csetA[i].cluster) && i < csizeA) i++;
-
-			/* Check elements of the cluster which is common to the elements of other cluster set */
-			print_info("\n================\n");
-			print_info("Cluster found:\n");
-		
-			common_el = 0;
-			for (j = k; j < i; j++) {
-				if (search_el(csetA[j].name, csetB, csizeB) == 1) {
-					common_el++;
-				}
-				print_info("    %10s | %ld\n", csetA[j].name, csetA[j].cluster);
-			}
-			T = single_combination(common_el, 2);
-			mpz_add(Np[x], Np[x], *T);
-			k = i;
-			i++;
 
-			print_info("----------------\n");
-			print_info("C. Elements = %ld\n", common_el);
-			gmp_print_info("         Nk = %Zd\n", *T);
-			print_info("----------------\n");
+/**
+ * \brief Store the pairs of one calculated row that fall on the tiles
+ *        into the matrix (and on the partial result file)
+ * \param [in] i Row
+ * \param [in] values Row values
+ * \param [in] arg Index being calculated (job_t)
+ * \note Rows are delivered in order, so the band of tiles of the row is
+ *       found from the one of the previous row.
+ */
+static void store_tile_row(unsigned long i, double *values, void *arg)
+{
+	job_t *job = arg;
+	unsigned long j, t;
+	tile_t *tile;
 
-			mpz_clear(*T);
-			free(T);
-		}
-		gmp_print_info("T[%d] = %Zd\n", x, Np[x]);
-	
-		/* switch clustersets */
-		csetA  = cset2;
-		csizeA = csize2;
-		fileA  = file2;
-		csetB  = cset1;
-		csizeB = csize1;
-		fileB  = file1;
+	while (i >= (job->tiles[job->tile].row + job->tiles[job->tile].nrows)) {
+		job->tile++;
 	}
 
-	if (mpz_cmp(Np[0], Np[1]) > 0) {
-		mpz_set(maxNp, Np[0]);
-	} else {
-		mpz_set(maxNp, Np[1]);
-	}
-
-	if ((flags & SHOW_NP)) {
-		return mpz_get_d(maxNp);
-	}
-
-	/* Calculate common clusters, i.e., present in both clustersets */
-	mpz_set_ui(Ne, 0);
-	for (i = 0; i < csize1; i++) {
-		e1 = cset1[i].name;
-		for (j = i+1; j < csize1; j++) {
-			/* We test all possible pair combination in clusterset 1 */
-			e2 = cset1[j].name;
-
-			/* are they on the same cluster ? */
-			if (cset1[i].cluster == cset1[j].cluster) {
-				/* Yes, lets try to find same pair on clusterset 2 */
-				for (k = 0; k < csize2; k++) {
-					for (l = k+1; l < csize2; l++) {
-						if (cset2[k].cluster == cset2[l].cluster) {
-							if (strcmp(e1, cset2[k].name) == 0 &&
-									strcmp(e2, cset2[l].name) == 0) {
-								mpz_add_ui(Ne, Ne, 1);
-							}
-						}
-					}
-				}
+	job->mat->matrix[i][i] = 1.0;
+	for (t = job->tile; t < job->ntiles && job->tiles[t].row == job->tiles[job->tile].row; t++) {
+		tile = &job->tiles[t];
+		j = (tile->col > i) ? tile->col : (i+1);
+		for (; j < (tile->col + tile->ncols); j++) {
+			store_pair(job, i, j, values[j]);
+			if (job->partial != NULL) {
+				write_partial_pair(job->partial, job->ind, i, j, values[j]);
 			}
 		}
 	}
+}
 
-	if ((flags & SHOW_NE)) {
-		return mpz_get_d(Ne);
+
+/**
+ * \brief Print one calculated row (upper triangle) and update statistics
+ * \param [in] i Row
+ * \param [in] values Row values
+ * \param [in] arg Index being calculated (job_t)
+ */
+static void print_row(unsigned long i, double *values, void *arg)
+{
+	job_t *job = arg;
+	unsigned long j;
+
+	writer_puts(job->writer, job->mat->col_names[i]);
+	writer_put(job->writer, " ", 1);
+	for (j = i; j < job->mat->size; j++) {
+		writer_double(job->writer, values[j]);
+		if (j > i) {
+			stat_add(&job->stat, values[j]);
+		}
 	}
+	writer_put(job->writer, "\n", 1);
+}
 
-	/* Finnaly, calculate congruency */
-	if (mpz_cmp_ui(maxNp, 0) != 0) {
-		mpf_init(NeNp);
-		mpf_init(div);
 
-		mpf_set_z(NeNp, Ne);
-		mpf_set_z(div, maxNp);
+/**
+ * \brief Prepare the calculation of one index
+ * \param [out] job Index being calculated
+ * \param [in] mat Total congruency matrix
+ * \param [in] store Loaded cluster sets
+ * \param [in] ind Which index should be calculated
+ * \param [in] flags Flags to show Np or Ne
+ */
+static void init_job(job_t *job, cmat_t *mat, cstore_t *store, char ind, char flags)
+{
+	memset(job, 0, sizeof(job_t));
+	job->mat     = mat;
+	job->store   = store;
+	job->ind     = ind;
+	job->flags   = flags;
+	job->index   = index_function(ind);
+	stat_init(&job->stat);
+}
+
 
-		/* NeNp = NeNp / div */
-		mpf_div(NeNp, NeNp, div);
+/**
+ * \brief Calculate total congruency
+ * \param [out] mat Total congruency matrix
+ * \param [in] store Loaded cluster sets
+ * \param [in] indx Which index should be calculated
+ * \param [in] flags Flags to show Np or Ne
+ * \param [in] tiles Tiles to be calculated (NULL for the whole matrix)
+ * \param [in] ntiles Number of tiles
+ * \param [out] partial Partial result file (NULL if not used)
+ * \return int
+ */
 
-		h = mpf_get_d(NeNp);
+int calculate_total_congruency(cmat_t *mat, cstore_t *store, char ind, char flags, tile_t *tiles, unsigned long ntiles, FILE *partial)
+{
+	job_t job;
 
-		mpf_clear(NeNp);
-		mpf_clear(div);
-	} else {
-		h = 0;
+	if (mat == NULL || store == NULL) {
+		return -1;
 	}
+	
+	init_job(&job, mat, store, ind, flags);
 
-	print_info("============= pair-to-pair congruency (h) =============\n");
-	gmp_print_info("               Ne = %Zd\n", Ne);
-	gmp_print_info("max{T[1], T[2]} = %Zd\n", maxNp);
-	print_info("                h = %f\n",  h);
-	print_info("\n\n");
+	if (tiles == NULL) {
+		return calculate_rows(mat->size, nthreads, pair_congruency, store_row, &job);
+	}
 
-	mpz_clear(Ne);
-	mpz_clear(maxNp);
-	mpz_clear(Np[0]);
-	mpz_clear(Np[1]);
+	/* Pairs are stored and written from this thread only */
+	job.tiles   = tiles;
+	job.ntiles  = ntiles;
+	job.partial = partial;
+	return calculate_tile_rows(mat->size, tiles, ntiles, nthreads, pair_congruency, store_tile_row, &job);
+}
 
-	free_clusterset(cset1, csize1);
-	free_clusterset(cset2, csize2);
 
-	return h;
+/**
+ * \brief Calculate all partition indexes of one pair (one contingency table)
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] arg Partition indexes being calculated (pjob_t)
+ * \return double Not used (values go straight to the matrices)
+ */
+static double partition_pair(unsigned long i, unsigned long j, void *arg)
+{
+	pjob_t *job = arg;
+	double values[NPARTITION];
+	int k;
+
+	calculate_partition(store_get(job->store, i), store_get(job->store, j), values);
+	for (k = 0; k < NPARTITION; k++) {
+		if (job->mats[k] != NULL) {
+			job->mats[k]->matrix[i][j] = values[k];
+			job->mats[k]->matrix[j][i] = values[k];
+			PROGRESS_ADD(1);
+		}
+	}
+	return 0;
 }
 
 
 /**
- *  \brief Calculate complete congruency index between two cluster sets
- *  \param [in] file1 Cluster set file 1
- *  \param [in] file2 Cluster set file 2
- *  \param [in] flags Flags to show Np or Ne
- *  \return double Congruency
+ * \brief Finish one row of the partition indexes
+ * \param [in] i Row
+ * \param [in] values Not used
+ * \param [in] arg Partition indexes being calculated (pjob_t)
  */
-double calculate_congruency2(char *file1, char *file2, char **names, unsigned long nsize, char flags)
+static void partition_row(unsigned long i, double *values, void *arg)
 {
-	unsigned long i, j, k, l, p, q;
-	unsigned long csize1, csize2, csizeA, csizeB, csizeC;
-	unsigned long common_el, num_el;
-	mpz_t A, *c, Np[2], Ne, maxNp;
-	mpf_t NeNp, div;
-	elem_t *cset1, *cset2;
-	elem_t *csetA, *csetB;
-	elem_t *caux;
-	char *fileA, *fileB, **elements;
-	int x;
-	double h;
-	char is_common;
+	pjob_t *job = arg;
+	int k;
 
-	cset1 = read_clusterset(file1, &csize1);
-	cset2 = read_clusterset(file2, &csize2);
-	if (cset1 == NULL || cset2 == NULL) {
-		perror("calculate_congruency2()");
-		return -1;
-	} 
-	
-	mpz_init(A);
-	mpz_init(Np[0]);
-	mpz_init(Np[1]);
-	mpz_init(Ne);
-	mpz_init(maxNp);
-
-	/* Here we first analyzes clusterset1 X clusterset2, and then,
-	   on the second iteration we make clusterset2 X clusterset1 analyzes */
-	csetA  = cset1;
-	csizeA = csize1;
-	fileA  = file1;
-	csetB  = cset2;
-	csizeB = csize2;
-	fileB  = file2;
-	for (x = 0; x < 2; x++) {
-		print_info("\n=========================================\n");
-		print_info("Clustersets: %s X %s\n", fileA, fileB);
+	for (k = 0; k < NPARTITION; k++) {
+		if (job->mats[k] != NULL) {
+			job->mats[k]->matrix[i][i] = 1.0;
+		}
+	}
+}
 
-		/* We copy all elements from clusterset2 to count common elements without repetition */
-		elements = malloc(sizeof(char*) * csizeB);
-		if (elements == NULL) {
-			perror("calculate_congruency2()");
+
+/**
+ * \brief Calculate the selected partition indexes in one pass, building the
+ *        contingency table of each pair once
+ * \param [in] mat Total congruency matrix (used by the first index)
+ * \param [in] store Loaded cluster sets
+ * \param [in] pindex Partition indexes (INDEX_PARTITION bits)
+ * \param [out] pmats Matrix of each partition index (order of the INDEX_*
+ *        bits, NULL if not selected)
+ * \return int 0 on success, -1 otherwise
+ * \note The pair function writes both cells itself: each pair is
+ *       calculated by one thread only.
+ */
+int calculate_partition_congruency(cmat_t *mat, cstore_t *store, char pindex, cmat_t **pmats)
+{
+	pjob_t job;
+	int k, first;
+
+	first = 1;
+	for (k = 0; k < NPARTITION; k++) {
+		pmats[k] = NULL;
+		if (!(pindex & (INDEX_ARI << k))) {
+			continue;
+		}
+		if (first) {
+			pmats[k] = mat;
+			first = 0;
+			continue;
+		}
+		pmats[k] = create_matrix(mat->size);
+		if (pmats[k] == NULL) {
+			perror("calculate_partition_congruency");
 			return -1;
 		}
-		for (i = 0; i < csizeB; i++) {
-			elements[i] = strdup(csetB[i].name);
-		}
-
-		/* analyzes first cluster set */
-		i = k = 0;
-		mpz_set_ui(Np[x], 0);
-		while(i <= csizeA) {
-			while((csetA[k].cluster == csetA[i].cluster) && i < csizeA) i++;
-
-			/* Check elements of the cluster which is common to the elements of other cluster set */
-			print_info("\n================\n");
-			print_info("Cluster found:\n");
-		
-			common_el = 0;
-			for (j = k; j < i; j++) {
-				for (l = 0; l < csizeB; l++) {
-					if (elements[l] != NULL && csetA[j].name != NULL) {
-						if (strcmp(csetA[j].name, elements[l]) == 0) {
-							common_el++;
-							free(elements[l]);
-							elements[l] = NULL;
-							break;
-						}
-					}
-				}
-				print_info("    %10s | %ld\n", csetA[j].name, csetA[j].cluster);
-			}
-			num_el = (i - k);
+		/* Names are shared (destroy_matrix() does not free them) */
+		memcpy(pmats[k]->col_names, mat->col_names, sizeof(char *) * mat->size);
+		zero_matrix(pmats[k]);
+	}
 
-			/* Calculate A */
-			mpz_set_ui(A, 0);
-			for (l = 1; l <= common_el; l++) {
-				c = single_combination(common_el, l);
-				mpz_add(A, A, *c);
+	job.store = store;
+	job.mats  = pmats;
+	return calculate_rows(mat->size, nthreads, partition_pair, partition_row, &job);
+}
 
-				gmp_print_info("(%ld/%ld)=%Zd ", common_el, l, *c);
 
-				mpz_clear(*c);
-				free(c);
-			}
-			print_info("\n");
-			mpz_add(Np[x], Np[x], A);
-			k = i;
-			i++;
+/**
+ * \brief Calculate one index with its permutation test and print the index,
+ *        p-value and z-score matrices
+ * \param [in] mat Total congruency matrix (observed index)
+ * \param [in] store Loaded cluster sets
+ * \param [in] ind Which index should be calculated (INDEX_P2P or INDEX_COMP)
+ * \return int 0 on success, -1 otherwise
+ */
+int permutation_test(cmat_t *mat, cstore_t *store, char ind)
+{
+	cmat_t *pz[2];
+	const char *what[2] = { "pvalue", "zscore" };
+	char *base;
+	int x, ret;
 
-			print_info("----------------\n");
-			print_info("C. Elements = %ld\n", common_el);
-			gmp_print_info("          A = %Zd\n", A);
-			print_info("----------------\n");
-		}
-		for (l = 0; l < csizeB; l++) {
-			if (elements[l] != NULL) {
-				free(elements[l]);
-			}
+	for (x = 0; x < 2; x++) {
+		if ((pz[x] = create_matrix(mat->size)) == NULL) {
+			perror("permutation_test");
+			destroy_matrix(pz[0]);
+			return -1;
 		}
-		free(elements);
+		/* Names are shared (destroy_matrix() does not free them) */
+		memcpy(pz[x]->col_names, mat->col_names, sizeof(char *) * mat->size);
+		zero_matrix(pz[x]);
+	}
 
-		gmp_print_info("Np = %Zd\n", Np[x]);
-	
-		/* switch clustersets */
-		csetA  = cset2;
-		csizeA = csize2;
-		fileA  = file2;
-		csetB  = cset1;
-		csizeB = csize1;
-		fileB  = file1;
+	ret = calculate_permutation_congruency(mat, store, ind, npermutations, perm_seed, pz[0], pz[1], nthreads);
+
+	stats_phase(PHASE_OUTPUT);
+	if (ret == 0) {
+		print_index_title(ind, fpout);
+		ret = output_results(mat, ind, outfmt, outfile, fpout);
+	}
+	for (x = 0; x < 2 && ret == 0; x++) {
+		print_index_title(ind, fpout);
+		fprintf(fpout, "%s (%lu permutations)\n", (x == 0) ? "p-value" : "z-score", npermutations);
+		base = NULL;
+		if (outfmt > OUTPUT_ROUNDTRIP) {
+			asprintf(&base, "%s-%s", outfile, what[x]);
+		}
+		ret = output_results(pz[x], ind, outfmt, base, fpout);
+		free(base);
 	}
 
-	if (mpz_cmp(Np[0], Np[1]) > 0) {
-		mpz_set(maxNp, Np[0]);
-	} else {
-		mpz_set(maxNp, Np[1]);
+	destroy_matrix(pz[0]);
+	destroy_matrix(pz[1]);
+	return ret;
+}
+
+
+/**
+ * \brief Calculate congruency and write each row as soon as it is calculated
+ * \param [in] mat Total congruency matrix (only file names and size are used)
+ * \param [in] store Loaded cluster sets
+ * \param [in] ind Which index should be calculated
+ * \param [in] flags Flags to show Np or Ne
+ * \param [out] stream Output file descriptor
+ * \return int
+ * \note Rows only have the upper triangle (from the diagonal on), so the
+ *       matrix is never kept in memory. Mean and standard deviation are
+ *       calculated online, in row order.
+ */
+int calculate_stream_congruency(cmat_t *mat, cstore_t *store, char ind, char flags, FILE *stream)
+{
+	job_t job;
+	double c_mean, sd;
+	int ret;
+
+	if (mat == NULL || store == NULL) {
+		return -1;
 	}
 
-	if ((flags & SHOW_NP)) {
-		return mpz_get_d(maxNp);
+	init_job(&job, mat, store, ind, flags);
+	job.writer = writer_open(stream, outfmt);
+	if (job.writer == NULL) {
+		perror("calculate_stream_congruency");
+		return -1;
 	}
 
+	ret = calculate_rows(mat->size, nthreads, pair_congruency, print_row, &job);
+	writer_close(job.writer);
 
-	/* Ne calculation:
-	 *	- First we copy both clustersets
-	 *	- Each clusterset is analysed, removing non common elements
-	 *	- Only common elements will remain on each clusterset
-	 *  - We count the congruency for each cluster
-	 */
-	print_info("\n-------------- Ne ---------------\n");
+	stat_result(&job.stat, &c_mean, &sd);
+	print_stats(c_mean, sd, stream);
 
-	csizeA = csize1; 
-	csetA  = dup_clusterset(cset1, csize1);
-	csizeB = csize2;
-	csetB  = dup_clusterset(cset2, csize2);
+	return ret;
+}
 
-	for (x = 0; x < 2; x++) {
-		/* We copy all elements from clusterset2 to count common elements without repetition */
-		elements = malloc(sizeof(char*) * csizeB);
-		if (elements == NULL) {
-			perror("calculate_congruency2()");
-			return -1;
-		}
-		for (i = 0; i < csizeB; i++) {
-			elements[i] = strdup(csetB[i].name);
-		}
-
-		i = k = 0;
-		while(i <= csizeA) {
-			while((csetA[k].cluster == csetA[i].cluster) && i < csizeA) i++;
-		
-			for (p = k; p < i; p++) {
-				is_common = 0;
-				for (l = 0; l < csizeB; l++) {
-					if (elements[l] != NULL) {
-						if (strcmp(csetA[p].name, elements[l]) == 0) {
-							free(elements[l]);
-							elements[l] = NULL;
-							is_common = 1;
-							break;
-						}
-					}
-				}
-				if (!is_common) {
-					/* Mark element to be removed */
-					free(csetA[p].name);
-					csetA[p].name = NULL;
-					csetA[p].cluster = FAKE_CLUSTER;
-				}
 
-			}
-			k = i;
-			i++;
-		}
-		qsort(csetA, csizeA, sizeof(elem_t), elem_cmp);
-		k = csizeA;
-		for (i = (k-1); i > 0; i--) {
-			if (csetA[i].name == NULL && csetA[i].cluster == FAKE_CLUSTER) {
-				csizeA--;
-			}
-		}
-		if (csizeA < k) {
-			caux = realloc(csetA, sizeof(elem_t) * csizeA); 
-			if (caux == NULL) {
-				perror("calculate_congruency2()");
-			} else {
-				csetA = caux;
-			}
-		}
-		
-		for (i = 0; i < csizeB; i++) {
-			if (elements[i] != NULL) {
-				free(elements[i]);
-			}
-		}
-		free(elements);
-
-		caux   = csetA;
-		csizeC = csizeA;
-		csetA  = csetB;
-		csizeA = csizeB;
-		csetB  = caux;
-		csizeB = csizeC;
-	}
-
-	/* Finally, we just count congruences */
-	i = k = 0;
-	mpz_set_ui(Ne, 0);
-	while(i <= csizeA) {
-		while((csetA[k].cluster == csetA[i].cluster) && i < csizeA) i++;
-
-		print_info("C1 cluster: ");
-		for (p = k; p < i; p++) {
-			print_info("%s ", cset1[p].name);
-		}
-		print_info("\n------\n");
-
-		j = l = 0;
-		mpz_set_ui(A, 0);
-		while(j <= csizeB) {
-			while((csetB[l].cluster == csetB[j].cluster) && j < csizeB) j++;
-
-			/* Count common elements */
-			num_el = 0;
-			for (p = l; p < j; p++) {
-				for (q = k; q < i; q++) {
-					if (csetA[q].name != NULL) {
-						if (strcmp(csetB[p].name, csetA[q].name) == 0) {
-							num_el++;
-							free(csetA[q].name);
-							csetA[q].name = NULL;
-							break;
-						}
-					}
-				}
+/**
+ * \brief Lowest congruency a new edge needs to enter the top-k list of a row
+ * \param [in] job Sparse calculation
+ * \param [in] row Row
+ * \return double -1 while the row is not full
+ */
+static double sparse_threshold(sjob_t *job, unsigned long row)
+{
+	double t;
 
-				print_info("C2: %s | %ld\n", csetB[p].name, csetB[p].cluster);
-			}
-			if (num_el == 1) {
-				if((i-k) > 1 && (j-l) > 1) {
-					num_el = 0;
-				} else if ((i-k) != (j-l)) {
-					num_el = 0;
-				}
-			}
+	pthread_mutex_lock(&job->locks[row]);
+	t = topk_threshold(job->tk, row);
+	pthread_mutex_unlock(&job->locks[row]);
+	return t;
+}
 
-			print_info("Common: %ld\n", num_el);
-			for (q = 1; q <= num_el; q++) {
-				c  = single_combination(num_el, q);
-				mpz_add(A, A, *c);
-			
-				gmp_print_info("(%ld/%ld)=%Zd ", num_el, q, *c);
-				
-				mpz_clear(*c);
-				free(c);
-			} print_info("\n\n");
 
-			l = j;
-			j++;
+/**
+ * \brief Calculate one pair of the sparse output
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] arg Sparse calculation (sjob_t)
+ * \return double Congruency (H_PRUNED if it cannot be shown)
+ * \note Thresholds only grow while rows are delivered, so a pair pruned
+ *       here would not enter the lists when its row is delivered either.
+ */
+static double sparse_pair(unsigned long i, unsigned long j, void *arg)
+{
+	sjob_t *job = arg;
+	double cutoff, ti, tj;
+
+	cutoff = minh;
+	if (job->tk != NULL) {
+		/* The pair must enter the list of one of its rows */
+		ti = sparse_threshold(job, i);
+		tj = sparse_threshold(job, j);
+		if (((ti < tj) ? ti : tj) > cutoff) {
+			cutoff = (ti < tj) ? ti : tj;
 		}
-	
-		mpz_add(Ne, Ne, A);
-
-		k = i;
-		i++;
 	}
 
-	if ((flags & SHOW_NE)) {
-		return mpz_get_d(Ne);
-	}
+	return job->index(store_get(job->store, i), store_get(job->store, j), 0, cutoff);
+}
 
-	/* Finally, calculate congruency */
-	if (mpz_cmp_ui(maxNp, 0) != 0) {
-		mpf_init(NeNp);
-		mpf_init(div);
 
-		mpf_set_z(NeNp, Ne);
-		mpf_set_z(div, maxNp);
+/**
+ * \brief Show (or add to the top-k lists) the pairs of one calculated row
+ * \param [in] i Row
+ * \param [in] values Row values
+ * \param [in] arg Sparse calculation (sjob_t)
+ */
+static void sparse_row(unsigned long i, double *values, void *arg)
+{
+	sjob_t *job = arg;
+	unsigned long j;
+	double h;
 
-		/* NeNp = NeNp / div */
-		mpf_div(NeNp, NeNp, div);
+	for (j = (i+1); j < job->mat->size; j++) {
+		h = values[j];
 
-		h = mpf_get_d(NeNp);
+		/* -1: cluster set not loaded (the adjusted Rand index can be negative) */
+		if (h == H_PRUNED || h == -1 || (h < 0 && job->ind != INDEX_ARI) || h < minh) {
+			continue;
+		}
+		if (job->tk != NULL) {
+			pthread_mutex_lock(&job->locks[i]);
+			pthread_mutex_lock(&job->locks[j]);
+			topk_add(job->tk, i, j, h);
+			pthread_mutex_unlock(&job->locks[j]);
+			pthread_mutex_unlock(&job->locks[i]);
+		} else {
+			fprintf(job->stream, "%s %s %f\n", job->mat->col_names[i], job->mat->col_names[j], h);
+		}
+	}
+	PROGRESS_ADD(job->mat->size - i - 1);
+}
 
-		mpf_clear(NeNp);
-		mpf_clear(div);
-	} else {
-		h = 0;
+
+/**
+ * \brief Calculate congruency and show only pairs above --min-h and/or the --top-k
+ *        most congruent partners of each file
+ * \param [in] mat Total congruency matrix (only file names and size are used)
+ * \param [in] store Loaded cluster sets
+ * \param [in] ind Which index should be calculated
+ * \param [out] stream Output file descriptor
+ * \return int
+ * \note The congruency functions receive the lowest value that can still be
+ *       shown, so Ne is not calculated for pairs that cannot qualify. Rows
+ *       are calculated by the workers and delivered in order, so the output
+ *       does not depend on the number of threads.
+ */
+int calculate_sparse_congruency(cmat_t *mat, cstore_t *store, char ind, FILE *stream)
+{
+	unsigned long i;
+	sjob_t job;
+	int ret;
+
+	if (mat == NULL || store == NULL) {
+		return -1;
 	}
 
-	print_info("============= complete congruency (h) =============\n");
-	gmp_print_info("               Ne = %Zd\n", Ne);
-	gmp_print_info("max{Np[1], Np[2]} = %Zd\n", maxNp);
-	print_info("               h2 = %f\n",  h);
-	print_info("\n\n");
+	memset(&job, 0, sizeof(sjob_t));
+	job.mat    = mat;
+	job.store  = store;
+	job.ind    = ind;
+	job.index  = index_function(ind);
+	job.stream = stream;
+
+	if (topk > 0) {
+		job.tk    = create_topk(mat->size, topk);
+		job.locks = malloc(sizeof(pthread_mutex_t) * ((mat->size > 0) ? mat->size : 1));
+		if (job.tk == NULL || job.locks == NULL) {
+			perror("calculate_sparse_congruency");
+			destroy_topk(job.tk);
+			free(job.locks);
+			return -1;
+		}
+		for (i = 0; i < mat->size; i++) {
+			pthread_mutex_init(&job.locks[i], NULL);
+		}
+	}
 
-	mpz_clear(A);
-	mpz_clear(Np[0]);
-	mpz_clear(Np[1]);
-	mpz_clear(Ne);
-	mpz_clear(maxNp);
+	ret = calculate_rows(mat->size, nthreads, sparse_pair, sparse_row, &job);
 
-	free_clusterset(csetA, csizeA);
-	free_clusterset(csetB, csizeB);
-	free_clusterset(cset1, csize1);
-	free_clusterset(cset2, csize2);
+	if (job.tk != NULL) {
+		if (ret == 0) {
+			print_topk(job.tk, mat->col_names, stream);
+		}
+		destroy_topk(job.tk);
+		for (i = 0; i < mat->size; i++) {
+			pthread_mutex_destroy(&job.locks[i]);
+		}
+		free(job.locks);
+	}
 
-	return h;
+	return ret;
 }
-
@@ -23,6 +23,8 @@
 	#define CMATCHES_H
 
 	#include <stdio.h>
+	#include <time.h>
+	#include <pthread.h>
 	#include <gmp.h>
 
 	/** Verbose information */
@@ -35,7 +37,90 @@
 	#define INDEX_P2P  0x01
 	/** complete congruency index */
 	#define INDEX_COMP 0x02
+	/** adjusted Rand index */
+	#define INDEX_ARI  0x04
+	/** normalized mutual information */
+	#define INDEX_NMI  0x08
+	/** Jaccard index (pairs of elements) */
+	#define INDEX_JACCARD 0x10
+	/** Fowlkes-Mallows index */
+	#define INDEX_FM   0x20
 
+	/** Number of indexes (INDEX_* bits) */
+	#define NINDEXES 6
+
+	/** Indexes calculated from the contingency table of a pair (see
+	 *  calculate_partition()), in the order of their bits */
+	#define INDEX_PARTITION (INDEX_ARI | INDEX_NMI | INDEX_JACCARD | INDEX_FM)
+	#define NPARTITION 4
+
+	/** Returned by congruency functions when Ne calculation was skipped */
+	#define H_PRUNED (-2.0)
+
+	/** Returned by the allocation free kernels for pairs they can not handle */
+	#define H_FALLBACK (-3.0)
+
+	/** Flags to show Np or Ne */
+	#define SHOW_NE       0x01
+	#define SHOW_NP       0x02
+
+	/** Cluster of elements removed by calculate_congruency2() */
+	#define FAKE_CLUSTER 9999999
+
+	/** Output formats */
+	#define OUTPUT_TEXT      0
+	#define OUTPUT_ROUNDTRIP 1
+	#define OUTPUT_RAW64     2
+	#define OUTPUT_RAW32     3
+	#define OUTPUT_NPY       4
+	#define OUTPUT_NPY32     5
+
+	/** Buffer size needed to format a double */
+	#define FORMAT_BUFFER 512
+
+	/** FNV-1a offset basis */
+	#define FNV_OFFSET 0xcbf29ce484222325UL
+	/** FNV-1a prime */
+	#define FNV_PRIME  0x100000001b3UL
+
+
+	/** Run phases (--stats) */
+	#define PHASE_NONE     (-1)
+	#define PHASE_SCAN     0
+	#define PHASE_ELEMENTS 1
+	#define PHASE_LOAD     2
+	#define PHASE_PAIRS    3
+	#define PHASE_NP       4
+	#define PHASE_NE       5
+	#define PHASE_STATS    6
+	#define PHASE_OUTPUT   7
+	#define NPHASES        8
+
+	/** Run counters (--stats) */
+	#define COUNT_PAIRS      0
+	#define COUNT_NAMEPAIRS  1
+	#define COUNT_ELEMENTS   2
+	#define COUNT_BYTES      3
+	#define NCOUNTERS        4
+
+	/** Hardware events (--perf) */
+	#define HW_CYCLES        0
+	#define HW_INSTRUCTIONS  1
+	#define HW_LLC_MISSES    2
+	#define HW_BRANCH_MISSES 3
+	#define NHWEVENTS        4
+
+	/** Pair size buckets (log2 of the number of elements of both sets) */
+	#define NBUCKETS 32
+
+	/** Start measuring a pair (only with --stats) */
+	#define STATS_START(ws) if (collect_stats) stats_start(ws)
+
+	/** Charge the time since the last lap to a kernel phase (only with --stats) */
+	#define STATS_LAP(ws, phase) if (collect_stats) stats_lap(ws, phase)
+
+	/** Add calculated pairs to the progress (only with --progress) */
+	#define PROGRESS_ADD(n) if (show_progress) __atomic_fetch_add(&progress_done, (n), __ATOMIC_RELAXED)
 
 	/** Output file descriptor */
 	extern FILE *fpout;
@@ -43,6 +128,30 @@
 	/** Verbose parameter */
 	extern char verbose;
 
+	/** Use the reference kernels */
+	extern char reference;
+
+	/** Output format */
+	extern int outfmt;
+
+	/** Show Np or Ne */
+	extern char show_n;
+
+	/** Number of threads reading cluster set files */
+	extern unsigned long iothreads;
+
+	/** Collect run statistics */
+	extern char collect_stats;
+
+	/** Count hardware events (cleared when they are not available) */
+	extern char hw_counters;
+
+	/** Report progress */
+	extern char show_progress;
+
+	/** Pairs calculated so far (see progress.c) */
+	extern unsigned long progress_done;
+
 
 	/** 
 	 * Congruency matrix:
@@ -66,26 +175,490 @@
 	 * Element structure:
 	 * name Element name
 	 * cluster Number of the cluster which element belongs to
+	 * id Element id (see map_clusterset())
 	 */
 	typedef struct _element {
 		char *name;
 		unsigned long cluster;
+		unsigned long id;
 	} elem_t;
 
+	/**
+	 * Tile of the upper triangle of the congruency matrix:
+	 * rows [row, row+nrows) X columns [col, col+ncols)
+	 */
+	typedef struct _tile {
+		/** first row */
+		unsigned long row;
+		/** first column */
+		unsigned long col;
+		/** number of rows */
+		unsigned long nrows;
+		/** number of columns */
+		unsigned long ncols;
+	} tile_t;
+
+	/**
+	 * Partial result file header (see shard.c)
+	 */
+	typedef struct _partial {
+		/** shard number */
+		unsigned long shard;
+		/** total number of shards */
+		unsigned long nshards;
+		/** congruency index(es) */
+		char cindex;
+		/** flags to show Np or Ne */
+		char flags;
+		/** input manifest fingerprint */
+		unsigned long fingerprint;
+		/** number of clusterset files */
+		unsigned long size;
+		/** clusterset file names */
+		char **names;
+	} partial_t;
+
+	/**
+	 * Checkpoint of a running calculation (see checkpoint.c)
+	 */
+	typedef struct _ckpt {
+		/** checkpoint file */
+		FILE *fp;
+		/** checkpoint file name */
+		const char *filename;
+		/** matrix size */
+		unsigned long size;
+		/** completed pairs (bitmap) of each index */
+		unsigned char *done[NINDEXES];
+		/** number of completed pairs found on resume */
+		unsigned long ndone;
+		/** last synchronization time */
+		time_t last_sync;
+	} ckpt_t;
+
+	/**
+	 * Edge of the sparse output (see sparse.c)
+	 */
+	typedef struct _edge {
+		/** column */
+		unsigned long col;
+		/** congruency */
+		double value;
+	} edge_t;
+
+	/**
+	 * Top-k lists: the k most congruent partners of each row
+	 */
+	typedef struct _topk {
+		/** number of rows */
+		unsigned long size;
+		/** edges per row */
+		unsigned long k;
+		/** number of edges on each row */
+		unsigned long *count;
+		/** edges (one heap of k edges per row) */
+		edge_t *edges;
+	} topk_t;
+
+	/**
+	 * Online statistics (Welford)
+	 */
+	typedef struct _stat {
+		/** number of values */
+		unsigned long n;
+		/** mean */
+		double mean;
+		/** sum of squared deviations */
+		double m2;
+	} stat_t;
+
+	/** Calculate one pair (row i, column j) */
+	typedef double (*pair_fn_t)(unsigned long i, unsigned long j, void *arg);
+	/** Receive one calculated row (upper triangle values, indexed by column) */
+	typedef void (*row_fn_t)(unsigned long i, double *values, void *arg);
+
+	/** Team of threads that calculate one pair together (see team.c) */
+	typedef struct _team team_t;
+	/** Job of a team member (member number, argument) */
+	typedef void (*team_fn_t)(unsigned long t, void *arg);
+
+	/**
+	 * Contingency table of a pair of partitions (common elements only),
+	 * summarized for partition_scores()
+	 */
+	typedef struct _ptable {
+		/** common elements */
+		unsigned long n;
+		/** pairs of elements on the same cluster of both partitions */
+		unsigned long pairs;
+		/** pairs of elements on the same cluster of each partition */
+		unsigned long pairs1, pairs2;
+		/** sum of n log n over the cells of the table */
+		double nlogn;
+		/** sum of n log n over the clusters of each partition */
+		double nlogn1, nlogn2;
+	} ptable_t;
+
+	/**
+	 * Buffered writer (see output.c)
+	 */
+	typedef struct _writer {
+		/** output stream */
+		FILE *stream;
+		/** format of doubles (OUTPUT_TEXT or OUTPUT_ROUNDTRIP) */
+		int format;
+		/** buffer */
+		char *buf;
+		/** used bytes */
+		size_t len;
+		/** buffer size */
+		size_t cap;
+	} writer_t;
+
+	/**
+	 * Name set stripe: open addressing hash table with its own lock
+	 */
+	typedef struct _nstripe {
+		/** names (NULL if slot is empty) */
+		char **slots;
+		/** hash of each name */
+		unsigned long *hashes;
+		/** element id of each name */
+		unsigned long *ids;
+		/** number of slots */
+		unsigned long cap;
+		/** number of names */
+		unsigned long count;
+		/** protects the fields above */
+		pthread_mutex_t lock;
+	} nstripe_t;
+
+	/**
+	 * Name set: concurrent set of element names (see nameset.c)
+	 */
+	typedef struct _nameset {
+		/** stripes */
+		nstripe_t *stripes;
+		/** number of stripes */
+		unsigned long nstripes;
+		/** next element id */
+		unsigned long nextid;
+	} nameset_t;
+
+	/**
+	 * Loaded clusterset
+	 */
+	typedef struct _cset {
+		/** file path */
+		char *path;
+		/** elements (sorted by cluster) */
+		elem_t *elems;
+		/** number of elements */
+		unsigned long size;
+		/** element ids come from the element dictionary */
+		char mapped;
+	} cset_t;
+
+	/** Congruency function of one index (see index_function()) */
+	typedef double (*index_fn_t)(cset_t *c1, cset_t *c2, char flags, double cutoff);
+
+	/**
+	 * Hierarchical clustering tree (see tree.c)
+	 */
+	typedef struct _tree {
+		/** file path */
+		char *path;
+		/** number of leaves */
+		unsigned long nleaves;
+		/** number of leaves with an element id */
+		unsigned long nkept;
+		/** element ids of the leaves (ascending) */
+		unsigned long *ids;
+		/** leaf (in leaf order) of each id */
+		unsigned long *leaves;
+		/** number of merges (internal nodes, in order of height) */
+		unsigned long nmerges;
+		/** children of merge q: children[first[q]] .. children[first[q+1]-1],
+		 *  leaves are nodes 0 .. nleaves-1 and merge q is node nleaves+q */
+		unsigned long *first;
+		unsigned long *children;
+	} tree_t;
+
+	/**
+	 * Clusterset store: clustersets loaded in background (see store.c)
+	 */
+	typedef struct _cstore {
+		/** number of clustersets */
+		unsigned long size;
+		/** clustersets */
+		cset_t *csets;
+		/** element dictionary (elements not in it are dropped, NULL to keep all) */
+		nameset_t *dict;
+		/** new elements are added to the dictionary instead of dropped */
+		char grow;
+		/** corpus stream (NULL when loading from a directory) */
+		FILE *input;
+		/** whole corpus stream was read */
+		char eof;
+		/** corpus stream could not be read */
+		char error;
+		/** allocated clustersets (corpus stream) */
+		unsigned long cap;
+		/** fingerprint of the corpus stream contents */
+		unsigned long fingerprint;
+		/** state of each clusterset */
+		char *state;
+		/** raw file contents waiting to be parsed */
+		char **raw;
+		/** raw file sizes */
+		size_t *rsize;
+		/** files waiting to be parsed (in read order) */
+		unsigned long *queue;
+		/** queue head */
+		unsigned long qhead;
+		/** queue tail */
+		unsigned long qtail;
+		/** next file to be read */
+		unsigned long next_read;
+		/** files read but not parsed yet */
+		unsigned long nraw;
+		/** maximum number of files read but not parsed yet */
+		unsigned long maxraw;
+		/** clustersets parsed */
+		unsigned long nloaded;
+		/** when loading started (--stats) */
+		double started;
+		/** protects the fields above */
+		pthread_mutex_t lock;
+		/** signaled when a file is read or parsed */
+		pthread_cond_t cond;
+		/** reader and parser threads */
+		pthread_t *threads;
+		/** number of threads */
+		unsigned long nthreads;
+	} cstore_t;
+
+	/**
+	 * Run statistics: time of each phase and counters
+	 */
+	typedef struct _runstats {
+		/** wall time of each phase (seconds) */
+		double wall[NPHASES];
+		/** CPU time of each phase (seconds) */
+		double cpu[NPHASES];
+		/** counters */
+		unsigned long count[NCOUNTERS];
+		/** hardware events of each phase */
+		unsigned long long hw[NPHASES][NHWEVENTS];
+		/** pairs of each size bucket */
+		unsigned long bpairs[NBUCKETS];
+		/** thread CPU time of the pairs of each size bucket (seconds) */
+		double btime[NBUCKETS];
+		/** hardware events of the pairs of each size bucket */
+		unsigned long long bhw[NBUCKETS][NHWEVENTS];
+	} runstats_t;
+
+	/**
+	 * Pair kernel workspace: accumulators and scratch vectors reused by
+	 * all pairs calculated by one thread (see kernel.c)
+	 */
+	typedef struct _workspace {
+		/** pair counter (marks elements of the current pair) */
+		unsigned long serial;
+		/** element id capacity */
+		unsigned long idcap;
+		/** elements of each cluster set of the current pair (by id) */
+		unsigned long *mark[2];
+		/** element positions on cluster set 2 (by id) */
+		unsigned long *pos;
+		/** position capacity */
+		unsigned long cap;
+		/** cluster (run) of each position of each cluster set */
+		unsigned long *run[2];
+		/** first position of each cluster */
+		unsigned long *start[2];
+		/** common elements of each cluster */
+		unsigned long *common[2];
+		/** common elements per cluster of set 2 (Ne of h2) */
+		unsigned long *count;
+		/** clusters of set 2 with count > 0 */
+		unsigned long *touched;
+		/** positions being sorted (Ne of h) */
+		unsigned long *vals;
+		/** merge sort scratch */
+		unsigned long *tmp;
+		/** permutation capacity (see perm_prepare()) */
+		unsigned long pcap;
+		/** common elements and clusters of set 1 with common elements */
+		unsigned long pm, prows;
+		/** first common element of each cluster of set 1 (set 1 order) */
+		unsigned long *rstart;
+		/** slot (common element position on set 2) of each common element */
+		unsigned long *slot;
+		/** permuted slots */
+		unsigned long *sigma;
+		/** cluster of set 2 of each slot */
+		unsigned long *scol;
+		/** first slot of each cluster of set 2 */
+		unsigned long *cstart;
+		/** threads that calculate each pair (see split_congruency()) */
+		unsigned long split;
+		/** team and state of split pairs (NULL until a pair is split) */
+		struct _splitter *splitter;
+		/** accumulators */
+		mpz_t Np[2], Ne, maxNp, A;
+		/** ratio operands */
+		mpf_t fnum, fden;
+		/** statistics of the thread */
+		runstats_t stats;
+		/** thread CPU time when the current pair started and at the last lap */
+		double tstart, tlast;
+		/** hardware counters of the thread (-1 if not open) */
+		int hwfd[NHWEVENTS];
+		/** hardware events when the current pair started and at the last lap */
+		unsigned long long hwstart[NHWEVENTS], hwlast[NHWEVENTS];
+	} workspace_t;
+
 	/* Prototypes */
 	cmat_t *create_matrix(unsigned long size);
+	cmat_t *create_matrix_header(unsigned long size);
 	void destroy_matrix(cmat_t *mat);
 	void zero_matrix(cmat_t *mat);
 	void print_matrix(cmat_t *mat, FILE *stream);
+	void matrix_stats(cmat_t *mat, double *mean, double *sd);
+	void print_index_title(char ind, FILE *stream);
+	int index_slot(char ind);
+	const char *index_name(char ind);
+	char parse_indexes(const char *list);
+	void print_results(cmat_t *mat, FILE *stream);
+	void print_stats(double mean, double sd, FILE *stream);
 	int elem_cmp(const void *e1, const void *e2);
 	int cmpstringp(const void *p1, const void *p2);
+	FILE *open_input(const char *filename, char *compressed);
+	char *read_file(const char *filename, size_t *fsize);
+	elem_t *parse_clusterset(char *buffer, size_t fsize, unsigned long *vsize);
 	elem_t *read_clusterset(char *filename, unsigned long *vsize);
 	elem_t *dup_clusterset(elem_t *cset, unsigned long size);
+	unsigned long map_clusterset(elem_t *cset, unsigned long size, nameset_t *dict, char grow);
 	void print_cluterset(char *filename, FILE *stream);
 	void show_clustersets(const char *dirname, FILE *stream);
 	void free_clusterset(elem_t *cset, unsigned long size);
-	char **gen_elements_list(const char *dirname, const char *filename, unsigned long *size);
+	nameset_t *create_nameset(void);
+	int nameset_add(nameset_t *ns, char *name, char take, unsigned long *id);
+	int nameset_find(nameset_t *ns, const char *name, unsigned long *id);
+	unsigned long nameset_count(nameset_t *ns);
+	char **nameset_list(nameset_t *ns, unsigned long *size);
+	char **nameset_names(nameset_t *ns, unsigned long *size);
+	int write_nameset(nameset_t *ns, const char *filename);
+	void destroy_nameset(nameset_t *ns);
 	mpz_t *factorial (unsigned long int n);
 	mpz_t *single_combination (unsigned int n, unsigned int r);
+	double congruency_ratio(mpz_t num, mpz_t den);
+	double congruency_ratio_f(mpz_t num, mpz_t den, mpf_t fnum, mpf_t fden);
+	void ptable_add(double *nlogn, unsigned long *pairs, unsigned long n);
+	void partition_scores(ptable_t *t, double *values);
+	void count_allocations(void);
+	unsigned long allocation_count(void);
+	workspace_t *get_workspace(void);
+	void release_workspace(void);
+	char search_el(char *name, elem_t *clusterset, unsigned long csize);
+	double calculate_congruency1(cset_t *c1, cset_t *c2, char flags, double cutoff);
+	double calculate_congruency2(cset_t *c1, cset_t *c2, char flags, double cutoff);
+	double fast_congruency1(workspace_t *ws, cset_t *c1, cset_t *c2, char flags, double cutoff);
+	double fast_congruency2(workspace_t *ws, cset_t *c1, cset_t *c2, char flags, double cutoff);
+	int fast_partition(workspace_t *ws, cset_t *c1, cset_t *c2, double *values);
+	int perm_prepare(workspace_t *ws, cset_t *c1, cset_t *c2, char ind);
+	void perm_ne(workspace_t *ws, char ind, unsigned long *sigma, mpz_t ne);
+	void set_split(unsigned long n);
+	team_t *create_team(unsigned long n);
+	unsigned long team_size(team_t *team);
+	void team_run(team_t *team, team_fn_t fn, void *arg);
+	void team_sync(team_t *team);
+	void destroy_team(team_t *team);
+	int calculate_partition(cset_t *c1, cset_t *c2, double *values);
+	double calculate_ari(cset_t *c1, cset_t *c2, char flags, double cutoff);
+	double calculate_nmi(cset_t *c1, cset_t *c2, char flags, double cutoff);
+	double calculate_jaccard(cset_t *c1, cset_t *c2, char flags, double cutoff);
+	double calculate_fm(cset_t *c1, cset_t *c2, char flags, double cutoff);
+	index_fn_t index_function(char ind);
+	double stats_clock(void);
+	double thread_cpu(void);
+	void stats_phase(int phase);
+	void stats_time(int phase, double wall, double cpu);
+	void stats_count(int counter, unsigned long n);
+	void stats_start(workspace_t *ws);
+	void stats_lap(workspace_t *ws, int phase);
+	void stats_pair(workspace_t *ws, unsigned long size);
+	void stats_merge(runstats_t *st);
+	int stats_report(const char *filename);
+	int hw_open(int *fd, char inherit);
+	int hw_read(int *fd, char inherit, unsigned long long *values);
+	void hw_close(int *fd);
+	void hw_pairs_begin(void);
+	int hw_pairs_end(unsigned long long *values);
+	int hw_status(void);
+	int progress_start(unsigned long total, const char *filename, unsigned long interval);
+	void progress_stop(void);
+	int parse_shard(const char *str, unsigned long *shard, unsigned long *nshards);
+	unsigned long gen_tiles(unsigned long size, unsigned long shard, unsigned long nshards, tile_t **tiles);
+	unsigned long count_tile_pairs(tile_t *tiles, unsigned long ntiles);
+	void write_partial_header(FILE *fp, cmat_t *mat, unsigned long shard, unsigned long nshards, char cindex, char flags, unsigned long fingerprint);
+	void write_partial_pair(FILE *fp, char ind, unsigned long i, unsigned long j, double value);
+	int read_partial_header(FILE *fp, const char *filename, partial_t *hdr);
+	int read_partial_pair(FILE *fp, char *ind, unsigned long *i, unsigned long *j, double *value);
+	void free_partial_header(partial_t *hdr);
+	int merge_partials(int nfiles, char **files, const char *basename, FILE *stream);
+	unsigned long fnv1a(unsigned long hash, const void *data, size_t len);
+	int manifest_fingerprint(const char *dirname, char **names, unsigned long size, unsigned long *fingerprint);
+	int file_fingerprint(const char *filename, unsigned long *fingerprint);
+	ckpt_t *open_checkpoint(const char *filename, cmat_t *mat, unsigned long shard, unsigned long nshards,
+			char cindex, char flags, unsigned long fingerprint, char resume);
+	char checkpoint_done(ckpt_t *ck, char ind, unsigned long i, unsigned long j);
+	int checkpoint_load(ckpt_t *ck, char ind, cmat_t *mat);
+	void checkpoint_pair(ckpt_t *ck, char ind, unsigned long i, unsigned long j, double value);
+	void sync_checkpoint(ckpt_t *ck);
+	void close_checkpoint(ckpt_t *ck);
+	topk_t *create_topk(unsigned long size, unsigned long k);
+	void destroy_topk(topk_t *tk);
+	double topk_threshold(topk_t *tk, unsigned long row);
+	void topk_add(topk_t *tk, unsigned long i, unsigned long j, double value);
+	void print_topk(topk_t *tk, char **names, FILE *stream);
+	void stat_init(stat_t *st);
+	void stat_add(stat_t *st, double x);
+	void stat_result(stat_t *st, double *mean, double *sd);
+	int parse_output_format(const char *name);
+	int format_fixed(double x, char *buf);
+	int format_shortest(double x, char *buf);
+	writer_t *writer_open(FILE *stream, int format);
+	void writer_flush(writer_t *w);
+	void writer_put(writer_t *w, const char *data, size_t len);
+	void writer_puts(writer_t *w, const char *str);
+	void writer_double(writer_t *w, double x);
+	void writer_close(writer_t *w);
+	int write_binary_matrix(cmat_t *mat, const char *filename, int format);
+	int output_results(cmat_t *mat, char ind, int format, const char *basename, FILE *stream);
+	int calculate_rows(unsigned long size, unsigned long nthreads, pair_fn_t pair, row_fn_t deliver, void *arg);
+	int calculate_tile_rows(unsigned long size, tile_t *tiles, unsigned long ntiles, unsigned long nthreads,
+			pair_fn_t pair, row_fn_t deliver, void *arg);
+	cstore_t *open_store(const char *dirname, char **names, unsigned long size, nameset_t *dict,
+			char grow, unsigned long nreaders, unsigned long nparsers);
+	cstore_t *open_stream_store(const char *filename, nameset_t *dict, char grow);
+	unsigned long store_wait(cstore_t *st);
+	cset_t *store_get(cstore_t *st, unsigned long i);
+	void close_store(cstore_t *st);
+	int run_batch(const char *manifest, char cindex, nameset_t *dict, char grow, unsigned long nworkers);
+	char is_corpus_stream(const char *input);
+	cmat_t *initialize_cmatrix(const char *dirname, char dense);
+	int serve(cstore_t *store, char **names, unsigned long size, nameset_t *dict, const char *path,
+			unsigned long nworkers);
+	int read_tree(const char *filename, nameset_t *dict, char grow, tree_t *tree);
+	void free_tree(tree_t *tree);
+	unsigned long *parse_levels(const char *list, unsigned long *nlevels);
+	int tree_congruency(tree_t *t1, tree_t *t2, char cindex, char flags, unsigned long *levels,
+			unsigned long nlevels, double *values);
+	int calculate_permutation_congruency(cmat_t *mat, cstore_t *store, char ind, unsigned long nperm,
+			unsigned long seed, cmat_t *pmat, cmat_t *zmat, unsigned long nworkers);
+	int calculate_tree_congruency(tree_t *trees, unsigned long ntrees, char cindex, char flags,
+			unsigned long *levels, unsigned long nlevels, cmat_t **mats, unsigned long nworkers);
 
 #endif
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "cmatches.h"
+
+/** Size of the compressed data buffer */
+#define INPUT_BUFFER (1 << 16)
+
+/** Input formats */
+#define INPUT_PLAIN 0
+#define INPUT_GZIP  1
+#define INPUT_ZSTD  2
+
+/**
+ * Decompressing input (see open_input())
+ */
+typedef struct _zinput {
+	/** underlying file */
+	FILE *fp;
+	/** input format */
+	int format;
+	/** bytes read to detect the format, served before the rest of the file */
+	unsigned char magic[4];
+	/** number of magic bytes */
+	size_t nmagic;
+	/** magic bytes already served */
+	size_t pmagic;
+	/** compressed data */
+	unsigned char *in;
+	/** compressed data length */
+	size_t inlen;
+	/** compressed data position */
+	size_t inpos;
+	/** compressed stream ended where the input ended (no truncated data) */
+	char complete;
+#ifdef HAVE_ZLIB
+	/** gzip stream */
+	z_stream zs;
+#endif
+#ifdef HAVE_ZSTD
+	/** zstd stream */
+	ZSTD_DStream *zd;
+#endif
+} zinput_t;
+
+
+/**
+ * \brief Read raw (compressed) data, magic bytes first
+ * \param [in] zi Input
+ * \param [out] buf Buffer
+ * \param [in] size Buffer size
+ * \return size_t Bytes read (0 at end of file)
+ */
+static size_t raw_read(zinput_t *zi, void *buf, size_t size)
+{
+	size_t n;
+
+	n = 0;
+	if (zi->pmagic < zi->nmagic) {
+		n = zi->nmagic - zi->pmagic;
+		if (n > size) {
+			n = size;
+		}
+		memcpy(buf, &zi->magic[zi->pmagic], n);
+		zi->pmagic += n;
+	}
+	if (n < size) {
+		n += fread((char*)buf + n, 1, size - n, zi->fp);
+	}
+	return n;
+}
+
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+/**
+ * \brief Refill the compressed data buffer when it is empty
+ * \param [in] zi Input
+ * \return size_t Compressed bytes available (0 at end of file)
+ */
+static size_t fill_input(zinput_t *zi)
+{
+	if (zi->inpos == zi->inlen) {
+		zi->inlen = raw_read(zi, zi->in, INPUT_BUFFER);
+		zi->inpos = 0;
+	}
+	return zi->inlen - zi->inpos;
+}
+#endif
+
+
+#ifdef HAVE_ZLIB
+/**
+ * \brief Decompress gzip data
+ * \param [in] zi Input
+ * \param [out] buf Buffer
+ * \param [in] size Buffer size
+ * \return ssize_t Bytes decompressed (0 at end of data), -1 on error
+ * \note Concatenated gzip members are read as one stream, like gzip -d does.
+ */
+static ssize_t gzip_read(zinput_t *zi, char *buf, size_t size)
+{
+	int r;
+
+	zi->zs.next_out  = (unsigned char *)buf;
+	zi->zs.avail_out = size;
+	while (zi->zs.avail_out > 0) {
+		if (fill_input(zi) == 0) {
+			if (!zi->complete) {
+				fprintf(stderr, "Compressed input is truncated.\n");
+				errno = EIO;
+				return -1;
+			}
+			break;
+		}
+		zi->zs.next_in  = &zi->in[zi->inpos];
+		zi->zs.avail_in = zi->inlen - zi->inpos;
+
+		r = inflate(&zi->zs, Z_NO_FLUSH);
+		zi->inpos    = zi->inlen - zi->zs.avail_in;
+		zi->complete = 0;
+		if (r == Z_STREAM_END) {
+			/* Next member (if any) */
+			inflateReset(&zi->zs);
+			zi->complete = 1;
+		} else if (r != Z_OK && r != Z_BUF_ERROR) {
+			fprintf(stderr, "Corrupted gzip input: %s\n", (zi->zs.msg != NULL) ? zi->zs.msg : "error");
+			errno = EIO;
+			return -1;
+		}
+	}
+	return size - zi->zs.avail_out;
+}
+#endif
+
+
+#ifdef HAVE_ZSTD
+/**
+ * \brief Decompress zstd data
+ * \param [in] zi Input
+ * \param [out] buf Buffer
+ * \param [in] size Buffer size
+ * \return ssize_t Bytes decompressed (0 at end of data), -1 on error
+ */
+static ssize_t zstd_read(zinput_t *zi, char *buf, size_t size)
+{
+	ZSTD_inBuffer ib;
+	ZSTD_outBuffer ob;
+	size_t r;
+
+	ob.dst  = buf;
+	ob.size = size;
+	ob.pos  = 0;
+	while (ob.pos < ob.size) {
+		if (fill_input(zi) == 0) {
+			if (!zi->complete) {
+				fprintf(stderr, "Compressed input is truncated.\n");
+				errno = EIO;
+				return -1;
+			}
+			break;
+		}
+		ib.src  = zi->in;
+		ib.size = zi->inlen;
+		ib.pos  = zi->inpos;
+
+		r = ZSTD_decompressStream(zi->zd, &ob, &ib);
+		zi->inpos = ib.pos;
+		if (ZSTD_isError(r)) {
+			fprintf(stderr, "Corrupted zstd input: %s\n", ZSTD_getErrorName(r));
+			errno = EIO;
+			return -1;
+		}
+		/* 0 means a frame is complete */
+		zi->complete = (r == 0);
+	}
+	return ob.pos;
+}
+#endif
+
+
+/**
+ * \brief Read function of the input stream
+ */
+static ssize_t zinput_read(void *cookie, char *buf, size_t size)
+{
+	zinput_t *zi = cookie;
+
+	switch (zi->format) {
+#ifdef HAVE_ZLIB
+		case INPUT_GZIP:
+			return gzip_read(zi, buf, size);
+#endif
+#ifdef HAVE_ZSTD
+		case INPUT_ZSTD:
+			return zstd_read(zi, buf, size);
+#endif
+		default:
+			return raw_read(zi, buf, size);
+	}
+}
+
+
+/**
+ * \brief Close function of the input stream
+ */
+static int zinput_close(void *cookie)
+{
+	zinput_t *zi = cookie;
+	int ret = 0;
+
+#ifdef HAVE_ZLIB
+	if (zi->format == INPUT_GZIP) {
+		inflateEnd(&zi->zs);
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (zi->format == INPUT_ZSTD) {
+		ZSTD_freeDStream(zi->zd);
+	}
+#endif
+	if (zi->fp != stdin) {
+		ret = fclose(zi->fp);
+	}
+	free(zi->in);
+	free(zi);
+	return ret;
+}
+
+
+/**
+ * \brief Detect the input format from the magic bytes
+ * \param [in] magic First bytes of the file
+ * \param [in] n Number of bytes
+ * \return int Input format (INPUT_*)
+ */
+static int detect_format(const unsigned char *magic, size_t n)
+{
+	if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+		return INPUT_GZIP;
+	}
+	if (n >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+		return INPUT_ZSTD;
+	}
+	return INPUT_PLAIN;
+}
+
+
+/**
+ * \brief Open an input file, decompressing it on the fly when it is
+ *        gzip or zstd compressed (detected by magic bytes)
+ * \param [in] filename File name ("-" for standard input)
+ * \param [out] compressed Set to 1 if data goes through the decompressor, so
+ *        its size is not known (may be NULL)
+ * \return FILE* Input stream (close with fclose), NULL on error
+ * \note Plain regular files are returned as they are, so they can be
+ *       seeked. Nothing is decompressed to disk.
+ */
+FILE *open_input(const char *filename, char *compressed)
+{
+	cookie_io_functions_t io = { zinput_read, NULL, NULL, zinput_close };
+	zinput_t *zi;
+	struct stat st;
+	FILE *fp, *zfp;
+
+	if (compressed != NULL) {
+		*compressed = 0;
+	}
+
+	if (strcmp(filename, "-") == 0) {
+		fp = stdin;
+	} else if ((fp = fopen(filename, "r")) == NULL) {
+		return NULL;
+	}
+
+	zi = calloc(1, sizeof(zinput_t));
+	if (zi == NULL) {
+		if (fp != stdin) fclose(fp);
+		return NULL;
+	}
+	zi->fp     = fp;
+	zi->nmagic = fread(zi->magic, 1, sizeof(zi->magic), fp);
+	zi->format = detect_format(zi->magic, zi->nmagic);
+
+	if (zi->format == INPUT_PLAIN && fp != stdin &&
+			fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)) {
+		/* Plain file: no need to go through the stream */
+		free(zi);
+		rewind(fp);
+		return fp;
+	}
+
+	zi->complete = 1;
+	zi->in = malloc(INPUT_BUFFER);
+	if (zi->in == NULL) {
+		zi->format = INPUT_PLAIN;
+		zinput_close(zi);
+		return NULL;
+	}
+
+	switch (zi->format) {
+		case INPUT_GZIP:
+#ifdef HAVE_ZLIB
+			if (inflateInit2(&zi->zs, 15 + 16) != Z_OK) {
+				zi->format = INPUT_PLAIN;
+				zinput_close(zi);
+				errno = ENOMEM;
+				return NULL;
+			}
+			break;
+#else
+			fprintf(stderr, "%s: gzip support was not built in (build with ZLIB=1).\n", filename);
+			zinput_close(zi);
+			errno = ENOTSUP;
+			return NULL;
+#endif
+
+		case INPUT_ZSTD:
+#ifdef HAVE_ZSTD
+			zi->zd = ZSTD_createDStream();
+			if (zi->zd == NULL || ZSTD_isError(ZSTD_initDStream(zi->zd))) {
+				zinput_close(zi);
+				errno = ENOMEM;
+				return NULL;
+			}
+			break;
+#else
+			fprintf(stderr, "%s: zstd support was not built in (build with ZSTD=1).\n", filename);
+			zinput_close(zi);
+			errno = ENOTSUP;
+			return NULL;
+#endif
+
+		default:
+			break;
+	}
+
+	zfp = fopencookie(zi, "r", io);
+	if (zfp == NULL) {
+		zinput_close(zi);
+		return NULL;
+	}
+	if (compressed != NULL) {
+		*compressed = 1;
+	}
+	return zfp;
+}
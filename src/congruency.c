@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gmp.h>
+#include "cmatches.h"
+
+/**
+ * \brief Search for an element on the cluster set
+ * \param [in] name 
+ * \param [in] clusterset
+ * \param [in] csize Clusterset size
+ * return char 1 if element was found, 0 otherwise
+ */
+char search_el(char *name, elem_t *clusterset, unsigned long csize)
+{
+	unsigned long i;
+	for (i = 0; i < csize; i++) {
+		if (strcmp(name, clusterset[i].name) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* Tracing kernels (-v) */
+#define KERNEL_TRACE 1
+#include "congruency.h"
+#undef KERNEL_TRACE
+
+/* Kernels without trace */
+#define KERNEL_TRACE 0
+#include "congruency.h"
+#undef KERNEL_TRACE
+
+
+/**
+ *  Calculate pair-to-pair congruency (h) between two cluster sets
+ *  \param [in] c1 Cluster set 1
+ *  \param [in] c2 Cluster set 2
+ *  \param [in] flags Flags to show Np or Ne
+ *  \param [in] cutoff Skip Ne calculation when h is known to be lower than cutoff
+ *  \return double Congruency (H_PRUNED if Ne calculation was skipped)
+ *  \note The verbose flag is checked once per pair: the kernels themselves
+ *        have no verbose branches. With --reference, the fast kernel is not
+ *        used.
+ */
+double calculate_congruency1(cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	workspace_t *ws;
+	double h;
+
+	if (c1 == NULL || c2 == NULL) {
+		return -1;
+	}
+	if (c1->size == 0 || c2->size == 0) {
+		/* No listed elements */
+		return 0;
+	}
+	ws = get_workspace();
+	if (ws != NULL) {
+		ws->stats.count[COUNT_PAIRS]++;
+	}
+	if (!verbose && !reference) {
+		h = fast_congruency1(ws, c1, c2, flags, cutoff);
+		if (h != H_FALLBACK) {
+			if (collect_stats) {
+				stats_pair(ws, c1->size + c2->size);
+			}
+			return h;
+		}
+	}
+	if (ws != NULL) {
+		ws->stats.count[COUNT_NAMEPAIRS]++;
+	}
+	if (verbose) {
+		return congruency1_trace(c1, c2, flags, cutoff);
+	}
+	return congruency1_quiet(c1, c2, flags, cutoff);
+}
+
+
+/**
+ *  \brief Calculate complete congruency index between two cluster sets
+ *  \param [in] c1 Cluster set 1
+ *  \param [in] c2 Cluster set 2
+ *  \param [in] flags Flags to show Np or Ne
+ *  \param [in] cutoff Skip Ne calculation when h2 is known to be lower than cutoff
+ *  \return double Congruency (H_PRUNED if Ne calculation was skipped)
+ *  \note The verbose flag is checked once per pair: the kernels themselves
+ *        have no verbose branches. With --reference, the fast kernel is not
+ *        used.
+ */
+double calculate_congruency2(cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	workspace_t *ws;
+	double h;
+
+	if (c1 == NULL || c2 == NULL) {
+		return -1;
+	}
+	if (c1->size == 0 || c2->size == 0) {
+		/* No listed elements */
+		return 0;
+	}
+	ws = get_workspace();
+	if (ws != NULL) {
+		ws->stats.count[COUNT_PAIRS]++;
+	}
+	if (!verbose && !reference) {
+		h = fast_congruency2(ws, c1, c2, flags, cutoff);
+		if (h != H_FALLBACK) {
+			if (collect_stats) {
+				stats_pair(ws, c1->size + c2->size);
+			}
+			return h;
+		}
+	}
+	if (ws != NULL) {
+		ws->stats.count[COUNT_NAMEPAIRS]++;
+	}
+	if (verbose) {
+		return congruency2_trace(c1, c2, flags, cutoff);
+	}
+	return congruency2_quiet(c1, c2, flags, cutoff);
+}
+
+
+/**
+ * Clusters of one common element (see partition_names())
+ */
+typedef struct _pcell {
+	/** cluster on cluster set 1 */
+	unsigned long c1;
+	/** cluster on cluster set 2 */
+	unsigned long c2;
+} pcell_t;
+
+
+/**
+ * \brief Sort common elements by cluster on cluster set 1, then on 2
+ */
+static int pcell_cmp12(const void *a, const void *b)
+{
+	const pcell_t *p = a, *q = b;
+
+	if (p->c1 != q->c1) {
+		return (p->c1 < q->c1) ? -1 : 1;
+	}
+	return (p->c2 < q->c2) ? -1 : (p->c2 > q->c2);
+}
+
+
+/**
+ * \brief Sort common elements by cluster on cluster set 2
+ */
+static int pcell_cmp2(const void *a, const void *b)
+{
+	const pcell_t *p = a, *q = b;
+
+	return (p->c2 < q->c2) ? -1 : (p->c2 > q->c2);
+}
+
+
+/**
+ * \brief Partition indexes of a pair working on names (pairs the
+ *        allocation free kernel can not handle, and --reference)
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [out] values Indexes (see partition_scores())
+ * \return int 0 on success, -1 otherwise
+ * \note A name repeated in a cluster set counts once, on its first cluster.
+ */
+static int partition_names(cset_t *c1, cset_t *c2, double *values)
+{
+	unsigned long i, j, k, m;
+	pcell_t *cells;
+	ptable_t t;
+
+	cells = malloc(sizeof(pcell_t) * ((c1->size > 0) ? c1->size : 1));
+	if (cells == NULL) {
+		perror("calculate_partition");
+		return -1;
+	}
+
+	/* Clusters of each common element */
+	m = 0;
+	for (i = 0; i < c1->size; i++) {
+		if (search_el(c1->elems[i].name, c1->elems, i)) {
+			continue;
+		}
+		for (j = 0; j < c2->size; j++) {
+			if (strcmp(c1->elems[i].name, c2->elems[j].name) == 0) {
+				cells[m].c1 = c1->elems[i].cluster;
+				cells[m].c2 = c2->elems[j].cluster;
+				m++;
+				break;
+			}
+		}
+	}
+
+	memset(&t, 0, sizeof(ptable_t));
+	t.n = m;
+
+	/* Cells and clusters of cluster set 1 */
+	qsort(cells, m, sizeof(pcell_t), pcell_cmp12);
+	for (i = 0; i < m; i = k) {
+		for (k = i; k < m && cells[k].c1 == cells[i].c1; k++);
+		ptable_add(&t.nlogn1, &t.pairs1, k - i);
+	}
+	for (i = 0; i < m; i = k) {
+		for (k = i; k < m && pcell_cmp12(&cells[k], &cells[i]) == 0; k++);
+		ptable_add(&t.nlogn, &t.pairs, k - i);
+	}
+
+	/* Clusters of cluster set 2 */
+	qsort(cells, m, sizeof(pcell_t), pcell_cmp2);
+	for (i = 0; i < m; i = k) {
+		for (k = i; k < m && cells[k].c2 == cells[i].c2; k++);
+		ptable_add(&t.nlogn2, &t.pairs2, k - i);
+	}
+
+	free(cells);
+	partition_scores(&t, values);
+	return 0;
+}
+
+
+/**
+ * \brief Calculate the partition indexes of two cluster sets (adjusted
+ *        Rand index, NMI, Jaccard and Fowlkes-Mallows) over their common
+ *        elements
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [out] values NPARTITION indexes (order of the INDEX_* bits)
+ * \return int 0 on success, -1 otherwise (values are set to -1)
+ */
+int calculate_partition(cset_t *c1, cset_t *c2, double *values)
+{
+	workspace_t *ws;
+	int k;
+
+	for (k = 0; k < NPARTITION; k++) {
+		values[k] = -1;
+	}
+	if (c1 == NULL || c2 == NULL) {
+		return -1;
+	}
+	if (c1->size == 0 || c2->size == 0) {
+		/* No listed elements */
+		for (k = 0; k < NPARTITION; k++) {
+			values[k] = 0;
+		}
+		return 0;
+	}
+	ws = get_workspace();
+	if (ws != NULL) {
+		ws->stats.count[COUNT_PAIRS]++;
+	}
+	if (!reference && fast_partition(ws, c1, c2, values) == 0) {
+		if (collect_stats) {
+			stats_pair(ws, c1->size + c2->size);
+		}
+		return 0;
+	}
+	if (ws != NULL) {
+		ws->stats.count[COUNT_NAMEPAIRS]++;
+	}
+	return partition_names(c1, c2, values);
+}
+
+
+/**
+ * \brief Adjusted Rand index of two cluster sets (see calculate_partition())
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [in] flags Not used
+ * \param [in] cutoff Not used
+ * \return double Index, -1 on error
+ */
+double calculate_ari(cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	double values[NPARTITION];
+
+	calculate_partition(c1, c2, values);
+	return values[0];
+}
+
+
+/**
+ * \brief Normalized mutual information of two cluster sets (see
+ *        calculate_partition())
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [in] flags Not used
+ * \param [in] cutoff Not used
+ * \return double Index, -1 on error
+ */
+double calculate_nmi(cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	double values[NPARTITION];
+
+	calculate_partition(c1, c2, values);
+	return values[1];
+}
+
+
+/**
+ * \brief Jaccard index of two cluster sets (see calculate_partition())
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [in] flags Not used
+ * \param [in] cutoff Not used
+ * \return double Index, -1 on error
+ */
+double calculate_jaccard(cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	double values[NPARTITION];
+
+	calculate_partition(c1, c2, values);
+	return values[2];
+}
+
+
+/**
+ * \brief Fowlkes-Mallows index of two cluster sets (see
+ *        calculate_partition())
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [in] flags Not used
+ * \param [in] cutoff Not used
+ * \return double Index, -1 on error
+ */
+double calculate_fm(cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	double values[NPARTITION];
+
+	calculate_partition(c1, c2, values);
+	return values[3];
+}
+
+
+/**
+ * \brief Congruency function of an index
+ * \param [in] ind Congruency index (one INDEX_* bit)
+ * \return index_fn_t Function, NULL if ind is not one index
+ */
+index_fn_t index_function(char ind)
+{
+	switch (ind) {
+		case INDEX_P2P:
+			return calculate_congruency1;
+		case INDEX_COMP:
+			return calculate_congruency2;
+		case INDEX_ARI:
+			return calculate_ari;
+		case INDEX_NMI:
+			return calculate_nmi;
+		case INDEX_JACCARD:
+			return calculate_jaccard;
+		case INDEX_FM:
+			return calculate_fm;
+		default:
+			return NULL;
+	}
+}
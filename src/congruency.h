@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Congruency kernels working on element names. This file is included by
+ * congruency.c once for each variant:
+ *
+ *   KERNEL_TRACE 1: explanatory trace (-v) is written to fpout
+ *   KERNEL_TRACE 0: no trace at all (pairs the allocation free kernels
+ *                   can not handle)
+ *
+ * KERNEL(name) gives the name of the function of each variant.
+ */
+
+#if KERNEL_TRACE
+	#define KERNEL(name) name##_trace
+	#define trace_info(...) fprintf(fpout, __VA_ARGS__)
+	#define gmp_trace_info(...) gmp_fprintf(fpout, __VA_ARGS__)
+#else
+	#define KERNEL(name) name##_quiet
+	/* Dead code, dropped by the compiler (arguments still count as used) */
+	#define trace_info(...) if (0) fprintf(fpout, __VA_ARGS__)
+	#define gmp_trace_info(...) if (0) gmp_fprintf(fpout, __VA_ARGS__)
+#endif
+
+/**
+ *  Calculate pair-to-pair congruency (h) between two cluster sets (original
+ *  algorithm, works on names)
+ *  \param [in] c1 Cluster set 1
+ *  \param [in] c2 Cluster set 2
+ *  \param [in] flags Flags to show Np or Ne
+ *  \param [in] cutoff Skip Ne calculation when h is known to be lower than cutoff
+ *  \return double Congruency (H_PRUNED if Ne calculation was skipped)
+ */
+static double KERNEL(congruency1)(cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	unsigned long i, j, k, l;
+	unsigned long csize1, csize2, csizeA, csizeB;
+	unsigned long common_el;
+	mpz_t *T;
+	mpz_t maxNp, Ne, Np[2];
+	elem_t *cset1, *cset2;
+	elem_t *csetA, *csetB;
+	char *file1, *file2, *fileA, *fileB, *e1, *e2;
+	int x;
+	double h;
+
+	cset1  = c1->elems;
+	csize1 = c1->size;
+	file1  = c1->path;
+	cset2  = c2->elems;
+	csize2 = c2->size;
+	file2  = c2->path;
+
+	mpz_init(Ne);
+	mpz_init(maxNp);
+	mpz_init(Np[0]);
+	mpz_init(Np[1]);
+
+	/* Here we first analyzes clusterset1 X clusterset2, and then,
+	   on the second iteration we make clusterset2 X clusterset1 analyzes */
+	csetA  = cset1;
+	csizeA = csize1;
+	fileA  = file1;
+	csetB  = cset2;
+	csizeB = csize2;
+	fileB  = file2;
+	for (x = 0; x < 2; x++) {
+		trace_info("\n=========================================\n");
+		trace_info("Clustersets: %s X %s\n", fileA, fileB);
+
+		/* analyzes first cluster set */
+		i = k = 0;
+		mpz_set_ui(Np[x], 0);
+		while(i <= csizeA) {
+			while((csetA[k].cluster == csetA[i].cluster) && i < csizeA) i++;
+
+			/* Check elements of the cluster which is common to the elements of other cluster set */
+			trace_info("\n================\n");
+			trace_info("Cluster found:\n");
+		
+			common_el = 0;
+			for (j = k; j < i; j++) {
+				if (search_el(csetA[j].name, csetB, csizeB) == 1) {
+					common_el++;
+				}
+				trace_info("    %10s | %ld\n", csetA[j].name, csetA[j].cluster);
+			}
+			T = single_combination(common_el, 2);
+			mpz_add(Np[x], Np[x], *T);
+			k = i;
+			i++;
+
+			trace_info("----------------\n");
+			trace_info("C. Elements = %ld\n", common_el);
+			gmp_trace_info("         Nk = %Zd\n", *T);
+			trace_info("----------------\n");
+
+			mpz_clear(*T);
+			free(T);
+		}
+		gmp_trace_info("T[%d] = %Zd\n", x, Np[x]);
+	
+		/* switch clustersets */
+		csetA  = cset2;
+		csizeA = csize2;
+		fileA  = file2;
+		csetB  = cset1;
+		csizeB = csize1;
+		fileB  = file1;
+	}
+
+	if (mpz_cmp(Np[0], Np[1]) > 0) {
+		mpz_set(maxNp, Np[0]);
+	} else {
+		mpz_set(maxNp, Np[1]);
+	}
+
+	if ((flags & SHOW_NP)) {
+		return mpz_get_d(maxNp);
+	}
+
+	/* Every pair counted by Ne is counted by T[1] and T[2] as well, so
+	   h <= min{T[1], T[2]} / max{T[1], T[2]} */
+	if (cutoff > 0 && congruency_ratio((mpz_cmp(Np[0], Np[1]) > 0) ? Np[1] : Np[0], maxNp) < cutoff) {
+		mpz_clear(Ne);
+		mpz_clear(maxNp);
+		mpz_clear(Np[0]);
+		mpz_clear(Np[1]);
+		return H_PRUNED;
+	}
+
+	/* Calculate common clusters, i.e., present in both clustersets */
+	mpz_set_ui(Ne, 0);
+	for (i = 0; i < csize1; i++) {
+		e1 = cset1[i].name;
+		for (j = i+1; j < csize1; j++) {
+			/* We test all possible pair combination in clusterset 1 */
+			e2 = cset1[j].name;
+
+			/* are they on the same cluster ? */
+			if (cset1[i].cluster == cset1[j].cluster) {
+				/* Yes, lets try to find same pair on clusterset 2 */
+				for (k = 0; k < csize2; k++) {
+					for (l = k+1; l < csize2; l++) {
+						if (cset2[k].cluster == cset2[l].cluster) {
+							if (strcmp(e1, cset2[k].name) == 0 &&
+									strcmp(e2, cset2[l].name) == 0) {
+								mpz_add_ui(Ne, Ne, 1);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if ((flags & SHOW_NE)) {
+		return mpz_get_d(Ne);
+	}
+
+	/* Finnaly, calculate congruency */
+	h = congruency_ratio(Ne, maxNp);
+
+	trace_info("============= pair-to-pair congruency (h) =============\n");
+	gmp_trace_info("               Ne = %Zd\n", Ne);
+	gmp_trace_info("max{T[1], T[2]} = %Zd\n", maxNp);
+	trace_info("                h = %f\n",  h);
+	trace_info("\n\n");
+
+	mpz_clear(Ne);
+	mpz_clear(maxNp);
+	mpz_clear(Np[0]);
+	mpz_clear(Np[1]);
+
+	return h;
+}
+
+
+/**
+ *  \brief Calculate complete congruency index between two cluster sets
+ *         (original algorithm, works on names)
+ *  \param [in] c1 Cluster set 1
+ *  \param [in] c2 Cluster set 2
+ *  \param [in] flags Flags to show Np or Ne
+ *  \param [in] cutoff Skip Ne calculation when h2 is known to be lower than cutoff
+ *  \return double Congruency (H_PRUNED if Ne calculation was skipped)
+ */
+static double KERNEL(congruency2)(cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	unsigned long i, j, k, l, p, q;
+	unsigned long csize1, csize2, csizeA, csizeB, csizeC;
+	unsigned long common_el, num_el;
+	mpz_t A, *c, Np[2], Ne, maxNp;
+	elem_t *cset1, *cset2;
+	elem_t *csetA, *csetB;
+	elem_t *caux;
+	char *file1, *file2, *fileA, *fileB, **elements;
+	int x;
+	double h;
+	char is_common;
+
+	cset1  = c1->elems;
+	csize1 = c1->size;
+	file1  = c1->path;
+	cset2  = c2->elems;
+	csize2 = c2->size;
+	file2  = c2->path;
+	
+	mpz_init(A);
+	mpz_init(Np[0]);
+	mpz_init(Np[1]);
+	mpz_init(Ne);
+	mpz_init(maxNp);
+
+	/* Here we first analyzes clusterset1 X clusterset2, and then,
+	   on the second iteration we make clusterset2 X clusterset1 analyzes */
+	csetA  = cset1;
+	csizeA = csize1;
+	fileA  = file1;
+	csetB  = cset2;
+	csizeB = csize2;
+	fileB  = file2;
+	for (x = 0; x < 2; x++) {
+		trace_info("\n=========================================\n");
+		trace_info("Clustersets: %s X %s\n", fileA, fileB);
+
+		/* We copy all elements from clusterset2 to count common elements without repetition */
+		elements = malloc(sizeof(char*) * csizeB);
+		if (elements == NULL) {
+			perror("calculate_congruency2()");
+			return -1;
+		}
+		for (i = 0; i < csizeB; i++) {
+			elements[i] = strdup(csetB[i].name);
+		}
+
+		/* analyzes first cluster set */
+		i = k = 0;
+		mpz_set_ui(Np[x], 0);
+		while(i <= csizeA) {
+			while((csetA[k].cluster == csetA[i].cluster) && i < csizeA) i++;
+
+			/* Check elements of the cluster which is common to the elements of other cluster set */
+			trace_info("\n================\n");
+			trace_info("Cluster found:\n");
+		
+			common_el = 0;
+			for (j = k; j < i; j++) {
+				for (l = 0; l < csizeB; l++) {
+					if (elements[l] != NULL && csetA[j].name != NULL) {
+						if (strcmp(csetA[j].name, elements[l]) == 0) {
+							common_el++;
+							free(elements[l]);
+							elements[l] = NULL;
+							break;
+						}
+					}
+				}
+				trace_info("    %10s | %ld\n", csetA[j].name, csetA[j].cluster);
+			}
+			num_el = (i - k);
+
+			/* Calculate A */
+			mpz_set_ui(A, 0);
+			for (l = 1; l <= common_el; l++) {
+				c = single_combination(common_el, l);
+				mpz_add(A, A, *c);
+
+				gmp_trace_info("(%ld/%ld)=%Zd ", common_el, l, *c);
+
+				mpz_clear(*c);
+				free(c);
+			}
+			trace_info("\n");
+			mpz_add(Np[x], Np[x], A);
+			k = i;
+			i++;
+
+			trace_info("----------------\n");
+			trace_info("C. Elements = %ld\n", common_el);
+			gmp_trace_info("          A = %Zd\n", A);
+			trace_info("----------------\n");
+		}
+		for (l = 0; l < csizeB; l++) {
+			if (elements[l] != NULL) {
+				free(elements[l]);
+			}
+		}
+		free(elements);
+
+		gmp_trace_info("Np = %Zd\n", Np[x]);
+	
+		/* switch clustersets */
+		csetA  = cset2;
+		csizeA = csize2;
+		fileA  = file2;
+		csetB  = cset1;
+		csizeB = csize1;
+		fileB  = file1;
+	}
+
+	if (mpz_cmp(Np[0], Np[1]) > 0) {
+		mpz_set(maxNp, Np[0]);
+	} else {
+		mpz_set(maxNp, Np[1]);
+	}
+
+	if ((flags & SHOW_NP)) {
+		return mpz_get_d(maxNp);
+	}
+
+	/* Ne subsets are subsets of common elements of a single cluster, so
+	   h2 <= min{Np[1], Np[2]} / max{Np[1], Np[2]} */
+	if (cutoff > 0 && congruency_ratio((mpz_cmp(Np[0], Np[1]) > 0) ? Np[1] : Np[0], maxNp) < cutoff) {
+		mpz_clear(A);
+		mpz_clear(Np[0]);
+		mpz_clear(Np[1]);
+		mpz_clear(Ne);
+		mpz_clear(maxNp);
+		return H_PRUNED;
+	}
+
+	/* Ne calculation:
+	 *	- First we copy both clustersets
+	 *	- Each clusterset is analysed, removing non common elements
+	 *	- Only common elements will remain on each clusterset
+	 *  - We count the congruency for each cluster
+	 */
+	trace_info("\n-------------- Ne ---------------\n");
+
+	csizeA = csize1; 
+	csetA  = dup_clusterset(cset1, csize1);
+	csizeB = csize2;
+	csetB  = dup_clusterset(cset2, csize2);
+
+	for (x = 0; x < 2; x++) {
+		/* We copy all elements from clusterset2 to count common elements without repetition */
+		elements = malloc(sizeof(char*) * csizeB);
+		if (elements == NULL) {
+			perror("calculate_congruency2()");
+			return -1;
+		}
+		for (i = 0; i < csizeB; i++) {
+			elements[i] = strdup(csetB[i].name);
+		}
+
+		i = k = 0;
+		while(i <= csizeA) {
+			while((csetA[k].cluster == csetA[i].cluster) && i < csizeA) i++;
+		
+			for (p = k; p < i; p++) {
+				is_common = 0;
+				for (l = 0; l < csizeB; l++) {
+					if (elements[l] != NULL) {
+						if (strcmp(csetA[p].name, elements[l]) == 0) {
+							free(elements[l]);
+							elements[l] = NULL;
+							is_common = 1;
+							break;
+						}
+					}
+				}
+				if (!is_common) {
+					/* Mark element to be removed */
+					free(csetA[p].name);
+					csetA[p].name = NULL;
+					csetA[p].cluster = FAKE_CLUSTER;
+				}
+
+			}
+			k = i;
+			i++;
+		}
+		qsort(csetA, csizeA, sizeof(elem_t), elem_cmp);
+		k = csizeA;
+		for (i = (k-1); i > 0; i--) {
+			if (csetA[i].name == NULL && csetA[i].cluster == FAKE_CLUSTER) {
+				csizeA--;
+			}
+		}
+		if (csizeA < k) {
+			caux = realloc(csetA, sizeof(elem_t) * csizeA); 
+			if (caux == NULL) {
+				perror("calculate_congruency2()");
+			} else {
+				csetA = caux;
+			}
+		}
+		
+		for (i = 0; i < csizeB; i++) {
+			if (elements[i] != NULL) {
+				free(elements[i]);
+			}
+		}
+		free(elements);
+
+		caux   = csetA;
+		csizeC = csizeA;
+		csetA  = csetB;
+		csizeA = csizeB;
+		csetB  = caux;
+		csizeB = csizeC;
+	}
+
+	/* Finally, we just count congruences */
+	i = k = 0;
+	mpz_set_ui(Ne, 0);
+	while(i <= csizeA) {
+		while((csetA[k].cluster == csetA[i].cluster) && i < csizeA) i++;
+
+		trace_info("C1 cluster: ");
+		for (p = k; p < i; p++) {
+			trace_info("%s ", cset1[p].name);
+		}
+		trace_info("\n------\n");
+
+		j = l = 0;
+		mpz_set_ui(A, 0);
+		while(j <= csizeB) {
+			while((csetB[l].cluster == csetB[j].cluster) && j < csizeB) j++;
+
+			/* Count common elements */
+			num_el = 0;
+			for (p = l; p < j; p++) {
+				for (q = k; q < i; q++) {
+					if (csetA[q].name != NULL) {
+						if (strcmp(csetB[p].name, csetA[q].name) == 0) {
+							num_el++;
+							free(csetA[q].name);
+							csetA[q].name = NULL;
+							break;
+						}
+					}
+				}
+
+				trace_info("C2: %s | %ld\n", csetB[p].name, csetB[p].cluster);
+			}
+			if (num_el == 1) {
+				if((i-k) > 1 && (j-l) > 1) {
+					num_el = 0;
+				} else if ((i-k) != (j-l)) {
+					num_el = 0;
+				}
+			}
+
+			trace_info("Common: %ld\n", num_el);
+			for (q = 1; q <= num_el; q++) {
+				c  = single_combination(num_el, q);
+				mpz_add(A, A, *c);
+			
+				gmp_trace_info("(%ld/%ld)=%Zd ", num_el, q, *c);
+				
+				mpz_clear(*c);
+				free(c);
+			} trace_info("\n\n");
+
+			l = j;
+			j++;
+		}
+	
+		mpz_add(Ne, Ne, A);
+
+		k = i;
+		i++;
+	}
+
+	if ((flags & SHOW_NE)) {
+		return mpz_get_d(Ne);
+	}
+
+	/* Finally, calculate congruency */
+	h = congruency_ratio(Ne, maxNp);
+
+	trace_info("============= complete congruency (h) =============\n");
+	gmp_trace_info("               Ne = %Zd\n", Ne);
+	gmp_trace_info("max{Np[1], Np[2]} = %Zd\n", maxNp);
+	trace_info("               h2 = %f\n",  h);
+	trace_info("\n\n");
+
+	mpz_clear(A);
+	mpz_clear(Np[0]);
+	mpz_clear(Np[1]);
+	mpz_clear(Ne);
+	mpz_clear(maxNp);
+
+	free_clusterset(csetA, csizeA);
+	free_clusterset(csetB, csizeB);
+	return h;
+}
+
+
+#undef KERNEL
+#undef trace_info
+#undef gmp_trace_info
@@ -0,0 +1,1244 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <gmp.h>
+#include "cmatches.h"
+
+/** Initial workspace capacity (elements) */
+#define WORKSPACE_ELEMS 1024
+
+/** Pairs with less elements (both cluster sets) are not split */
+#define SPLIT_ELEMS (1UL << 16)
+
+/**
+ * Team that calculates the pairs of one thread (see split_congruency())
+ */
+typedef struct _splitter {
+	/** team (the thread that owns the splitter is member 0) */
+	team_t *team;
+	/** number of members */
+	unsigned long n;
+	/** workspace of member 0: marks, positions and clusters of the pair */
+	workspace_t *ws;
+	/** pair */
+	cset_t *c[2];
+	/** index (INDEX_P2P or INDEX_COMP) and flags */
+	char ind, flags;
+	/** cutoff */
+	double cutoff;
+	/** first cluster of each member range (n + 1 per cluster set) */
+	unsigned long *first[2];
+	/** biggest element id of each member range */
+	unsigned long *maxid;
+	/** Np and Ne of each member (h) */
+	unsigned long *np[2], *ne;
+	/** workspace of each member (partial sums of h2) */
+	workspace_t **tws;
+	/** pair must go through the original kernels (found before and while
+	 * marking elements: flags read after a barrier are not written by the
+	 * phase that follows it) */
+	char fallback, repeated;
+	/** result is known before Ne (Np shown or pair pruned) */
+	char done;
+	/** result */
+	double result;
+} splitter_t;
+
+/** Heap allocations made by workspaces (and by GMP, see count_allocations()) */
+static unsigned long allocations = 0;
+
+/** Workspace of each thread */
+static pthread_key_t ws_key;
+static pthread_once_t ws_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * \brief GMP allocation function (counts allocations)
+ */
+static void *count_alloc(size_t size)
+{
+	void *p;
+
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	if ((p = malloc(size)) == NULL) {
+		perror("gmp");
+		abort();
+	}
+	return p;
+}
+
+
+/**
+ * \brief GMP reallocation function (counts allocations)
+ */
+static void *count_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+	void *p;
+
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	if ((p = realloc(ptr, new_size)) == NULL) {
+		perror("gmp");
+		abort();
+	}
+	return p;
+}
+
+
+/**
+ * \brief GMP free function
+ */
+static void count_free(void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+
+/**
+ * \brief Count GMP heap allocations as well as workspace ones
+ * \note Call it before any other thread is started.
+ */
+void count_allocations(void)
+{
+	mp_set_memory_functions(count_alloc, count_realloc, count_free);
+}
+
+
+/**
+ * \brief Number of heap allocations made so far by workspaces (and by GMP,
+ *        after count_allocations())
+ * \return unsigned long
+ */
+unsigned long allocation_count(void)
+{
+	return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * \brief Destroy a splitter and its team
+ * \param [in] sp Splitter
+ */
+static void destroy_splitter(splitter_t *sp)
+{
+	if (sp == NULL) return;
+
+	destroy_team(sp->team);
+	free(sp->first[0]);
+	free(sp->tws);
+	free(sp);
+}
+
+
+/**
+ * \brief Destroy a workspace
+ * \param [in] arg Workspace
+ */
+static void destroy_workspace(void *arg)
+{
+	workspace_t *ws = arg;
+	int x;
+
+	if (ws == NULL) return;
+
+	destroy_splitter(ws->splitter);
+	stats_merge(&ws->stats);
+	hw_close(ws->hwfd);
+	for (x = 0; x < 2; x++) {
+		free(ws->mark[x]);
+		free(ws->run[x]);
+		free(ws->start[x]);
+		free(ws->common[x]);
+		mpz_clear(ws->Np[x]);
+	}
+	free(ws->pos);
+	free(ws->count);
+	free(ws->touched);
+	free(ws->vals);
+	free(ws->tmp);
+	free(ws->rstart);
+	free(ws->slot);
+	free(ws->sigma);
+	free(ws->scol);
+	free(ws->cstart);
+	mpz_clear(ws->Ne);
+	mpz_clear(ws->maxNp);
+	mpz_clear(ws->A);
+	mpf_clear(ws->fnum);
+	mpf_clear(ws->fden);
+	free(ws);
+}
+
+
+/**
+ * \brief Create the workspace key
+ */
+static void create_key(void)
+{
+	pthread_key_create(&ws_key, destroy_workspace);
+}
+
+
+/**
+ * \brief Get the workspace of the calling thread (created on first use,
+ *        destroyed when the thread exits)
+ * \return workspace_t* Workspace, NULL on error
+ */
+workspace_t *get_workspace(void)
+{
+	workspace_t *ws;
+	int x;
+
+	pthread_once(&ws_once, create_key);
+	if ((ws = pthread_getspecific(ws_key)) != NULL) {
+		return ws;
+	}
+
+	ws = calloc(1, sizeof(workspace_t));
+	if (ws == NULL) {
+		return NULL;
+	}
+	mpz_init(ws->Np[0]);
+	mpz_init(ws->Np[1]);
+	mpz_init(ws->Ne);
+	mpz_init(ws->maxNp);
+	mpz_init(ws->A);
+	mpf_init(ws->fnum);
+	mpf_init(ws->fden);
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+
+	/* Hardware counters of this thread (--perf) */
+	for (x = 0; x < NHWEVENTS; x++) {
+		ws->hwfd[x] = -1;
+	}
+	if (hw_counters) {
+		hw_open(ws->hwfd, 0);
+	}
+
+	if (pthread_setspecific(ws_key, ws) != 0) {
+		destroy_workspace(ws);
+		return NULL;
+	}
+	return ws;
+}
+
+
+/**
+ * \brief Destroy the workspace of the calling thread (the main thread does
+ *        not run key destructors)
+ */
+void release_workspace(void)
+{
+	workspace_t *ws;
+
+	pthread_once(&ws_once, create_key);
+	if ((ws = pthread_getspecific(ws_key)) != NULL) {
+		pthread_setspecific(ws_key, NULL);
+		destroy_workspace(ws);
+	}
+}
+
+
+/**
+ * \brief Set the number of threads that calculate each pair of the calling
+ *        thread (see split_congruency())
+ * \param [in] n Number of threads (0 or 1: pairs are not split)
+ * \note Called by workers when there are less pairs than threads. The team
+ *       is created by the first pair big enough to be split.
+ */
+void set_split(unsigned long n)
+{
+	workspace_t *ws;
+
+	if ((ws = get_workspace()) == NULL) {
+		return;
+	}
+	if (n != ws->split) {
+		destroy_splitter(ws->splitter);
+		ws->splitter = NULL;
+	}
+	ws->split = n;
+}
+
+
+/**
+ * \brief Grow a vector keeping its contents
+ * \param [in,out] v Vector
+ * \param [in] old Current number of items
+ * \param [in] size New number of items
+ * \param [in] zero New items must be zeroed
+ * \return int 0 on success, -1 otherwise
+ */
+static int grow_vector(unsigned long **v, unsigned long old, unsigned long size, char zero)
+{
+	unsigned long *p;
+
+	p = realloc(*v, sizeof(unsigned long) * size);
+	if (p == NULL) {
+		return -1;
+	}
+	if (zero) {
+		memset(&p[old], 0, sizeof(unsigned long) * (size - old));
+	}
+	*v = p;
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+
+/**
+ * \brief Make room for a pair of cluster sets
+ * \param [in] ws Workspace
+ * \param [in] size Size of the biggest cluster set
+ * \param [in] maxid Biggest element id
+ * \return int 0 on success, -1 otherwise
+ * \note Capacity only grows, so once the biggest cluster set was seen
+ *       nothing else is allocated.
+ */
+static int reserve_workspace(workspace_t *ws, unsigned long size, unsigned long maxid)
+{
+	unsigned long cap, bits;
+	int x;
+
+	if (maxid >= ws->idcap) {
+		cap = (ws->idcap > 0) ? ws->idcap : WORKSPACE_ELEMS;
+		while (cap <= maxid) cap *= 2;
+		for (x = 0; x < 2; x++) {
+			if (grow_vector(&ws->mark[x], ws->idcap, cap, 1) < 0) return -1;
+		}
+		if (grow_vector(&ws->pos, ws->idcap, cap, 0) < 0) return -1;
+		ws->idcap = cap;
+	}
+
+	if (size > ws->cap) {
+		cap = (ws->cap > 0) ? ws->cap : WORKSPACE_ELEMS;
+		while (cap < size) cap *= 2;
+		for (x = 0; x < 2; x++) {
+			if (grow_vector(&ws->run[x], ws->cap, cap, 0) < 0) return -1;
+			if (grow_vector(&ws->start[x], ws->cap, cap, 0) < 0) return -1;
+			if (grow_vector(&ws->common[x], ws->cap, cap, 0) < 0) return -1;
+		}
+		if (grow_vector(&ws->count, ws->cap, cap, 1) < 0) return -1;
+		if (grow_vector(&ws->touched, ws->cap, cap, 0) < 0) return -1;
+		if (grow_vector(&ws->vals, ws->cap, cap, 0) < 0) return -1;
+		if (grow_vector(&ws->tmp, ws->cap, cap, 0) < 0) return -1;
+		ws->cap = cap;
+
+		/* Np[x] <= sum of 2^c over clusters <= 2^(size+1) */
+		bits = cap + 2;
+		for (x = 0; x < 2; x++) {
+			mpz_realloc2(ws->Np[x], bits);
+		}
+		mpz_realloc2(ws->Ne, bits);
+		mpz_realloc2(ws->maxNp, bits);
+		mpz_realloc2(ws->A, bits);
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Mark the elements of both cluster sets of a pair
+ * \param [in] ws Workspace
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \return int 0 on success, -1 if the pair must go through the original
+ *         kernels (names are not mapped to ids, a name is repeated in a
+ *         cluster set, or cluster numbers would collide with FAKE_CLUSTER)
+ */
+static int mark_pair(workspace_t *ws, cset_t *c1, cset_t *c2)
+{
+	unsigned long i, id, maxid;
+	cset_t *c;
+	int x;
+
+	if (!c1->mapped || !c2->mapped) {
+		return -1;
+	}
+
+	maxid = 0;
+	for (x = 0; x < 2; x++) {
+		c = (x == 0) ? c1 : c2;
+		for (i = 0; i < c->size; i++) {
+			if (c->elems[i].id > maxid) maxid = c->elems[i].id;
+			if (c->elems[i].cluster >= FAKE_CLUSTER) return -1;
+		}
+	}
+	if (reserve_workspace(ws, (c1->size > c2->size) ? c1->size : c2->size, maxid) < 0) {
+		return -1;
+	}
+
+	ws->serial++;
+	ws->stats.count[COUNT_ELEMENTS] += c1->size + c2->size;
+	for (x = 0; x < 2; x++) {
+		c = (x == 0) ? c1 : c2;
+		for (i = 0; i < c->size; i++) {
+			id = c->elems[i].id;
+			if (ws->mark[x][id] == ws->serial) {
+				return -1;
+			}
+			ws->mark[x][id] = ws->serial;
+			if (x == 1) {
+				ws->pos[id] = i;
+			}
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Split a cluster set in runs of elements of the same cluster and
+ *        count the elements of each run that are in the other cluster set
+ * \param [in] ws Workspace (pair already marked)
+ * \param [in] x Cluster set (0 or 1)
+ * \param [in] c Cluster set
+ * \return unsigned long Number of runs
+ */
+static unsigned long scan_runs(workspace_t *ws, int x, cset_t *c)
+{
+	unsigned long i, r, *other;
+
+	other = ws->mark[1 - x];
+	r = 0;
+	ws->start[x][0]  = 0;
+	ws->common[x][0] = 0;
+	for (i = 0; i < c->size; i++) {
+		if (i > 0 && c->elems[i].cluster != c->elems[i-1].cluster) {
+			r++;
+			ws->start[x][r]  = i;
+			ws->common[x][r] = 0;
+		}
+		ws->run[x][i] = r;
+		if (other[c->elems[i].id] == ws->serial) {
+			ws->common[x][r]++;
+		}
+	}
+	ws->stats.count[COUNT_ELEMENTS] += c->size;
+	return r + 1;
+}
+
+
+/**
+ * \brief Sort positions of cluster set 2 counting the pairs that keep their
+ *        order and are in the same cluster of cluster set 2
+ * \param [in] ws Workspace
+ * \param [in,out] v Positions (distinct)
+ * \param [in] n Number of positions
+ * \param [in] start First position of each cluster
+ * \param [in] run Cluster of each position
+ * \return unsigned long Number of pairs a before b (on v) with a < b on the
+ *         same cluster
+ * \note Merge sort: for each b of the right half, the left half elements
+ *       counted are the ones in [start of the cluster of b, b). Both bounds
+ *       only grow during the merge.
+ */
+static unsigned long ordered_pairs(workspace_t *ws, unsigned long *v, unsigned long n,
+		unsigned long *start, unsigned long *run)
+{
+	unsigned long h, i, j, g, o, s, cnt, *l, *r;
+
+	if (n < 2) {
+		return 0;
+	}
+	h   = n / 2;
+	cnt = ordered_pairs(ws, v, h, start, run) + ordered_pairs(ws, &v[h], n - h, start, run);
+
+	l = v;
+	r = &v[h];
+	i = j = g = o = 0;
+	while (j < (n - h)) {
+		while (i < h && l[i] < r[j]) {
+			ws->tmp[o++] = l[i++];
+		}
+		s = start[run[r[j]]];
+		while (g < i && l[g] < s) g++;
+		cnt += i - g;
+		ws->tmp[o++] = r[j++];
+	}
+	while (i < h) {
+		ws->tmp[o++] = l[i++];
+	}
+	memcpy(v, ws->tmp, sizeof(unsigned long) * n);
+	return cnt;
+}
+
+
+/**
+ * \brief Calculate num / den (see congruency_ratio_f())
+ * \param [in] ws Workspace
+ * \param [in] num Numerator
+ * \param [in] den Denominator
+ * \param [in] phase Kernel phase charged with the time
+ * \return double
+ */
+static double ratio(workspace_t *ws, mpz_t num, mpz_t den, int phase)
+{
+	double r;
+
+	r = congruency_ratio_f(num, den, ws->fnum, ws->fden);
+	STATS_LAP(ws, phase);
+	return r;
+}
+
+
+/**
+ * \brief Add 2^n - 1 (number of non empty subsets of n elements)
+ * \param [in] ws Workspace
+ * \param [in,out] acc Accumulator
+ * \param [in] n Number of elements
+ */
+static void add_subsets(workspace_t *ws, mpz_t acc, unsigned long n)
+{
+	if (n < (sizeof(unsigned long) * 8)) {
+		mpz_add_ui(acc, acc, (1UL << n) - 1);
+	} else {
+		mpz_set_ui(ws->A, 0);
+		mpz_setbit(ws->A, n);
+		mpz_sub_ui(ws->A, ws->A, 1);
+		mpz_add(acc, acc, ws->A);
+	}
+}
+
+
+/**
+ * \brief Split a cluster set in ranges of whole clusters
+ * \param [in] c Cluster set
+ * \param [in] k Range
+ * \param [in] n Number of ranges
+ * \return unsigned long First position of range k (size of the cluster set
+ *         for k = n)
+ */
+static unsigned long split_bound(cset_t *c, unsigned long k, unsigned long n)
+{
+	unsigned long p;
+
+	if (k >= n) {
+		return c->size;
+	}
+	p = (unsigned long)(((unsigned __int128)c->size * k) / n);
+	while (p > 0 && p < c->size && c->elems[p].cluster == c->elems[p-1].cluster) {
+		p++;
+	}
+	return p;
+}
+
+
+/**
+ * \brief Add up the partial sums of all members, in pairs (member 0 gets
+ *        the total)
+ * \param [in] sp Splitter
+ * \param [in] t Member
+ * \param [in] ne Add Ne (otherwise, Np of both cluster sets)
+ */
+static void split_reduce(splitter_t *sp, unsigned long t, char ne)
+{
+	workspace_t *tw, *o;
+	unsigned long s;
+
+	tw = sp->tws[t];
+	for (s = 1; s < sp->n; s *= 2) {
+		if ((t % (2 * s)) == 0 && (t + s) < sp->n) {
+			o = sp->tws[t + s];
+			if (ne) {
+				mpz_add(tw->Ne, tw->Ne, o->Ne);
+			} else {
+				mpz_add(tw->Np[0], tw->Np[0], o->Np[0]);
+				mpz_add(tw->Np[1], tw->Np[1], o->Np[1]);
+			}
+		}
+		team_sync(sp->team);
+	}
+}
+
+
+/**
+ * \brief Calculate one part of a split pair (team job)
+ * \param [in] t Member
+ * \param [in] arg Splitter
+ * \note Same steps as fast_congruency1() and fast_congruency2(), each member
+ *       on a range of whole clusters of each cluster set. Marks, positions
+ *       and clusters go to the workspace of member 0; Np and Ne are added
+ *       up per member and then reduced.
+ */
+static void split_job(unsigned long t, void *arg)
+{
+	splitter_t *sp = arg;
+	workspace_t *ws, *tw;
+	unsigned long a[2], b[2], i, r, r2, id, m, n, nt, np, ne, maxid, end, *other;
+	cset_t *c;
+	int x;
+
+	ws = sp->ws;
+
+	/* Ranges, clusters and biggest id of each member */
+	maxid = 0;
+	for (x = 0; x < 2; x++) {
+		c    = sp->c[x];
+		a[x] = split_bound(c, t, sp->n);
+		b[x] = split_bound(c, t + 1, sp->n);
+		r = 0;
+		for (i = a[x]; i < b[x]; i++) {
+			if (c->elems[i].id > maxid) maxid = c->elems[i].id;
+			if (c->elems[i].cluster >= FAKE_CLUSTER) {
+				__atomic_store_n(&sp->fallback, 1, __ATOMIC_RELAXED);
+			}
+			if (i == a[x] || c->elems[i].cluster != c->elems[i-1].cluster) r++;
+		}
+		sp->first[x][t + 1] = r;
+	}
+	sp->maxid[t] = maxid;
+
+	tw = (t == 0) ? ws : get_workspace();
+	if (tw == NULL || (t > 0 && reserve_workspace(tw,
+				(sp->c[0]->size > sp->c[1]->size) ? sp->c[0]->size : sp->c[1]->size, 0) < 0)) {
+		__atomic_store_n(&sp->fallback, 1, __ATOMIC_RELAXED);
+	}
+	sp->tws[t] = tw;
+	team_sync(sp->team);
+
+	if (t == 0) {
+		for (i = 1; i < sp->n; i++) {
+			if (sp->maxid[i] > maxid) maxid = sp->maxid[i];
+		}
+		for (x = 0; x < 2; x++) {
+			sp->first[x][0] = 0;
+			for (i = 1; i <= sp->n; i++) {
+				sp->first[x][i] += sp->first[x][i-1];
+			}
+		}
+		if (!sp->fallback && reserve_workspace(ws,
+					(sp->c[0]->size > sp->c[1]->size) ? sp->c[0]->size : sp->c[1]->size, maxid) < 0) {
+			sp->fallback = 1;
+		}
+		ws->serial++;
+	}
+	team_sync(sp->team);
+	if (sp->fallback) {
+		return;
+	}
+
+	/* Mark elements (a name repeated in a cluster set is found by the
+	 * member that marks it last) */
+	for (x = 0; x < 2; x++) {
+		c = sp->c[x];
+		for (i = a[x]; i < b[x]; i++) {
+			id = c->elems[i].id;
+			if (__atomic_exchange_n(&ws->mark[x][id], ws->serial, __ATOMIC_RELAXED) == ws->serial) {
+				__atomic_store_n(&sp->repeated, 1, __ATOMIC_RELAXED);
+			}
+			if (x == 1) {
+				ws->pos[id] = i;
+			}
+		}
+		tw->stats.count[COUNT_ELEMENTS] += b[x] - a[x];
+	}
+	team_sync(sp->team);
+	if (sp->repeated) {
+		return;
+	}
+
+	/* Clusters, their common elements and Np of each member */
+	for (x = 0; x < 2; x++) {
+		c     = sp->c[x];
+		other = ws->mark[1 - x];
+		r     = sp->first[x][t];
+		for (i = a[x]; i < b[x]; i++) {
+			if (i == a[x] || c->elems[i].cluster != c->elems[i-1].cluster) {
+				if (i > a[x]) r++;
+				ws->start[x][r]  = i;
+				ws->common[x][r] = 0;
+			}
+			ws->run[x][i] = r;
+			if (other[c->elems[i].id] == ws->serial) {
+				ws->common[x][r]++;
+			}
+		}
+		tw->stats.count[COUNT_ELEMENTS] += b[x] - a[x];
+
+		if (sp->ind == INDEX_P2P) {
+			np = 0;
+			for (r = sp->first[x][t]; r < sp->first[x][t+1]; r++) {
+				m   = ws->common[x][r];
+				np += (m * (m - 1)) / 2;
+			}
+			sp->np[x][t] = np;
+		} else {
+			mpz_set_ui(tw->Np[x], 0);
+			for (r = sp->first[x][t]; r < sp->first[x][t+1]; r++) {
+				add_subsets(tw, tw->Np[x], ws->common[x][r]);
+			}
+		}
+	}
+	team_sync(sp->team);
+
+	if (sp->ind == INDEX_COMP) {
+		split_reduce(sp, t, 0);
+	}
+	if (t == 0) {
+		if (sp->ind == INDEX_P2P) {
+			for (x = 0; x < 2; x++) {
+				np = 0;
+				for (i = 0; i < sp->n; i++) {
+					np += sp->np[x][i];
+				}
+				mpz_set_ui(ws->Np[x], np);
+			}
+		}
+		mpz_set(ws->maxNp, (mpz_cmp(ws->Np[0], ws->Np[1]) > 0) ? ws->Np[0] : ws->Np[1]);
+		STATS_LAP(ws, PHASE_NP);
+		if ((sp->flags & SHOW_NP)) {
+			sp->result = mpz_get_d(ws->maxNp);
+			sp->done   = 1;
+		} else if (sp->cutoff > 0 && ratio(ws, (mpz_cmp(ws->Np[0], ws->Np[1]) > 0) ? ws->Np[1] : ws->Np[0],
+					ws->maxNp, PHASE_NP) < sp->cutoff) {
+			sp->result = H_PRUNED;
+			sp->done   = 1;
+		}
+	}
+	team_sync(sp->team);
+	if (sp->done) {
+		return;
+	}
+
+	/* Ne of the clusters of set 1 of each member */
+	c  = sp->c[0];
+	ne = 0;
+	mpz_set_ui(tw->Ne, 0);
+	for (r = sp->first[0][t]; r < sp->first[0][t+1]; r++) {
+		if (ws->common[0][r] < ((sp->ind == INDEX_P2P) ? 2 : 1)) continue;
+		end = (r + 1 < sp->first[0][t+1]) ? ws->start[0][r+1] : b[0];
+		tw->stats.count[COUNT_ELEMENTS] += end - ws->start[0][r];
+
+		if (sp->ind == INDEX_P2P) {
+			m = 0;
+			for (i = ws->start[0][r]; i < end; i++) {
+				id = c->elems[i].id;
+				if (ws->mark[1][id] == ws->serial) {
+					tw->vals[m++] = ws->pos[id];
+				}
+			}
+			ne += ordered_pairs(tw, tw->vals, m, ws->start[1], ws->run[1]);
+			continue;
+		}
+
+		nt = 0;
+		for (i = ws->start[0][r]; i < end; i++) {
+			id = c->elems[i].id;
+			if (ws->mark[1][id] == ws->serial) {
+				r2 = ws->run[1][ws->pos[id]];
+				if (tw->count[r2]++ == 0) {
+					tw->touched[nt++] = r2;
+				}
+			}
+		}
+		while (nt > 0) {
+			r2 = tw->touched[--nt];
+			n  = tw->count[r2];
+			tw->count[r2] = 0;
+			if (n == 1 && (ws->common[0][r] != 1 || ws->common[1][r2] != 1)) {
+				continue;
+			}
+			add_subsets(tw, tw->Ne, n);
+		}
+	}
+	sp->ne[t] = ne;
+	team_sync(sp->team);
+
+	if (sp->ind == INDEX_COMP) {
+		split_reduce(sp, t, 1);
+	}
+	if (t == 0) {
+		if (sp->ind == INDEX_P2P) {
+			for (i = 1; i < sp->n; i++) {
+				ne += sp->ne[i];
+			}
+			mpz_set_ui(ws->Ne, ne);
+		}
+		STATS_LAP(ws, PHASE_NE);
+		if ((sp->flags & SHOW_NE)) {
+			sp->result = mpz_get_d(ws->Ne);
+		} else {
+			sp->result = ratio(ws, ws->Ne, ws->maxNp, PHASE_NE);
+		}
+	}
+}
+
+
+/**
+ * \brief Get the splitter of a workspace (created on first use)
+ * \param [in] ws Workspace
+ * \return splitter_t* Splitter, NULL if pairs are not split (or the team
+ *         could not be created)
+ */
+static splitter_t *get_splitter(workspace_t *ws)
+{
+	splitter_t *sp;
+	unsigned long n;
+
+	if (ws->split < 2) {
+		return NULL;
+	}
+	if (ws->splitter != NULL) {
+		return ws->splitter;
+	}
+
+	sp = calloc(1, sizeof(splitter_t));
+	if (sp == NULL || (sp->team = create_team(ws->split)) == NULL) {
+		free(sp);
+		ws->split = 1;
+		return NULL;
+	}
+	n = sp->n = team_size(sp->team);
+	sp->first[0] = malloc(sizeof(unsigned long) * ((2 * (n + 1)) + (4 * n)));
+	sp->tws      = malloc(sizeof(workspace_t*) * n);
+	if (n < 2 || sp->first[0] == NULL || sp->tws == NULL) {
+		destroy_splitter(sp);
+		ws->split = 1;
+		return NULL;
+	}
+	sp->first[1] = &sp->first[0][n + 1];
+	sp->maxid    = &sp->first[1][n + 1];
+	sp->np[0]    = &sp->maxid[n];
+	sp->np[1]    = &sp->np[0][n];
+	sp->ne       = &sp->np[1][n];
+	__atomic_add_fetch(&allocations, 3, __ATOMIC_RELAXED);
+	ws->splitter = sp;
+	return sp;
+}
+
+
+/**
+ * \brief Calculate h or h2 of a big pair with the team of the workspace
+ * \param [in] ws Workspace
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [in] ind Index (INDEX_P2P or INDEX_COMP)
+ * \param [in] flags Flags to show Np or Ne
+ * \param [in] cutoff Skip Ne calculation when the index is known to be lower
+ *        than cutoff
+ * \return double Same as fast_congruency1() or fast_congruency2()
+ * \note Integer sums do not depend on the order they are added, so the
+ *       result is the same as the one of a single thread.
+ */
+static double split_congruency(workspace_t *ws, cset_t *c1, cset_t *c2, char ind, char flags, double cutoff)
+{
+	splitter_t *sp = ws->splitter;
+
+	if (!c1->mapped || !c2->mapped) {
+		return H_FALLBACK;
+	}
+	sp->ws       = ws;
+	sp->c[0]     = c1;
+	sp->c[1]     = c2;
+	sp->ind      = ind;
+	sp->flags    = flags;
+	sp->cutoff   = cutoff;
+	sp->fallback = 0;
+	sp->repeated = 0;
+	sp->done     = 0;
+	sp->result   = 0;
+	team_run(sp->team, split_job, sp);
+	return (sp->fallback || sp->repeated) ? H_FALLBACK : sp->result;
+}
+
+
+/**
+ * \brief Pair-to-pair congruency (h) without heap allocations, same result
+ *        as calculate_congruency1()
+ * \param [in] ws Workspace
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [in] flags Flags to show Np or Ne
+ * \param [in] cutoff Skip Ne calculation when h is known to be lower than cutoff
+ * \return double Congruency (H_PRUNED if Ne calculation was skipped,
+ *         H_FALLBACK if the pair must go through calculate_congruency1())
+ * \note With unique names, a pair of elements of the same cluster of c1 is
+ *       counted by Ne when it is on the same cluster of c2 in the same order.
+ */
+double fast_congruency1(workspace_t *ws, cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	unsigned long nruns, r, i, m, end, np, ne, id;
+	int x;
+
+	if (ws == NULL) {
+		return H_FALLBACK;
+	}
+	STATS_START(ws);
+	if ((c1->size + c2->size) >= SPLIT_ELEMS && get_splitter(ws) != NULL) {
+		return split_congruency(ws, c1, c2, INDEX_P2P, flags, cutoff);
+	}
+	if (mark_pair(ws, c1, c2) < 0) {
+		return H_FALLBACK;
+	}
+
+	for (x = 0; x < 2; x++) {
+		nruns = scan_runs(ws, x, (x == 0) ? c1 : c2);
+		np = 0;
+		for (r = 0; r < nruns; r++) {
+			m   = ws->common[x][r];
+			np += (m * (m - 1)) / 2;
+		}
+		mpz_set_ui(ws->Np[x], np);
+	}
+	nruns = ws->run[0][c1->size - 1] + 1;
+
+	mpz_set(ws->maxNp, (mpz_cmp(ws->Np[0], ws->Np[1]) > 0) ? ws->Np[0] : ws->Np[1]);
+	STATS_LAP(ws, PHASE_NP);
+	if ((flags & SHOW_NP)) {
+		return mpz_get_d(ws->maxNp);
+	}
+	if (cutoff > 0 && ratio(ws, (mpz_cmp(ws->Np[0], ws->Np[1]) > 0) ? ws->Np[1] : ws->Np[0],
+				ws->maxNp, PHASE_NP) < cutoff) {
+		return H_PRUNED;
+	}
+
+	ne = 0;
+	for (r = 0; r < nruns; r++) {
+		if (ws->common[0][r] < 2) continue;
+		end = (r + 1 < nruns) ? ws->start[0][r+1] : c1->size;
+		m = 0;
+		for (i = ws->start[0][r]; i < end; i++) {
+			id = c1->elems[i].id;
+			if (ws->mark[1][id] == ws->serial) {
+				ws->vals[m++] = ws->pos[id];
+			}
+		}
+		ws->stats.count[COUNT_ELEMENTS] += end - ws->start[0][r];
+		ne += ordered_pairs(ws, ws->vals, m, ws->start[1], ws->run[1]);
+	}
+	mpz_set_ui(ws->Ne, ne);
+	STATS_LAP(ws, PHASE_NE);
+
+	if ((flags & SHOW_NE)) {
+		return mpz_get_d(ws->Ne);
+	}
+	return ratio(ws, ws->Ne, ws->maxNp, PHASE_NE);
+}
+
+
+/**
+ * \brief Complete congruency index (h2) without heap allocations, same
+ *        result as calculate_congruency2()
+ * \param [in] ws Workspace
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [in] flags Flags to show Np or Ne
+ * \param [in] cutoff Skip Ne calculation when h2 is known to be lower than cutoff
+ * \return double Congruency (H_PRUNED if Ne calculation was skipped,
+ *         H_FALLBACK if the pair must go through calculate_congruency2())
+ * \note Ne counts the common elements of each cluster of c1 that share a
+ *       cluster of c2. A single shared element only counts when it is the
+ *       only common element of both clusters.
+ */
+double fast_congruency2(workspace_t *ws, cset_t *c1, cset_t *c2, char flags, double cutoff)
+{
+	unsigned long nruns, r, r2, i, end, nt, n, id;
+	int x;
+
+	if (ws == NULL) {
+		return H_FALLBACK;
+	}
+	STATS_START(ws);
+	if ((c1->size + c2->size) >= SPLIT_ELEMS && get_splitter(ws) != NULL) {
+		return split_congruency(ws, c1, c2, INDEX_COMP, flags, cutoff);
+	}
+	if (mark_pair(ws, c1, c2) < 0) {
+		return H_FALLBACK;
+	}
+
+	for (x = 0; x < 2; x++) {
+		nruns = scan_runs(ws, x, (x == 0) ? c1 : c2);
+		mpz_set_ui(ws->Np[x], 0);
+		for (r = 0; r < nruns; r++) {
+			add_subsets(ws, ws->Np[x], ws->common[x][r]);
+		}
+	}
+	nruns = ws->run[0][c1->size - 1] + 1;
+
+	mpz_set(ws->maxNp, (mpz_cmp(ws->Np[0], ws->Np[1]) > 0) ? ws->Np[0] : ws->Np[1]);
+	STATS_LAP(ws, PHASE_NP);
+	if ((flags & SHOW_NP)) {
+		return mpz_get_d(ws->maxNp);
+	}
+	if (cutoff > 0 && ratio(ws, (mpz_cmp(ws->Np[0], ws->Np[1]) > 0) ? ws->Np[1] : ws->Np[0],
+				ws->maxNp, PHASE_NP) < cutoff) {
+		return H_PRUNED;
+	}
+
+	mpz_set_ui(ws->Ne, 0);
+	for (r = 0; r < nruns; r++) {
+		if (ws->common[0][r] == 0) continue;
+		end = (r + 1 < nruns) ? ws->start[0][r+1] : c1->size;
+
+		/* Common elements of this cluster on each cluster of c2 */
+		nt = 0;
+		for (i = ws->start[0][r]; i < end; i++) {
+			id = c1->elems[i].id;
+			if (ws->mark[1][id] == ws->serial) {
+				r2 = ws->run[1][ws->pos[id]];
+				if (ws->count[r2]++ == 0) {
+					ws->touched[nt++] = r2;
+				}
+			}
+		}
+		ws->stats.count[COUNT_ELEMENTS] += end - ws->start[0][r];
+		while (nt > 0) {
+			r2 = ws->touched[--nt];
+			n  = ws->count[r2];
+			ws->count[r2] = 0;
+			if (n == 1 && (ws->common[0][r] != 1 || ws->common[1][r2] != 1)) {
+				continue;
+			}
+			add_subsets(ws, ws->Ne, n);
+		}
+	}
+	STATS_LAP(ws, PHASE_NE);
+
+	if ((flags & SHOW_NE)) {
+		return mpz_get_d(ws->Ne);
+	}
+	return ratio(ws, ws->Ne, ws->maxNp, PHASE_NE);
+}
+
+
+/**
+ * \brief Partition indexes (adjusted Rand index, NMI, Jaccard and
+ *        Fowlkes-Mallows) of the common elements of a pair, all from one
+ *        contingency table
+ * \param [in] ws Workspace
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [out] values Indexes (see partition_scores())
+ * \return int 0 on success, -1 if the pair must go through
+ *         calculate_partition()
+ * \note Cells of the table are the clusters of c2 touched by each cluster
+ *       of c1, as in fast_congruency2().
+ */
+int fast_partition(workspace_t *ws, cset_t *c1, cset_t *c2, double *values)
+{
+	unsigned long nruns, r, r2, i, end, nt, id;
+	ptable_t t;
+	int x;
+
+	if (ws == NULL) {
+		return -1;
+	}
+	STATS_START(ws);
+	if (mark_pair(ws, c1, c2) < 0) {
+		return -1;
+	}
+
+	memset(&t, 0, sizeof(ptable_t));
+	for (x = 0; x < 2; x++) {
+		nruns = scan_runs(ws, x, (x == 0) ? c1 : c2);
+		for (r = 0; r < nruns; r++) {
+			if (x == 0) {
+				t.n += ws->common[0][r];
+				ptable_add(&t.nlogn1, &t.pairs1, ws->common[0][r]);
+			} else {
+				ptable_add(&t.nlogn2, &t.pairs2, ws->common[1][r]);
+			}
+		}
+	}
+	nruns = ws->run[0][c1->size - 1] + 1;
+	STATS_LAP(ws, PHASE_NP);
+
+	for (r = 0; r < nruns; r++) {
+		if (ws->common[0][r] == 0) continue;
+		end = (r + 1 < nruns) ? ws->start[0][r+1] : c1->size;
+
+		nt = 0;
+		for (i = ws->start[0][r]; i < end; i++) {
+			id = c1->elems[i].id;
+			if (ws->mark[1][id] == ws->serial) {
+				r2 = ws->run[1][ws->pos[id]];
+				if (ws->count[r2]++ == 0) {
+					ws->touched[nt++] = r2;
+				}
+			}
+		}
+		ws->stats.count[COUNT_ELEMENTS] += end - ws->start[0][r];
+		while (nt > 0) {
+			r2 = ws->touched[--nt];
+			ptable_add(&t.nlogn, &t.pairs, ws->count[r2]);
+			ws->count[r2] = 0;
+		}
+	}
+	STATS_LAP(ws, PHASE_NE);
+
+	partition_scores(&t, values);
+	return 0;
+}
+
+
+/**
+ * \brief Prepare the permutation test of a pair: common elements of c1 (in
+ *        c1 order, split by cluster) and their slots on c2 (positions of
+ *        the common elements in c2 order, split by cluster)
+ * \param [in] ws Workspace
+ * \param [in] c1 Cluster set 1
+ * \param [in] c2 Cluster set 2
+ * \param [in] ind Index (INDEX_P2P or INDEX_COMP), ws->maxNp is set to its Np
+ * \return int 0 on success, -1 if the pair can not be handled (see mark_pair())
+ * \note A permutation maps the common elements to the slots (ws->slot is the
+ *       observed one): clusters of both sets keep their sizes, so Np does
+ *       not change and only Ne has to be calculated again (perm_ne()).
+ */
+int perm_prepare(workspace_t *ws, cset_t *c1, cset_t *c2, char ind)
+{
+	unsigned long i, id, n, k, cap, last, np[2];
+	cset_t *c;
+	int x;
+
+	if (ws == NULL || mark_pair(ws, c1, c2) < 0) {
+		return -1;
+	}
+
+	n = ((c1->size > c2->size) ? c1->size : c2->size) + 1;
+	if (n > ws->pcap) {
+		cap = (ws->pcap > 0) ? ws->pcap : WORKSPACE_ELEMS;
+		while (cap < n) cap *= 2;
+		if (grow_vector(&ws->rstart, ws->pcap, cap, 0) < 0) return -1;
+		if (grow_vector(&ws->slot, ws->pcap, cap, 0) < 0) return -1;
+		if (grow_vector(&ws->sigma, ws->pcap, cap, 0) < 0) return -1;
+		if (grow_vector(&ws->scol, ws->pcap, cap, 0) < 0) return -1;
+		if (grow_vector(&ws->cstart, ws->pcap, cap, 0) < 0) return -1;
+		ws->pcap = cap;
+	}
+
+	/* Slots (c2), then common elements (c1) with their slots */
+	for (x = 1; x >= 0; x--) {
+		c = (x == 0) ? c1 : c2;
+		n = k = 0;
+		last = 0;
+		for (i = 0; i < c->size; i++) {
+			id = c->elems[i].id;
+			if (ws->mark[1 - x][id] != ws->serial) {
+				continue;
+			}
+			if (n == 0 || c->elems[i].cluster != c->elems[last].cluster) {
+				if (x == 0) {
+					ws->rstart[k++] = n;
+				} else {
+					ws->cstart[k++] = n;
+				}
+			}
+			if (x == 0) {
+				ws->slot[n] = ws->pos[id];
+			} else {
+				ws->scol[n]  = k - 1;
+				ws->pos[id] = n;
+			}
+			last = i;
+			n++;
+		}
+		if (x == 0) {
+			ws->rstart[k] = n;
+			ws->prows = k;
+			ws->pm    = n;
+		} else {
+			ws->cstart[k] = n;
+		}
+		ws->stats.count[COUNT_ELEMENTS] += c->size;
+
+		/* Np of the clusters */
+		np[x] = 0;
+		mpz_set_ui(ws->Np[x], 0);
+		for (i = 0; i < k; i++) {
+			n = (x == 0) ? (ws->rstart[i+1] - ws->rstart[i]) : (ws->cstart[i+1] - ws->cstart[i]);
+			if (ind == INDEX_P2P) {
+				np[x] += (n * (n - 1)) / 2;
+			} else {
+				add_subsets(ws, ws->Np[x], n);
+			}
+		}
+		if (ind == INDEX_P2P) {
+			mpz_set_ui(ws->Np[x], np[x]);
+		}
+	}
+	mpz_set(ws->maxNp, (mpz_cmp(ws->Np[0], ws->Np[1]) > 0) ? ws->Np[0] : ws->Np[1]);
+	return 0;
+}
+
+
+/**
+ * \brief Ne of a pair prepared by perm_prepare(), common elements mapped to
+ *        the slots by sigma
+ * \param [in] ws Workspace
+ * \param [in] ind Index (INDEX_P2P or INDEX_COMP)
+ * \param [in] sigma Slot of each common element (ws->slot for the pair
+ *        itself)
+ * \param [out] ne Ne
+ * \note Same counts as fast_congruency1() and fast_congruency2(), with the
+ *       common elements only.
+ */
+void perm_ne(workspace_t *ws, char ind, unsigned long *sigma, mpz_t ne)
+{
+	unsigned long r, e, n, nt, c, cnt, *rs;
+	unsigned __int128 small;
+
+	rs = ws->rstart;
+	if (ind == INDEX_P2P) {
+		cnt = 0;
+		for (r = 0; r < ws->prows; r++) {
+			n = rs[r+1] - rs[r];
+			if (n < 2) continue;
+			memcpy(ws->vals, &sigma[rs[r]], sizeof(unsigned long) * n);
+			cnt += ordered_pairs(ws, ws->vals, n, ws->cstart, ws->scol);
+		}
+		mpz_set_ui(ne, cnt);
+		return;
+	}
+
+	/* Cells of less than 64 elements add up without GMP (less than
+	 * 2^64 cells of less than 2^64 each) */
+	small = 0;
+	mpz_set_ui(ne, 0);
+	for (r = 0; r < ws->prows; r++) {
+		nt = 0;
+		for (e = rs[r]; e < rs[r+1]; e++) {
+			c = ws->scol[sigma[e]];
+			if (ws->count[c]++ == 0) {
+				ws->touched[nt++] = c;
+			}
+		}
+		while (nt > 0) {
+			c = ws->touched[--nt];
+			n = ws->count[c];
+			ws->count[c] = 0;
+			if (n == 1 && ((rs[r+1] - rs[r]) != 1 || (ws->cstart[c+1] - ws->cstart[c]) != 1)) {
+				continue;
+			}
+			if (n < (sizeof(unsigned long) * 8)) {
+				small += (1UL << n) - 1;
+			} else {
+				add_subsets(ws, ne, n);
+			}
+		}
+	}
+	mpz_set_ui(ws->A, (unsigned long)(small >> 64));
+	mpz_mul_2exp(ws->A, ws->A, 64);
+	mpz_add_ui(ws->A, ws->A, (unsigned long)small);
+	mpz_add(ne, ne, ws->A);
+}
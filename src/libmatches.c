@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "cmatches.h"
+#include "libmatches.h"
+
+/*
+ * Library API (see libmatches.h)
+ *
+ * Partitions are cluster sets with mapped element ids, so every pair goes
+ * through the fast kernels (kernel.c). Cases that would need the kernels
+ * based on names (repeated elements, cluster ids colliding with
+ * FAKE_CLUSTER) are refused when the partition is created.
+ */
+
+/**
+ * Partition
+ */
+struct _matches_partition {
+	/** elements sorted by cluster (as in a loaded cluster set) */
+	cset_t cset;
+};
+
+/**
+ * Full matrix being calculated
+ */
+typedef struct _libjob {
+	/** partitions */
+	matches_partition_t *const *parts;
+	/** congruency index */
+	int index;
+	/** output (n x n, row major) */
+	double *values;
+	/** matrix size */
+	unsigned long n;
+	/** some pair failed */
+	char failed;
+} libjob_t;
+
+
+/**
+ * \brief Compare elements by cluster (same order as elem_cmp(), so
+ *        partitions are sorted like loaded cluster sets)
+ */
+static int cluster_cmp(const void *e1, const void *e2)
+{
+	const elem_t *elem1 = e1;
+	const elem_t *elem2 = e2;
+
+	return (elem1->cluster - elem2->cluster);
+}
+
+
+/**
+ * \brief Compare element ids
+ */
+static int id_cmp(const void *p1, const void *p2)
+{
+	unsigned long id1 = *(const unsigned long *)p1;
+	unsigned long id2 = *(const unsigned long *)p2;
+
+	return (id1 > id2) - (id1 < id2);
+}
+
+
+/**
+ * \brief Create a partition
+ * \param [in] elements Element ids
+ * \param [in] clusters Cluster id of each element
+ * \param [in] n Number of elements
+ * \return matches_partition_t* Partition, NULL on error (errno is EINVAL
+ *         for repeated elements or invalid cluster ids)
+ * \note Arrays are copied.
+ */
+matches_partition_t *matches_partition_create(const unsigned long *elements, const unsigned long *clusters,
+		unsigned long n)
+{
+	matches_partition_t *p;
+	unsigned long *ids, i;
+
+	if ((elements == NULL || clusters == NULL) && n > 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Repeated elements */
+	ids = malloc(sizeof(unsigned long) * ((n > 0) ? n : 1));
+	if (ids == NULL) {
+		return NULL;
+	}
+	memcpy(ids, elements, sizeof(unsigned long) * n);
+	qsort(ids, n, sizeof(unsigned long), id_cmp);
+	for (i = 1; i < n; i++) {
+		if (ids[i] == ids[i - 1]) {
+			free(ids);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	free(ids);
+
+	p = calloc(1, sizeof(matches_partition_t));
+	if (p == NULL) {
+		return NULL;
+	}
+	p->cset.elems = malloc(sizeof(elem_t) * ((n > 0) ? n : 1));
+	if (p->cset.elems == NULL) {
+		free(p);
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		if (clusters[i] >= FAKE_CLUSTER) {
+			matches_partition_destroy(p);
+			errno = EINVAL;
+			return NULL;
+		}
+		p->cset.elems[i].name    = NULL;
+		p->cset.elems[i].cluster = clusters[i];
+		p->cset.elems[i].id      = elements[i];
+	}
+	qsort(p->cset.elems, n, sizeof(elem_t), cluster_cmp);
+	p->cset.size   = n;
+	p->cset.mapped = 1;
+
+	return p;
+}
+
+
+/**
+ * \brief Destroy a partition
+ * \param [in] p Partition
+ */
+void matches_partition_destroy(matches_partition_t *p)
+{
+	if (p != NULL) {
+		free(p->cset.elems);
+		free(p);
+	}
+}
+
+
+/**
+ * \brief Position of a partition index on the values of fast_partition()
+ * \param [in] index MATCHES_ARI, MATCHES_NMI, MATCHES_JACCARD or MATCHES_FM
+ * \return int Position, -1 for other indexes
+ */
+static int partition_slot(int index)
+{
+	switch (index) {
+		case MATCHES_ARI:
+			return 0;
+		case MATCHES_NMI:
+			return 1;
+		case MATCHES_JACCARD:
+			return 2;
+		case MATCHES_FM:
+			return 3;
+		default:
+			return -1;
+	}
+}
+
+
+/**
+ * \brief Calculate one congruency index
+ * \param [in] p1 Partition 1
+ * \param [in] p2 Partition 2
+ * \param [in] index MATCHES_H, MATCHES_H2, MATCHES_ARI, MATCHES_NMI,
+ *        MATCHES_JACCARD or MATCHES_FM
+ * \param [out] h Congruency
+ * \return int 0 on success, -1 otherwise (errno is set)
+ */
+int matches_pair(const matches_partition_t *p1, const matches_partition_t *p2, int index, double *h)
+{
+	workspace_t *ws;
+	cset_t *c1, *c2;
+	double values[NPARTITION];
+
+	if (p1 == NULL || p2 == NULL || h == NULL ||
+			(index != MATCHES_H && index != MATCHES_H2 && partition_slot(index) < 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	c1 = (cset_t *)&p1->cset;
+	c2 = (cset_t *)&p2->cset;
+	if (c1->size == 0 || c2->size == 0) {
+		/* No elements */
+		*h = 0;
+		return 0;
+	}
+
+	if ((ws = get_workspace()) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (index == MATCHES_H) {
+		*h = fast_congruency1(ws, c1, c2, 0, 0);
+	} else if (index == MATCHES_H2) {
+		*h = fast_congruency2(ws, c1, c2, 0, 0);
+	} else {
+		*h = (fast_partition(ws, c1, c2, values) == 0) ? values[partition_slot(index)] : H_FALLBACK;
+	}
+	if (*h == H_FALLBACK) {
+		/* Workspace could not grow */
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Calculate one row of the congruency matrix
+ * \param [in] parts Partitions
+ * \param [in] n Number of partitions
+ * \param [in] row Row
+ * \param [in] index MATCHES_H, MATCHES_H2, MATCHES_ARI, MATCHES_NMI,
+ *        MATCHES_JACCARD or MATCHES_FM
+ * \param [out] values Row (n values, 1 on the diagonal)
+ * \return int 0 on success, -1 otherwise (errno is set)
+ * \note Pairs are taken in the order of the upper triangle, so rows are
+ *       the ones of matches_matrix() to the last bit.
+ */
+int matches_row(matches_partition_t *const *parts, unsigned long n, unsigned long row, int index,
+		double *values)
+{
+	unsigned long j;
+
+	if (parts == NULL || values == NULL || row >= n) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (j = 0; j < n; j++) {
+		if (j == row) {
+			values[j] = 1.0;
+		} else if (matches_pair(parts[(j < row) ? j : row], parts[(j < row) ? row : j], index, &values[j]) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Calculate one pair of the full matrix (see calculate_rows())
+ */
+static double lib_pair(unsigned long i, unsigned long j, void *arg)
+{
+	libjob_t *job = arg;
+	double h;
+
+	if (matches_pair(job->parts[i], job->parts[j], job->index, &h) < 0) {
+		job->failed = 1;
+		return 0;
+	}
+	return h;
+}
+
+
+/**
+ * \brief Store one row of the full matrix (see calculate_rows())
+ */
+static void lib_row(unsigned long i, double *values, void *arg)
+{
+	libjob_t *job = arg;
+	unsigned long j;
+
+	job->values[(i * job->n) + i] = 1.0;
+	for (j = (i+1); j < job->n; j++) {
+		job->values[(i * job->n) + j] = values[j];
+		job->values[(j * job->n) + i] = values[j];
+	}
+}
+
+
+/**
+ * \brief Calculate the full congruency matrix
+ * \param [in] parts Partitions
+ * \param [in] n Number of partitions
+ * \param [in] index MATCHES_H, MATCHES_H2, MATCHES_ARI, MATCHES_NMI,
+ *        MATCHES_JACCARD or MATCHES_FM
+ * \param [in] nthreads Number of worker threads
+ * \param [out] values Matrix (n x n, row major)
+ * \return int 0 on success, -1 otherwise (errno is set)
+ */
+int matches_matrix(matches_partition_t *const *parts, unsigned long n, int index, unsigned long nthreads,
+		double *values)
+{
+	libjob_t job;
+
+	if (parts == NULL || values == NULL ||
+			(index != MATCHES_H && index != MATCHES_H2 && partition_slot(index) < 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	job.parts  = parts;
+	job.index  = index;
+	job.values = values;
+	job.n      = n;
+	job.failed = 0;
+	if (calculate_rows(n, nthreads, lib_pair, lib_row, &job) < 0) {
+		return -1;
+	}
+	if (job.failed) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Release the workspace of the calling thread
+ * \note Workspaces of other threads are released when they exit; the main
+ *       thread of a process does not run key destructors, so it may call
+ *       this when it is done.
+ */
+void matches_thread_cleanup(void)
+{
+	release_workspace();
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef LIBMATCHES_H
+
+	#define LIBMATCHES_H
+
+	/*
+	 * libmatches: congruency indexes of partitions kept in memory
+	 *
+	 * A partition is built from two arrays: element ids and their cluster
+	 * ids. Element ids are shared by all partitions (the same element has
+	 * the same id everywhere) and index per-thread arrays, so they should
+	 * be dense (e.g. 0..N-1). Elements are taken in the given order, like
+	 * lines of a cluster set file, so results are the ones of matches.
+	 *
+	 * Functions are thread-safe: each calling thread gets its own
+	 * workspace (released when the thread exits, or with
+	 * matches_thread_cleanup()). Partitions are not changed after they
+	 * are created, so they can be shared by threads.
+	 */
+
+	/** Functions exported by the shared library (everything else is hidden) */
+	#define MATCHES_API __attribute__((visibility("default")))
+
+	/** Pair-to-pair congruency (h) */
+	#define MATCHES_H  0x01
+	/** Complete congruency (h2) */
+	#define MATCHES_H2 0x02
+	/** Adjusted Rand index */
+	#define MATCHES_ARI 0x04
+	/** Normalized mutual information */
+	#define MATCHES_NMI 0x08
+	/** Jaccard index (pairs of elements) */
+	#define MATCHES_JACCARD 0x10
+	/** Fowlkes-Mallows index */
+	#define MATCHES_FM 0x20
+
+	/** Partition (opaque) */
+	typedef struct _matches_partition matches_partition_t;
+
+	/* Prototypes */
+	MATCHES_API matches_partition_t *matches_partition_create(const unsigned long *elements,
+			const unsigned long *clusters, unsigned long n);
+	MATCHES_API void matches_partition_destroy(matches_partition_t *p);
+	MATCHES_API int matches_pair(const matches_partition_t *p1, const matches_partition_t *p2, int index,
+			double *h);
+	MATCHES_API int matches_row(matches_partition_t *const *parts, unsigned long n, unsigned long row,
+			int index, double *values);
+	MATCHES_API int matches_matrix(matches_partition_t *const *parts, unsigned long n, int index,
+			unsigned long nthreads, double *values);
+	MATCHES_API void matches_thread_cleanup(void);
+
+#endif
@@ -20,6 +20,7 @@
  */
 #include "cmatches.h"
 #include <stdlib.h>
+#include <math.h>
 #include <gmp.h>
 
 /**
@@ -86,3 +87,117 @@ mpz_t *single_combination (unsigned int n, unsigned int r)
 	return comb;
 }
 
+
+
+/**
+ * \brief Calculate num / den as a double
+ * \param [in] num Numerator
+ * \param [in] den Denominator
+ * \return double 0 if den is zero
+ */
+double congruency_ratio(mpz_t num, mpz_t den)
+{
+	mpf_t fnum, fden;
+	double r;
+
+	if (mpz_cmp_ui(den, 0) == 0) {
+		return 0;
+	}
+
+	mpf_init(fnum);
+	mpf_init(fden);
+
+	r = congruency_ratio_f(num, den, fnum, fden);
+
+	mpf_clear(fnum);
+	mpf_clear(fden);
+
+	return r;
+}
+
+
+/**
+ * \brief Calculate num / den as a double using initialized mpf variables
+ * \param [in] num Numerator
+ * \param [in] den Denominator
+ * \param [in] fnum Scratch variable (mpf_init)
+ * \param [in] fden Scratch variable (mpf_init)
+ * \return double 0 if den is zero
+ */
+double congruency_ratio_f(mpz_t num, mpz_t den, mpf_t fnum, mpf_t fden)
+{
+	if (mpz_cmp_ui(den, 0) == 0) {
+		return 0;
+	}
+
+	mpf_set_z(fnum, num);
+	mpf_set_z(fden, den);
+
+	/* fnum = fnum / fden */
+	mpf_div(fnum, fnum, fden);
+
+	return mpf_get_d(fnum);
+}
+
+
+/**
+ * \brief Add a cell (or a cluster) of n elements to a contingency table
+ * \param [in,out] nlogn Sum of n log n
+ * \param [in,out] pairs Sum of pairs of elements, n (n - 1) / 2
+ * \param [in] n Number of elements
+ */
+void ptable_add(double *nlogn, unsigned long *pairs, unsigned long n)
+{
+	if (n > 1) {
+		*nlogn += n * log(n);
+		*pairs += (n * (n - 1)) / 2;
+	}
+}
+
+
+/**
+ * \brief Partition indexes of a contingency table
+ * \param [in] t Contingency table
+ * \param [out] values Adjusted Rand index, normalized mutual information
+ *        (arithmetic mean of entropies), Jaccard and Fowlkes-Mallows
+ *        indexes (NPARTITION values, order of the INDEX_* bits)
+ * \note Partitions with nothing to compare (no pairs or no entropy on
+ *       both sides) are identical, so their indexes are 1. Without common
+ *       elements, all indexes are 0.
+ */
+void partition_scores(ptable_t *t, double *values)
+{
+	double n, total, expected, max, h1, h2, mi, den;
+
+	if (t->n == 0) {
+		values[0] = values[1] = values[2] = values[3] = 0;
+		return;
+	}
+	n = t->n;
+
+	/* Adjusted Rand index */
+	total    = (n * (n - 1)) / 2;
+	expected = (total > 0) ? ((double)t->pairs1 * t->pairs2) / total : 0;
+	max      = ((double)t->pairs1 + t->pairs2) / 2;
+	values[0] = (max != expected) ? (t->pairs - expected) / (max - expected) : 1;
+
+	/* Normalized mutual information */
+	h1  = log(n) - t->nlogn1 / n;
+	h2  = log(n) - t->nlogn2 / n;
+	mi  = (t->nlogn - t->nlogn1 - t->nlogn2) / n + log(n);
+	den = h1 + h2;
+	values[1] = (den > 0) ? (2 * mi) / den : 1;
+	if (values[1] < 0) values[1] = 0;
+	if (values[1] > 1) values[1] = 1;
+
+	/* Jaccard */
+	den = (double)t->pairs1 + t->pairs2 - t->pairs;
+	values[2] = (den > 0) ? t->pairs / den : 1;
+
+	/* Fowlkes-Mallows */
+	if (t->pairs1 > 0 && t->pairs2 > 0) {
+		values[3] = t->pairs / sqrt((double)t->pairs1 * t->pairs2);
+	} else {
+		values[3] = (t->pairs1 == t->pairs2) ? 1 : 0;
+	}
+}
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "cmatches.h"
 
 /**
@@ -66,6 +67,32 @@ cmat_t *create_matrix(unsigned long size)
 }
 
 
+/**
+ * \brief Create a matrix without values (just size and columns names)
+ * \param size Matrix size
+ * \param return cmat_t
+ */
+cmat_t *create_matrix_header(unsigned long size)
+{
+	cmat_t *mat;
+
+	mat = (cmat_t*)malloc(sizeof(cmat_t));
+	if (mat == NULL) {
+		return NULL;
+	}
+
+	mat->col_names = (char**)malloc(sizeof(char*) * size);
+	if (mat->col_names == NULL) {
+		free(mat);
+		return NULL;
+	}
+	mat->matrix = NULL;
+	mat->size   = size;
+
+	return(mat);
+}
+
+
 /**
  * \brief Destroy matrix
  * \param mat Matrix
@@ -81,8 +108,11 @@ void destroy_matrix(cmat_t *mat)
 	}
 
 	free(mat->col_names);
-	for (i = 0; i < size; i++) {
-		free(mat->matrix[i]);
+	if (mat->matrix != NULL) {
+		for (i = 0; i < size; i++) {
+			free(mat->matrix[i]);
+		}
+		free(mat->matrix);
 	}
 
 	free(mat);
@@ -98,7 +128,7 @@ void zero_matrix(cmat_t *mat)
 {
 	unsigned long i, j;
 
-	if (mat == NULL) {
+	if (mat == NULL || mat->matrix == NULL) {
 		return;
 	}
 
@@ -118,17 +148,199 @@ void zero_matrix(cmat_t *mat)
 void print_matrix(cmat_t *mat, FILE *stream)
 {
 	unsigned long i, j;
+	writer_t *w;
 
 	if (mat == NULL) {
 		return;
 	}
 
+	w = writer_open(stream, outfmt);
+	if (w == NULL) {
+		perror("print_matrix");
+		return;
+	}
+
 	for (i = 0; i < mat->size; i++) {
-		fprintf(stream, "%s ", mat->col_names[i]);
+		writer_puts(w, mat->col_names[i]);
+		writer_put(w, " ", 1);
 		for (j = 0; j < mat->size; j++) {
-			fprintf(stream, "%f ", mat->matrix[i][j]);
+			writer_double(w, mat->matrix[i][j]);
+		}
+		writer_put(w, "\n", 1);
+	}
+
+	writer_close(w);
+}
+
+
+
+/**
+ * \brief Calculate total mean and standard deviation of the matrix
+ * \param [in] mat Matrix
+ * \param [out] mean Total mean (upper triangle)
+ * \param [out] sd Standard deviation (upper triangle)
+ */
+void matrix_stats(cmat_t *mat, double *mean, double *sd)
+{
+	unsigned long i, j, n;
+	double c_mean, sumsqr, dev, va;
+
+	c_mean = n = 0;
+	for (i = 0; i < mat->size; i++) {
+		for (j = i+1; j < mat->size; j++) {
+			c_mean += mat->matrix[i][j];
+			n++;
+		}
+	}
+	c_mean = c_mean / (double)n;
+
+	sumsqr = 0;
+	for (i = 0; i < mat->size; i++) {
+		for (j = i+1; j < mat->size; j++) {
+			dev     = mat->matrix[i][j] - c_mean;
+			sumsqr += (dev * dev);
+		}
+	}
+	if (n == 1) {
+		*sd = 0;
+	} else {
+		va  = sumsqr / (double)(n-1);
+		*sd = sqrt(va);
+	}
+	*mean = c_mean;
+}
+
+
+/** Names of the congruency indexes (order of the INDEX_* bits) */
+static const char *index_names[NINDEXES] = { "h", "h2", "ari", "nmi", "jaccard", "fm" };
+
+
+/**
+ * \brief Position of a congruency index (order of the INDEX_* bits)
+ * \param [in] ind Congruency index (one bit)
+ * \return int Position, -1 if ind is not one index
+ */
+int index_slot(char ind)
+{
+	int k;
+
+	for (k = 0; k < NINDEXES; k++) {
+		if (ind == (1 << k)) {
+			return k;
 		}
-		fprintf(stream, "\n");
 	}
+	return -1;
+}
+
+
+/**
+ * \brief Name of a congruency index (used by --index and output files)
+ * \param [in] ind Congruency index (one bit)
+ * \return const char* Name, "?" if ind is not one index
+ */
+const char *index_name(char ind)
+{
+	int k;
+
+	k = index_slot(ind);
+	return (k >= 0) ? index_names[k] : "?";
 }
 
+
+/**
+ * \brief Parse a list of congruency indexes
+ * \param [in] list Names separated by commas (e.g. h,h2,ari)
+ * \return char Indexes (INDEX_* bits), 0 if a name is not known
+ */
+char parse_indexes(const char *list)
+{
+	const char *p, *end;
+	size_t len;
+	char ind;
+	int k;
+
+	ind = 0;
+	for (p = list; ; p = end + 1) {
+		end = strchr(p, ',');
+		len = (end != NULL) ? (size_t)(end - p) : strlen(p);
+		for (k = 0; k < NINDEXES; k++) {
+			if (strlen(index_names[k]) == len && strncmp(p, index_names[k], len) == 0) {
+				break;
+			}
+		}
+		if (k == NINDEXES) {
+			return 0;
+		}
+		ind |= (1 << k);
+		if (end == NULL) {
+			return ind;
+		}
+	}
+}
+
+
+/**
+ * \brief Print the title of a congruency index
+ * \param [in] ind Congruency index
+ * \param [out] stream File stream
+ */
+void print_index_title(char ind, FILE *stream)
+{
+	switch (ind) {
+		case INDEX_P2P:
+			fprintf(stream, "============= pair-to-pair congruency (h) =============\n");
+			break;
+
+		case INDEX_ARI:
+			fprintf(stream, "============== adjusted Rand index (ari) ==============\n");
+			break;
+
+		case INDEX_NMI:
+			fprintf(stream, "======== normalized mutual information (nmi) ==========\n");
+			break;
+
+		case INDEX_JACCARD:
+			fprintf(stream, "================ Jaccard index (jaccard) ==============\n");
+			break;
+
+		case INDEX_FM:
+			fprintf(stream, "============= Fowlkes-Mallows index (fm) ==============\n");
+			break;
+
+		default:
+			fprintf(stream, "============== complete congruency index ==============\n");
+	}
+}
+
+
+/**
+ * \brief Print the matrix followed by its mean and standard deviation
+ * \param [in] mat Matrix
+ * \param [out] stream File stream
+ */
+void print_results(cmat_t *mat, FILE *stream)
+{
+	double c_mean, sd;
+
+	stats_phase(PHASE_STATS);
+	matrix_stats(mat, &c_mean, &sd);
+	stats_phase(PHASE_OUTPUT);
+
+	print_matrix(mat, stream);
+	print_stats(c_mean, sd, stream);
+}
+
+
+/**
+ * \brief Print total mean and standard deviation
+ * \param [in] mean Total mean
+ * \param [in] sd Standard deviation
+ * \param [out] stream File stream
+ */
+void print_stats(double mean, double sd, FILE *stream)
+{
+	fprintf(stream, "---------------------------------------\n");
+	fprintf(stream, "Total mean         = %f\n", mean);
+	fprintf(stream, "Standard deviation = %f\n", sd);
+	fprintf(stream, "---------------------------------------\n\n");
+}
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cmatches.h"
+
+/** Number of stripes (power of 2), each one with its own lock */
+#define NAMESET_STRIPES 64
+/** Initial number of slots of each stripe (power of 2) */
+#define NAMESET_SLOTS   256
+
+
+/**
+ * \brief Hash a string (FNV-1a)
+ * \param [in] str String
+ * \return unsigned long Hash value
+ */
+static unsigned long hash_name(const char *str)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	unsigned long hash = FNV_OFFSET;
+
+	while (*p) {
+		hash ^= *p++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+
+/**
+ * \brief Create an empty name set
+ * \return nameset_t* Name set, NULL on error
+ */
+nameset_t *create_nameset(void)
+{
+	nameset_t *ns;
+	unsigned long i;
+
+	ns = calloc(1, sizeof(nameset_t));
+	if (ns == NULL) {
+		return NULL;
+	}
+	ns->nstripes = NAMESET_STRIPES;
+	ns->stripes  = calloc(ns->nstripes, sizeof(nstripe_t));
+	if (ns->stripes == NULL) {
+		free(ns);
+		return NULL;
+	}
+	for (i = 0; i < ns->nstripes; i++) {
+		pthread_mutex_init(&ns->stripes[i].lock, NULL);
+		ns->stripes[i].cap    = NAMESET_SLOTS;
+		ns->stripes[i].slots  = calloc(NAMESET_SLOTS, sizeof(char*));
+		ns->stripes[i].hashes = malloc(sizeof(unsigned long) * NAMESET_SLOTS);
+		ns->stripes[i].ids    = malloc(sizeof(unsigned long) * NAMESET_SLOTS);
+		if (ns->stripes[i].slots == NULL || ns->stripes[i].hashes == NULL || ns->stripes[i].ids == NULL) {
+			destroy_nameset(ns);
+			return NULL;
+		}
+	}
+	return ns;
+}
+
+
+/**
+ * \brief Double the number of slots of a stripe
+ * \param [in] s Stripe (locked)
+ * \return int 0 on success, -1 otherwise
+ */
+static int grow_stripe(nstripe_t *s)
+{
+	char **slots;
+	unsigned long *hashes, *ids, cap, i, k;
+
+	cap    = s->cap * 2;
+	slots  = calloc(cap, sizeof(char*));
+	hashes = malloc(sizeof(unsigned long) * cap);
+	ids    = malloc(sizeof(unsigned long) * cap);
+	if (slots == NULL || hashes == NULL || ids == NULL) {
+		free(slots);
+		free(hashes);
+		free(ids);
+		return -1;
+	}
+	for (i = 0; i < s->cap; i++) {
+		if (s->slots[i] == NULL) continue;
+		k = s->hashes[i] & (cap - 1);
+		while (slots[k] != NULL) {
+			k = (k + 1) & (cap - 1);
+		}
+		slots[k]  = s->slots[i];
+		hashes[k] = s->hashes[i];
+		ids[k]    = s->ids[i];
+	}
+	free(s->slots);
+	free(s->hashes);
+	free(s->ids);
+	s->slots  = slots;
+	s->hashes = hashes;
+	s->ids    = ids;
+	s->cap    = cap;
+	return 0;
+}
+
+
+/**
+ * \brief Add a name to the set (thread safe)
+ * \param [in] ns Name set
+ * \param [in] name Name
+ * \param [in] take Name was allocated with malloc and can be kept by the set
+ * \param [out] id Element id of the name (may be NULL)
+ * \return int 1 if the name was added, 0 if it was already there, -1 on error
+ * \note When take is set and the name is added, the set owns the name.
+ *       Names get ids 0, 1, 2, ... in the order they are added.
+ */
+int nameset_add(nameset_t *ns, char *name, char take, unsigned long *id)
+{
+	nstripe_t *s;
+	unsigned long hash, k;
+	int ret;
+
+	hash = hash_name(name);
+	/* High bits choose the stripe, low bits the slot */
+	s = &ns->stripes[(hash >> 58) & (ns->nstripes - 1)];
+
+	pthread_mutex_lock(&s->lock);
+	k = hash & (s->cap - 1);
+	while (s->slots[k] != NULL) {
+		if (s->hashes[k] == hash && strcmp(s->slots[k], name) == 0) {
+			if (id != NULL) {
+				*id = s->ids[k];
+			}
+			pthread_mutex_unlock(&s->lock);
+			return 0;
+		}
+		k = (k + 1) & (s->cap - 1);
+	}
+
+	/* Keep load factor below 1/2 */
+	if (((s->count + 1) * 2) > s->cap) {
+		if (grow_stripe(s) < 0) {
+			pthread_mutex_unlock(&s->lock);
+			return -1;
+		}
+		k = hash & (s->cap - 1);
+		while (s->slots[k] != NULL) {
+			k = (k + 1) & (s->cap - 1);
+		}
+	}
+
+	ret = -1;
+	s->slots[k] = take ? name : strdup(name);
+	if (s->slots[k] != NULL) {
+		s->hashes[k] = hash;
+		s->ids[k]    = __atomic_fetch_add(&ns->nextid, 1, __ATOMIC_RELAXED);
+		s->count++;
+		if (id != NULL) {
+			*id = s->ids[k];
+		}
+		ret = 1;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return ret;
+}
+
+
+/**
+ * \brief Look up a name
+ * \param [in] ns Name set
+ * \param [in] name Name
+ * \param [out] id Element id of the name (may be NULL)
+ * \return int 1 if the name is in the set, 0 otherwise
+ * \note Must not run concurrently with nameset_add()
+ */
+int nameset_find(nameset_t *ns, const char *name, unsigned long *id)
+{
+	nstripe_t *s;
+	unsigned long hash, k;
+
+	hash = hash_name(name);
+	s    = &ns->stripes[(hash >> 58) & (ns->nstripes - 1)];
+
+	k = hash & (s->cap - 1);
+	while (s->slots[k] != NULL) {
+		if (s->hashes[k] == hash && strcmp(s->slots[k], name) == 0) {
+			if (id != NULL) {
+				*id = s->ids[k];
+			}
+			return 1;
+		}
+		k = (k + 1) & (s->cap - 1);
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Number of names in the set
+ * \param [in] ns Name set
+ * \return unsigned long
+ */
+unsigned long nameset_count(nameset_t *ns)
+{
+	unsigned long i, n;
+
+	n = 0;
+	for (i = 0; i < ns->nstripes; i++) {
+		n += ns->stripes[i].count;
+	}
+	return n;
+}
+
+
+/**
+ * \brief Get the names of the set (the set still owns them)
+ * \param [in] ns Name set
+ * \param [out] size Vector size
+ * \return char** Names in no particular order (free only the vector), NULL on error
+ */
+char **nameset_names(nameset_t *ns, unsigned long *size)
+{
+	char **names;
+	unsigned long i, k, n;
+
+	names = malloc(sizeof(char*) * (nameset_count(ns) + 1));
+	if (names == NULL) {
+		return NULL;
+	}
+
+	n = 0;
+	for (i = 0; i < ns->nstripes; i++) {
+		for (k = 0; k < ns->stripes[i].cap; k++) {
+			if (ns->stripes[i].slots[k] != NULL) {
+				names[n++] = ns->stripes[i].slots[k];
+			}
+		}
+	}
+	*size = n;
+	return names;
+}
+
+
+/**
+ * \brief Write the names of the set to a list file (sorted)
+ * \param [in] ns Name set
+ * \param [in] filename List file name
+ * \return int 0 on success, -1 otherwise
+ */
+int write_nameset(nameset_t *ns, const char *filename)
+{
+	char **names;
+	unsigned long i, n;
+	FILE *fp;
+
+	if ((names = nameset_names(ns, &n)) == NULL) {
+		return -1;
+	}
+	if ((fp = fopen(filename, "w")) == NULL) {
+		free(names);
+		return -1;
+	}
+	qsort(names, n, sizeof(char*), cmpstringp);
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "%s\n", names[i]);
+	}
+	free(names);
+	return fclose(fp);
+}
+
+
+/**
+ * \brief Move the names out of the set into a vector (in no particular order)
+ * \param [in] ns Name set (left empty)
+ * \param [out] size Vector size
+ * \return char** Names, NULL on error
+ */
+char **nameset_list(nameset_t *ns, unsigned long *size)
+{
+	char **names;
+	unsigned long i, k, n;
+
+	n = nameset_count(ns);
+	names = malloc(sizeof(char*) * ((n > 0) ? n : 1));
+	if (names == NULL) {
+		return NULL;
+	}
+
+	n = 0;
+	for (i = 0; i < ns->nstripes; i++) {
+		for (k = 0; k < ns->stripes[i].cap; k++) {
+			if (ns->stripes[i].slots[k] != NULL) {
+				names[n++] = ns->stripes[i].slots[k];
+				ns->stripes[i].slots[k] = NULL;
+			}
+		}
+		ns->stripes[i].count = 0;
+	}
+	*size = n;
+	return names;
+}
+
+
+/**
+ * \brief Destroy a name set
+ * \param [in] ns Name set
+ */
+void destroy_nameset(nameset_t *ns)
+{
+	unsigned long i, k;
+
+	if (ns == NULL) return;
+
+	for (i = 0; i < ns->nstripes; i++) {
+		if (ns->stripes[i].cap == 0) {
+			/* not initialized */
+			break;
+		}
+		if (ns->stripes[i].slots != NULL) {
+			for (k = 0; k < ns->stripes[i].cap; k++) {
+				free(ns->stripes[i].slots[k]);
+			}
+		}
+		free(ns->stripes[i].slots);
+		free(ns->stripes[i].hashes);
+		free(ns->stripes[i].ids);
+		pthread_mutex_destroy(&ns->stripes[i].lock);
+	}
+	free(ns->stripes);
+	free(ns);
+}
@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "cmatches.h"
+
+/** Writer buffer size */
+#define WRITER_BUFFER (1 << 20)
+
+/** Largest value formatted without printf (fixed precision) */
+#define FIXED_MAX 1e6
+
+/** Raw matrix file magic (8 bytes) */
+#define RAW_MAGIC   "MATCHES"
+/** Raw matrix file version */
+#define RAW_VERSION 1
+
+/** Output format names (same order as OUTPUT_* constants) */
+static const char *format_names[] = {
+	"text", "roundtrip", "raw64", "raw32", "npy", "npy32", NULL
+};
+
+
+/**
+ * \brief Parse output format name
+ * \param [in] name Format name
+ * \return int Output format (OUTPUT_*), -1 if unknown
+ */
+int parse_output_format(const char *name)
+{
+	int i;
+
+	for (i = 0; format_names[i] != NULL; i++) {
+		if (strcmp(name, format_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/**
+ * \brief Format a double exactly as printf("%f") does
+ * \param [in] x Value
+ * \param [out] buf Buffer (at least FORMAT_BUFFER bytes)
+ * \return int String length
+ * \note Values are scaled to an integer number of millionths. The scaled
+ *       value carries at most half ulp of error, so only values whose
+ *       fraction is too close to 0.5 (and big values) go through snprintf.
+ */
+int format_fixed(double x, char *buf)
+{
+	double ax, scaled, frac;
+	uint64_t n, ip;
+	uint32_t fp;
+	char tmp[24];
+	int len, i;
+
+	ax = fabs(x);
+	if (!(ax < FIXED_MAX)) {
+		return snprintf(buf, FORMAT_BUFFER, "%f", x);
+	}
+
+	scaled = ax * 1e6;
+	n      = (uint64_t)scaled;
+	frac   = scaled - (double)n;
+	if (frac > 0.499 && frac < 0.501) {
+		return snprintf(buf, FORMAT_BUFFER, "%f", x);
+	}
+	if (frac > 0.5) {
+		n++;
+	}
+
+	ip = n / 1000000;
+	fp = n % 1000000;
+
+	len = 0;
+	if (signbit(x)) {
+		buf[len++] = '-';
+	}
+	i = 0;
+	do {
+		tmp[i++] = '0' + (ip % 10);
+		ip /= 10;
+	} while (ip > 0);
+	while (i > 0) {
+		buf[len++] = tmp[--i];
+	}
+	buf[len++] = '.';
+	for (i = 5; i >= 0; i--) {
+		buf[len + i] = '0' + (fp % 10);
+		fp /= 10;
+	}
+	len += 6;
+	buf[len] = '\0';
+
+	return len;
+}
+
+
+/**
+ * \brief Format a double with the shortest representation that reads back
+ *        to the same value
+ * \param [in] x Value
+ * \param [out] buf Buffer (at least FORMAT_BUFFER bytes)
+ * \return int String length
+ */
+int format_shortest(double x, char *buf)
+{
+	int prec, len;
+
+	len = 0;
+	for (prec = 15; prec <= 17; prec++) {
+		len = snprintf(buf, FORMAT_BUFFER, "%.*g", prec, x);
+		if (!isfinite(x) || strtod(buf, NULL) == x) {
+			break;
+		}
+	}
+	return len;
+}
+
+
+/**
+ * \brief Create a buffered writer on top of a stream
+ * \param [in] stream Output stream
+ * \param [in] format Output format for doubles (OUTPUT_TEXT or OUTPUT_ROUNDTRIP)
+ * \return writer_t*
+ */
+writer_t *writer_open(FILE *stream, int format)
+{
+	writer_t *w;
+
+	w = malloc(sizeof(writer_t));
+	if (w == NULL) {
+		return NULL;
+	}
+	w->buf = malloc(WRITER_BUFFER);
+	if (w->buf == NULL) {
+		free(w);
+		return NULL;
+	}
+	w->stream = stream;
+	w->format = format;
+	w->len    = 0;
+	w->cap    = WRITER_BUFFER;
+	return w;
+}
+
+
+/**
+ * \brief Write buffered data to the stream
+ * \param [in] w Writer
+ */
+void writer_flush(writer_t *w)
+{
+	if (w->len > 0) {
+		fwrite(w->buf, 1, w->len, w->stream);
+		w->len = 0;
+	}
+}
+
+
+/**
+ * \brief Write a memory block
+ * \param [in] w Writer
+ * \param [in] data Data
+ * \param [in] len Data length
+ */
+void writer_put(writer_t *w, const char *data, size_t len)
+{
+	if ((w->len + len) > w->cap) {
+		writer_flush(w);
+		if (len > w->cap) {
+			fwrite(data, 1, len, w->stream);
+			return;
+		}
+	}
+	memcpy(&w->buf[w->len], data, len);
+	w->len += len;
+}
+
+
+/**
+ * \brief Write a string
+ * \param [in] w Writer
+ * \param [in] str String
+ */
+void writer_puts(writer_t *w, const char *str)
+{
+	writer_put(w, str, strlen(str));
+}
+
+
+/**
+ * \brief Write a double followed by a space (as print_matrix() always did)
+ * \param [in] w Writer
+ * \param [in] x Value
+ */
+void writer_double(writer_t *w, double x)
+{
+	char buf[FORMAT_BUFFER];
+	int len;
+
+	if (w->format == OUTPUT_ROUNDTRIP) {
+		len = format_shortest(x, buf);
+	} else {
+		len = format_fixed(x, buf);
+	}
+	buf[len++] = ' ';
+	writer_put(w, buf, len);
+}
+
+
+/**
+ * \brief Flush and destroy the writer (the stream is not closed)
+ * \param [in] w Writer
+ */
+void writer_close(writer_t *w)
+{
+	if (w == NULL) return;
+
+	writer_flush(w);
+	free(w->buf);
+	free(w);
+}
+
+
+/**
+ * \brief Store a 32 bit value as little endian
+ */
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
+/**
+ * \brief Store a 64 bit value as little endian
+ */
+static void put_le64(unsigned char *p, uint64_t v)
+{
+	put_le32(p, (uint32_t)v);
+	put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+
+/**
+ * \brief Write the header of a raw matrix file
+ * \param [out] fp File
+ * \param [in] size Matrix size
+ * \param [in] esize Element size (4 or 8)
+ * \note Header: magic "MATCHES\0", version (u32), element size (u32),
+ *       rows (u64) and columns (u64), all little endian. Values follow in
+ *       row major order.
+ */
+static void write_raw_header(FILE *fp, unsigned long size, uint32_t esize)
+{
+	unsigned char hdr[32];
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, RAW_MAGIC, strlen(RAW_MAGIC));
+	put_le32(&hdr[8],  RAW_VERSION);
+	put_le32(&hdr[12], esize);
+	put_le64(&hdr[16], size);
+	put_le64(&hdr[24], size);
+	fwrite(hdr, 1, sizeof(hdr), fp);
+}
+
+
+/**
+ * \brief Write the header of a NumPy (.npy) file
+ * \param [out] fp File
+ * \param [in] size Matrix size
+ * \param [in] esize Element size (4 or 8)
+ */
+static void write_npy_header(FILE *fp, unsigned long size, uint32_t esize)
+{
+	char dict[128];
+	unsigned char pre[10];
+	int len, pad;
+
+	len = snprintf(dict, sizeof(dict), "{'descr': '<f%u', 'fortran_order': False, 'shape': (%lu, %lu), }",
+			esize, size, size);
+
+	/* Magic + version + header length + dict + padding + '\n' must be a multiple of 64 */
+	pad = 64 - ((10 + len + 1) % 64);
+	if (pad == 64) {
+		pad = 0;
+	}
+
+	memcpy(pre, "\x93NUMPY", 6);
+	pre[6] = 1;
+	pre[7] = 0;
+	pre[8] = (len + pad + 1) & 0xff;
+	pre[9] = ((len + pad + 1) >> 8) & 0xff;
+	fwrite(pre, 1, sizeof(pre), fp);
+	fwrite(dict, 1, len, fp);
+	while (pad-- > 0) {
+		fputc(' ', fp);
+	}
+	fputc('\n', fp);
+}
+
+
+/**
+ * \brief Write a matrix in a binary format
+ * \param [in] mat Matrix
+ * \param [in] filename Output file name
+ * \param [in] format Output format (OUTPUT_RAW64, OUTPUT_RAW32, OUTPUT_NPY or OUTPUT_NPY32)
+ * \return int 0 on success, -1 otherwise
+ */
+int write_binary_matrix(cmat_t *mat, const char *filename, int format)
+{
+	FILE *fp;
+	unsigned char *row;
+	unsigned long i, j;
+	uint32_t esize;
+	uint64_t u64;
+	uint32_t u32;
+	float f;
+	int ret = 0;
+
+	esize = (format == OUTPUT_RAW32 || format == OUTPUT_NPY32) ? 4 : 8;
+
+	if ((fp = fopen(filename, "wb")) == NULL) {
+		perror(filename);
+		return -1;
+	}
+	row = malloc(esize * ((mat->size > 0) ? mat->size : 1));
+	if (row == NULL) {
+		perror("write_binary_matrix");
+		fclose(fp);
+		return -1;
+	}
+
+	if (format == OUTPUT_NPY || format == OUTPUT_NPY32) {
+		write_npy_header(fp, mat->size, esize);
+	} else {
+		write_raw_header(fp, mat->size, esize);
+	}
+
+	for (i = 0; i < mat->size; i++) {
+		for (j = 0; j < mat->size; j++) {
+			if (esize == 8) {
+				memcpy(&u64, &mat->matrix[i][j], sizeof(u64));
+				put_le64(&row[j * 8], u64);
+			} else {
+				f = (float)mat->matrix[i][j];
+				memcpy(&u32, &f, sizeof(u32));
+				put_le32(&row[j * 4], u32);
+			}
+		}
+		if (fwrite(row, esize, mat->size, fp) < mat->size) {
+			perror(filename);
+			ret = -1;
+			break;
+		}
+	}
+
+	free(row);
+	if (fclose(fp) != 0) {
+		perror(filename);
+		ret = -1;
+	}
+	return ret;
+}
+
+
+/**
+ * \brief Write matrix results: text formats to the stream, binary formats
+ *        to files named after basename (mean and standard deviation are
+ *        always shown on the stream)
+ * \param [in] mat Matrix
+ * \param [in] ind Congruency index
+ * \param [in] format Output format (OUTPUT_*)
+ * \param [in] basename Output file base name (binary formats)
+ * \param [out] stream Output file descriptor
+ * \return int 0 on success, -1 otherwise
+ * \note Binary formats write <basename>-<index name> with extension .bin or
+ *       .npy, and the row/column names to <basename>.names
+ */
+int output_results(cmat_t *mat, char ind, int format, const char *basename, FILE *stream)
+{
+	char *filename;
+	double c_mean, sd;
+	unsigned long i;
+	FILE *fp;
+	int ret;
+
+	if (format == OUTPUT_TEXT || format == OUTPUT_ROUNDTRIP) {
+		print_results(mat, stream);
+		return 0;
+	}
+
+	/* Names */
+	asprintf(&filename, "%s.names", basename);
+	if ((fp = fopen(filename, "w")) == NULL) {
+		perror(filename);
+		free(filename);
+		return -1;
+	}
+	for (i = 0; i < mat->size; i++) {
+		fprintf(fp, "%s\n", mat->col_names[i]);
+	}
+	fclose(fp);
+	free(filename);
+
+	/* Matrix */
+	asprintf(&filename, "%s-%s.%s", basename, index_name(ind),
+			(format == OUTPUT_NPY || format == OUTPUT_NPY32) ? "npy" : "bin");
+	ret = write_binary_matrix(mat, filename, format);
+	if (ret == 0) {
+		fprintf(stream, "Matrix: %s\n", filename);
+	}
+	free(filename);
+
+	stats_phase(PHASE_STATS);
+	matrix_stats(mat, &c_mean, &sd);
+	stats_phase(PHASE_OUTPUT);
+	print_stats(c_mean, sd, stream);
+
+	return ret;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "cmatches.h"
+
+/*
+ * Hardware performance counters (--perf)
+ *
+ * Each thread that calculates pairs opens one group of counters (read all
+ * at once), so kernel phases are counted by the thread itself. The pairs
+ * phase is counted by inherited counters opened by the main thread, which
+ * also count the worker threads it starts (added when they exit).
+ *
+ * When counters can not be opened (no PMU, perf_event_paranoid, seccomp,
+ * ...) hw_counters is cleared and runs go on with timing only.
+ */
+
+/** Count hardware events (--perf) */
+char hw_counters = 0;
+
+/** Hardware events (same order as HW_* constants) */
+static const unsigned long long hw_config[NHWEVENTS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+/** Counters of the pairs phase (main thread and its workers) */
+static int pairs_fd[NHWEVENTS] = { -1, -1, -1, -1 };
+/** Pairs phase counters were opened at least once */
+static char pairs_counted = 0;
+/** Counters could not be opened */
+static char hw_failed = 0;
+
+
+/**
+ * \brief Open one hardware counter of the calling thread
+ * \param [in] config Event (PERF_COUNT_HW_*)
+ * \param [in] group Group leader (-1 for none)
+ * \param [in] inherit Count threads created afterwards too
+ * \return int File descriptor, -1 on error
+ */
+static int open_counter(unsigned long long config, int group, char inherit)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size           = sizeof(attr);
+	attr.type           = PERF_TYPE_HARDWARE;
+	attr.config         = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+	attr.inherit        = inherit;
+	if (!inherit) {
+		attr.read_format = PERF_FORMAT_GROUP;
+	}
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+
+/**
+ * \brief Close hardware counters
+ * \param [in,out] fd Counters (set to -1)
+ */
+void hw_close(int *fd)
+{
+	int i;
+
+	for (i = (NHWEVENTS - 1); i >= 0; i--) {
+		if (fd[i] >= 0) {
+			close(fd[i]);
+		}
+		fd[i] = -1;
+	}
+}
+
+
+/**
+ * \brief Open the hardware counters of the calling thread
+ * \param [out] fd Counters (fd[0] is the group leader)
+ * \param [in] inherit Independent counters that count threads created
+ *        afterwards too (otherwise, one group)
+ * \return int 0 on success, -1 otherwise (hw_counters is cleared)
+ */
+int hw_open(int *fd, char inherit)
+{
+	int i;
+
+	for (i = 0; i < NHWEVENTS; i++) {
+		fd[i] = -1;
+	}
+	for (i = 0; i < NHWEVENTS; i++) {
+		fd[i] = open_counter(hw_config[i], (inherit || i == 0) ? -1 : fd[0], inherit);
+		if (fd[i] < 0) {
+			hw_close(fd);
+			/* Not available: just timing */
+			hw_counters = 0;
+			hw_failed   = 1;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Read hardware counters
+ * \param [in] fd Counters (see hw_open())
+ * \param [in] inherit Counters were opened with inherit
+ * \param [out] values Counter values
+ * \return int 0 on success, -1 otherwise
+ */
+int hw_read(int *fd, char inherit, unsigned long long *values)
+{
+	unsigned long long buf[NHWEVENTS + 1];
+	int i;
+
+	if (fd[0] < 0) {
+		return -1;
+	}
+	if (inherit) {
+		for (i = 0; i < NHWEVENTS; i++) {
+			if (read(fd[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	/* Group: number of counters, then the values */
+	if (read(fd[0], buf, sizeof(buf)) != sizeof(buf) || buf[0] != NHWEVENTS) {
+		return -1;
+	}
+	memcpy(values, &buf[1], sizeof(unsigned long long) * NHWEVENTS);
+	return 0;
+}
+
+
+/**
+ * \brief Start counting the pairs phase
+ * \note Called by the main thread before worker threads are started.
+ */
+void hw_pairs_begin(void)
+{
+	if (hw_open(pairs_fd, 1) == 0) {
+		pairs_counted = 1;
+	}
+}
+
+
+/**
+ * \brief Stop counting the pairs phase
+ * \param [out] values Events counted since hw_pairs_begin()
+ * \return int 0 on success, -1 if nothing was counted
+ * \note Worker threads must have exited, so their events were added.
+ */
+int hw_pairs_end(unsigned long long *values)
+{
+	int ret;
+
+	ret = hw_read(pairs_fd, 1, values);
+	hw_close(pairs_fd);
+	return ret;
+}
+
+
+/**
+ * \brief Hardware counters status of the run
+ * \return int 1 if events were counted, -1 if counters are not available,
+ *         0 if they were not used
+ */
+int hw_status(void)
+{
+	if (pairs_counted && !hw_failed) {
+		return 1;
+	}
+	return hw_failed ? -1 : 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <gmp.h>
+#include "cmatches.h"
+
+/*
+ * Permutation test (--permutations K)
+ *
+ * The null model of a pair relabels the common elements of the second
+ * cluster set at random: a permutation maps the common elements to the
+ * positions of the common elements of the second set, so the clusters of
+ * both sets keep their sizes (and Np) and only Ne changes (see
+ * perm_prepare() and perm_ne()). For each pair, K permutations give the
+ * p-value, (1 + permutations with Ne >= observed Ne) / (K + 1), and the
+ * z-score of the observed Ne (same as the z-score of the index, Np is
+ * fixed).
+ *
+ * Permutations come from a counter-based generator (Philox2x64-10) keyed
+ * by the seed and the names of both files, with the permutation number as
+ * counter: permutation k of a pair is the same whatever thread calculates
+ * it. Sums of Ne and Ne^2 are exact, so results do not depend on the
+ * number of threads either. When there are fewer pairs than threads,
+ * pairs are split in blocks of permutations so all threads have work.
+ */
+
+/** Philox2x64 multiplier and key increment (Weyl sequence) */
+#define PHILOX_M 0xD2B74407B1CE6E93UL
+#define PHILOX_W 0x9E3779B97F4A7C15UL
+/** Philox rounds */
+#define PHILOX_ROUNDS 10
+
+/**
+ * Permutation results of a pair split in blocks
+ */
+typedef struct _pacc {
+	/** permutations with Ne >= observed Ne */
+	unsigned long ge;
+	/** blocks done */
+	unsigned long blocks;
+	/** a block could not be calculated */
+	char error;
+	/** sum of Ne and of Ne^2 */
+	mpz_t sum, sumsq;
+	/** protects the fields above */
+	pthread_mutex_t lock;
+} pacc_t;
+
+/**
+ * Permutation test of one index
+ */
+typedef struct _permjob {
+	/** observed index, p-values and z-scores */
+	cmat_t *mat, *pmat, *zmat;
+	/** loaded cluster sets */
+	cstore_t *store;
+	/** index (INDEX_P2P or INDEX_COMP) */
+	char ind;
+	/** permutations of each pair */
+	unsigned long nperm;
+	/** generator seed */
+	unsigned long seed;
+	/** blocks of each pair and number of tasks (pair, block) */
+	unsigned long nblocks, ntasks;
+	/** next task */
+	unsigned long next;
+	/** first pair (upper triangle, row order) of each row */
+	unsigned long *rowstart;
+	/** results of the pairs (NULL when pairs are not split) */
+	pacc_t *acc;
+} permjob_t;
+
+
+/**
+ * \brief Philox2x64-10 block
+ * \param [in] ctr Counter
+ * \param [in] key Key
+ * \param [out] out Random output (128 bits)
+ */
+static void philox(const uint64_t *ctr, uint64_t key, uint64_t *out)
+{
+	unsigned __int128 p;
+	uint64_t x0, x1;
+	int r;
+
+	x0 = ctr[0];
+	x1 = ctr[1];
+	for (r = 0; r < PHILOX_ROUNDS; r++) {
+		p   = (unsigned __int128)PHILOX_M * x0;
+		x0  = (uint64_t)(p >> 64) ^ key ^ x1;
+		x1  = (uint64_t)p;
+		key += PHILOX_W;
+	}
+	out[0] = x0;
+	out[1] = x1;
+}
+
+
+/**
+ * \brief Permutation k of a pair (Fisher-Yates shuffle)
+ * \param [out] sigma Slot of each common element
+ * \param [in] m Common elements
+ * \param [in] key Key of the pair
+ * \param [in] k Permutation
+ */
+static void shuffle(unsigned long *sigma, unsigned long m, uint64_t key, unsigned long k)
+{
+	uint64_t ctr[2], out[2], u;
+	unsigned long e, j, t;
+
+	for (e = 0; e < m; e++) {
+		sigma[e] = e;
+	}
+	ctr[0] = k;
+	ctr[1] = 0;
+	out[0] = out[1] = 0;
+	for (e = m; e > 1; e--) {
+		if (((m - e) & 1) == 0) {
+			philox(ctr, key, out);
+			ctr[1]++;
+			u = out[0];
+		} else {
+			u = out[1];
+		}
+		/* Uniform in [0, e) */
+		j = (unsigned long)(((unsigned __int128)u * e) >> 64);
+		t = sigma[e-1];
+		sigma[e-1] = sigma[j];
+		sigma[j]   = t;
+	}
+}
+
+
+/**
+ * \brief Store the results of a pair
+ * \param [in] job Permutation test
+ * \param [in] ws Workspace (pair prepared by perm_prepare())
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] obs Observed Ne
+ * \param [in] ge Permutations with Ne >= observed Ne
+ * \param [in] sum Sum of Ne
+ * \param [in] sumsq Sum of Ne^2
+ * \param [in] error Pair could not be calculated
+ */
+static void perm_result(permjob_t *job, workspace_t *ws, unsigned long i, unsigned long j,
+		mpz_t obs, unsigned long ge, mpz_t sum, mpz_t sumsq, char error)
+{
+	double h, p, z;
+	mpz_t num, var;
+
+	h = p = z = -1;
+	if (!error) {
+		h = congruency_ratio_f(obs, ws->maxNp, ws->fnum, ws->fden);
+		p = (double)(1 + ge) / (double)(job->nperm + 1);
+
+		/* z = (K obs - sum) / sqrt(K (K sumsq - sum^2) / (K - 1)) */
+		z = 0;
+		mpz_init(num);
+		mpz_init(var);
+		mpz_mul_ui(var, sumsq, job->nperm);
+		mpz_submul(var, sum, sum);
+		if (job->nperm > 1 && mpz_sgn(var) > 0) {
+			mpz_mul_ui(num, obs, job->nperm);
+			mpz_sub(num, num, sum);
+			mpf_set_z(ws->fden, var);
+			mpf_mul_ui(ws->fden, ws->fden, job->nperm);
+			mpf_div_ui(ws->fden, ws->fden, job->nperm - 1);
+			mpf_sqrt(ws->fden, ws->fden);
+			mpf_set_z(ws->fnum, num);
+			mpf_div(ws->fnum, ws->fnum, ws->fden);
+			z = mpf_get_d(ws->fnum);
+		}
+		mpz_clear(num);
+		mpz_clear(var);
+	}
+
+	job->mat->matrix[i][j]  = job->mat->matrix[j][i]  = h;
+	job->pmat->matrix[i][j] = job->pmat->matrix[j][i] = p;
+	job->zmat->matrix[i][j] = job->zmat->matrix[j][i] = z;
+	PROGRESS_ADD(1);
+}
+
+
+/**
+ * \brief Calculate one block of permutations of a pair
+ * \param [in] job Permutation test
+ * \param [in] t Task (pair, block)
+ */
+static void perm_task(permjob_t *job, unsigned long t)
+{
+	unsigned long p, b, i, j, lo, hi, k, k0, k1, ge;
+	workspace_t *ws;
+	pacc_t *acc;
+	mpz_t obs, ne, sq, sum, sumsq;
+	uint64_t key;
+	char error, last;
+
+	p = t / job->nblocks;
+	b = t % job->nblocks;
+
+	/* Row of the pair: last row starting at or before it */
+	lo = 0;
+	hi = job->mat->size - 1;
+	while (lo + 1 < hi) {
+		i = (lo + hi) / 2;
+		if (job->rowstart[i] <= p) {
+			lo = i;
+		} else {
+			hi = i;
+		}
+	}
+	i = lo;
+	j = i + 1 + (p - job->rowstart[i]);
+
+	k0 = (b * job->nperm) / job->nblocks;
+	k1 = ((b + 1) * job->nperm) / job->nblocks;
+
+	mpz_init(obs);
+	mpz_init(ne);
+	mpz_init(sq);
+	mpz_init(sum);
+	mpz_init(sumsq);
+	ge = 0;
+
+	ws = get_workspace();
+	error = (perm_prepare(ws, store_get(job->store, i), store_get(job->store, j), job->ind) < 0);
+	if (!error) {
+		perm_ne(ws, job->ind, ws->slot, obs);
+
+		key = fnv1a(FNV_OFFSET, &job->seed, sizeof(job->seed));
+		key = fnv1a(key, job->mat->col_names[i], strlen(job->mat->col_names[i]) + 1);
+		key = fnv1a(key, job->mat->col_names[j], strlen(job->mat->col_names[j]) + 1);
+		for (k = k0; k < k1; k++) {
+			shuffle(ws->sigma, ws->pm, key, k);
+			perm_ne(ws, job->ind, ws->sigma, ne);
+			if (mpz_cmp(ne, obs) >= 0) {
+				ge++;
+			}
+			mpz_add(sum, sum, ne);
+			mpz_mul(sq, ne, ne);
+			mpz_add(sumsq, sumsq, sq);
+		}
+	}
+
+	if (job->acc == NULL) {
+		perm_result(job, ws, i, j, obs, ge, sum, sumsq, error);
+	} else {
+		/* The last block of the pair stores the results */
+		acc = &job->acc[p];
+		pthread_mutex_lock(&acc->lock);
+		acc->ge += ge;
+		acc->error |= error;
+		mpz_add(acc->sum, acc->sum, sum);
+		mpz_add(acc->sumsq, acc->sumsq, sumsq);
+		last = (++acc->blocks == job->nblocks);
+		pthread_mutex_unlock(&acc->lock);
+		if (last) {
+			perm_result(job, ws, i, j, obs, acc->ge, acc->sum, acc->sumsq, acc->error);
+		}
+	}
+
+	mpz_clear(obs);
+	mpz_clear(ne);
+	mpz_clear(sq);
+	mpz_clear(sum);
+	mpz_clear(sumsq);
+}
+
+
+/**
+ * \brief Permutation test worker
+ * \param [in] arg Permutation test (permjob_t)
+ */
+static void *perm_worker(void *arg)
+{
+	permjob_t *job = arg;
+	unsigned long t;
+
+	while ((t = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->ntasks) {
+		perm_task(job, t);
+	}
+	return NULL;
+}
+
+
+/**
+ * \brief Calculate one index with its permutation test (p-values and
+ *        z-scores) for all pairs
+ * \param [out] mat Observed index
+ * \param [in] store Loaded cluster sets
+ * \param [in] ind Index (INDEX_P2P or INDEX_COMP)
+ * \param [in] nperm Permutations of each pair
+ * \param [in] seed Generator seed
+ * \param [out] pmat p-values
+ * \param [out] zmat z-scores
+ * \param [in] nworkers Number of threads
+ * \return int 0 on success, -1 otherwise
+ * \note Pairs that can not be calculated (see perm_prepare()) get -1 on all
+ *       matrices. The diagonal of the p-values and z-scores is 0.
+ */
+int calculate_permutation_congruency(cmat_t *mat, cstore_t *store, char ind, unsigned long nperm,
+		unsigned long seed, cmat_t *pmat, cmat_t *zmat, unsigned long nworkers)
+{
+	permjob_t job;
+	pthread_t *threads;
+	unsigned long i, npairs, n;
+
+	memset(&job, 0, sizeof(permjob_t));
+	job.mat   = mat;
+	job.pmat  = pmat;
+	job.zmat  = zmat;
+	job.store = store;
+	job.ind   = ind;
+	job.nperm = nperm;
+	job.seed  = seed;
+
+	for (i = 0; i < mat->size; i++) {
+		mat->matrix[i][i]  = 1.0;
+		pmat->matrix[i][i] = 0;
+		zmat->matrix[i][i] = 0;
+	}
+	npairs = (mat->size * (mat->size - 1)) / 2;
+	if (npairs == 0 || nperm == 0) {
+		return 0;
+	}
+
+	/* Split pairs when there are fewer than threads */
+	job.nblocks = 1;
+	if (npairs < nworkers) {
+		job.nblocks = (2 * nworkers + npairs - 1) / npairs;
+		if (job.nblocks > nperm) {
+			job.nblocks = nperm;
+		}
+	}
+	job.ntasks = npairs * job.nblocks;
+
+	job.rowstart = malloc(sizeof(unsigned long) * mat->size);
+	threads = malloc(sizeof(pthread_t) * nworkers);
+	if (job.nblocks > 1) {
+		job.acc = calloc(npairs, sizeof(pacc_t));
+	}
+	if (job.rowstart == NULL || threads == NULL || (job.nblocks > 1 && job.acc == NULL)) {
+		perror("calculate_permutation_congruency");
+		free(job.rowstart);
+		free(threads);
+		free(job.acc);
+		return -1;
+	}
+	for (i = 0, n = 0; i < mat->size; i++) {
+		job.rowstart[i] = n;
+		n += mat->size - 1 - i;
+	}
+	for (i = 0; job.acc != NULL && i < npairs; i++) {
+		mpz_init(job.acc[i].sum);
+		mpz_init(job.acc[i].sumsq);
+		pthread_mutex_init(&job.acc[i].lock, NULL);
+	}
+
+	/* Threads started take all tasks */
+	for (n = 0; n < nworkers; n++) {
+		if (pthread_create(&threads[n], NULL, perm_worker, &job) != 0) {
+			perror("calculate_permutation_congruency");
+			break;
+		}
+	}
+	if (n == 0) {
+		perm_worker(&job);
+	}
+	while (n > 0) {
+		pthread_join(threads[--n], NULL);
+	}
+
+	for (i = 0; job.acc != NULL && i < npairs; i++) {
+		mpz_clear(job.acc[i].sum);
+		mpz_clear(job.acc[i].sumsq);
+		pthread_mutex_destroy(&job.acc[i].lock);
+	}
+	free(job.acc);
+	free(job.rowstart);
+	free(threads);
+	return 0;
+}
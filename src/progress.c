@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "cmatches.h"
+
+/*
+ * Progress reporter (--progress)
+ *
+ * Threads that calculate pairs just add them to progress_done (relaxed
+ * atomic add, see PROGRESS_ADD); a reporter thread wakes up every few
+ * seconds and writes pairs done, throughput, ETA and resident memory to
+ * stderr or to a status file. Without --progress there is no reporter and
+ * nothing is counted.
+ *
+ * The status file is written to a temporary file and renamed, so a job
+ * monitor polling it never reads a partial update.
+ */
+
+/** Pairs calculated so far (all indexes) */
+unsigned long progress_done = 0;
+
+/** Pairs to be calculated */
+static unsigned long progress_total;
+/** When the calculation started */
+static double progress_begin;
+/** Status file (NULL for stderr) */
+static const char *progress_file;
+/** Seconds between updates */
+static unsigned long progress_secs;
+/** Reporter thread */
+static pthread_t progress_thread;
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_cond;
+/** Reporter is running */
+static char progress_running = 0;
+
+
+/**
+ * \brief Current resident memory of the process
+ * \return unsigned long Bytes
+ * \note Falls back to the peak resident memory when /proc is not available.
+ */
+static unsigned long resident_bytes(void)
+{
+	FILE *fp;
+	unsigned long size, rss;
+	struct rusage ru;
+
+	if ((fp = fopen("/proc/self/statm", "r")) != NULL) {
+		if (fscanf(fp, "%lu %lu", &size, &rss) == 2) {
+			fclose(fp);
+			return rss * sysconf(_SC_PAGESIZE);
+		}
+		fclose(fp);
+	}
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		return ru.ru_maxrss * 1024UL;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Format a number of seconds as h:mm:ss
+ * \param [in] secs Seconds (negative when not known)
+ * \param [out] buf Buffer (at least 32 bytes)
+ */
+static void format_time(double secs, char *buf)
+{
+	unsigned long s;
+
+	if (secs < 0) {
+		strcpy(buf, "-");
+		return;
+	}
+	s = (unsigned long)(secs + 0.5);
+	snprintf(buf, 32, "%lu:%02lu:%02lu", s / 3600, (s / 60) % 60, s % 60);
+}
+
+
+/**
+ * \brief Write the status file
+ * \param [in] done Pairs done
+ * \param [in] elapsed Seconds since the start
+ * \param [in] rate Pairs per second
+ * \param [in] eta Seconds remaining (negative when not known)
+ * \param [in] rss Resident memory (bytes)
+ * \param [in] finished Calculation is over
+ */
+static void write_status(unsigned long done, double elapsed, double rate, double eta,
+		unsigned long rss, char finished)
+{
+	FILE *fp;
+	char *tmpname;
+
+	tmpname = malloc(strlen(progress_file) + 5);
+	if (tmpname == NULL) {
+		return;
+	}
+	sprintf(tmpname, "%s.tmp", progress_file);
+
+	if ((fp = fopen(tmpname, "w")) == NULL) {
+		perror(tmpname);
+		free(tmpname);
+		return;
+	}
+	fprintf(fp, "{ \"pairs_done\": %lu, \"pairs_total\": %lu, \"elapsed\": %.3f, "
+			"\"pairs_per_second\": %.3f, \"eta\": ", done, progress_total, elapsed, rate);
+	if (eta < 0) {
+		fprintf(fp, "null");
+	} else {
+		fprintf(fp, "%.3f", eta);
+	}
+	fprintf(fp, ", \"rss\": %lu, \"finished\": %s }\n", rss, finished ? "true" : "false");
+
+	if (fclose(fp) != 0 || rename(tmpname, progress_file) != 0) {
+		perror(progress_file);
+	}
+	free(tmpname);
+}
+
+
+/**
+ * \brief Report progress
+ * \param [in] finished Calculation is over
+ */
+static void progress_report(char finished)
+{
+	unsigned long done, rss;
+	double elapsed, rate, eta, pct;
+	char selapsed[32], seta[32];
+
+	done    = __atomic_load_n(&progress_done, __ATOMIC_RELAXED);
+	elapsed = stats_clock() - progress_begin;
+	rate    = (elapsed > 0) ? (done / elapsed) : 0;
+	eta     = -1;
+	if (finished) {
+		eta = 0;
+	} else if (rate > 0 && done <= progress_total) {
+		eta = (progress_total - done) / rate;
+	}
+	rss = resident_bytes();
+
+	if (progress_file != NULL) {
+		write_status(done, elapsed, rate, eta, rss, finished);
+		return;
+	}
+
+	pct = (progress_total > 0) ? ((100.0 * done) / progress_total) : 100.0;
+	format_time(elapsed, selapsed);
+	format_time(eta, seta);
+	fprintf(stderr, "Progress: %lu/%lu pairs (%.1f%%), %s elapsed, %.1f pairs/s, ETA %s, RSS %.1f MiB\n",
+			done, progress_total, pct, selapsed, rate, seta, rss / (1024.0 * 1024.0));
+}
+
+
+/**
+ * \brief Reporter thread
+ */
+static void *progress_reporter(void *arg)
+{
+	struct timespec deadline;
+
+	pthread_mutex_lock(&progress_lock);
+	while (progress_running) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += progress_secs;
+		while (progress_running &&
+				pthread_cond_timedwait(&progress_cond, &progress_lock, &deadline) == 0);
+
+		if (progress_running) {
+			pthread_mutex_unlock(&progress_lock);
+			progress_report(0);
+			pthread_mutex_lock(&progress_lock);
+		}
+	}
+	pthread_mutex_unlock(&progress_lock);
+	return NULL;
+}
+
+
+/**
+ * \brief Start reporting progress
+ * \param [in] total Pairs to be calculated
+ * \param [in] filename Status file (NULL for stderr)
+ * \param [in] interval Seconds between updates
+ * \return int 0 on success, -1 otherwise
+ */
+int progress_start(unsigned long total, const char *filename, unsigned long interval)
+{
+	pthread_condattr_t attr;
+
+	progress_total = total;
+	progress_file  = filename;
+	progress_secs  = (interval > 0) ? interval : 1;
+	progress_begin = stats_clock();
+	__atomic_store_n(&progress_done, 0, __ATOMIC_RELAXED);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&progress_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	progress_running = 1;
+	if (pthread_create(&progress_thread, NULL, progress_reporter, NULL) != 0) {
+		perror("progress_start");
+		progress_running = 0;
+		pthread_cond_destroy(&progress_cond);
+		return -1;
+	}
+	progress_report(0);
+	return 0;
+}
+
+
+/**
+ * \brief Stop reporting progress (the last update is written)
+ */
+void progress_stop(void)
+{
+	pthread_mutex_lock(&progress_lock);
+	if (!progress_running) {
+		pthread_mutex_unlock(&progress_lock);
+		return;
+	}
+	progress_running = 0;
+	pthread_cond_signal(&progress_cond);
+	pthread_mutex_unlock(&progress_lock);
+
+	pthread_join(progress_thread, NULL);
+	pthread_cond_destroy(&progress_cond);
+	progress_report(1);
+}
@@ -0,0 +1,638 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "cmatches.h"
+
+/*
+ * Resident service (matches serve)
+ *
+ * The corpus is loaded once; clients connect to a Unix domain socket and
+ * send requests, each one answered before the next is read:
+ *
+ *   request:  uint32 length, uint8 op, uint8 index, uint16 0, payload
+ *   response: uint32 length, int32 status (0 or errno), payload
+ *
+ * length counts the bytes after it. Integers and doubles are in host
+ * byte order (the socket is local). index is one INDEX_* bit (h, h2, ari,
+ * nmi, jaccard or fm). Operations:
+ *
+ *   SERVE_INFO   no payload; answers uint32 n and n file names, each one
+ *                ending with '\0'
+ *   SERVE_PAIR   uint32 i, uint32 j; answers one double
+ *   SERVE_ROW    uint32 i; answers n doubles (row i of the matrix)
+ *   SERVE_QUERY  a cluster set, as the text of a cluster set file;
+ *                answers n doubles (its congruency with each file)
+ *
+ * Each connection has its own thread, but pairs are calculated by one
+ * pool of workers: rows of all pending requests are split in chunks of
+ * columns and workers take chunks from any of them, so concurrent
+ * requests share the pool instead of adding threads.
+ *
+ * On SIGINT / SIGTERM the socket stops accepting, open connections are
+ * shut down and their threads joined (requests in flight are finished
+ * by the workers), then the workers are stopped and joined, so the
+ * corpus can be released when serve() returns.
+ */
+
+/** Operations */
+#define SERVE_INFO  0
+#define SERVE_PAIR  1
+#define SERVE_ROW   2
+#define SERVE_QUERY 3
+
+/** Request header size (op, index, padding) */
+#define SERVE_HEADER 4
+
+/** Largest request accepted (bytes) */
+#define SERVE_MAX_REQUEST (256UL << 20)
+
+/** Columns per chunk */
+#define SERVE_CHUNK 16
+
+/**
+ * Pending request: congruency of one cluster set with some columns
+ */
+typedef struct _sreq {
+	/** cluster set of the row */
+	cset_t *row;
+	/** first column */
+	unsigned long first;
+	/** number of columns */
+	unsigned long ncols;
+	/** congruency function */
+	index_fn_t index;
+	/** results (one per column) */
+	double *values;
+	/** next column to be taken by a worker */
+	unsigned long next;
+	/** columns not calculated yet */
+	unsigned long pending;
+	/** next pending request */
+	struct _sreq *qnext;
+	/** signaled when all columns are calculated */
+	pthread_cond_t done;
+} sreq_t;
+
+/**
+ * Client connection
+ */
+typedef struct _sconn {
+	/** service state */
+	struct _server *srv;
+	/** socket (closed when the thread is joined) */
+	int fd;
+	/** connection thread */
+	pthread_t thread;
+	/** thread is done */
+	char done;
+	/** next connection */
+	struct _sconn *next;
+} sconn_t;
+
+/**
+ * Service state
+ */
+typedef struct _server {
+	/** loaded cluster sets */
+	cstore_t *store;
+	/** file names */
+	char **names;
+	/** number of cluster sets */
+	unsigned long size;
+	/** element dictionary (names of queries are mapped with it) */
+	nameset_t *dict;
+	/** pending requests (FIFO) */
+	sreq_t *qhead, *qtail;
+	/** open connections */
+	sconn_t *conns;
+	/** workers end once the queue is empty */
+	char stop;
+	/** protects the queue, the requests and the connections */
+	pthread_mutex_t lock;
+	/** signaled when a request is queued */
+	pthread_cond_t work;
+} server_t;
+
+/** Set by SIGINT / SIGTERM */
+static volatile sig_atomic_t stop_serving = 0;
+
+
+/**
+ * \brief Signal handler: stop accepting connections
+ */
+static void serve_signal(int sig)
+{
+	stop_serving = 1;
+}
+
+
+/**
+ * \brief Worker: calculate chunks of pending requests
+ * \param [in] arg Service state
+ */
+static void *serve_worker(void *arg)
+{
+	server_t *srv = arg;
+	sreq_t *req;
+	unsigned long j, start, end;
+
+	pthread_mutex_lock(&srv->lock);
+	for (;;) {
+		while (srv->qhead == NULL && !srv->stop) {
+			pthread_cond_wait(&srv->work, &srv->lock);
+		}
+		if (srv->qhead == NULL) {
+			break;
+		}
+
+		/* Take a chunk of the oldest request */
+		req   = srv->qhead;
+		start = req->next;
+		end   = start + SERVE_CHUNK;
+		if (end >= req->ncols) {
+			end = req->ncols;
+			srv->qhead = req->qnext;
+			if (srv->qhead == NULL) {
+				srv->qtail = NULL;
+			}
+		}
+		req->next = end;
+		pthread_mutex_unlock(&srv->lock);
+
+		for (j = start; j < end; j++) {
+			req->values[j] = req->index(req->row, store_get(srv->store, req->first + j), 0, 0);
+		}
+
+		pthread_mutex_lock(&srv->lock);
+		req->pending -= (end - start);
+		if (req->pending == 0) {
+			pthread_cond_signal(&req->done);
+		}
+	}
+	pthread_mutex_unlock(&srv->lock);
+	return NULL;
+}
+
+
+/**
+ * \brief Calculate the congruency of a cluster set with some columns on
+ *        the worker pool
+ * \param [in] srv Service state
+ * \param [in] row Cluster set of the row
+ * \param [in] first First column
+ * \param [in] ncols Number of columns
+ * \param [in] ind Congruency index
+ * \param [out] values Results
+ */
+static void serve_calculate(server_t *srv, cset_t *row, unsigned long first, unsigned long ncols,
+		char ind, double *values)
+{
+	sreq_t req;
+
+	if (ncols == 0) {
+		return;
+	}
+	memset(&req, 0, sizeof(sreq_t));
+	req.row     = row;
+	req.first   = first;
+	req.ncols   = ncols;
+	req.index   = index_function(ind);
+	req.values  = values;
+	req.pending = ncols;
+	pthread_cond_init(&req.done, NULL);
+
+	pthread_mutex_lock(&srv->lock);
+	if (srv->qtail != NULL) {
+		srv->qtail->qnext = &req;
+	} else {
+		srv->qhead = &req;
+	}
+	srv->qtail = &req;
+	pthread_cond_broadcast(&srv->work);
+	while (req.pending > 0) {
+		pthread_cond_wait(&req.done, &srv->lock);
+	}
+	pthread_mutex_unlock(&srv->lock);
+
+	pthread_cond_destroy(&req.done);
+}
+
+
+/**
+ * \brief Read exactly size bytes
+ * \param [in] fd Socket
+ * \param [out] buf Buffer
+ * \param [in] size Bytes
+ * \return int 0 on success, -1 on error or end of connection
+ */
+static int read_full(int fd, void *buf, size_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		n = read(fd, buf, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		buf   = (char *)buf + n;
+		size -= n;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Write exactly size bytes
+ * \param [in] fd Socket
+ * \param [in] buf Buffer
+ * \param [in] size Bytes
+ * \return int 0 on success, -1 on error
+ */
+static int write_full(int fd, const void *buf, size_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		n = write(fd, buf, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		buf   = (const char *)buf + n;
+		size -= n;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Send a response
+ * \param [in] fd Socket
+ * \param [in] status 0 or errno
+ * \param [in] payload Payload (may be NULL)
+ * \param [in] size Payload size
+ * \return int 0 on success, -1 on error
+ */
+static int send_response(int fd, int32_t status, const void *payload, size_t size)
+{
+	uint32_t len;
+
+	len = sizeof(status) + size;
+	if (write_full(fd, &len, sizeof(len)) < 0 || write_full(fd, &status, sizeof(status)) < 0) {
+		return -1;
+	}
+	return (size > 0) ? write_full(fd, payload, size) : 0;
+}
+
+
+/**
+ * \brief Answer SERVE_INFO
+ * \param [in] srv Service state
+ * \param [in] fd Socket
+ * \return int 0 on success, -1 on error
+ */
+static int serve_info(server_t *srv, int fd)
+{
+	char *buf;
+	size_t size, len;
+	unsigned long i;
+	uint32_t n;
+	int ret;
+
+	size = sizeof(n);
+	for (i = 0; i < srv->size; i++) {
+		size += strlen(srv->names[i]) + 1;
+	}
+	if ((buf = malloc(size)) == NULL) {
+		return send_response(fd, ENOMEM, NULL, 0);
+	}
+	n = srv->size;
+	memcpy(buf, &n, sizeof(n));
+	size = sizeof(n);
+	for (i = 0; i < srv->size; i++) {
+		len = strlen(srv->names[i]) + 1;
+		memcpy(&buf[size], srv->names[i], len);
+		size += len;
+	}
+	ret = send_response(fd, 0, buf, size);
+	free(buf);
+	return ret;
+}
+
+
+/**
+ * \brief Answer one request
+ * \param [in] srv Service state
+ * \param [in] fd Socket
+ * \param [in] req Request (after the length)
+ * \param [in] len Request length
+ * \param [in] values Buffer for a row
+ * \return int 0 on success, -1 if the connection must be closed
+ */
+static int serve_request(server_t *srv, int fd, char *req, uint32_t len, double *values)
+{
+	uint32_t i, j;
+	unsigned char op, ind;
+	char *payload;
+	size_t plen;
+	cset_t query, *row;
+
+	op      = req[0];
+	ind     = req[1];
+	payload = &req[SERVE_HEADER];
+	plen    = len - SERVE_HEADER;
+	if (op != SERVE_INFO && index_function(ind) == NULL) {
+		return send_response(fd, EINVAL, NULL, 0);
+	}
+
+	switch (op) {
+		case SERVE_INFO:
+			return serve_info(srv, fd);
+
+		case SERVE_PAIR:
+			if (plen != (2 * sizeof(uint32_t))) {
+				return send_response(fd, EINVAL, NULL, 0);
+			}
+			memcpy(&i, payload, sizeof(i));
+			memcpy(&j, payload + sizeof(i), sizeof(j));
+			if (i >= srv->size || j >= srv->size) {
+				return send_response(fd, ERANGE, NULL, 0);
+			}
+			if (i == j) {
+				values[0] = 1.0;
+			} else {
+				serve_calculate(srv, store_get(srv->store, i), j, 1, ind, values);
+			}
+			return send_response(fd, 0, values, sizeof(double));
+
+		case SERVE_ROW:
+			if (plen != sizeof(uint32_t)) {
+				return send_response(fd, EINVAL, NULL, 0);
+			}
+			memcpy(&i, payload, sizeof(i));
+			if (i >= srv->size) {
+				return send_response(fd, ERANGE, NULL, 0);
+			}
+			row = store_get(srv->store, i);
+			serve_calculate(srv, row, 0, srv->size, ind, values);
+			values[i] = 1.0;
+			return send_response(fd, 0, values, sizeof(double) * srv->size);
+
+		case SERVE_QUERY:
+			memset(&query, 0, sizeof(cset_t));
+			query.elems = parse_clusterset(payload, plen, &query.size);
+			if (query.elems == NULL) {
+				return send_response(fd, EINVAL, NULL, 0);
+			}
+			/* Elements out of the corpus can not be common to any file */
+			query.size   = map_clusterset(query.elems, query.size, srv->dict, 0);
+			query.mapped = 1;
+			serve_calculate(srv, &query, 0, srv->size, ind, values);
+			free_clusterset(query.elems, query.size);
+			return send_response(fd, 0, values, sizeof(double) * srv->size);
+
+		default:
+			return send_response(fd, ENOSYS, NULL, 0);
+	}
+}
+
+
+/**
+ * \brief Connection thread: answer requests until the client disconnects
+ *        (or the connection is shut down)
+ * \param [in] arg Connection
+ */
+static void *serve_connection(void *arg)
+{
+	sconn_t *conn = arg;
+	server_t *srv = conn->srv;
+	int fd = conn->fd;
+	double *values;
+	char *req;
+	uint32_t len;
+
+	values = malloc(sizeof(double) * ((srv->size > 0) ? srv->size : 1));
+	req    = NULL;
+	while (values != NULL && read_full(fd, &len, sizeof(len)) == 0) {
+		if (len < SERVE_HEADER || len > SERVE_MAX_REQUEST) {
+			send_response(fd, EMSGSIZE, NULL, 0);
+			break;
+		}
+		/* One more byte: queries are parsed as text */
+		free(req);
+		if ((req = malloc(len + 1)) == NULL || read_full(fd, req, len) < 0) {
+			break;
+		}
+		req[len] = '\0';
+		if (serve_request(srv, fd, req, len, values) < 0) {
+			break;
+		}
+	}
+	free(req);
+	free(values);
+
+	pthread_mutex_lock(&srv->lock);
+	conn->done = 1;
+	pthread_mutex_unlock(&srv->lock);
+	return NULL;
+}
+
+
+/**
+ * \brief Join connection threads and release their connections
+ * \param [in] srv Service state
+ * \param [in] all Shut down and join all connections (otherwise, only
+ *        the ones whose thread is done)
+ * \note Only the accepting thread adds and removes connections.
+ */
+static void reap_connections(server_t *srv, char all)
+{
+	sconn_t **prev, *conn;
+
+	pthread_mutex_lock(&srv->lock);
+	if (all) {
+		/* Pending reads return, writes fail */
+		for (conn = srv->conns; conn != NULL; conn = conn->next) {
+			shutdown(conn->fd, SHUT_RDWR);
+		}
+	}
+	prev = &srv->conns;
+	while ((conn = *prev) != NULL) {
+		if (!all && !conn->done) {
+			prev = &conn->next;
+			continue;
+		}
+		*prev = conn->next;
+		pthread_mutex_unlock(&srv->lock);
+		pthread_join(conn->thread, NULL);
+		close(conn->fd);
+		free(conn);
+		pthread_mutex_lock(&srv->lock);
+	}
+	pthread_mutex_unlock(&srv->lock);
+}
+
+
+/**
+ * \brief Serve a loaded corpus on a Unix domain socket until SIGINT or
+ *        SIGTERM
+ * \param [in] store Loaded cluster sets
+ * \param [in] names File names
+ * \param [in] size Number of cluster sets
+ * \param [in] dict Element dictionary
+ * \param [in] path Socket path
+ * \param [in] nworkers Number of worker threads
+ * \return int 0 on success, -1 otherwise
+ */
+int serve(cstore_t *store, char **names, unsigned long size, nameset_t *dict, const char *path,
+		unsigned long nworkers)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct stat st;
+	server_t srv;
+	pthread_t *workers;
+	unsigned long i, started;
+	sconn_t *conn;
+	int lfd, fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path is too long: %s\n", path);
+		return -1;
+	}
+
+	memset(&srv, 0, sizeof(server_t));
+	srv.store = store;
+	srv.names = names;
+	srv.size  = size;
+	srv.dict  = dict;
+
+	/* Stale socket of a previous run (never remove anything else) */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd < 0) {
+		perror("socket");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 64) < 0) {
+		perror(path);
+		close(lfd);
+		return -1;
+	}
+
+	/* accept() must be interrupted by signals */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serve_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_mutex_init(&srv.lock, NULL);
+	pthread_cond_init(&srv.work, NULL);
+	if (nworkers < 1) {
+		nworkers = 1;
+	}
+	workers = malloc(sizeof(pthread_t) * nworkers);
+	started = 0;
+	for (i = 0; workers != NULL && i < nworkers; i++) {
+		if (pthread_create(&workers[i], NULL, serve_worker, &srv) != 0) {
+			perror("serve");
+			break;
+		}
+		started++;
+	}
+	if (started == 0) {
+		free(workers);
+		close(lfd);
+		unlink(path);
+		pthread_mutex_destroy(&srv.lock);
+		pthread_cond_destroy(&srv.work);
+		return -1;
+	}
+
+	print_info("Serving %lu cluster sets on %s\n", size, path);
+	while (!stop_serving) {
+		fd = accept(lfd, NULL, NULL);
+		reap_connections(&srv, 0);
+		if (fd < 0) {
+			if (errno != EINTR) {
+				perror("accept");
+			}
+			continue;
+		}
+		conn = calloc(1, sizeof(sconn_t));
+		if (conn == NULL) {
+			close(fd);
+			continue;
+		}
+		conn->srv = &srv;
+		conn->fd  = fd;
+		if (pthread_create(&conn->thread, NULL, serve_connection, conn) != 0) {
+			perror("serve");
+			free(conn);
+			close(fd);
+			continue;
+		}
+		pthread_mutex_lock(&srv.lock);
+		conn->next = srv.conns;
+		srv.conns  = conn;
+		pthread_mutex_unlock(&srv.lock);
+	}
+
+	/* No new connections; requests in flight are finished by the workers */
+	close(lfd);
+	unlink(path);
+	reap_connections(&srv, 1);
+
+	pthread_mutex_lock(&srv.lock);
+	srv.stop = 1;
+	pthread_cond_broadcast(&srv.work);
+	pthread_mutex_unlock(&srv.lock);
+	for (i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+
+	pthread_mutex_destroy(&srv.lock);
+	pthread_cond_destroy(&srv.work);
+	return 0;
+}
@@ -0,0 +1,524 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cmatches.h"
+
+/** Maximum tile size (rows and columns) */
+#define TILE_SIZE 64
+/** Minimum number of tiles per shard (used to choose the tile size) */
+#define TILES_PER_SHARD 4
+
+/** Partial result file magic */
+#define PARTIAL_MAGIC   "matches-partial"
+/** Partial result file version */
+#define PARTIAL_VERSION 1
+
+
+/**
+ * \brief Parse shard specification (k/K)
+ * \param [in] str Shard string
+ * \param [out] shard Shard number (1..nshards)
+ * \param [out] nshards Total number of shards
+ * \return int 0 on success, -1 otherwise
+ */
+int parse_shard(const char *str, unsigned long *shard, unsigned long *nshards)
+{
+	char *end;
+
+	*shard = strtoul(str, &end, 10);
+	if (end == str || *end != '/') {
+		return -1;
+	}
+	str = end + 1;
+	*nshards = strtoul(str, &end, 10);
+	if (end == str || *end != '\0') {
+		return -1;
+	}
+	if (*nshards == 0 || *shard == 0 || *shard > *nshards) {
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Number of pairs (upper triangle, diagonal excluded) inside a tile
+ * \param [in] tile Tile
+ * \return unsigned long
+ */
+static unsigned long tile_pairs(tile_t *tile)
+{
+	if (tile->row == tile->col) {
+		return (tile->nrows * (tile->nrows - 1)) / 2;
+	} else {
+		return tile->nrows * tile->ncols;
+	}
+}
+
+
+/**
+ * \brief Number of pairs inside a set of tiles
+ * \param [in] tiles Tiles
+ * \param [in] ntiles Number of tiles
+ * \return unsigned long
+ */
+unsigned long count_tile_pairs(tile_t *tiles, unsigned long ntiles)
+{
+	unsigned long t, n;
+
+	n = 0;
+	for (t = 0; t < ntiles; t++) {
+		n += tile_pairs(&tiles[t]);
+	}
+	return n;
+}
+
+
+/**
+ * \brief Split the upper triangle of a matrix in tiles
+ * \param [in] size Matrix size
+ * \param [in] tsize Tile size
+ * \param [out] tiles Tiles vector (NULL to just count them)
+ * \return unsigned long Number of tiles
+ */
+static unsigned long split_tiles(unsigned long size, unsigned long tsize, tile_t *tiles)
+{
+	unsigned long i, j, n;
+
+	n = 0;
+	for (i = 0; i < size; i += tsize) {
+		for (j = i; j < size; j += tsize) {
+			if (tiles != NULL) {
+				tiles[n].row   = i;
+				tiles[n].col   = j;
+				tiles[n].nrows = (i + tsize > size) ? (size - i) : tsize;
+				tiles[n].ncols = (j + tsize > size) ? (size - j) : tsize;
+			}
+			n++;
+		}
+	}
+	return n;
+}
+
+
+/**
+ * \brief Compare two tiles by number of pairs (descending), then by position
+ * \note This function should be used with qsort
+ */
+static int tile_cmp(const void *t1, const void *t2)
+{
+	tile_t *tile1 = (tile_t*)t1;
+	tile_t *tile2 = (tile_t*)t2;
+	unsigned long p1, p2;
+
+	p1 = tile_pairs(tile1);
+	p2 = tile_pairs(tile2);
+	if (p1 != p2) {
+		return (p1 > p2) ? -1 : 1;
+	}
+	if (tile1->row != tile2->row) {
+		return (tile1->row < tile2->row) ? -1 : 1;
+	}
+	if (tile1->col != tile2->col) {
+		return (tile1->col < tile2->col) ? -1 : 1;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Compare two tiles by position (row major)
+ * \note This function should be used with qsort
+ */
+static int tile_poscmp(const void *t1, const void *t2)
+{
+	tile_t *tile1 = (tile_t*)t1;
+	tile_t *tile2 = (tile_t*)t2;
+
+	if (tile1->row != tile2->row) {
+		return (tile1->row < tile2->row) ? -1 : 1;
+	}
+	if (tile1->col != tile2->col) {
+		return (tile1->col < tile2->col) ? -1 : 1;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Generate the tiles of the upper triangle that belong to a shard
+ * \param [in] size Matrix size
+ * \param [in] shard Shard number (1..nshards)
+ * \param [in] nshards Total number of shards
+ * \param [out] tiles Tiles of the shard (row major order)
+ * \return unsigned long Number of tiles of the shard
+ * \note The assignment only depends on size and nshards, so every process
+ *       computes the same partition. Tiles are given to the least loaded
+ *       shard, biggest tiles first (LPT), which keeps the number of pairs
+ *       per shard balanced.
+ */
+unsigned long gen_tiles(unsigned long size, unsigned long shard, unsigned long nshards, tile_t **tiles)
+{
+	tile_t *all;
+	unsigned long tsize, ntiles, i, s, best, n;
+	unsigned long *load;
+
+	*tiles = NULL;
+	if (size == 0 || nshards == 0 || shard == 0 || shard > nshards) {
+		return 0;
+	}
+
+	/* Reduce tile size until each shard gets a few tiles */
+	tsize = TILE_SIZE;
+	while (tsize > 1 && split_tiles(size, tsize, NULL) < (nshards * TILES_PER_SHARD)) {
+		tsize /= 2;
+	}
+
+	ntiles = split_tiles(size, tsize, NULL);
+	all    = malloc(sizeof(tile_t) * ntiles);
+	load   = calloc(nshards, sizeof(unsigned long));
+	if (all == NULL || load == NULL) {
+		perror("gen_tiles");
+		free(all);
+		free(load);
+		return 0;
+	}
+	split_tiles(size, tsize, all);
+	qsort(all, ntiles, sizeof(tile_t), tile_cmp);
+
+	/* Assign each tile to the least loaded shard and keep ours */
+	n = 0;
+	for (i = 0; i < ntiles; i++) {
+		best = 0;
+		for (s = 1; s < nshards; s++) {
+			if (load[s] < load[best]) {
+				best = s;
+			}
+		}
+		load[best] += tile_pairs(&all[i]);
+		if (best == (shard - 1)) {
+			all[n++] = all[i];
+		}
+	}
+	free(load);
+
+	qsort(all, n, sizeof(tile_t), tile_poscmp);
+	*tiles = all;
+	return n;
+}
+
+
+/**
+ * \brief Write partial result file header
+ * \param [out] fp Partial result file
+ * \param [in] mat Matrix (only file names and size are used)
+ * \param [in] shard Shard number
+ * \param [in] nshards Total number of shards
+ * \param [in] cindex Congruency index(es) calculated
+ * \param [in] flags Flags to show Np or Ne
+ * \param [in] fingerprint Input manifest fingerprint
+ */
+void write_partial_header(FILE *fp, cmat_t *mat, unsigned long shard, unsigned long nshards, char cindex, char flags, unsigned long fingerprint)
+{
+	unsigned long i;
+
+	fprintf(fp, "%s %d\n", PARTIAL_MAGIC, PARTIAL_VERSION);
+	fprintf(fp, "shard %lu %lu\n", shard, nshards);
+	fprintf(fp, "index %d %d\n", cindex, flags);
+	fprintf(fp, "manifest %016lx\n", fingerprint);
+	fprintf(fp, "files %lu\n", mat->size);
+	for (i = 0; i < mat->size; i++) {
+		fprintf(fp, "%s\n", mat->col_names[i]);
+	}
+}
+
+
+/**
+ * \brief Write one pair result to the partial result file
+ * \param [out] fp Partial result file
+ * \param [in] ind Congruency index
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] value Congruency
+ */
+void write_partial_pair(FILE *fp, char ind, unsigned long i, unsigned long j, double value)
+{
+	fprintf(fp, "%d %lu %lu %.17g\n", ind, i, j, value);
+}
+
+
+/**
+ * \brief Read one pair result from the partial result file
+ * \param [in] fp Partial result file
+ * \param [out] ind Congruency index
+ * \param [out] i Row
+ * \param [out] j Column
+ * \param [out] value Congruency
+ * \return int 1 if a pair was read, 0 at the end of file, -1 if the record is corrupted
+ * \note An incomplete last record (e.g., process killed while writing it) is
+ *       reported as end of file.
+ */
+int read_partial_pair(FILE *fp, char *ind, unsigned long *i, unsigned long *j, double *value)
+{
+	char line[128];
+	int index, n;
+	size_t len;
+
+	if (fgets(line, sizeof(line), fp) == NULL) {
+		return 0;
+	}
+	len = strlen(line);
+	if (len == 0 || line[len-1] != '\n') {
+		return (feof(fp)) ? 0 : -1;
+	}
+	if (sscanf(line, "%d %lu %lu %lf%n", &index, i, j, value, &n) != 4 || line[n] != '\n') {
+		return -1;
+	}
+	*ind = index;
+	return 1;
+}
+
+
+/**
+ * \brief Read partial result file header
+ * \param [in] fp Partial result file
+ * \param [in] filename Partial result file name (for messages)
+ * \param [out] hdr Header
+ * \return int 0 on success, -1 otherwise
+ */
+int read_partial_header(FILE *fp, const char *filename, partial_t *hdr)
+{
+	char magic[32], *line;
+	int version, cindex, flags;
+	size_t len;
+	ssize_t nread;
+	unsigned long i;
+
+	if (fscanf(fp, "%31s %d", magic, &version) != 2 ||
+			strcmp(magic, PARTIAL_MAGIC) != 0 || version != PARTIAL_VERSION) {
+		fprintf(stderr, "%s: not a partial result file.\n", filename);
+		return -1;
+	}
+	if (fscanf(fp, " shard %lu %lu", &hdr->shard, &hdr->nshards) != 2 ||
+			fscanf(fp, " index %d %d", &cindex, &flags) != 2 ||
+			fscanf(fp, " manifest %lx", &hdr->fingerprint) != 1 ||
+			fscanf(fp, " files %lu", &hdr->size) != 1 ||
+			hdr->shard == 0 || hdr->shard > hdr->nshards) {
+		fprintf(stderr, "%s: corrupted header.\n", filename);
+		return -1;
+	}
+	hdr->cindex = cindex;
+	hdr->flags  = flags;
+
+	/* skip end of line */
+	fgetc(fp);
+
+	hdr->names = malloc(sizeof(char*) * hdr->size);
+	if (hdr->names == NULL) {
+		perror("read_partial_header");
+		return -1;
+	}
+	line = NULL;
+	len  = 0;
+	for (i = 0; i < hdr->size; i++) {
+		if ((nread = getline(&line, &len, fp)) <= 0) {
+			fprintf(stderr, "%s: corrupted header.\n", filename);
+			hdr->size = i;
+			free(line);
+			return -1;
+		}
+		if (line[nread-1] == '\n') {
+			line[nread-1] = '\0';
+		}
+		hdr->names[i] = strdup(line);
+	}
+	free(line);
+	return 0;
+}
+
+
+/**
+ * \brief Release partial result header
+ * \param [in] hdr Header
+ */
+void free_partial_header(partial_t *hdr)
+{
+	unsigned long i;
+
+	if (hdr->names == NULL) return;
+	for (i = 0; i < hdr->size; i++) {
+		free(hdr->names[i]);
+	}
+	free(hdr->names);
+	hdr->names = NULL;
+}
+
+
+/**
+ * \brief Merge partial result files and print the final matrices
+ * \param [in] nfiles Number of partial result files
+ * \param [in] files Partial result file names
+ * \param [in] basename Output file base name (binary formats)
+ * \param [out] stream Output file descriptor
+ * \return int 0 on success, -1 otherwise
+ */
+int merge_partials(int nfiles, char **files, const char *basename, FILE *stream)
+{
+	FILE *fp;
+	partial_t ref, hdr;
+	cmat_t *mat[NINDEXES] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	char *seen = NULL;
+	int f, q, ret, r;
+	char ind;
+	unsigned long i, j;
+	double value;
+
+	memset(&ref, 0, sizeof(partial_t));
+	ret = -1;
+
+	for (f = 0; f < nfiles; f++) {
+		if ((fp = fopen(files[f], "r")) == NULL) {
+			perror(files[f]);
+			goto out;
+		}
+
+		memset(&hdr, 0, sizeof(partial_t));
+		if (read_partial_header(fp, files[f], &hdr) < 0) {
+			free_partial_header(&hdr);
+			fclose(fp);
+			goto out;
+		}
+
+		if (f == 0) {
+			ref = hdr;
+			seen = calloc(ref.nshards, sizeof(char));
+			if (seen == NULL) {
+				perror("merge_partials");
+				fclose(fp);
+				goto out;
+			}
+			for (q = 0; q < NINDEXES; q++) {
+				if (!(ref.cindex & (1 << q))) continue;
+				mat[q] = create_matrix(ref.size);
+				if (mat[q] == NULL) {
+					perror("merge_partials");
+					fclose(fp);
+					goto out;
+				}
+				for (i = 0; i < ref.size; i++) {
+					mat[q]->col_names[i] = ref.names[i];
+					for (j = 0; j < ref.size; j++) {
+						mat[q]->matrix[i][j] = (i == j) ? 1.0 : NAN;
+					}
+				}
+			}
+		} else {
+			/* All partial files must come from the same run */
+			if (hdr.size != ref.size || hdr.nshards != ref.nshards ||
+					hdr.cindex != ref.cindex || hdr.flags != ref.flags ||
+					hdr.fingerprint != ref.fingerprint) {
+				fprintf(stderr, "%s: does not belong to the same run of %s.\n", files[f], files[0]);
+				free_partial_header(&hdr);
+				fclose(fp);
+				goto out;
+			}
+			for (i = 0; i < hdr.size; i++) {
+				if (strcmp(hdr.names[i], ref.names[i]) != 0) {
+					fprintf(stderr, "%s: clusterset files differ from %s.\n", files[f], files[0]);
+					free_partial_header(&hdr);
+					fclose(fp);
+					goto out;
+				}
+			}
+			free_partial_header(&hdr);
+		}
+
+		if (seen[hdr.shard-1]) {
+			fprintf(stderr, "%s: shard %lu/%lu was already merged.\n", files[f], hdr.shard, hdr.nshards);
+			fclose(fp);
+			goto out;
+		}
+		seen[hdr.shard-1] = 1;
+
+		/* Read pairs */
+		while ((r = read_partial_pair(fp, &ind, &i, &j, &value)) > 0) {
+			q = index_slot(ind);
+			if (q < 0 || mat[q] == NULL || i >= ref.size || j >= ref.size || i >= j) {
+				fprintf(stderr, "%s: invalid pair %lu %lu.\n", files[f], i, j);
+				fclose(fp);
+				goto out;
+			}
+			if (!isnan(mat[q]->matrix[i][j])) {
+				fprintf(stderr, "%s: pair %lu %lu already merged.\n", files[f], i, j);
+				fclose(fp);
+				goto out;
+			}
+			mat[q]->matrix[i][j] = value;
+			mat[q]->matrix[j][i] = value;
+		}
+		if (r < 0) {
+			fprintf(stderr, "%s: corrupted pair record.\n", files[f]);
+			fclose(fp);
+			goto out;
+		}
+		fclose(fp);
+	}
+
+	if (nfiles == 0) {
+		fprintf(stderr, "No partial result files to merge.\n");
+		goto out;
+	}
+
+	/* Check that all pairs were computed */
+	for (q = 0; q < NINDEXES; q++) {
+		if (mat[q] == NULL) continue;
+		for (i = 0; i < ref.size; i++) {
+			for (j = i+1; j < ref.size; j++) {
+				if (isnan(mat[q]->matrix[i][j])) {
+					fprintf(stderr, "Missing pair %s X %s: not all shards were merged.\n",
+							ref.names[i], ref.names[j]);
+					goto out;
+				}
+			}
+		}
+	}
+
+	for (q = 0; q < NINDEXES; q++) {
+		if (mat[q] != NULL) {
+			print_index_title(1 << q, stream);
+			if (output_results(mat[q], 1 << q, outfmt, basename, stream) < 0) {
+				goto out;
+			}
+		}
+	}
+	ret = 0;
+
+out:
+	for (q = 0; q < NINDEXES; q++) {
+		destroy_matrix(mat[q]);
+	}
+	free_partial_header(&ref);
+	free(seen);
+	return ret;
+}
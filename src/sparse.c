@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cmatches.h"
+
+
+/**
+ * \brief Compare two edges: e1 is worse than e2
+ * \param [in] e1 Edge 1
+ * \param [in] e2 Edge 2
+ * \return int 1 if e1 has lower congruency (or same congruency and higher column)
+ */
+static int edge_worse(edge_t *e1, edge_t *e2)
+{
+	if (e1->value != e2->value) {
+		return (e1->value < e2->value);
+	}
+	return (e1->col > e2->col);
+}
+
+
+/**
+ * \brief Compare two edges, best first
+ * \note This function should be used with qsort
+ */
+static int edge_cmp(const void *e1, const void *e2)
+{
+	edge_t *edge1 = (edge_t*)e1;
+	edge_t *edge2 = (edge_t*)e2;
+
+	if (edge_worse(edge1, edge2)) {
+		return 1;
+	} else if (edge_worse(edge2, edge1)) {
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Create top-k lists
+ * \param [in] size Number of rows
+ * \param [in] k Number of edges kept on each row
+ * \return topk_t*
+ */
+topk_t *create_topk(unsigned long size, unsigned long k)
+{
+	topk_t *tk;
+
+	tk = malloc(sizeof(topk_t));
+	if (tk == NULL) {
+		return NULL;
+	}
+	tk->size  = size;
+	tk->k     = k;
+	tk->count = calloc(size, sizeof(unsigned long));
+	tk->edges = malloc(sizeof(edge_t) * size * k);
+	if (tk->count == NULL || tk->edges == NULL) {
+		destroy_topk(tk);
+		return NULL;
+	}
+	return tk;
+}
+
+
+/**
+ * \brief Destroy top-k lists
+ * \param [in] tk Top-k lists
+ */
+void destroy_topk(topk_t *tk)
+{
+	if (tk == NULL) return;
+
+	free(tk->count);
+	free(tk->edges);
+	free(tk);
+}
+
+
+/**
+ * \brief Lowest congruency a new edge needs to enter the row
+ * \param [in] tk Top-k lists
+ * \param [in] row Row
+ * \return double -1 while the row is not full
+ */
+double topk_threshold(topk_t *tk, unsigned long row)
+{
+	if (tk->count[row] < tk->k) {
+		return -1;
+	}
+	/* root of the heap is the worst edge */
+	return tk->edges[row * tk->k].value;
+}
+
+
+/**
+ * \brief Add an edge to a row, keeping only the k best ones
+ * \param [in] tk Top-k lists
+ * \param [in] row Row
+ * \param [in] col Column
+ * \param [in] value Congruency
+ */
+static void topk_add_edge(topk_t *tk, unsigned long row, unsigned long col, double value)
+{
+	edge_t *heap, e, tmp;
+	unsigned long i, c, n;
+
+	heap    = &tk->edges[row * tk->k];
+	n       = tk->count[row];
+	e.col   = col;
+	e.value = value;
+
+	if (n < tk->k) {
+		/* sift up */
+		i = n;
+		heap[i] = e;
+		while (i > 0 && edge_worse(&heap[i], &heap[(i-1)/2])) {
+			tmp = heap[i];
+			heap[i] = heap[(i-1)/2];
+			heap[(i-1)/2] = tmp;
+			i = (i-1)/2;
+		}
+		tk->count[row]++;
+		return;
+	}
+
+	if (!edge_worse(&heap[0], &e)) {
+		return;
+	}
+
+	/* replace the worst edge and sift down */
+	heap[0] = e;
+	i = 0;
+	while ((c = 2*i + 1) < n) {
+		if ((c+1) < n && edge_worse(&heap[c+1], &heap[c])) {
+			c++;
+		}
+		if (!edge_worse(&heap[c], &heap[i])) {
+			break;
+		}
+		tmp = heap[i];
+		heap[i] = heap[c];
+		heap[c] = tmp;
+		i = c;
+	}
+}
+
+
+/**
+ * \brief Add a pair to the top-k lists of both rows
+ * \param [in] tk Top-k lists
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] value Congruency
+ */
+void topk_add(topk_t *tk, unsigned long i, unsigned long j, double value)
+{
+	if (tk->k == 0) return;
+
+	topk_add_edge(tk, i, j, value);
+	topk_add_edge(tk, j, i, value);
+}
+
+
+/**
+ * \brief Print the top-k lists as an edge list (best edges first)
+ * \param [in] tk Top-k lists
+ * \param [in] names Row names
+ * \param [out] stream Output file descriptor
+ */
+void print_topk(topk_t *tk, char **names, FILE *stream)
+{
+	unsigned long i, j;
+	edge_t *row;
+
+	for (i = 0; i < tk->size; i++) {
+		row = &tk->edges[i * tk->k];
+		qsort(row, tk->count[i], sizeof(edge_t), edge_cmp);
+		for (j = 0; j < tk->count[i]; j++) {
+			fprintf(stream, "%s %s %f\n", names[i], names[row[j].col], row[j].value);
+		}
+	}
+}
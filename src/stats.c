@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "cmatches.h"
+
+/*
+ * Run statistics (--stats)
+ *
+ * The main thread goes through phases (scan, elements, load, pairs,
+ * statistics, output): stats_phase() charges the wall time and the process
+ * CPU time (all threads) since the last call to the phase it leaves.
+ *
+ * Pair kernel phases (np, ne) are measured by each thread on its own
+ * workspace, with its own CPU clock, and added to the totals when the
+ * thread is done, so they are thread time (summed over threads) and have
+ * no wall time. The h/h2 ratio is charged to the phase that needs it.
+ *
+ * Cluster sets of a directory are loaded in background while pairs are
+ * calculated: load wall time is then the time until the last cluster set
+ * was loaded, and its CPU time the one of reader and parser threads.
+ *
+ * Pairs are also grouped by size (elements of both cluster sets, in
+ * powers of 2). With --perf, hardware events are counted for the pairs
+ * phase, kernel phases and size buckets (see perf.c).
+ */
+
+/** Collect run statistics (--stats) */
+char collect_stats = 0;
+
+/** Phase names (same order as PHASE_* constants) */
+static const char *phase_names[] = {
+	"scan", "elements", "load", "pairs", "np", "ne", "statistics", "output"
+};
+
+/** Hardware event names (same order as HW_* constants) */
+static const char *hw_names[] = {
+	"cycles", "instructions", "llc_misses", "branch_misses"
+};
+
+/** Counter names (same order as COUNT_* constants) */
+static const char *count_names[] = {
+	"pairs", "name_kernel_pairs", "elements_compared", "bytes_read"
+};
+
+/** Run totals */
+static runstats_t totals;
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Phase of the main thread */
+static int cur_phase = PHASE_NONE;
+/** When the main thread entered its phase */
+static double phase_wall, phase_cpu;
+
+
+/**
+ * \brief Read a clock
+ * \param [in] clk Clock id
+ * \return double Seconds
+ */
+static double read_clock(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+/**
+ * \brief Monotonic clock
+ * \return double Seconds
+ */
+double stats_clock(void)
+{
+	return read_clock(CLOCK_MONOTONIC);
+}
+
+
+/**
+ * \brief CPU time of the calling thread
+ * \return double Seconds
+ */
+double thread_cpu(void)
+{
+	return read_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+
+/**
+ * \brief Enter a phase of the main thread
+ * \param [in] phase Phase (PHASE_NONE when leaving the last one)
+ */
+void stats_phase(int phase)
+{
+	double wall, cpu;
+	unsigned long long hw[NHWEVENTS];
+	int i;
+
+	if (!collect_stats) return;
+
+	wall = stats_clock();
+	cpu  = read_clock(CLOCK_PROCESS_CPUTIME_ID);
+	if (cur_phase != PHASE_NONE) {
+		stats_time(cur_phase, wall - phase_wall, cpu - phase_cpu);
+	}
+	if (cur_phase == PHASE_PAIRS && phase != PHASE_PAIRS && hw_pairs_end(hw) == 0) {
+		for (i = 0; i < NHWEVENTS; i++) {
+			totals.hw[PHASE_PAIRS][i] += hw[i];
+		}
+	}
+	if (phase == PHASE_PAIRS && cur_phase != PHASE_PAIRS && hw_counters) {
+		hw_pairs_begin();
+	}
+	cur_phase  = phase;
+	phase_wall = wall;
+	phase_cpu  = cpu;
+}
+
+
+/**
+ * \brief Add time to a phase
+ * \param [in] phase Phase
+ * \param [in] wall Wall time (seconds)
+ * \param [in] cpu CPU time (seconds)
+ */
+void stats_time(int phase, double wall, double cpu)
+{
+	pthread_mutex_lock(&totals_lock);
+	totals.wall[phase] += wall;
+	totals.cpu[phase]  += cpu;
+	pthread_mutex_unlock(&totals_lock);
+}
+
+
+/**
+ * \brief Add to a counter (for events that are not per pair)
+ * \param [in] counter Counter
+ * \param [in] n Value
+ */
+void stats_count(int counter, unsigned long n)
+{
+	__atomic_add_fetch(&totals.count[counter], n, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * \brief Start measuring a pair
+ * \param [in] ws Workspace of the thread
+ * \note Use STATS_START(), which does nothing when statistics are off
+ */
+void stats_start(workspace_t *ws)
+{
+	ws->tstart = ws->tlast = thread_cpu();
+	if (ws->hwfd[0] >= 0 && hw_read(ws->hwfd, 0, ws->hwlast) == 0) {
+		memcpy(ws->hwstart, ws->hwlast, sizeof(ws->hwstart));
+	}
+}
+
+
+/**
+ * \brief Charge the time (and hardware events) since the last lap to a
+ *        kernel phase
+ * \param [in] ws Workspace of the thread
+ * \param [in] phase Phase
+ * \note Use STATS_LAP(), which does nothing when statistics are off
+ */
+void stats_lap(workspace_t *ws, int phase)
+{
+	unsigned long long hw[NHWEVENTS];
+	double now;
+	int i;
+
+	now = thread_cpu();
+	ws->stats.cpu[phase] += now - ws->tlast;
+	ws->tlast = now;
+
+	if (ws->hwfd[0] >= 0 && hw_read(ws->hwfd, 0, hw) == 0) {
+		for (i = 0; i < NHWEVENTS; i++) {
+			ws->stats.hw[phase][i] += hw[i] - ws->hwlast[i];
+			ws->hwlast[i] = hw[i];
+		}
+	}
+}
+
+
+/**
+ * \brief Account a pair measured since stats_start() to its size bucket
+ * \param [in] ws Workspace of the thread
+ * \param [in] size Elements of both cluster sets
+ */
+void stats_pair(workspace_t *ws, unsigned long size)
+{
+	int b, i;
+
+	for (b = 0; b < (NBUCKETS - 1) && (size >> (b + 1)) > 0; b++);
+
+	ws->stats.bpairs[b]++;
+	ws->stats.btime[b] += ws->tlast - ws->tstart;
+	if (ws->hwfd[0] >= 0) {
+		for (i = 0; i < NHWEVENTS; i++) {
+			ws->stats.bhw[b][i] += ws->hwlast[i] - ws->hwstart[i];
+		}
+	}
+}
+
+
+/**
+ * \brief Add the statistics of one thread to the run totals
+ * \param [in] st Thread statistics (zeroed)
+ */
+void stats_merge(runstats_t *st)
+{
+	int i, k;
+
+	pthread_mutex_lock(&totals_lock);
+	for (i = 0; i < NPHASES; i++) {
+		totals.wall[i] += st->wall[i];
+		totals.cpu[i]  += st->cpu[i];
+	}
+	for (i = 0; i < NCOUNTERS; i++) {
+		totals.count[i] += st->count[i];
+	}
+	for (i = 0; i < NPHASES; i++) {
+		for (k = 0; k < NHWEVENTS; k++) {
+			totals.hw[i][k] += st->hw[i][k];
+		}
+	}
+	for (i = 0; i < NBUCKETS; i++) {
+		totals.bpairs[i] += st->bpairs[i];
+		totals.btime[i]  += st->btime[i];
+		for (k = 0; k < NHWEVENTS; k++) {
+			totals.bhw[i][k] += st->bhw[i][k];
+		}
+	}
+	pthread_mutex_unlock(&totals_lock);
+	memset(st, 0, sizeof(runstats_t));
+}
+
+
+/**
+ * \brief Phase has no wall time (thread time of pair kernels)
+ */
+static char thread_phase(int phase)
+{
+	return (phase == PHASE_NP || phase == PHASE_NE);
+}
+
+
+/**
+ * \brief Write the run statistics as text
+ * \param [out] fp Stream
+ */
+static void report_text(FILE *fp)
+{
+	int i, k;
+
+	fprintf(fp, "---------------------------------------\n");
+	fprintf(fp, "%-14s %12s %12s\n", "Phase", "wall (s)", "cpu (s)");
+	for (i = 0; i < NPHASES; i++) {
+		if (thread_phase(i)) {
+			fprintf(fp, "  %-12s %12s %12.6f\n", phase_names[i], "-", totals.cpu[i]);
+		} else {
+			fprintf(fp, "%-14s %12.6f %12.6f\n", phase_names[i], totals.wall[i], totals.cpu[i]);
+		}
+	}
+	fprintf(fp, "---------------------------------------\n");
+	for (i = 0; i < NCOUNTERS; i++) {
+		fprintf(fp, "%-18s = %lu\n", count_names[i], totals.count[i]);
+	}
+	fprintf(fp, "---------------------------------------\n");
+	fprintf(fp, "%-21s %10s %12s\n", "Pair size (elements)", "pairs", "cpu (s)");
+	for (i = 0; i < NBUCKETS; i++) {
+		if (totals.bpairs[i] == 0) continue;
+		fprintf(fp, "%10lu - %-8lu %10lu %12.6f\n", 1UL << i, (2UL << i) - 1, totals.bpairs[i], totals.btime[i]);
+	}
+	fprintf(fp, "---------------------------------------\n");
+
+	if (hw_status() < 0) {
+		fprintf(fp, "Hardware counters not available\n");
+		fprintf(fp, "---------------------------------------\n");
+	}
+	if (hw_status() <= 0) {
+		return;
+	}
+	fprintf(fp, "%-14s", "Events");
+	for (k = 0; k < NHWEVENTS; k++) {
+		fprintf(fp, " %14s", hw_names[k]);
+	}
+	fprintf(fp, "\n");
+	for (i = 0; i < NPHASES; i++) {
+		if (i != PHASE_PAIRS && !thread_phase(i)) continue;
+		fprintf(fp, thread_phase(i) ? "  %-12s" : "%-14s", phase_names[i]);
+		for (k = 0; k < NHWEVENTS; k++) {
+			fprintf(fp, " %14llu", totals.hw[i][k]);
+		}
+		fprintf(fp, "\n");
+	}
+	for (i = 0; i < NBUCKETS; i++) {
+		if (totals.bpairs[i] == 0) continue;
+		fprintf(fp, "%6lu - %-6lu", 1UL << i, (2UL << i) - 1);
+		for (k = 0; k < NHWEVENTS; k++) {
+			fprintf(fp, " %14llu", totals.bhw[i][k]);
+		}
+		fprintf(fp, "\n");
+	}
+	fprintf(fp, "---------------------------------------\n");
+}
+
+
+/**
+ * \brief Write hardware events as a JSON object
+ * \param [out] fp Stream
+ * \param [in] hw Events
+ */
+static void json_events(FILE *fp, unsigned long long *hw)
+{
+	int k;
+
+	for (k = 0; k < NHWEVENTS; k++) {
+		fprintf(fp, "%s\"%s\": %llu", (k > 0) ? ", " : "", hw_names[k], hw[k]);
+	}
+}
+
+
+/**
+ * \brief Write the run statistics as JSON
+ * \param [out] fp Stream
+ */
+static void report_json(FILE *fp)
+{
+	int i, n;
+
+	fprintf(fp, "{\n  \"phases\": {\n");
+	for (i = 0; i < NPHASES; i++) {
+		if (thread_phase(i)) {
+			fprintf(fp, "    \"%s\": { \"wall\": null, \"cpu\": %.9f", phase_names[i], totals.cpu[i]);
+		} else {
+			fprintf(fp, "    \"%s\": { \"wall\": %.9f, \"cpu\": %.9f", phase_names[i], totals.wall[i], totals.cpu[i]);
+		}
+		if (hw_status() > 0 && (i == PHASE_PAIRS || thread_phase(i))) {
+			fprintf(fp, ", ");
+			json_events(fp, totals.hw[i]);
+		}
+		fprintf(fp, " }%s\n", (i < (NPHASES - 1)) ? "," : "");
+	}
+	fprintf(fp, "  },\n  \"counters\": {\n");
+	for (i = 0; i < NCOUNTERS; i++) {
+		fprintf(fp, "    \"%s\": %lu%s\n", count_names[i], totals.count[i], (i < (NCOUNTERS - 1)) ? "," : "");
+	}
+	fprintf(fp, "  },\n  \"pair_sizes\": [");
+	n = 0;
+	for (i = 0; i < NBUCKETS; i++) {
+		if (totals.bpairs[i] == 0) continue;
+		fprintf(fp, "%s\n    { \"min\": %lu, \"max\": %lu, \"pairs\": %lu, \"time\": %.9f",
+				(n++ > 0) ? "," : "", 1UL << i, (2UL << i) - 1, totals.bpairs[i], totals.btime[i]);
+		if (hw_status() > 0) {
+			fprintf(fp, ", ");
+			json_events(fp, totals.bhw[i]);
+		}
+		fprintf(fp, " }");
+	}
+	fprintf(fp, "\n  ],\n  \"hardware_counters\": %s\n}\n", (hw_status() > 0) ? "true" : "false");
+}
+
+
+/**
+ * \brief Write the run statistics
+ * \param [in] filename JSON file name (NULL for a text report on stderr)
+ * \return int 0 on success, -1 otherwise
+ * \note Call it after the workspaces were released.
+ */
+int stats_report(const char *filename)
+{
+	FILE *fp;
+
+	stats_phase(PHASE_NONE);
+
+	if (filename == NULL) {
+		report_text(stderr);
+		return 0;
+	}
+
+	if ((fp = fopen(filename, "w")) == NULL) {
+		perror(filename);
+		return -1;
+	}
+	report_json(fp);
+	if (fclose(fp) != 0) {
+		perror(filename);
+		return -1;
+	}
+	return 0;
+}
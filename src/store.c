@@ -0,0 +1,582 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cmatches.h"
+
+/** Files read but not parsed yet, per parser thread */
+#define RAW_PER_PARSER 4
+
+/** Initial number of clustersets allocated for a corpus stream */
+#define STREAM_CSETS 64
+
+/** Clusterset states */
+#define CS_EMPTY   0
+#define CS_RAW     1
+#define CS_LOADED  2
+#define CS_FAILED  3
+
+
+/**
+ * \brief Reader thread: read raw file contents, in file order
+ * \param [in] arg Clusterset store
+ */
+static void *store_reader(void *arg)
+{
+	cstore_t *st = arg;
+	unsigned long i;
+	size_t fsize;
+	char *buffer;
+	double cpu = 0;
+
+	if (collect_stats) {
+		cpu = thread_cpu();
+	}
+	for (;;) {
+		pthread_mutex_lock(&st->lock);
+		while (st->next_read < st->size && st->nraw >= st->maxraw) {
+			pthread_cond_wait(&st->cond, &st->lock);
+		}
+		if (st->next_read >= st->size) {
+			pthread_mutex_unlock(&st->lock);
+			break;
+		}
+		i = st->next_read++;
+		st->nraw++;
+		pthread_mutex_unlock(&st->lock);
+
+		buffer = read_file(st->csets[i].path, &fsize);
+		if (buffer == NULL) {
+			perror(st->csets[i].path);
+		}
+
+		pthread_mutex_lock(&st->lock);
+		st->raw[i]   = buffer;
+		st->rsize[i] = fsize;
+		st->state[i] = CS_RAW;
+		st->queue[st->qtail++] = i;
+		pthread_cond_broadcast(&st->cond);
+		pthread_mutex_unlock(&st->lock);
+	}
+
+	if (collect_stats) {
+		stats_time(PHASE_LOAD, 0, thread_cpu() - cpu);
+	}
+	return NULL;
+}
+
+
+/**
+ * \brief Parser thread: parse raw file contents as they arrive
+ * \param [in] arg Clusterset store
+ */
+static void *store_parser(void *arg)
+{
+	cstore_t *st = arg;
+	unsigned long i, csize;
+	elem_t *elems;
+	char *buffer;
+	double cpu = 0;
+
+	if (collect_stats) {
+		cpu = thread_cpu();
+	}
+	for (;;) {
+		pthread_mutex_lock(&st->lock);
+		while (st->qhead == st->qtail && st->qtail < st->size) {
+			pthread_cond_wait(&st->cond, &st->lock);
+		}
+		if (st->qhead == st->qtail) {
+			pthread_mutex_unlock(&st->lock);
+			break;
+		}
+		i = st->queue[st->qhead++];
+		buffer = st->raw[i];
+		st->raw[i] = NULL;
+		pthread_mutex_unlock(&st->lock);
+
+		elems = NULL;
+		csize = 0;
+		if (buffer != NULL) {
+			elems = parse_clusterset(buffer, st->rsize[i], &csize);
+			free(buffer);
+			if (elems != NULL && st->dict != NULL) {
+				csize = map_clusterset(elems, csize, st->dict, st->grow);
+			}
+		}
+
+		pthread_mutex_lock(&st->lock);
+		st->csets[i].elems = elems;
+		st->csets[i].size  = csize;
+		st->csets[i].mapped = (st->dict != NULL);
+		__atomic_store_n(&st->state[i], (elems != NULL) ? CS_LOADED : CS_FAILED, __ATOMIC_RELEASE);
+		st->nraw--;
+		if (++st->nloaded == st->size && collect_stats) {
+			/* Background loading is done */
+			stats_time(PHASE_LOAD, stats_clock() - st->started, 0);
+		}
+		pthread_cond_broadcast(&st->cond);
+		pthread_mutex_unlock(&st->lock);
+	}
+
+	if (collect_stats) {
+		stats_time(PHASE_LOAD, 0, thread_cpu() - cpu);
+	}
+	return NULL;
+}
+
+
+/**
+ * \brief Open a clusterset store and start loading the clustersets
+ * \param [in] dirname Directory with clustersets
+ * \param [in] names Clusterset file names
+ * \param [in] size Number of files
+ * \param [in] dict Element dictionary: elements not in it are dropped (NULL to keep all)
+ * \param [in] grow Add new elements to the dictionary instead of dropping them
+ * \param [in] nreaders Number of reader threads
+ * \param [in] nparsers Number of parser threads
+ * \return cstore_t* Clusterset store, NULL on error
+ * \note Loading runs in background: readers read the files (in order) and
+ *       parsers turn them into clustersets. store_get() waits only for the
+ *       clusterset it needs, so calculation starts as soon as the first
+ *       files are loaded. Each file is read and parsed only once.
+ */
+cstore_t *open_store(const char *dirname, char **names, unsigned long size, nameset_t *dict,
+		char grow, unsigned long nreaders, unsigned long nparsers)
+{
+	cstore_t *st;
+	unsigned long i;
+
+	st = calloc(1, sizeof(cstore_t));
+	if (st == NULL) {
+		perror("open_store");
+		return NULL;
+	}
+	st->size   = size;
+	st->dict   = dict;
+	st->grow   = grow;
+	st->csets  = calloc(size, sizeof(cset_t));
+	st->state  = calloc(size, sizeof(char));
+	st->raw    = calloc(size, sizeof(char*));
+	st->rsize  = calloc(size, sizeof(size_t));
+	st->queue  = calloc(size, sizeof(unsigned long));
+	if ((size > 0) && (st->csets == NULL || st->state == NULL || st->raw == NULL ||
+			st->rsize == NULL || st->queue == NULL)) {
+		perror("open_store");
+		close_store(st);
+		return NULL;
+	}
+	for (i = 0; i < size; i++) {
+		asprintf(&st->csets[i].path, "%s/%s", dirname, names[i]);
+	}
+
+	if (nreaders < 1) nreaders = 1;
+	if (nparsers < 1) nparsers = 1;
+	st->maxraw = nparsers * RAW_PER_PARSER;
+	if (collect_stats) {
+		st->started = stats_clock();
+	}
+
+	pthread_mutex_init(&st->lock, NULL);
+	pthread_cond_init(&st->cond, NULL);
+
+	st->threads = malloc(sizeof(pthread_t) * (nreaders + nparsers));
+	if (st->threads == NULL) {
+		perror("open_store");
+		close_store(st);
+		return NULL;
+	}
+	for (i = 0; i < nreaders; i++) {
+		if (pthread_create(&st->threads[st->nthreads], NULL, store_reader, st) == 0) {
+			st->nthreads++;
+		}
+	}
+	if (st->nthreads == 0) {
+		perror("open_store");
+		close_store(st);
+		return NULL;
+	}
+	for (i = 0; i < nparsers; i++) {
+		if (pthread_create(&st->threads[st->nthreads], NULL, store_parser, st) == 0) {
+			st->nthreads++;
+		}
+	}
+	if (st->nthreads == nreaders) {
+		/* No parser thread: parse here */
+		store_parser(st);
+	}
+
+	return st;
+}
+
+
+/**
+ * \brief Add a clusterset read from a corpus stream to the store
+ * \param [in] st Clusterset store
+ * \param [in] name Clusterset name (the store keeps it)
+ * \param [in] elems Elements (the store keeps them)
+ * \param [in] csize Number of elements
+ * \return int 0 on success, -1 otherwise
+ */
+static int store_publish(cstore_t *st, char *name, elem_t *elems, unsigned long csize)
+{
+	cset_t *csets;
+	char *state, cstate;
+	unsigned long cap;
+
+	cstate = CS_LOADED;
+	if (csize == 0) {
+		fprintf(stderr, "%s: cluster set is empty.\n", name);
+		free(elems);
+		elems  = NULL;
+		cstate = CS_FAILED;
+	} else {
+		/* Same order parse_clusterset() gives */
+		qsort(elems, csize, sizeof(elem_t), elem_cmp);
+		if (st->dict != NULL) {
+			csize = map_clusterset(elems, csize, st->dict, st->grow);
+		}
+	}
+
+	pthread_mutex_lock(&st->lock);
+	if (st->size == st->cap) {
+		cap   = (st->cap > 0) ? (st->cap * 2) : STREAM_CSETS;
+		csets = realloc(st->csets, sizeof(cset_t) * cap);
+		if (csets != NULL) {
+			st->csets = csets;
+		}
+		state = realloc(st->state, sizeof(char) * cap);
+		if (state != NULL) {
+			st->state = state;
+		}
+		if (csets == NULL || state == NULL) {
+			pthread_mutex_unlock(&st->lock);
+			perror("store_publish");
+			free(name);
+			free_clusterset(elems, csize);
+			return -1;
+		}
+		st->cap = cap;
+	}
+	st->csets[st->size].path  = name;
+	st->csets[st->size].elems = elems;
+	st->csets[st->size].size  = csize;
+	st->csets[st->size].mapped = (st->dict != NULL);
+	st->state[st->size]       = cstate;
+	st->size++;
+	pthread_cond_broadcast(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+
+	return 0;
+}
+
+
+/**
+ * \brief Add one element to a growing vector
+ * \param [in] [out] elems Elements
+ * \param [in] [out] csize Number of elements
+ * \param [in] [out] ecap Allocated elements
+ * \param [in] name Element name
+ * \param [in] cluster Cluster number
+ * \return int 0 on success, -1 otherwise
+ */
+static int add_element(elem_t **elems, unsigned long *csize, unsigned long *ecap, const char *name, unsigned long cluster)
+{
+	elem_t *e;
+
+	if (*csize == *ecap) {
+		*ecap = (*ecap > 0) ? (*ecap * 2) : 64;
+		e = realloc(*elems, sizeof(elem_t) * (*ecap));
+		if (e == NULL) {
+			return -1;
+		}
+		*elems = e;
+	}
+	(*elems)[*csize].name    = strdup(name);
+	(*elems)[*csize].cluster = cluster;
+	(*elems)[*csize].id      = 0;
+	if ((*elems)[*csize].name == NULL) {
+		return -1;
+	}
+	(*csize)++;
+	return 0;
+}
+
+
+/**
+ * \brief Stream reader thread: parse a corpus stream, one line at a time
+ * \param [in] arg Clusterset store
+ * \note Corpus format: each clusterset starts with a line ">name", followed
+ *       by its elements in the clusterset file format ("element cluster,").
+ *       Only the current line and the current clusterset are kept in memory.
+ */
+static void *store_stream_reader(void *arg)
+{
+	cstore_t *st = arg;
+	char *line, *name, *str, *p;
+	size_t lcap;
+	ssize_t len;
+	elem_t *elems;
+	unsigned long csize, ecap, lineno, hash, nbytes;
+	int failed;
+
+	failed = 0;
+	line   = NULL;
+	lcap   = 0;
+	name   = NULL;
+	elems  = NULL;
+	csize  = ecap = 0;
+	lineno = 0;
+	nbytes = 0;
+	hash   = FNV_OFFSET;
+
+	while ((len = getline(&line, &lcap, st->input)) >= 0) {
+		lineno++;
+		nbytes += len;
+		hash = fnv1a(hash, line, len);
+
+		/* Strip line ending */
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+			line[--len] = '\0';
+		}
+
+		if (line[0] == '>') {
+			/* New clusterset */
+			if (name != NULL && store_publish(st, name, elems, csize) < 0) {
+				/* store_publish() frees them */
+				name   = NULL;
+				elems  = NULL;
+				failed = 1;
+				break;
+			}
+			elems = NULL;
+			csize = ecap = 0;
+			for (p = &line[1]; *p == ' '; p++);
+			name = strdup(p);
+			if (name == NULL) {
+				perror("store_stream_reader");
+				failed = 1;
+				break;
+			}
+			continue;
+		}
+
+		/* Elements: "name cluster," (one or more on each line) */
+		p = line;
+		for (;;) {
+			while (*p == ' ' || *p == '\t') p++;
+			if (*p == '\0') break;
+
+			if (name == NULL) {
+				fprintf(stderr, "Line %lu: element out of a cluster set (missing '>name' line).\n", lineno);
+				break;
+			}
+
+			str = p;
+			while (*p != ' ' && *p != '\t' && *p != '\0') p++;
+			if (*p == '\0') {
+				fprintf(stderr, "Line %lu: element without cluster number.\n", lineno);
+				break;
+			}
+			*p++ = '\0';
+
+			if (add_element(&elems, &csize, &ecap, str, atoi(p)) < 0) {
+				perror("store_stream_reader");
+				failed = 1;
+				break;
+			}
+			while (*p != ',' && *p != '\0') p++;
+			if (*p == ',') p++;
+		}
+		if (failed) {
+			break;
+		}
+	}
+	if (name != NULL && !failed) {
+		if (store_publish(st, name, elems, csize) < 0) {
+			failed = 1;
+		}
+	} else {
+		free(name);
+		free_clusterset(elems, csize);
+	}
+	free(line);
+	stats_count(COUNT_BYTES, nbytes);
+
+	pthread_mutex_lock(&st->lock);
+	/* Callers of store_wait() see a failed stream as a read error */
+	if (failed || ferror(st->input)) {
+		st->error = 1;
+	}
+	st->fingerprint = hash;
+	__atomic_store_n(&st->eof, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+
+	return NULL;
+}
+
+
+/**
+ * \brief Open a clusterset store that loads a corpus stream (many named
+ *        clustersets in one file)
+ * \param [in] filename Corpus file name ("-" for standard input)
+ * \param [in] dict Element dictionary
+ * \param [in] grow Add new elements to the dictionary (otherwise, elements
+ *        not in the dictionary are dropped)
+ * \return cstore_t* Clusterset store, NULL on error
+ * \note Clustersets are added to the store as they are parsed; see
+ *       store_wait().
+ */
+cstore_t *open_stream_store(const char *filename, nameset_t *dict, char grow)
+{
+	cstore_t *st;
+
+	st = calloc(1, sizeof(cstore_t));
+	if (st == NULL) {
+		perror("open_stream_store");
+		return NULL;
+	}
+	st->dict = dict;
+	st->grow = grow;
+
+	/* Compressed corpora are decompressed while they are parsed */
+	if ((st->input = open_input(filename, NULL)) == NULL) {
+		perror(filename);
+		free(st);
+		return NULL;
+	}
+
+	pthread_mutex_init(&st->lock, NULL);
+	pthread_cond_init(&st->cond, NULL);
+
+	st->threads = malloc(sizeof(pthread_t));
+	if (st->threads == NULL || pthread_create(&st->threads[0], NULL, store_stream_reader, st) != 0) {
+		perror("open_stream_store");
+		close_store(st);
+		return NULL;
+	}
+	st->nthreads = 1;
+
+	return st;
+}
+
+
+/**
+ * \brief Wait until the whole corpus stream is loaded
+ * \param [in] st Clusterset store
+ * \return unsigned long Number of clustersets
+ */
+unsigned long store_wait(cstore_t *st)
+{
+	unsigned long size;
+
+	if (st->input == NULL || __atomic_load_n(&st->eof, __ATOMIC_ACQUIRE)) {
+		return st->size;
+	}
+
+	pthread_mutex_lock(&st->lock);
+	while (!st->eof) {
+		pthread_cond_wait(&st->cond, &st->lock);
+	}
+	size = st->size;
+	pthread_mutex_unlock(&st->lock);
+
+	return size;
+}
+
+
+/**
+ * \brief Get a clusterset, waiting until it is loaded
+ * \param [in] st Clusterset store
+ * \param [in] i Clusterset number
+ * \return cset_t* Clusterset, NULL if it could not be loaded
+ */
+cset_t *store_get(cstore_t *st, unsigned long i)
+{
+	char state;
+
+	/* Clustersets of a corpus stream move while it is loaded */
+	store_wait(st);
+
+	if (i >= st->size) {
+		return NULL;
+	}
+
+	/* Loaded clustersets never change, so no lock is needed after that */
+	state = __atomic_load_n(&st->state[i], __ATOMIC_ACQUIRE);
+	if (state != CS_LOADED && state != CS_FAILED) {
+		pthread_mutex_lock(&st->lock);
+		while (st->state[i] != CS_LOADED && st->state[i] != CS_FAILED) {
+			pthread_cond_wait(&st->cond, &st->lock);
+		}
+		state = st->state[i];
+		pthread_mutex_unlock(&st->lock);
+	}
+
+	return (state == CS_LOADED) ? &st->csets[i] : NULL;
+}
+
+
+/**
+ * \brief Wait for loading to finish and release the clusterset store
+ * \param [in] st Clusterset store
+ */
+void close_store(cstore_t *st)
+{
+	unsigned long i;
+
+	if (st == NULL) return;
+
+	if (st->threads != NULL) {
+		for (i = 0; i < st->nthreads; i++) {
+			pthread_join(st->threads[i], NULL);
+		}
+		free(st->threads);
+	}
+	if (st->input != NULL || st->threads != NULL) {
+		pthread_mutex_destroy(&st->lock);
+		pthread_cond_destroy(&st->cond);
+	}
+	if (st->input != NULL && st->input != stdin) {
+		fclose(st->input);
+	}
+
+	if (st->csets != NULL) {
+		for (i = 0; i < st->size; i++) {
+			free_clusterset(st->csets[i].elems, st->csets[i].size);
+			free(st->csets[i].path);
+		}
+	}
+	if (st->raw != NULL) {
+		for (i = 0; i < st->size; i++) {
+			free(st->raw[i]);
+		}
+	}
+	free(st->csets);
+	free(st->state);
+	free(st->raw);
+	free(st->rsize);
+	free(st->queue);
+	free(st);
+}
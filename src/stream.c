@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "cmatches.h"
+
+/** Rows being calculated (or waiting to be delivered) per worker */
+#define ROWS_PER_THREAD 2
+
+/**
+ * Row slot: a row calculated by a worker waiting to be delivered
+ */
+typedef struct _rowslot {
+	/** row values (indexed by column) */
+	double *values;
+	/** row is ready to be delivered */
+	char ready;
+} rowslot_t;
+
+/**
+ * Row engine state shared by the workers
+ */
+typedef struct _rows {
+	/** matrix size */
+	unsigned long size;
+	/** number of rows to be calculated */
+	unsigned long nrows;
+	/** tiles to be calculated (NULL for the whole upper triangle) */
+	tile_t *tiles;
+	/** number of tiles */
+	unsigned long ntiles;
+	/** matrix row of each row to be calculated (with tiles) */
+	unsigned long *index;
+	/** first tile of the band of each row to be calculated (with tiles) */
+	unsigned long *band;
+	/** next row to be calculated */
+	unsigned long next;
+	/** next row to be delivered */
+	unsigned long deliver;
+	/** number of slots */
+	unsigned long nslots;
+	/** row slots (row i uses slot i % nslots) */
+	rowslot_t *slots;
+	/** threads that calculate each pair (see set_split()) */
+	unsigned long split;
+	/** pair function */
+	pair_fn_t pair;
+	/** user argument */
+	void *arg;
+	/** protects the fields above */
+	pthread_mutex_t lock;
+	/** signaled when a slot becomes free or a row becomes ready */
+	pthread_cond_t cond;
+} rows_t;
+
+
+/**
+ * \brief Initialize online statistics (Welford)
+ * \param [out] st Statistics
+ */
+void stat_init(stat_t *st)
+{
+	st->n    = 0;
+	st->mean = 0;
+	st->m2   = 0;
+}
+
+
+/**
+ * \brief Add a value to online statistics
+ * \param [in] st Statistics
+ * \param [in] x Value
+ */
+void stat_add(stat_t *st, double x)
+{
+	double dev;
+
+	st->n++;
+	dev       = x - st->mean;
+	st->mean += dev / (double)st->n;
+	st->m2   += dev * (x - st->mean);
+}
+
+
+/**
+ * \brief Get mean and standard deviation from online statistics
+ * \param [in] st Statistics
+ * \param [out] mean Mean
+ * \param [out] sd Standard deviation
+ */
+void stat_result(stat_t *st, double *mean, double *sd)
+{
+	*mean = (st->n == 0) ? NAN : st->mean;
+	*sd   = (st->n <= 1) ? 0 : sqrt(st->m2 / (double)(st->n - 1));
+}
+
+
+/**
+ * \brief Matrix row of a row to be calculated
+ * \param [in] rows Row engine
+ * \param [in] r Row to be calculated (0..nrows-1)
+ * \return unsigned long Matrix row
+ */
+static unsigned long matrix_row(rows_t *rows, unsigned long r)
+{
+	return (rows->tiles != NULL) ? rows->index[r] : r;
+}
+
+
+/**
+ * \brief Calculate the upper triangle part of one row (or the part that
+ *        falls on the tiles)
+ * \param [in] rows Row engine
+ * \param [in] r Row to be calculated (0..nrows-1)
+ * \param [out] values Row values (indexed by column)
+ */
+static void calculate_row(rows_t *rows, unsigned long r, double *values)
+{
+	unsigned long i, j, t;
+	tile_t *tile;
+
+	i = matrix_row(rows, r);
+	values[i] = 1.0;
+	if (rows->tiles == NULL) {
+		for (j = (i+1); j < rows->size; j++) {
+			values[j] = rows->pair(i, j, rows->arg);
+		}
+		return;
+	}
+
+	for (t = rows->band[r]; t < rows->ntiles && rows->tiles[t].row == rows->tiles[rows->band[r]].row; t++) {
+		tile = &rows->tiles[t];
+		j = (tile->col > i) ? tile->col : (i+1);
+		for (; j < (tile->col + tile->ncols); j++) {
+			values[j] = rows->pair(i, j, rows->arg);
+		}
+	}
+}
+
+
+/**
+ * \brief Worker thread: calculate rows while there are free slots
+ * \param [in] arg Row engine
+ */
+static void *row_worker(void *arg)
+{
+	rows_t *rows = arg;
+	unsigned long i;
+	rowslot_t *slot;
+
+	set_split(rows->split);
+	for (;;) {
+		pthread_mutex_lock(&rows->lock);
+		while (rows->next < rows->nrows && rows->next >= (rows->deliver + rows->nslots)) {
+			pthread_cond_wait(&rows->cond, &rows->lock);
+		}
+		if (rows->next >= rows->nrows) {
+			pthread_mutex_unlock(&rows->lock);
+			break;
+		}
+		i    = rows->next++;
+		slot = &rows->slots[i % rows->nslots];
+		pthread_mutex_unlock(&rows->lock);
+
+		calculate_row(rows, i, slot->values);
+
+		pthread_mutex_lock(&rows->lock);
+		slot->ready = 1;
+		pthread_cond_broadcast(&rows->cond);
+		pthread_mutex_unlock(&rows->lock);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * \brief Calculate the rows of an engine with a pool of workers
+ * \param [in] rows Row engine (size, rows, tiles and functions set)
+ * \param [in] npairs Number of pairs to be calculated
+ * \param [in] nbusy Number of rows with pairs
+ * \param [in] nthreads Number of worker threads
+ * \param [in] deliver Function called with each calculated row
+ * \return int 0 on success, -1 otherwise
+ */
+static int run_rows(rows_t *rows, unsigned long npairs, unsigned long nbusy,
+		unsigned long nthreads, row_fn_t deliver)
+{
+	pthread_t *threads;
+	unsigned long r, t, started, split;
+	rowslot_t *slot;
+	int ret = 0;
+
+	if (nthreads < 1) {
+		nthreads = 1;
+	}
+
+	/* Less pairs than threads: rows with pairs go to fewer workers and
+	 * each one calculates its pairs with several threads */
+	split = 0;
+	if (nbusy > 0 && npairs < nthreads) {
+		split    = nthreads / nbusy;
+		nthreads = nbusy;
+	}
+	if (nthreads > rows->nrows) {
+		nthreads = (rows->nrows > 0) ? rows->nrows : 1;
+	}
+
+	rows->split  = split;
+	rows->nslots = (nthreads == 1) ? 1 : (nthreads * ROWS_PER_THREAD);
+	rows->slots  = calloc(rows->nslots, sizeof(rowslot_t));
+	if (rows->slots == NULL) {
+		perror("calculate_rows");
+		return -1;
+	}
+	for (r = 0; r < rows->nslots; r++) {
+		rows->slots[r].values = malloc(sizeof(double) * ((rows->size > 0) ? rows->size : 1));
+		if (rows->slots[r].values == NULL) {
+			perror("calculate_rows");
+			ret = -1;
+			goto out;
+		}
+	}
+
+	started = 0;
+	threads = NULL;
+	if (nthreads > 1) {
+		threads = malloc(sizeof(pthread_t) * nthreads);
+		if (threads == NULL) {
+			perror("calculate_rows");
+			ret = -1;
+			goto out;
+		}
+		pthread_mutex_init(&rows->lock, NULL);
+		pthread_cond_init(&rows->cond, NULL);
+
+		for (t = 0; t < nthreads; t++) {
+			if (pthread_create(&threads[t], NULL, row_worker, rows) != 0) {
+				perror("calculate_rows");
+				break;
+			}
+			started++;
+		}
+	}
+
+	/* Single thread: just calculate and deliver each row */
+	if (started == 0) {
+		set_split(split);
+		for (r = 0; r < rows->nrows; r++) {
+			calculate_row(rows, r, rows->slots[0].values);
+			deliver(matrix_row(rows, r), rows->slots[0].values, rows->arg);
+		}
+		set_split(0);
+		goto out_threads;
+	}
+
+	/* Deliver rows in order */
+	for (r = 0; r < rows->nrows; r++) {
+		slot = &rows->slots[r % rows->nslots];
+
+		pthread_mutex_lock(&rows->lock);
+		while (!slot->ready) {
+			pthread_cond_wait(&rows->cond, &rows->lock);
+		}
+		pthread_mutex_unlock(&rows->lock);
+
+		deliver(matrix_row(rows, r), slot->values, rows->arg);
+
+		pthread_mutex_lock(&rows->lock);
+		slot->ready = 0;
+		rows->deliver++;
+		pthread_cond_broadcast(&rows->cond);
+		pthread_mutex_unlock(&rows->lock);
+	}
+
+	for (t = 0; t < started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+out_threads:
+	if (threads != NULL) {
+		pthread_mutex_destroy(&rows->lock);
+		pthread_cond_destroy(&rows->cond);
+		free(threads);
+	}
+
+out:
+	for (r = 0; r < rows->nslots; r++) {
+		free(rows->slots[r].values);
+	}
+	free(rows->slots);
+	return ret;
+}
+
+
+/**
+ * \brief Calculate the upper triangle of a matrix, row by row
+ * \param [in] size Matrix size
+ * \param [in] nthreads Number of worker threads
+ * \param [in] pair Function that calculates one pair
+ * \param [in] deliver Function called with each calculated row
+ * \param [in] arg User argument (passed to pair and deliver)
+ * \return int 0 on success, -1 otherwise
+ * \note Rows are delivered in order (0, 1, ..., size-1) from the calling
+ *       thread, no matter which worker calculated them. Only a few rows per
+ *       worker are kept in memory.
+ */
+int calculate_rows(unsigned long size, unsigned long nthreads, pair_fn_t pair, row_fn_t deliver, void *arg)
+{
+	rows_t rows;
+
+	memset(&rows, 0, sizeof(rows_t));
+	rows.size  = size;
+	rows.nrows = size;
+	rows.pair  = pair;
+	rows.arg   = arg;
+	return run_rows(&rows, (size > 1) ? ((size * (size - 1)) / 2) : 0,
+			(size > 1) ? (size - 1) : 0, nthreads, deliver);
+}
+
+
+/**
+ * \brief Calculate the pairs of a set of tiles of the upper triangle, row
+ *        by row (see calculate_rows())
+ * \param [in] size Matrix size
+ * \param [in] tiles Tiles (row major order, as given by gen_tiles())
+ * \param [in] ntiles Number of tiles
+ * \param [in] nthreads Number of worker threads
+ * \param [in] pair Function that calculates one pair
+ * \param [in] deliver Function called with each calculated row
+ * \param [in] arg User argument (passed to pair and deliver)
+ * \return int 0 on success, -1 otherwise
+ * \note Only the rows of the tiles are delivered, in order, and only the
+ *       columns of the tiles (and the diagonal) of each row are set.
+ */
+int calculate_tile_rows(unsigned long size, tile_t *tiles, unsigned long ntiles, unsigned long nthreads,
+		pair_fn_t pair, row_fn_t deliver, void *arg)
+{
+	rows_t rows;
+	unsigned long t, b, i, npairs;
+	int ret;
+
+	memset(&rows, 0, sizeof(rows_t));
+	rows.size   = size;
+	rows.tiles  = tiles;
+	rows.ntiles = ntiles;
+	rows.pair   = pair;
+	rows.arg    = arg;
+
+	/* Tiles of a band (same rows) are consecutive */
+	npairs = 0;
+	for (t = 0; t < ntiles; t++) {
+		if (t == 0 || tiles[t].row != tiles[t-1].row) {
+			rows.nrows += tiles[t].nrows;
+		}
+		npairs += (tiles[t].row == tiles[t].col) ? ((tiles[t].nrows * (tiles[t].nrows - 1)) / 2) :
+			(tiles[t].nrows * tiles[t].ncols);
+	}
+	rows.index = malloc(sizeof(unsigned long) * ((rows.nrows > 0) ? rows.nrows : 1));
+	rows.band  = malloc(sizeof(unsigned long) * ((rows.nrows > 0) ? rows.nrows : 1));
+	if (rows.index == NULL || rows.band == NULL) {
+		perror("calculate_tile_rows");
+		free(rows.index);
+		free(rows.band);
+		return -1;
+	}
+	rows.nrows = 0;
+	for (b = 0; b < ntiles; b = t) {
+		for (i = tiles[b].row; i < (tiles[b].row + tiles[b].nrows); i++) {
+			rows.index[rows.nrows] = i;
+			rows.band[rows.nrows]  = b;
+			rows.nrows++;
+		}
+		for (t = b; t < ntiles && tiles[t].row == tiles[b].row; t++);
+	}
+
+	ret = run_rows(&rows, npairs, rows.nrows, nthreads, deliver);
+	free(rows.index);
+	free(rows.band);
+	return ret;
+}
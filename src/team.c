@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cmatches.h"
+
+/*
+ * Teams of threads that calculate one pair together (see split_congruency())
+ *
+ * The thread that creates the team is its member 0. The other members wait
+ * for jobs: team_run() runs a function on all members at once and returns
+ * when all of them are done. Inside the function, members wait for each
+ * other with team_sync().
+ */
+
+/**
+ * One member of a team (other than member 0)
+ */
+typedef struct _member {
+	/** team */
+	struct _team *team;
+	/** member number */
+	unsigned long t;
+} member_t;
+
+/**
+ * Team of threads
+ */
+struct _team {
+	/** number of members (including member 0) */
+	unsigned long n;
+	/** threads of members 1, ..., n-1 */
+	pthread_t *threads;
+	/** members 1, ..., n-1 */
+	member_t *members;
+	/** job number (changes when a job is started) */
+	unsigned long generation;
+	/** members must exit */
+	char quit;
+	/** job function */
+	team_fn_t fn;
+	/** job argument */
+	void *arg;
+	/** protects the fields above */
+	pthread_mutex_t lock;
+	/** signaled when a job is started */
+	pthread_cond_t cond;
+	/** members waiting for each other */
+	pthread_barrier_t barrier;
+};
+
+
+/**
+ * \brief Member thread: run jobs until the team is destroyed
+ * \param [in] arg Member
+ */
+static void *team_member(void *arg)
+{
+	member_t *m = arg;
+	team_t *team = m->team;
+	unsigned long gen;
+	team_fn_t fn;
+	void *farg;
+
+	gen = 0;
+	for (;;) {
+		pthread_mutex_lock(&team->lock);
+		while (team->generation == gen && !team->quit) {
+			pthread_cond_wait(&team->cond, &team->lock);
+		}
+		if (team->quit) {
+			pthread_mutex_unlock(&team->lock);
+			break;
+		}
+		gen  = team->generation;
+		fn   = team->fn;
+		farg = team->arg;
+		pthread_mutex_unlock(&team->lock);
+
+		fn(m->t, farg);
+		pthread_barrier_wait(&team->barrier);
+	}
+	return NULL;
+}
+
+
+/**
+ * \brief Create a team of threads
+ * \param [in] n Number of members, including the calling thread
+ * \return team_t* Team (it may have less members than asked when threads
+ *         can not be created), NULL on error
+ */
+team_t *create_team(unsigned long n)
+{
+	team_t *team;
+	unsigned long t;
+
+	if (n < 1) {
+		n = 1;
+	}
+	team = calloc(1, sizeof(team_t));
+	if (team == NULL) {
+		perror("create_team");
+		return NULL;
+	}
+	team->threads = malloc(sizeof(pthread_t) * n);
+	team->members = malloc(sizeof(member_t) * n);
+	if (team->threads == NULL || team->members == NULL) {
+		perror("create_team");
+		free(team->threads);
+		free(team->members);
+		free(team);
+		return NULL;
+	}
+	pthread_mutex_init(&team->lock, NULL);
+	pthread_cond_init(&team->cond, NULL);
+
+	/* Members do not use the barrier before the first job */
+	team->n = 1;
+	for (t = 1; t < n; t++) {
+		team->members[t].team = team;
+		team->members[t].t    = t;
+		if (pthread_create(&team->threads[t], NULL, team_member, &team->members[t]) != 0) {
+			perror("create_team");
+			break;
+		}
+		team->n++;
+	}
+	pthread_barrier_init(&team->barrier, NULL, team->n);
+	return team;
+}
+
+
+/**
+ * \brief Number of members of a team
+ * \param [in] team Team
+ * \return unsigned long
+ */
+unsigned long team_size(team_t *team)
+{
+	return team->n;
+}
+
+
+/**
+ * \brief Run a function on all members of a team (the calling thread is
+ *        member 0)
+ * \param [in] team Team
+ * \param [in] fn Function, called with the member number and arg
+ * \param [in] arg Function argument
+ * \note Returns when all members are done.
+ */
+void team_run(team_t *team, team_fn_t fn, void *arg)
+{
+	if (team->n > 1) {
+		pthread_mutex_lock(&team->lock);
+		team->fn  = fn;
+		team->arg = arg;
+		team->generation++;
+		pthread_cond_broadcast(&team->cond);
+		pthread_mutex_unlock(&team->lock);
+	}
+	fn(0, arg);
+	pthread_barrier_wait(&team->barrier);
+}
+
+
+/**
+ * \brief Wait for all members of a team (called from a job function)
+ * \param [in] team Team
+ */
+void team_sync(team_t *team)
+{
+	pthread_barrier_wait(&team->barrier);
+}
+
+
+/**
+ * \brief Destroy a team, waiting for its threads to exit
+ * \param [in] team Team
+ */
+void destroy_team(team_t *team)
+{
+	unsigned long t;
+
+	if (team == NULL) return;
+
+	pthread_mutex_lock(&team->lock);
+	team->quit = 1;
+	pthread_cond_broadcast(&team->cond);
+	pthread_mutex_unlock(&team->lock);
+	for (t = 1; t < team->n; t++) {
+		pthread_join(team->threads[t], NULL);
+	}
+	pthread_barrier_destroy(&team->barrier);
+	pthread_cond_destroy(&team->cond);
+	pthread_mutex_destroy(&team->lock);
+	free(team->threads);
+	free(team->members);
+	free(team);
+}
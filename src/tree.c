@@ -0,0 +1,1163 @@
+/*
+ * Copyright (C) 2014 Renê de Souza Pinto. All rights reserved.
+ *
+ * Author: Renê S. Pinto
+ *
+ * This file is part of matches.
+ *
+ * Matches is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Matches is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Matches.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cmatches.h"
+
+/*
+ * Hierarchical clustering trees (--newick)
+ *
+ * Each input file has one tree in Newick format, e.g.
+ *
+ *   ((a:1,b:1):2,(c:1,(d:0.5,e:0.5):0.5):2);
+ *
+ * Leaves are elements (unnamed leaves and leaves out of the element list
+ * are dropped), internal nodes are merges. Merges are applied in order of
+ * height (the longest path down to a leaf; every branch counts 1 when the
+ * tree has no branch lengths), ties in post-order, so the tree cut at k
+ * clusters is the first state with at most k clusters.
+ *
+ * Congruency between two trees is calculated at all cut levels in one pass:
+ * the contingency table of the common elements (cells of a cluster of
+ * each tree) is kept while the clusters of one tree or the other are
+ * merged, and Np and Ne are updated with the cells that change. Merging
+ * clusters moves the cells of the smaller ones to the largest one, so
+ * each cell moves O(log n) times. Within a cluster, elements are in leaf
+ * order (Ne of h counts pairs in the same order on both trees), which is
+ * the order of the flat cluster set files written from the trees.
+ */
+
+/** No cell / element */
+#define NONE ((unsigned long)-1)
+
+/**
+ * Node of a tree being parsed
+ */
+typedef struct _pnode {
+	/** parent (NONE for the root) */
+	unsigned long parent;
+	/** leaf index, or order of completion (internal nodes) */
+	unsigned long order;
+	/** branch length */
+	double length;
+	/** height (longest path down to a leaf) */
+	double height;
+	/** label (leaves) */
+	char *label;
+	/** it is a leaf */
+	char leaf;
+	/** branch length was given */
+	char haslen;
+} pnode_t;
+
+/**
+ * Element id of a leaf
+ */
+typedef struct _leafid {
+	unsigned long id;
+	unsigned long leaf;
+} leafid_t;
+
+/**
+ * Contingency table of a pair of trees, while they are cut
+ */
+typedef struct _tpair {
+	/** common elements */
+	unsigned long m;
+	/** leaf of each common element on each tree (leaf order) */
+	unsigned long *pos[2];
+	/** next element of the same cell */
+	unsigned long *enext;
+	/** cluster of each cell on each tree */
+	unsigned long *line[2];
+	/** next and previous cells of the same cluster of each tree */
+	unsigned long *next[2], *prev[2];
+	/** elements of each cell */
+	unsigned long *n;
+	/** first and last elements of each cell */
+	unsigned long *ehead, *etail;
+	/** cell hash (by clusters of both trees) */
+	unsigned long *bucket, *hnext;
+	/** bits of the hash size */
+	unsigned int hbits;
+	/** first cell, number of cells and common elements of each cluster
+	 *  (clusters take the index of one of their leaves) */
+	unsigned long *head[2], *ncells[2], *margin[2];
+	/** cluster of each node of each tree */
+	unsigned long *lineid[2];
+	/** merges applied and clusters of each tree */
+	unsigned long done[2], clusters[2];
+	/** Np of h of each tree and Ne of h */
+	unsigned long np[2], ne;
+	/** Np of h2 of each tree and Ne of h2 (cells of 2 or more elements) */
+	mpz_t np2[2], ne2;
+	/** cells of one element that are the only common element of both clusters */
+	unsigned long iso;
+	/** scratch */
+	mpz_t A, B;
+	mpf_t fnum, fden;
+	/** indexes being calculated */
+	char cindex;
+	/** all arrays (one allocation) */
+	unsigned long *mem;
+} tpair_t;
+
+/**
+ * Calculation of the trees of a directory
+ */
+typedef struct _tjob {
+	/** trees */
+	tree_t *trees;
+	/** indexes (INDEX_P2P and/or INDEX_COMP) */
+	char cindex;
+	/** flags to show Np or Ne */
+	char flags;
+	/** cut levels (numbers of clusters, ascending) */
+	unsigned long *levels;
+	/** number of levels */
+	unsigned long nlevels;
+	/** matrices of h and h2 of each level (NULL if not selected) */
+	cmat_t **mats;
+} tjob_t;
+
+
+/**
+ * \brief Compare leaves by element id
+ */
+static int leafid_cmp(const void *p1, const void *p2)
+{
+	const leafid_t *a = p1, *b = p2;
+
+	if (a->id != b->id) {
+		return (a->id < b->id) ? -1 : 1;
+	}
+	return (a->leaf < b->leaf) ? -1 : (a->leaf > b->leaf);
+}
+
+
+/**
+ * \brief Compare internal nodes by height, then order of completion
+ */
+static int merge_cmp(const void *p1, const void *p2)
+{
+	const pnode_t *a = *(pnode_t * const *)p1, *b = *(pnode_t * const *)p2;
+
+	if (a->height != b->height) {
+		return (a->height < b->height) ? -1 : 1;
+	}
+	return (a->order < b->order) ? -1 : (a->order > b->order);
+}
+
+
+/**
+ * \brief Compare unsigned longs
+ */
+static int ulong_cmp(const void *p1, const void *p2)
+{
+	unsigned long a = *(const unsigned long *)p1, b = *(const unsigned long *)p2;
+
+	return (a < b) ? -1 : (a > b);
+}
+
+
+/**
+ * \brief Add a node to the tree being parsed
+ * \param [in,out] nodes Nodes
+ * \param [in,out] size Number of nodes
+ * \param [in,out] cap Allocated nodes
+ * \param [in] parent Parent node (NONE for the root)
+ * \param [in] leaf It is a leaf
+ * \return unsigned long Node index, NONE on error
+ */
+static unsigned long add_node(pnode_t **nodes, unsigned long *size, unsigned long *cap,
+		unsigned long parent, char leaf)
+{
+	pnode_t *nn;
+
+	if (*size == *cap) {
+		*cap = (*cap > 0) ? (*cap * 2) : 64;
+		nn = realloc(*nodes, sizeof(pnode_t) * (*cap));
+		if (nn == NULL) {
+			return NONE;
+		}
+		*nodes = nn;
+	}
+	nn = &(*nodes)[*size];
+	memset(nn, 0, sizeof(pnode_t));
+	nn->parent = parent;
+	nn->leaf   = leaf;
+	return (*size)++;
+}
+
+
+/**
+ * \brief Parse a label (quoted or not)
+ * \param [in,out] p Position (moved past the label)
+ * \return char* Label (allocated), NULL on error (not terminated quote or
+ *         no memory)
+ */
+static char *parse_label(const char **p)
+{
+	const char *s;
+	char *label, *d;
+
+	s = *p;
+	if (*s == '\'') {
+		/* Quoted: '' is a quote */
+		if ((label = d = malloc(strlen(s))) == NULL) {
+			return NULL;
+		}
+		for (s++; ; s++) {
+			if (*s == '\0') {
+				free(label);
+				return NULL;
+			}
+			if (*s == '\'') {
+				if (s[1] != '\'') {
+					break;
+				}
+				s++;
+			}
+			*d++ = *s;
+		}
+		*d = '\0';
+		*p = s + 1;
+		return label;
+	}
+
+	while (*s != '\0' && !isspace((unsigned char)*s) && strchr("()[]:;,'", *s) == NULL) {
+		s++;
+	}
+	label = strndup(*p, s - *p);
+	*p = s;
+	return label;
+}
+
+
+/**
+ * \brief Parse a Newick tree
+ * \param [in] buffer Tree (the first one of the buffer, up to ';')
+ * \param [out] nodes Nodes, parents before their children
+ * \param [out] nnodes Number of nodes
+ * \return const char* NULL on success, the error otherwise
+ */
+static const char *parse_newick(const char *buffer, pnode_t **nodes, unsigned long *nnodes)
+{
+	unsigned long size, cap, depth, scap, cur, v, nleaves, ninternal;
+	unsigned long *stack, *ns;
+	const char *p, *err;
+	char *end, *label;
+	char expect;
+
+	*nodes = NULL;
+	size = cap = 0;
+	stack = NULL;
+	depth = scap = 0;
+	cur = NONE;
+	expect = 1;
+	nleaves = ninternal = 0;
+	err = NULL;
+
+	p = buffer;
+	while (err == NULL) {
+		while (isspace((unsigned char)*p)) {
+			p++;
+		}
+		if (*p == '[') {
+			/* Comment */
+			if ((p = strchr(p, ']')) == NULL) {
+				err = "comment is not terminated";
+				break;
+			}
+			p++;
+			continue;
+		}
+		if (*p == '\0' || *p == ';') {
+			break;
+		}
+
+		if (expect && (*p == ',' || *p == ')' || *p == ':')) {
+			/* Unnamed leaf */
+			v = add_node(nodes, &size, &cap, (depth > 0) ? stack[depth-1] : NONE, 1);
+			if (v == NONE) {
+				err = "out of memory";
+				break;
+			}
+			(*nodes)[v].order = nleaves++;
+			cur = v;
+			expect = 0;
+		}
+
+		switch (*p) {
+			case '(':
+				if (!expect) {
+					err = "unexpected '('";
+					break;
+				}
+				v = add_node(nodes, &size, &cap, (depth > 0) ? stack[depth-1] : NONE, 0);
+				if (depth == scap) {
+					scap = (scap > 0) ? (scap * 2) : 64;
+					if ((ns = realloc(stack, sizeof(unsigned long) * scap)) == NULL) {
+						v = NONE;
+					} else {
+						stack = ns;
+					}
+				}
+				if (v == NONE) {
+					err = "out of memory";
+					break;
+				}
+				stack[depth++] = v;
+				cur = NONE;
+				p++;
+				break;
+
+			case ',':
+				if (depth == 0) {
+					err = "',' out of parentheses";
+					break;
+				}
+				cur = NONE;
+				expect = 1;
+				p++;
+				break;
+
+			case ')':
+				if (depth == 0) {
+					err = "unbalanced ')'";
+					break;
+				}
+				cur = stack[--depth];
+				(*nodes)[cur].order = ninternal++;
+				p++;
+				break;
+
+			case ':':
+				if (cur == NONE || (*nodes)[cur].haslen) {
+					err = "unexpected ':'";
+					break;
+				}
+				(*nodes)[cur].length = strtod(p + 1, &end);
+				if (end == (p + 1)) {
+					err = "invalid branch length";
+					break;
+				}
+				(*nodes)[cur].haslen = 1;
+				p = end;
+				break;
+
+			default:
+				if ((label = parse_label(&p)) == NULL) {
+					err = "quoted label is not terminated";
+					break;
+				}
+				if (expect) {
+					v = add_node(nodes, &size, &cap, (depth > 0) ? stack[depth-1] : NONE, 1);
+					if (v == NONE) {
+						free(label);
+						err = "out of memory";
+						break;
+					}
+					(*nodes)[v].label = label;
+					(*nodes)[v].order = nleaves++;
+					cur = v;
+					expect = 0;
+				} else if (cur != NONE && !(*nodes)[cur].leaf && !(*nodes)[cur].haslen) {
+					/* Label of an internal node: not used */
+					free(label);
+				} else {
+					free(label);
+					err = "unexpected label";
+				}
+				break;
+		}
+	}
+	free(stack);
+
+	if (err == NULL && depth > 0) {
+		err = "unbalanced '('";
+	}
+	if (err == NULL && size == 0) {
+		err = "empty tree";
+	}
+	*nnodes = size;
+	return err;
+}
+
+
+/**
+ * \brief Free the nodes of a parsed tree
+ * \param [in] nodes Nodes
+ * \param [in] nnodes Number of nodes
+ */
+static void free_nodes(pnode_t *nodes, unsigned long nnodes)
+{
+	unsigned long v;
+
+	for (v = 0; v < nnodes; v++) {
+		free(nodes[v].label);
+	}
+	free(nodes);
+}
+
+
+/**
+ * \brief Build the merges and the element ids of a parsed tree
+ * \param [in] nodes Nodes (parents before their children)
+ * \param [in] nnodes Number of nodes
+ * \param [in] dict Element dictionary
+ * \param [in] grow Add new elements to the dictionary instead of dropping them
+ * \param [out] tree Tree
+ * \return const char* NULL on success, the error otherwise
+ */
+static const char *build_tree(pnode_t *nodes, unsigned long nnodes, nameset_t *dict, char grow, tree_t *tree)
+{
+	unsigned long v, k, nleaves, nmerges, *num, *fill;
+	pnode_t **merges;
+	leafid_t *lid;
+	double len;
+	char haslen;
+	int found;
+
+	nleaves = nmerges = 0;
+	haslen  = 0;
+	for (v = 0; v < nnodes; v++) {
+		if (nodes[v].leaf) {
+			nleaves++;
+		} else {
+			nmerges++;
+		}
+		haslen |= nodes[v].haslen;
+	}
+
+	/* Heights: children come after their parents */
+	for (v = nnodes; v-- > 1;) {
+		if (!haslen) {
+			len = 1;
+		} else {
+			len = (nodes[v].haslen && nodes[v].length > 0) ? nodes[v].length : 0;
+		}
+		if (nodes[v].height + len > nodes[nodes[v].parent].height) {
+			nodes[nodes[v].parent].height = nodes[v].height + len;
+		}
+	}
+
+	/* Merges by height; leaves are nodes 0 .. nleaves-1, merge q is node nleaves+q */
+	merges = malloc(sizeof(pnode_t *) * (nmerges + 1));
+	num    = malloc(sizeof(unsigned long) * nnodes);
+	tree->first    = calloc(nmerges + 2, sizeof(unsigned long));
+	tree->children = malloc(sizeof(unsigned long) * nnodes);
+	lid = malloc(sizeof(leafid_t) * (nleaves + 1));
+	if (merges == NULL || num == NULL || tree->first == NULL || tree->children == NULL || lid == NULL) {
+		free(merges);
+		free(num);
+		free(lid);
+		return "out of memory";
+	}
+	k = 0;
+	for (v = 0; v < nnodes; v++) {
+		if (!nodes[v].leaf) {
+			merges[k++] = &nodes[v];
+		}
+	}
+	qsort(merges, nmerges, sizeof(pnode_t *), merge_cmp);
+	for (k = 0; k < nmerges; k++) {
+		num[merges[k] - nodes] = nleaves + k;
+	}
+	free(merges);
+	for (v = 0; v < nnodes; v++) {
+		if (nodes[v].leaf) {
+			num[v] = nodes[v].order;
+		}
+	}
+
+	/* Children of each merge, left to right */
+	for (v = 1; v < nnodes; v++) {
+		tree->first[num[nodes[v].parent] - nleaves + 2]++;
+	}
+	for (k = 2; k < (nmerges + 2); k++) {
+		tree->first[k] += tree->first[k-1];
+	}
+	fill = &tree->first[1];
+	for (v = 1; v < nnodes; v++) {
+		tree->children[fill[num[nodes[v].parent] - nleaves]++] = num[v];
+	}
+	free(num);
+	tree->nleaves = nleaves;
+	tree->nmerges = nmerges;
+
+	/* Element ids of the leaves */
+	k = 0;
+	for (v = 0; v < nnodes; v++) {
+		if (!nodes[v].leaf || nodes[v].label == NULL) {
+			continue;
+		}
+		if (grow) {
+			found = (nameset_add(dict, nodes[v].label, 0, &lid[k].id) >= 0);
+		} else {
+			found = nameset_find(dict, nodes[v].label, &lid[k].id);
+		}
+		if (found) {
+			lid[k++].leaf = nodes[v].order;
+		}
+	}
+	qsort(lid, k, sizeof(leafid_t), leafid_cmp);
+	for (v = 1; v < k; v++) {
+		if (lid[v].id == lid[v-1].id) {
+			free(lid);
+			return "an element is on more than one leaf";
+		}
+	}
+	tree->nkept  = k;
+	tree->ids    = malloc(sizeof(unsigned long) * (k + 1));
+	tree->leaves = malloc(sizeof(unsigned long) * (k + 1));
+	if (tree->ids == NULL || tree->leaves == NULL) {
+		free(lid);
+		return "out of memory";
+	}
+	for (v = 0; v < k; v++) {
+		tree->ids[v]    = lid[v].id;
+		tree->leaves[v] = lid[v].leaf;
+	}
+	free(lid);
+	return NULL;
+}
+
+
+/**
+ * \brief Read a tree in Newick format
+ * \param [in] filename File name
+ * \param [in] dict Element dictionary
+ * \param [in] grow Add new elements to the dictionary instead of dropping them
+ * \param [out] tree Tree (free with free_tree(), also on error)
+ * \return int 0 on success, -1 otherwise
+ */
+int read_tree(const char *filename, nameset_t *dict, char grow, tree_t *tree)
+{
+	pnode_t *nodes;
+	unsigned long nnodes;
+	const char *err;
+	char *buffer;
+	size_t fsize;
+
+	memset(tree, 0, sizeof(tree_t));
+	if ((tree->path = strdup(filename)) == NULL) {
+		perror("read_tree()");
+		return -1;
+	}
+	if ((buffer = read_file(filename, &fsize)) == NULL) {
+		perror(filename);
+		return -1;
+	}
+
+	err = parse_newick(buffer, &nodes, &nnodes);
+	free(buffer);
+	if (err == NULL) {
+		err = build_tree(nodes, nnodes, dict, grow, tree);
+	}
+	free_nodes(nodes, nnodes);
+	if (err != NULL) {
+		fprintf(stderr, "%s: invalid Newick tree: %s.\n", filename, err);
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * \brief Free a tree
+ * \param [in] tree Tree
+ */
+void free_tree(tree_t *tree)
+{
+	free(tree->path);
+	free(tree->ids);
+	free(tree->leaves);
+	free(tree->first);
+	free(tree->children);
+	memset(tree, 0, sizeof(tree_t));
+}
+
+
+/**
+ * \brief Parse a list of cut levels (numbers of clusters), e.g. 2,4,10-20
+ * \param [in] list List
+ * \param [out] nlevels Number of levels
+ * \return unsigned long* Levels (ascending, no repetitions), NULL if the
+ *         list is invalid
+ */
+unsigned long *parse_levels(const char *list, unsigned long *nlevels)
+{
+	unsigned long *levels, *nl, a, b, n, cap;
+	const char *p;
+	char *end;
+
+	levels = NULL;
+	n = cap = 0;
+	p = list;
+	for (;;) {
+		if (!isdigit((unsigned char)*p)) {
+			break;
+		}
+		a = b = strtoul(p, &end, 10);
+		if (*end == '-') {
+			p = end + 1;
+			if (!isdigit((unsigned char)*p)) {
+				break;
+			}
+			b = strtoul(p, &end, 10);
+		}
+		if (a < 1 || b < a) {
+			break;
+		}
+		for (; a <= b; a++) {
+			if (n == cap) {
+				cap = (cap > 0) ? (cap * 2) : 16;
+				if ((nl = realloc(levels, sizeof(unsigned long) * cap)) == NULL) {
+					free(levels);
+					return NULL;
+				}
+				levels = nl;
+			}
+			levels[n++] = a;
+		}
+		if (*end == '\0') {
+			qsort(levels, n, sizeof(unsigned long), ulong_cmp);
+			for (a = b = 0; a < n; a++) {
+				if (b == 0 || levels[a] != levels[b-1]) {
+					levels[b++] = levels[a];
+				}
+			}
+			*nlevels = b;
+			return levels;
+		}
+		if (*end != ',') {
+			break;
+		}
+		p = end + 1;
+	}
+	free(levels);
+	return NULL;
+}
+
+
+/**
+ * \brief Add (or subtract) 2^n - 1 (number of non empty subsets of n elements)
+ * \param [in] tp Pair
+ * \param [in,out] acc Accumulator
+ * \param [in] n Number of elements
+ * \param [in] sub Subtract
+ */
+static void tree_subsets(tpair_t *tp, mpz_t acc, unsigned long n, char sub)
+{
+	if (n == 0) {
+		return;
+	}
+	if (n < (sizeof(unsigned long) * 8)) {
+		mpz_set_ui(tp->A, (1UL << n) - 1);
+	} else {
+		mpz_set_ui(tp->A, 0);
+		mpz_setbit(tp->A, n);
+		mpz_sub_ui(tp->A, tp->A, 1);
+	}
+	if (sub) {
+		mpz_sub(acc, acc, tp->A);
+	} else {
+		mpz_add(acc, acc, tp->A);
+	}
+}
+
+
+/**
+ * \brief Hash of a cell
+ * \param [in] tp Pair
+ * \param [in] l0 Cluster of tree 1
+ * \param [in] l1 Cluster of tree 2
+ * \return unsigned long Bucket
+ */
+static inline unsigned long cell_hash(tpair_t *tp, unsigned long l0, unsigned long l1)
+{
+	return (((l0 * FNV_PRIME) ^ l1) * 0x9e3779b97f4a7c15UL) >> (64 - tp->hbits);
+}
+
+
+/**
+ * \brief Find the cell of a pair of clusters
+ * \param [in] tp Pair
+ * \param [in] l0 Cluster of tree 1
+ * \param [in] l1 Cluster of tree 2
+ * \return unsigned long Cell, NONE if the clusters have no common elements
+ */
+static unsigned long find_cell(tpair_t *tp, unsigned long l0, unsigned long l1)
+{
+	unsigned long c;
+
+	for (c = tp->bucket[cell_hash(tp, l0, l1)]; c != NONE; c = tp->hnext[c]) {
+		if (tp->line[0][c] == l0 && tp->line[1][c] == l1) {
+			break;
+		}
+	}
+	return c;
+}
+
+
+/**
+ * \brief Add a cell to the hash
+ */
+static void hash_cell(tpair_t *tp, unsigned long c)
+{
+	unsigned long h = cell_hash(tp, tp->line[0][c], tp->line[1][c]);
+
+	tp->hnext[c]  = tp->bucket[h];
+	tp->bucket[h] = c;
+}
+
+
+/**
+ * \brief Remove a cell from the hash
+ */
+static void unhash_cell(tpair_t *tp, unsigned long c)
+{
+	unsigned long *pc = &tp->bucket[cell_hash(tp, tp->line[0][c], tp->line[1][c])];
+
+	while (*pc != c) {
+		pc = &tp->hnext[*pc];
+	}
+	*pc = tp->hnext[c];
+}
+
+
+/**
+ * \brief Add a cell to the cells of its cluster of tree d
+ */
+static void link_cell(tpair_t *tp, int d, unsigned long c)
+{
+	unsigned long l = tp->line[d][c];
+
+	tp->prev[d][c] = NONE;
+	tp->next[d][c] = tp->head[d][l];
+	if (tp->head[d][l] != NONE) {
+		tp->prev[d][tp->head[d][l]] = c;
+	}
+	tp->head[d][l] = c;
+	tp->ncells[d][l]++;
+}
+
+
+/**
+ * \brief Remove a cell from the cells of its cluster of tree d
+ */
+static void unlink_cell(tpair_t *tp, int d, unsigned long c)
+{
+	unsigned long l = tp->line[d][c];
+
+	if (tp->prev[d][c] != NONE) {
+		tp->next[d][tp->prev[d][c]] = tp->next[d][c];
+	} else {
+		tp->head[d][l] = tp->next[d][c];
+	}
+	if (tp->next[d][c] != NONE) {
+		tp->prev[d][tp->next[d][c]] = tp->prev[d][c];
+	}
+	tp->ncells[d][l]--;
+}
+
+
+/**
+ * \brief Merge cell s into cell x (same clusters of both trees now)
+ * \param [in] tp Pair
+ * \param [in] x Cell that is kept
+ * \param [in] s Cell that is merged
+ */
+static void merge_cells(tpair_t *tp, unsigned long x, unsigned long s)
+{
+	unsigned long u, v, ne;
+
+	if (tp->cindex & INDEX_P2P) {
+		/* Pairs of elements that meet now: same order on both trees? */
+		ne = 0;
+		for (u = tp->ehead[x]; u != NONE; u = tp->enext[u]) {
+			for (v = tp->ehead[s]; v != NONE; v = tp->enext[v]) {
+				ne += ((tp->pos[0][u] < tp->pos[0][v]) == (tp->pos[1][u] < tp->pos[1][v]));
+			}
+		}
+		tp->ne += ne;
+	}
+	if (tp->cindex & INDEX_COMP) {
+		/* Cells of one element are counted by iso */
+		if (tp->n[x] > 1) {
+			tree_subsets(tp, tp->ne2, tp->n[x], 1);
+		}
+		if (tp->n[s] > 1) {
+			tree_subsets(tp, tp->ne2, tp->n[s], 1);
+		}
+		tree_subsets(tp, tp->ne2, tp->n[x] + tp->n[s], 0);
+	}
+
+	tp->enext[tp->etail[x]] = tp->ehead[s];
+	tp->etail[x] = tp->etail[s];
+	tp->n[x] += tp->n[s];
+}
+
+
+/**
+ * \brief Apply the next merge of tree d
+ * \param [in] tp Pair
+ * \param [in] t Tree
+ * \param [in] d Which tree (0 or 1)
+ * \note The children are merged into the cluster with more cells, the
+ *       cells of the others are moved to it (or merged with its cell of
+ *       the same cluster of the other tree).
+ */
+static void merge_clusters(tpair_t *tp, tree_t *t, int d)
+{
+	unsigned long q, k, nch, *ch, base, l, s, nxt, x, mi, M, pairs;
+	int o = 1 - d;
+
+	q   = tp->done[d]++;
+	ch  = &t->children[t->first[q]];
+	nch = t->first[q+1] - t->first[q];
+
+	base = tp->lineid[d][ch[0]];
+	for (k = 1; k < nch; k++) {
+		l = tp->lineid[d][ch[k]];
+		if (tp->ncells[d][l] > tp->ncells[d][base]) {
+			base = l;
+		}
+	}
+
+	/* Np */
+	M = pairs = 0;
+	for (k = 0; k < nch; k++) {
+		l  = tp->lineid[d][ch[k]];
+		mi = tp->margin[d][l];
+		if (mi == 1 && tp->margin[o][tp->line[o][tp->head[d][l]]] == 1) {
+			tp->iso--;
+		}
+		M     += mi;
+		pairs += (mi * (mi - 1)) / 2;
+		if (tp->cindex & INDEX_COMP) {
+			tree_subsets(tp, tp->np2[d], mi, 1);
+		}
+	}
+	tp->np[d] += (M * (M - 1)) / 2 - pairs;
+	if (tp->cindex & INDEX_COMP) {
+		tree_subsets(tp, tp->np2[d], M, 0);
+	}
+
+	/* Cells */
+	for (k = 0; k < nch; k++) {
+		l = tp->lineid[d][ch[k]];
+		if (l == base) {
+			continue;
+		}
+		for (s = tp->head[d][l]; s != NONE; s = nxt) {
+			nxt = tp->next[d][s];
+			x = (d == 0) ? find_cell(tp, base, tp->line[1][s]) : find_cell(tp, tp->line[0][s], base);
+			unhash_cell(tp, s);
+			if (x != NONE) {
+				merge_cells(tp, x, s);
+				unlink_cell(tp, o, s);
+			} else {
+				tp->line[d][s] = base;
+				hash_cell(tp, s);
+				link_cell(tp, d, s);
+			}
+		}
+		tp->head[d][l]   = NONE;
+		tp->ncells[d][l] = 0;
+		tp->margin[d][l] = 0;
+	}
+	tp->margin[d][base] = M;
+	tp->lineid[d][t->nleaves + q] = base;
+	tp->clusters[d] -= nch - 1;
+
+	if (M == 1 && tp->margin[o][tp->line[o][tp->head[d][base]]] == 1) {
+		tp->iso++;
+	}
+}
+
+
+/**
+ * \brief Prepare the contingency table of a pair of trees (all leaves are
+ *        clusters)
+ * \param [out] tp Pair
+ * \param [in] t1 Tree 1
+ * \param [in] t2 Tree 2
+ * \param [in] cindex Indexes (INDEX_P2P and/or INDEX_COMP)
+ * \return int 0 on success, -1 otherwise
+ */
+static int init_tree_pair(tpair_t *tp, tree_t *t1, tree_t *t2, char cindex)
+{
+	unsigned long i, j, m, c, hsize, total, *p;
+	tree_t *t[2] = { t1, t2 };
+	int d;
+
+	memset(tp, 0, sizeof(tpair_t));
+	tp->cindex = cindex;
+
+	/* Common elements */
+	m = 0;
+	for (i = j = 0; i < t1->nkept && j < t2->nkept;) {
+		if (t1->ids[i] < t2->ids[j]) {
+			i++;
+		} else if (t1->ids[i] > t2->ids[j]) {
+			j++;
+		} else {
+			m++, i++, j++;
+		}
+	}
+	tp->m = m;
+
+	tp->hbits = 4;
+	while ((1UL << tp->hbits) < 2 * m) {
+		tp->hbits++;
+	}
+	hsize = 1UL << tp->hbits;
+	total = 13 * m + hsize;
+	for (d = 0; d < 2; d++) {
+		total += 4 * t[d]->nleaves + t[d]->nmerges;
+	}
+	if ((p = tp->mem = malloc(sizeof(unsigned long) * total)) == NULL) {
+		return -1;
+	}
+	tp->pos[0] = p; p += m;
+	tp->pos[1] = p; p += m;
+	tp->enext  = p; p += m;
+	tp->n      = p; p += m;
+	tp->ehead  = p; p += m;
+	tp->etail  = p; p += m;
+	tp->hnext  = p; p += m;
+	for (d = 0; d < 2; d++) {
+		tp->line[d] = p; p += m;
+		tp->next[d] = p; p += m;
+		tp->prev[d] = p; p += m;
+		tp->head[d]   = p; p += t[d]->nleaves;
+		tp->ncells[d] = p; p += t[d]->nleaves;
+		tp->margin[d] = p; p += t[d]->nleaves;
+		tp->lineid[d] = p; p += t[d]->nleaves + t[d]->nmerges;
+		for (i = 0; i < t[d]->nleaves; i++) {
+			tp->head[d][i]   = NONE;
+			tp->ncells[d][i] = 0;
+			tp->margin[d][i] = 0;
+			tp->lineid[d][i] = i;
+		}
+		tp->clusters[d] = t[d]->nleaves;
+	}
+	tp->bucket = p;
+	for (i = 0; i < hsize; i++) {
+		tp->bucket[i] = NONE;
+	}
+
+	/* One cell of each common element */
+	c = 0;
+	for (i = j = 0; i < t1->nkept && j < t2->nkept;) {
+		if (t1->ids[i] < t2->ids[j]) {
+			i++;
+		} else if (t1->ids[i] > t2->ids[j]) {
+			j++;
+		} else {
+			tp->pos[0][c]  = tp->line[0][c] = t1->leaves[i];
+			tp->pos[1][c]  = tp->line[1][c] = t2->leaves[j];
+			tp->enext[c]   = NONE;
+			tp->n[c]       = 1;
+			tp->ehead[c]   = tp->etail[c] = c;
+			for (d = 0; d < 2; d++) {
+				link_cell(tp, d, c);
+				tp->margin[d][tp->line[d][c]] = 1;
+			}
+			hash_cell(tp, c);
+			c++, i++, j++;
+		}
+	}
+
+	/* Every element is a cluster of both trees */
+	tp->iso = m;
+	for (d = 0; d < 2; d++) {
+		mpz_init_set_ui(tp->np2[d], m);
+	}
+	mpz_init(tp->ne2);
+	mpz_init(tp->A);
+	mpz_init(tp->B);
+	mpf_init(tp->fnum);
+	mpf_init(tp->fden);
+	return 0;
+}
+
+
+/**
+ * \brief Free the contingency table of a pair of trees
+ */
+static void free_tree_pair(tpair_t *tp)
+{
+	mpz_clear(tp->np2[0]);
+	mpz_clear(tp->np2[1]);
+	mpz_clear(tp->ne2);
+	mpz_clear(tp->A);
+	mpz_clear(tp->B);
+	mpf_clear(tp->fnum);
+	mpf_clear(tp->fden);
+	free(tp->mem);
+}
+
+
+/**
+ * \brief Congruency (h and/or h2) between two trees at each cut level
+ * \param [in] t1 Tree 1
+ * \param [in] t2 Tree 2
+ * \param [in] cindex Indexes (INDEX_P2P and/or INDEX_COMP)
+ * \param [in] flags Flags to show Np or Ne
+ * \param [in] levels Cut levels (numbers of clusters, ascending)
+ * \param [in] nlevels Number of levels
+ * \param [out] values h of each level, then h2 of each level
+ * \return int 0 on success, -1 otherwise
+ * \note Same results as the kernels for the flat cluster sets of each
+ *       level (elements in leaf order).
+ */
+int tree_congruency(tree_t *t1, tree_t *t2, char cindex, char flags, unsigned long *levels,
+		unsigned long nlevels, double *values)
+{
+	tpair_t tp;
+	unsigned long l, k, maxnp;
+
+	if (init_tree_pair(&tp, t1, t2, cindex) < 0) {
+		return -1;
+	}
+
+	/* From the leaves up: most clusters first */
+	for (l = nlevels; l-- > 0;) {
+		k = levels[l];
+		while (tp.clusters[0] > k && tp.done[0] < t1->nmerges) {
+			merge_clusters(&tp, t1, 0);
+		}
+		while (tp.clusters[1] > k && tp.done[1] < t2->nmerges) {
+			merge_clusters(&tp, t2, 1);
+		}
+
+		if (cindex & INDEX_P2P) {
+			maxnp = (tp.np[0] > tp.np[1]) ? tp.np[0] : tp.np[1];
+			if (flags & SHOW_NP) {
+				values[l] = maxnp;
+			} else if (flags & SHOW_NE) {
+				values[l] = tp.ne;
+			} else {
+				mpz_set_ui(tp.A, tp.ne);
+				mpz_set_ui(tp.B, maxnp);
+				values[l] = congruency_ratio_f(tp.A, tp.B, tp.fnum, tp.fden);
+			}
+		}
+		if (cindex & INDEX_COMP) {
+			mpz_add_ui(tp.A, tp.ne2, tp.iso);
+			mpz_set(tp.B, (mpz_cmp(tp.np2[0], tp.np2[1]) > 0) ? tp.np2[0] : tp.np2[1]);
+			if (flags & SHOW_NP) {
+				values[nlevels + l] = mpz_get_d(tp.B);
+			} else if (flags & SHOW_NE) {
+				values[nlevels + l] = mpz_get_d(tp.A);
+			} else {
+				values[nlevels + l] = congruency_ratio_f(tp.A, tp.B, tp.fnum, tp.fden);
+			}
+		}
+	}
+
+	free_tree_pair(&tp);
+	return 0;
+}
+
+
+/**
+ * \brief Calculate one pair of trees at all levels
+ * \param [in] i Row
+ * \param [in] j Column
+ * \param [in] arg Trees being calculated (tjob_t)
+ * \return double Not used (values go straight to the matrices)
+ */
+static double tree_pair(unsigned long i, unsigned long j, void *arg)
+{
+	tjob_t *job = arg;
+	double *values;
+	unsigned long k, n;
+
+	n = 2 * job->nlevels;
+	if ((values = malloc(sizeof(double) * n)) == NULL ||
+			tree_congruency(&job->trees[i], &job->trees[j], job->cindex, job->flags,
+				job->levels, job->nlevels, values) < 0) {
+		free(values);
+		values = NULL;
+	}
+	for (k = 0; k < n; k++) {
+		if (job->mats[k] != NULL) {
+			job->mats[k]->matrix[i][j] = (values != NULL) ? values[k] : -1;
+			job->mats[k]->matrix[j][i] = job->mats[k]->matrix[i][j];
+			PROGRESS_ADD(1);
+		}
+	}
+	free(values);
+	return 0;
+}
+
+
+/**
+ * \brief Finish one row of the trees
+ * \param [in] i Row
+ * \param [in] values Not used
+ * \param [in] arg Trees being calculated (tjob_t)
+ */
+static void tree_row(unsigned long i, double *values, void *arg)
+{
+	tjob_t *job = arg;
+	unsigned long k;
+
+	for (k = 0; k < (2 * job->nlevels); k++) {
+		if (job->mats[k] != NULL) {
+			job->mats[k]->matrix[i][i] = 1.0;
+		}
+	}
+}
+
+
+/**
+ * \brief Calculate congruency between all pairs of trees at each cut level
+ * \param [in] trees Trees
+ * \param [in] ntrees Number of trees
+ * \param [in] cindex Indexes (INDEX_P2P and/or INDEX_COMP)
+ * \param [in] flags Flags to show Np or Ne
+ * \param [in] levels Cut levels (numbers of clusters, ascending)
+ * \param [in] nlevels Number of levels
+ * \param [out] mats Matrix of h of each level, then of h2 of each level
+ *        (NULL for indexes not selected)
+ * \param [in] nworkers Number of threads
+ * \return int 0 on success, -1 otherwise
+ */
+int calculate_tree_congruency(tree_t *trees, unsigned long ntrees, char cindex, char flags,
+		unsigned long *levels, unsigned long nlevels, cmat_t **mats, unsigned long nworkers)
+{
+	tjob_t job;
+
+	job.trees   = trees;
+	job.cindex  = cindex;
+	job.flags   = flags;
+	job.levels  = levels;
+	job.nlevels = nlevels;
+	job.mats    = mats;
+	return calculate_rows(ntrees, nworkers, tree_pair, tree_row, &job);
+}